@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+
+#include <ftw.h>
+#include <sys/resource.h>
+
+#include "blockchain.h"
+#include "contract.h"
+#include "crypto.h"
+#include "log.h"
+#include "storage.h"
+#include "threadpool.h"
+#include "consensus/regtest.h"
+
+/**
+* End-to-end validation benchmark. Generates a synthetic chain to a file, or
+* replays such a file through Blockchain::submitBlock on a fresh database and
+* reports the throughput.
+*
+* Usage:
+*   replay-ck generate <file> [--blocks N] [--txs T] [--inputs I] [--outputs O]
+*                             [--utxos U] [--contracts PERCENT] [--reorgevery R]
+*                             [--seed S]
+*   replay-ck replay <file> [--threads N] [--dbdir DIR]
+*
+* Contract outputs are checked with sandbox.lua, so run it from the directory
+* that holds it. The results of a replay are printed to stdout as JSON.
+*/
+
+namespace {
+const uint64_t blockReward = 50000000000000;
+
+class ReplayChain : public CryptoKernel::Blockchain {
+public:
+    ReplayChain(CryptoKernel::Log* log, const std::string& dbDir) :
+        CryptoKernel::Blockchain(log, dbDir) {}
+
+private:
+    uint64_t getBlockReward(const uint64_t height) {
+        return blockReward;
+    }
+
+    std::string getCoinbaseOwner(const std::string& publicKey) {
+        return publicKey;
+    }
+};
+
+std::map<std::string, std::string> parseOptions(int argc, char* argv[], const int first) {
+    std::map<std::string, std::string> options;
+    for(int i = first; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        if(key.size() < 3 || key.substr(0, 2) != "--") {
+            throw std::runtime_error("Unexpected argument " + key);
+        }
+        options[key.substr(2)] = argv[i + 1];
+    }
+    return options;
+}
+
+uint64_t option(const std::map<std::string, std::string>& options, const std::string& name,
+                const uint64_t defaultValue) {
+    const auto it = options.find(name);
+    return it == options.end() ? defaultValue : std::stoull(it->second);
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t directorySize = 0;
+int addFileSize(const char* path, const struct stat* info, int flag, struct FTW* ftw) {
+    if(flag == FTW_F) {
+        directorySize += info->st_size;
+    }
+    return 0;
+}
+
+/**
+* Builds the synthetic chain with Regtest consensus in a scratch database.
+* Every block accepted by that database, including the blocks of abandoned
+* forks, is written to the output in submission order.
+*/
+class Generator {
+public:
+    Generator(const std::map<std::string, std::string>& options, std::ofstream& out) :
+        out(out), key(true) {
+        blocks = option(options, "blocks", 1000);
+        txsPerBlock = option(options, "txs", 100);
+        inputsPerTx = std::max<uint64_t>(option(options, "inputs", 2), 1);
+        outputsPerTx = std::max<uint64_t>(option(options, "outputs", 2), 1);
+        targetUtxos = option(options, "utxos", 10000);
+        contractPercent = option(options, "contracts", 5);
+        reorgEvery = option(options, "reorgevery", 100);
+        generator.seed(option(options, "seed", 42));
+
+        contract = CryptoKernel::ContractRunner::compile(
+                       "function verify() return true end");
+    }
+
+    void run() {
+        const std::string dbDir = "./replaygendb";
+        CryptoKernel::Storage::destroy(dbDir);
+
+        CryptoKernel::Log log("replay-generate.log", false);
+
+        // The genesis block is the first line of the file
+        const std::string genesisFile = "./replaygenesis.json";
+        {
+            ReplayChain genesisChain(&log, dbDir);
+            const CryptoKernel::Blockchain::block genesis =
+                genesisChain.generateVerifyingBlock(key.getPublicKey());
+            std::ofstream genesisOut(genesisFile);
+            genesisOut << CryptoKernel::Storage::toString(genesis.toJson());
+            write(genesis);
+        }
+        CryptoKernel::Storage::destroy(dbDir);
+
+        chain.reset(new ReplayChain(&log, dbDir));
+        regtest.reset(new CryptoKernel::Consensus::Regtest(chain.get()));
+        if(!chain->loadChain(regtest.get(), genesisFile)) {
+            throw std::runtime_error("Failed to load the generated genesis block");
+        }
+
+        // Fan the coinbase outputs out until the UTXO set is big enough
+        while(chain->getUnspentOutputs(key.getPublicKey()).size() < targetUtxos) {
+            spendRandomOutputs(txsPerBlock, 1, outputsPerTx + inputsPerTx);
+            mine();
+        }
+
+        for(uint64_t i = 0; i < blocks; i++) {
+            spendRandomOutputs(txsPerBlock, inputsPerTx, outputsPerTx);
+            mine();
+
+            if(reorgEvery > 0 && (i + 1) % reorgEvery == 0) {
+                reorg();
+            }
+        }
+
+        chain.reset();
+        CryptoKernel::Storage::destroy(dbDir);
+        std::remove(genesisFile.c_str());
+    }
+
+private:
+    std::ofstream& out;
+    CryptoKernel::Crypto key;
+    std::mt19937_64 generator;
+    std::string contract;
+
+    uint64_t blocks;
+    uint64_t txsPerBlock;
+    uint64_t inputsPerTx;
+    uint64_t outputsPerTx;
+    uint64_t targetUtxos;
+    uint64_t contractPercent;
+    uint64_t reorgEvery;
+
+    std::unique_ptr<ReplayChain> chain;
+    std::unique_ptr<CryptoKernel::Consensus::Regtest> regtest;
+
+    void write(const CryptoKernel::Blockchain::block& block) {
+        std::string line = CryptoKernel::Storage::toString(block.toJson());
+        if(!line.empty() && line.back() == '\n') {
+            line.pop_back();
+        }
+        out << line << "\n";
+    }
+
+    void submit(const CryptoKernel::Blockchain::block& block) {
+        if(!std::get<0>(chain->submitBlock(block))) {
+            throw std::runtime_error("Generated block was rejected");
+        }
+        write(block);
+    }
+
+    void mine() {
+        CryptoKernel::Blockchain::block block = chain->generateVerifyingBlock(key.getPublicKey());
+        Json::Value consensusData;
+        consensusData["isBetter"] = true;
+        block.setConsensusData(consensusData);
+        submit(block);
+    }
+
+    // Replaces the tip with an empty block on its parent. The transactions
+    // of the old tip go back to the mempool and are mined again next.
+    void reorg() {
+        const CryptoKernel::Blockchain::dbBlock tip = chain->getBlockDB("tip");
+
+        Json::Value data;
+        data["publicKey"] = key.getPublicKey();
+        std::set<CryptoKernel::Blockchain::output> outputs;
+        outputs.insert(CryptoKernel::Blockchain::output(blockReward, generator(), data));
+        const CryptoKernel::Blockchain::transaction coinbaseTx(
+            std::set<CryptoKernel::Blockchain::input>(), outputs, tip.getTimestamp() + 1, true);
+
+        Json::Value consensusData;
+        consensusData["isBetter"] = true;
+        const CryptoKernel::Blockchain::block fork(std::set<CryptoKernel::Blockchain::transaction>(),
+                coinbaseTx, tip.getPreviousBlockId(), tip.getTimestamp() + 1, consensusData,
+                tip.getHeight());
+        submit(fork);
+
+        mine();
+    }
+
+    void spendRandomOutputs(const uint64_t count, const uint64_t inputs, const uint64_t outputs) {
+        const std::set<CryptoKernel::Blockchain::dbOutput> unspentSet =
+            chain->getUnspentOutputs(key.getPublicKey());
+        std::vector<CryptoKernel::Blockchain::dbOutput> unspent(unspentSet.begin(),
+                unspentSet.end());
+        std::shuffle(unspent.begin(), unspent.end(), generator);
+
+        const uint64_t timestamp = static_cast<uint64_t>(std::time(0));
+
+        auto next = unspent.begin();
+        for(uint64_t i = 0; i < count; i++) {
+            if(unspent.end() - next < static_cast<int64_t>(inputs)) {
+                break;
+            }
+
+            std::vector<CryptoKernel::Blockchain::dbOutput> spending(next, next + inputs);
+            next += inputs;
+
+            uint64_t total = 0;
+            for(const auto& spend : spending) {
+                total += spend.getValue();
+            }
+
+            std::set<CryptoKernel::Blockchain::output> newOutputs;
+            uint64_t fee = 0;
+            std::vector<Json::Value> outputData;
+            for(uint64_t j = 0; j < outputs; j++) {
+                Json::Value data;
+                data["publicKey"] = key.getPublicKey();
+                if(generator() % 100 < contractPercent) {
+                    data["contract"] = contract;
+                }
+                fee += CryptoKernel::Storage::toString(data).size() * 100;
+                outputData.push_back(data);
+            }
+            // Mirrors Blockchain::getTransactionFee, 200 bytes covers a signature
+            fee += inputs * 200 * 100;
+
+            if(total <= fee + outputs) {
+                continue;
+            }
+
+            const uint64_t value = (total - fee) / outputs;
+            for(const Json::Value& data : outputData) {
+                newOutputs.insert(CryptoKernel::Blockchain::output(value, generator(), data));
+            }
+
+            const std::string outputSetId =
+                CryptoKernel::Blockchain::transaction::getOutputSetId(newOutputs).toString();
+
+            std::set<CryptoKernel::Blockchain::input> newInputs;
+            for(const auto& spend : spending) {
+                Json::Value spendData;
+                if(spend.getData()["contract"].empty()) {
+                    spendData["signature"] = key.sign(spend.getId().toString() + outputSetId);
+                }
+                newInputs.insert(CryptoKernel::Blockchain::input(spend.getId(), spendData));
+            }
+
+            const CryptoKernel::Blockchain::transaction tx(newInputs, newOutputs, timestamp);
+            if(!std::get<0>(chain->submitTransaction(tx))) {
+                throw std::runtime_error("Generated transaction " + tx.getId().toString() +
+                                         " was rejected");
+            }
+        }
+    }
+};
+
+/**
+* Replays a generated chain on a fresh database. Blocks are submitted one at
+* a time like a syncing node. The requested number of threads both decodes
+* each batch of blocks and verifies the transactions of each block through
+* the blockchain's validation pool.
+*/
+Json::Value replay(const std::string& fileName, const std::map<std::string, std::string>& options) {
+    const unsigned int threads = std::max<uint64_t>(option(options, "threads", 1), 1);
+    const auto dirIt = options.find("dbdir");
+    const std::string dbDir = dirIt == options.end() ? "./replaydb" : dirIt->second;
+    const unsigned int batchSize = 64;
+
+    double readTime = 0;
+    double decodeTime = 0;
+    double submitTime = 0;
+    uint64_t blocks = 0;
+    uint64_t rejected = 0;
+    uint64_t transactions = 0;
+    uint64_t inputs = 0;
+    uint64_t outputs = 0;
+
+    std::ifstream in(fileName);
+    if(!in.is_open()) {
+        throw std::runtime_error("Could not open " + fileName);
+    }
+
+    std::string genesisLine;
+    std::getline(in, genesisLine);
+    const std::string genesisFile = dbDir + "-genesis.json";
+    {
+        std::ofstream genesisOut(genesisFile);
+        genesisOut << genesisLine;
+    }
+
+    CryptoKernel::Storage::destroy(dbDir);
+    CryptoKernel::Log log("replay.log", false);
+    CryptoKernel::ThreadPool pool(threads);
+    ReplayChain chain(&log, dbDir);
+    chain.setValidationPool(&pool, threads);
+    CryptoKernel::Consensus::Regtest regtest(&chain);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if(!chain.loadChain(&regtest, genesisFile)) {
+        throw std::runtime_error("Failed to load the genesis block");
+    }
+
+    while(in) {
+        auto stageStart = std::chrono::steady_clock::now();
+        std::vector<std::string> lines;
+        std::string line;
+        while(lines.size() < batchSize && std::getline(in, line)) {
+            if(!line.empty()) {
+                lines.push_back(line);
+            }
+        }
+        readTime += secondsSince(stageStart);
+
+        if(lines.empty()) {
+            break;
+        }
+
+        stageStart = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<CryptoKernel::Blockchain::block>> batch(lines.size());
+        pool.forEach(lines.size(), [&](const size_t i) {
+            batch[i].reset(new CryptoKernel::Blockchain::block(
+                               CryptoKernel::Storage::toJson(lines[i])));
+        }, threads);
+        decodeTime += secondsSince(stageStart);
+
+        stageStart = std::chrono::steady_clock::now();
+        for(const auto& block : batch) {
+            if(std::get<0>(chain.submitBlock(*block))) {
+                blocks++;
+                transactions += block->getTransactions().size();
+                for(const auto& tx : block->getTransactions()) {
+                    inputs += tx.getInputs().size();
+                    outputs += tx.getOutputs().size();
+                }
+            } else {
+                rejected++;
+            }
+        }
+        submitTime += secondsSince(stageStart);
+    }
+
+    const double total = secondsSince(start);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    directorySize = 0;
+    nftw(dbDir.c_str(), addFileSize, 16, FTW_PHYS);
+
+    Json::Value returning;
+    returning["blocks"] = Json::UInt64(blocks);
+    returning["rejectedBlocks"] = Json::UInt64(rejected);
+    returning["transactions"] = Json::UInt64(transactions);
+    returning["inputs"] = Json::UInt64(inputs);
+    returning["outputs"] = Json::UInt64(outputs);
+    returning["threads"] = threads;
+    returning["seconds"] = total;
+    returning["blocksPerSecond"] = blocks / total;
+    returning["transactionsPerSecond"] = transactions / total;
+    returning["stageSeconds"]["read"] = readTime;
+    returning["stageSeconds"]["decode"] = decodeTime;
+    returning["stageSeconds"]["submit"] = submitTime;
+    // ru_maxrss is in kilobytes on Linux
+    returning["peakRssKB"] = Json::Int64(usage.ru_maxrss);
+    returning["dbSizeBytes"] = Json::UInt64(directorySize);
+    returning["tipHeight"] = Json::UInt64(chain.getBlockDB("tip").getHeight());
+
+    std::remove(genesisFile.c_str());
+
+    return returning;
+}
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " generate|replay <file> [options]" << std::endl;
+        return 1;
+    }
+
+    try {
+        const std::string mode = argv[1];
+        const std::map<std::string, std::string> options = parseOptions(argc, argv, 3);
+
+        if(mode == "generate") {
+            std::ofstream out(argv[2]);
+            Generator(options, out).run();
+        } else if(mode == "replay") {
+            std::cout << CryptoKernel::Storage::toString(replay(argv[2], options), true) << std::endl;
+        } else {
+            std::cerr << "Unknown mode " << mode << std::endl;
+            return 1;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <random>
+
+#include "bench.h"
+
+#include "blockchain.h"
+#include "crypto.h"
+#include "base64.h"
+#include "merkletree.h"
+#include "storage.h"
+
+namespace {
+// Written by every benchmark so the compiler can't drop the work
+volatile uint64_t sink;
+
+std::string randomHex(std::mt19937_64& generator, const unsigned int bytes) {
+    std::string returning;
+    const char* digits = "0123456789abcdef";
+    for(unsigned int i = 0; i < bytes * 2; i++) {
+        returning += digits[generator() % 16];
+    }
+    return returning;
+}
+
+std::string randomBytes(std::mt19937_64& generator, const unsigned int bytes) {
+    std::string returning;
+    for(unsigned int i = 0; i < bytes; i++) {
+        returning += static_cast<char>(generator() % 256);
+    }
+    return returning;
+}
+}
+
+/**
+* Runs the kernel micro-benchmarks and prints the results to stdout as a
+* JSON array. A human-readable summary goes to stderr.
+*
+* Usage: bench-ck [filter] [samples]
+*/
+int main(int argc, char* argv[]) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+    const unsigned int samples = argc > 2 ? std::stoul(argv[2]) : 100;
+
+    CryptoKernel::Bench bench(filter, samples);
+
+    // Fixed seed so every run benchmarks the same inputs
+    std::mt19937_64 generator(42);
+
+    // BigNum
+    const CryptoKernel::BigNum a(randomHex(generator, 32));
+    const CryptoKernel::BigNum b(randomHex(generator, 16));
+    const std::string aHex = a.toString();
+
+    bench.run("BigNum::BigNum(hex)", [&]() {
+        sink = CryptoKernel::BigNum(aHex).toString().size();
+    });
+    bench.run("BigNum::toString", [&]() {
+        sink = a.toString().size();
+    });
+    bench.run("BigNum::operator+", [&]() {
+        sink = (a + b) > a;
+    });
+    bench.run("BigNum::operator*", [&]() {
+        sink = (a * b) > a;
+    });
+    bench.run("BigNum::operator/", [&]() {
+        sink = (a / b) > b;
+    });
+    bench.run("BigNum::operator<", [&]() {
+        sink = b < a;
+    });
+
+    // Hashing and signatures
+    const std::string message64 = randomBytes(generator, 64);
+    const std::string message1k = randomBytes(generator, 1024);
+
+    bench.run("Crypto::sha256(64B)", [&]() {
+        sink = CryptoKernel::Crypto::sha256(message64).size();
+    });
+    bench.run("Crypto::sha256(1KB)", [&]() {
+        sink = CryptoKernel::Crypto::sha256(message1k).size();
+    });
+
+    CryptoKernel::Crypto crypto(true);
+    const std::string signature = crypto.sign(message64);
+
+    bench.run("Crypto::sign", [&]() {
+        sink = crypto.sign(message64).size();
+    });
+    bench.run("Crypto::verify", [&]() {
+        sink = crypto.verify(message64, signature);
+    });
+
+    // Encoding
+    const std::string encoded1k = base64_encode(
+                                      reinterpret_cast<const unsigned char*>(message1k.c_str()),
+                                      message1k.size());
+
+    bench.run("base64_encode(1KB)", [&]() {
+        sink = base64_encode(reinterpret_cast<const unsigned char*>(message1k.c_str()),
+                             message1k.size()).size();
+    });
+    bench.run("base64_decode(1KB)", [&]() {
+        sink = base64_decode(encoded1k).size();
+    });
+
+    // Merkle trees
+    std::set<CryptoKernel::BigNum> leaves;
+    while(leaves.size() < 1000) {
+        leaves.insert(CryptoKernel::BigNum(randomHex(generator, 32)));
+    }
+
+    bench.run("MerkleNode::makeMerkleTree(1000)", [&]() {
+        sink = CryptoKernel::MerkleNode::makeMerkleTree(leaves)->getMerkleRoot() > a;
+    });
+
+    // Transactions and blocks
+    Json::Value outputData;
+    outputData["publicKey"] = crypto.getPublicKey();
+
+    std::set<CryptoKernel::Blockchain::output> outputs;
+    for(unsigned int i = 0; i < 10; i++) {
+        outputs.insert(CryptoKernel::Blockchain::output(generator() % 100000000, generator(),
+                       outputData));
+    }
+
+    Json::Value inputData;
+    inputData["signature"] = signature;
+    std::set<CryptoKernel::Blockchain::input> inputs;
+    for(unsigned int i = 0; i < 10; i++) {
+        inputs.insert(CryptoKernel::Blockchain::input(
+                          CryptoKernel::BigNum(randomHex(generator, 32)), inputData));
+    }
+
+    bench.run("transaction(10 in, 10 out)", [&]() {
+        sink = CryptoKernel::Blockchain::transaction(inputs, outputs, 1500000000).getId() > a;
+    });
+
+    const CryptoKernel::Blockchain::transaction tx(inputs, outputs, 1500000000);
+    const Json::Value txJson = tx.toJson();
+
+    bench.run("transaction(Json)", [&]() {
+        sink = CryptoKernel::Blockchain::transaction(txJson).getId() > a;
+    });
+
+    std::set<CryptoKernel::Blockchain::transaction> transactions;
+    for(unsigned int i = 0; i < 100; i++) {
+        std::set<CryptoKernel::Blockchain::input> txInputs;
+        txInputs.insert(CryptoKernel::Blockchain::input(
+                            CryptoKernel::BigNum(randomHex(generator, 32)), inputData));
+        std::set<CryptoKernel::Blockchain::output> txOutputs;
+        txOutputs.insert(CryptoKernel::Blockchain::output(generator() % 100000000, generator(),
+                         outputData));
+        transactions.insert(CryptoKernel::Blockchain::transaction(txInputs, txOutputs, 1500000000));
+    }
+
+    std::set<CryptoKernel::Blockchain::output> coinbaseOutputs;
+    coinbaseOutputs.insert(CryptoKernel::Blockchain::output(5000000000, generator(), outputData));
+    const CryptoKernel::Blockchain::transaction coinbaseTx(
+        std::set<CryptoKernel::Blockchain::input>(), coinbaseOutputs, 1500000000, true);
+
+    bench.run("block(100 txs)", [&]() {
+        sink = CryptoKernel::Blockchain::block(transactions, coinbaseTx, a, 1500000000,
+                                               Json::Value(), 1).getId() > a;
+    });
+
+    const CryptoKernel::Blockchain::block block(transactions, coinbaseTx, a, 1500000000,
+                                                Json::Value(), 1);
+    const Json::Value blockJson = block.toJson();
+
+    bench.run("block::toJson(100 txs)", [&]() {
+        sink = block.toJson().size();
+    });
+    bench.run("block(Json, 100 txs)", [&]() {
+        sink = CryptoKernel::Blockchain::block(blockJson).getId() > a;
+    });
+
+    // JSON serialisation
+    const std::string blockString = CryptoKernel::Storage::toString(blockJson);
+
+    bench.run("Storage::toString(block)", [&]() {
+        sink = CryptoKernel::Storage::toString(blockJson).size();
+    });
+    bench.run("Storage::toJson(block)", [&]() {
+        sink = CryptoKernel::Storage::toJson(blockString).size();
+    });
+
+    std::cout << CryptoKernel::Storage::toString(bench.getResults(), true) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "blockchain.h"
+#include "log.h"
+#include "network.h"
+#include "storage.h"
+#include "consensus/regtest.h"
+
+/**
+* Multi-node network simulation. Starts several nodes in this process, each
+* with its own databases and listening on its own loopback port, connects
+* them in the given topology and times how long transactions and blocks
+* created on node 0 take to reach every other node. Finally a fresh node
+* joins and the time it takes to sync the chain is measured.
+*
+* Usage:
+*   netsim-ck [--nodes N] [--topology line|ring|star|full] [--latency MS]
+*             [--bandwidth BYTES_PER_SECOND] [--rounds R] [--txs T]
+*             [--baseport P] [--timeout SECONDS] [--dir DIR]
+*
+* Latency and bandwidth are applied to every message a node receives. The
+* results are printed to stdout as JSON.
+*/
+
+namespace {
+class SimChain : public CryptoKernel::Blockchain {
+public:
+    SimChain(CryptoKernel::Log* log, const std::string& dbDir) :
+        CryptoKernel::Blockchain(log, dbDir) {}
+
+private:
+    uint64_t getBlockReward(const uint64_t height) {
+        return 50000000000000;
+    }
+
+    std::string getCoinbaseOwner(const std::string& publicKey) {
+        return publicKey;
+    }
+};
+
+std::map<std::string, std::string> parseOptions(int argc, char* argv[], const int first) {
+    std::map<std::string, std::string> options;
+    for(int i = first; i + 1 < argc; i += 2) {
+        const std::string key = argv[i];
+        if(key.size() < 3 || key.substr(0, 2) != "--") {
+            throw std::runtime_error("Unexpected argument " + key);
+        }
+        options[key.substr(2)] = argv[i + 1];
+    }
+    return options;
+}
+
+uint64_t option(const std::map<std::string, std::string>& options, const std::string& name,
+                const uint64_t defaultValue) {
+    const auto it = options.find(name);
+    return it == options.end() ? defaultValue : std::stoull(it->second);
+}
+
+std::string option(const std::map<std::string, std::string>& options, const std::string& name,
+                   const std::string& defaultValue) {
+    const auto it = options.find(name);
+    return it == options.end() ? defaultValue : it->second;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Returns the nodes with a lower index than the given one that it connects
+* to. Connecting only to nodes that started earlier means every connection
+* is made to a port that is already listening.
+*/
+std::vector<unsigned int> neighbours(const std::string& topology, const unsigned int node,
+                                     const unsigned int nodes) {
+    std::vector<unsigned int> returning;
+    if(node == 0) {
+        return returning;
+    }
+
+    if(topology == "line") {
+        returning.push_back(node - 1);
+    } else if(topology == "ring") {
+        returning.push_back(node - 1);
+        if(node == nodes - 1 && nodes > 2) {
+            returning.push_back(0);
+        }
+    } else if(topology == "star") {
+        returning.push_back(0);
+    } else if(topology == "full") {
+        for(unsigned int i = 0; i < node; i++) {
+            returning.push_back(i);
+        }
+    } else {
+        throw std::runtime_error("Unknown topology " + topology);
+    }
+
+    return returning;
+}
+
+struct Node {
+    std::unique_ptr<CryptoKernel::Log> log;
+    std::unique_ptr<SimChain> chain;
+    std::unique_ptr<CryptoKernel::Consensus::Regtest> regtest;
+    std::unique_ptr<CryptoKernel::Network> network;
+};
+
+class Simulation {
+public:
+    explicit Simulation(const std::map<std::string, std::string>& options) {
+        nodes = std::max<uint64_t>(option(options, "nodes", 8), 2);
+        topology = option(options, "topology", std::string("ring"));
+        latency = option(options, "latency", 0);
+        bandwidth = option(options, "bandwidth", 0);
+        rounds = option(options, "rounds", 20);
+        txsPerRound = option(options, "txs", 50);
+        basePort = option(options, "baseport", 49100);
+        timeout = std::chrono::seconds(option(options, "timeout", 60));
+        dir = option(options, "dir", std::string("./netsim"));
+    }
+
+    Json::Value run() {
+        mkdir(dir.c_str(), 0755);
+        genesisFile = dir + "/genesis.json";
+        std::remove(genesisFile.c_str());
+
+        Json::Value returning;
+        returning["nodes"] = nodes;
+        returning["topology"] = topology;
+        returning["latencyMs"] = latency;
+        returning["bandwidth"] = Json::UInt64(bandwidth);
+
+        // Every node starts from the genesis block node 0 generates
+        for(unsigned int i = 0; i < nodes; i++) {
+            startNode(i, nodes);
+        }
+
+        const auto connectStart = std::chrono::steady_clock::now();
+        waitForConnections();
+        returning["connectSeconds"] = secondsSince(connectStart);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<double> txLatencies;
+        std::vector<double> blockLatencies;
+        uint64_t txTimeouts = 0;
+        uint64_t blockTimeouts = 0;
+        uint64_t transactions = 0;
+
+        Node& source = *simNodes[0];
+        for(uint64_t round = 0; round < rounds; round++) {
+            const std::vector<CryptoKernel::BigNum> txIds =
+                source.regtest->generateTransactions(txsPerRound);
+            if(!txIds.empty()) {
+                const std::set<CryptoKernel::Blockchain::transaction> mempool =
+                    source.chain->getUnconfirmedTransactions();
+                const unsigned int expected = source.chain->mempoolCount();
+                transactions += txIds.size();
+
+                const auto sent = std::chrono::steady_clock::now();
+                source.network->broadcastTransactions(
+                    std::vector<CryptoKernel::Blockchain::transaction>(mempool.begin(), mempool.end()));
+
+                txTimeouts += waitForAll([&](Node& node) {
+                    return node.chain->mempoolCount() >= expected;
+                }, sent, txLatencies);
+            }
+
+            const std::vector<CryptoKernel::BigNum> blockIds = source.regtest->generateBlocks(1, "");
+            if(blockIds.empty()) {
+                throw std::runtime_error("Node 0 failed to generate a block");
+            }
+
+            const std::string blockId = blockIds[0].toString();
+            const auto sent = std::chrono::steady_clock::now();
+            source.network->broadcastBlock(source.chain->getBlock(blockId));
+
+            blockTimeouts += waitForAll([&](Node& node) {
+                return node.chain->getBlockDB("tip").getId().toString() == blockId;
+            }, sent, blockLatencies);
+        }
+
+        const double elapsed = secondsSince(start);
+
+        returning["seconds"] = elapsed;
+        returning["transactions"] = summarise(txLatencies, txTimeouts);
+        returning["transactions"]["count"] = Json::UInt64(transactions);
+        returning["blocks"] = summarise(blockLatencies, blockTimeouts);
+        returning["blocks"]["count"] = Json::UInt64(rounds);
+
+        returning["perNode"] = Json::arrayValue;
+        for(unsigned int i = 0; i < nodes; i++) {
+            uint64_t up = 0;
+            uint64_t down = 0;
+            const auto stats = simNodes[i]->network->getPeerStats();
+            for(const auto& peer : stats) {
+                up += peer.second.transferUp;
+                down += peer.second.transferDown;
+            }
+
+            Json::Value node;
+            node["node"] = i;
+            node["peers"] = static_cast<unsigned int>(stats.size());
+            node["bytesUp"] = Json::UInt64(up);
+            node["bytesDown"] = Json::UInt64(down);
+            node["bytesUpPerSecond"] = up / elapsed;
+            node["bytesDownPerSecond"] = down / elapsed;
+            returning["perNode"].append(node);
+        }
+
+        // A node joining now has to download the whole chain
+        const std::string tipId = source.chain->getBlockDB("tip").getId().toString();
+        const auto joinStart = std::chrono::steady_clock::now();
+        startNode(nodes, nodes + 1);
+        Node& joiner = *simNodes[nodes];
+        while(joiner.chain->getBlockDB("tip").getId().toString() != tipId) {
+            if(std::chrono::steady_clock::now() - joinStart > timeout) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        returning["lateJoin"]["height"] = Json::UInt64(source.chain->getBlockDB("tip").getHeight());
+        returning["lateJoin"]["synced"] = joiner.chain->getBlockDB("tip").getId().toString() == tipId;
+        returning["lateJoin"]["syncSeconds"] = secondsSince(joinStart);
+
+        simNodes.clear();
+        std::remove(genesisFile.c_str());
+
+        return returning;
+    }
+
+private:
+    unsigned int nodes;
+    std::string topology;
+    unsigned int latency;
+    uint64_t bandwidth;
+    uint64_t rounds;
+    uint64_t txsPerRound;
+    unsigned int basePort;
+    std::chrono::steady_clock::duration timeout;
+    std::string dir;
+    std::string genesisFile;
+
+    std::vector<std::unique_ptr<Node>> simNodes;
+
+    void startNode(const unsigned int index, const unsigned int nodeCount) {
+        const std::string nodeDir = dir + "/node" + std::to_string(index);
+        mkdir(nodeDir.c_str(), 0755);
+
+        const std::string peersFile = nodeDir + "/peers.txt";
+        {
+            std::ofstream peersOut(peersFile);
+            for(const unsigned int neighbour : neighbours(topology, index, nodeCount)) {
+                peersOut << "127.0.0.1:" << basePort + neighbour << "\n";
+            }
+        }
+
+        std::unique_ptr<Node> node(new Node());
+        node->log.reset(new CryptoKernel::Log(nodeDir + "/node.log", false));
+
+        CryptoKernel::Storage::destroy(nodeDir + "/chain");
+        node->chain.reset(new SimChain(node->log.get(), nodeDir + "/chain"));
+        node->regtest.reset(new CryptoKernel::Consensus::Regtest(node->chain.get()));
+        if(!node->chain->loadChain(node->regtest.get(), genesisFile)) {
+            throw std::runtime_error("Node " + std::to_string(index) + " failed to load its chain");
+        }
+
+        CryptoKernel::Network::Options networkOptions;
+        networkOptions.port = basePort + index;
+        networkOptions.dbDir = nodeDir + "/peers";
+        networkOptions.peersFile = peersFile;
+        networkOptions.bindAddress = "127.0.0.1";
+        networkOptions.publicAddress = "127.0.0.1";
+        networkOptions.allowLocal = true;
+        networkOptions.discovery = false;
+        networkOptions.syncInterval = 100;
+        networkOptions.latency = latency;
+        networkOptions.bandwidth = bandwidth;
+
+        CryptoKernel::Storage::destroy(networkOptions.dbDir);
+        node->network.reset(new CryptoKernel::Network(node->log.get(), node->chain.get(),
+                            networkOptions));
+
+        simNodes.push_back(std::move(node));
+    }
+
+    void waitForConnections() {
+        std::vector<unsigned int> degree(nodes, 0);
+        for(unsigned int i = 0; i < nodes; i++) {
+            for(const unsigned int neighbour : neighbours(topology, i, nodes)) {
+                degree[i]++;
+                degree[neighbour]++;
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for(unsigned int i = 0; i < nodes; i++) {
+            while(simNodes[i]->network->getConnections() < degree[i]) {
+                if(std::chrono::steady_clock::now() - start > timeout) {
+                    throw std::runtime_error("Node " + std::to_string(i) +
+                                             " did not connect to all of its peers");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    }
+
+    /**
+    * Polls every node but node 0 until the condition holds for it, adding
+    * how long each one took to the latencies. Returns the number of nodes
+    * that timed out.
+    */
+    uint64_t waitForAll(const std::function<bool(Node&)>& condition,
+                        const std::chrono::steady_clock::time_point& sent,
+                        std::vector<double>& latencies) {
+        std::vector<bool> done(nodes, false);
+        unsigned int remaining = nodes - 1;
+        while(remaining > 0 && std::chrono::steady_clock::now() - sent < timeout) {
+            for(unsigned int i = 1; i < nodes; i++) {
+                if(!done[i] && condition(*simNodes[i])) {
+                    latencies.push_back(secondsSince(sent) * 1000);
+                    done[i] = true;
+                    remaining--;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return remaining;
+    }
+
+    static Json::Value summarise(std::vector<double> latencies, const uint64_t timeouts) {
+        Json::Value returning;
+        returning["samples"] = static_cast<unsigned int>(latencies.size());
+        returning["timeouts"] = Json::UInt64(timeouts);
+        if(latencies.empty()) {
+            return returning;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        const auto percentile = [&](const unsigned int p) {
+            return latencies[(latencies.size() - 1) * p / 100];
+        };
+        returning["p50Ms"] = percentile(50);
+        returning["p90Ms"] = percentile(90);
+        returning["p99Ms"] = percentile(99);
+        returning["maxMs"] = latencies.back();
+        return returning;
+    }
+};
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        const std::map<std::string, std::string> options = parseOptions(argc, argv, 1);
+        std::cout << CryptoKernel::Storage::toString(Simulation(options).run(), true) << std::endl;
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
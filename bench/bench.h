@@ -0,0 +1,117 @@
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+namespace CryptoKernel {
+/**
+* Minimal micro-benchmark runner. Each benchmark is warmed up, then timed in
+* a fixed number of samples. A sample runs the benchmark enough times to take
+* at least a few microseconds, so that cheap operations are not swamped by
+* the cost of reading the clock. Results are reported per call.
+*/
+class Bench {
+public:
+    /**
+    * Constructs a runner
+    *
+    * @param filter only run benchmarks whose name contains this string
+    * @param samples the number of timed samples to take of each benchmark
+    */
+    Bench(const std::string& filter, const unsigned int samples) {
+        this->filter = filter;
+        this->samples = samples;
+        results = Json::arrayValue;
+    }
+
+    /**
+    * Runs the given benchmark unless it is filtered out
+    *
+    * @param name the name to report the benchmark under
+    * @param func the operation to time. It must not depend on how many
+    *        times it has run before.
+    */
+    void run(const std::string& name, const std::function<void()>& func) {
+        if(name.find(filter) == std::string::npos) {
+            return;
+        }
+
+        // Warm up caches and find how many calls make a sample long enough
+        uint64_t batch = 1;
+        while(true) {
+            const uint64_t elapsed = time(func, batch);
+            if(elapsed >= minSampleNs || batch >= maxBatch) {
+                break;
+            }
+            batch *= 2;
+        }
+        time(func, batch);
+
+        std::vector<double> perCall;
+        perCall.reserve(samples);
+        for(unsigned int i = 0; i < samples; i++) {
+            perCall.push_back(static_cast<double>(time(func, batch)) / batch);
+        }
+        std::sort(perCall.begin(), perCall.end());
+
+        double total = 0;
+        for(const double ns : perCall) {
+            total += ns;
+        }
+
+        Json::Value result;
+        result["name"] = name;
+        result["samples"] = samples;
+        result["callsPerSample"] = Json::UInt64(batch);
+        result["meanNs"] = total / perCall.size();
+        result["minNs"] = perCall.front();
+        result["p50Ns"] = percentile(perCall, 50);
+        result["p90Ns"] = percentile(perCall, 90);
+        result["p99Ns"] = percentile(perCall, 99);
+        result["maxNs"] = perCall.back();
+        results.append(result);
+
+        fprintf(stderr, "%-32s %12.0f ns/op  p50 %12.0f  p99 %12.0f\n", name.c_str(),
+                result["meanNs"].asDouble(), result["p50Ns"].asDouble(),
+                result["p99Ns"].asDouble());
+    }
+
+    /**
+    * Returns the results of every benchmark run so far
+    */
+    Json::Value getResults() const {
+        return results;
+    }
+
+private:
+    std::string filter;
+    unsigned int samples;
+    Json::Value results;
+
+    static const uint64_t minSampleNs = 20000;
+    static const uint64_t maxBatch = 1 << 20;
+
+    static uint64_t time(const std::function<void()>& func, const uint64_t calls) {
+        const auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < calls; i++) {
+            func();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    static double percentile(const std::vector<double>& sorted, const unsigned int p) {
+        const size_t index = (sorted.size() - 1) * p / 100;
+        return sorted[index];
+    }
+};
+}
+
+#endif // BENCH_H_INCLUDED
@@ -69,6 +69,19 @@ public:
         else
         { throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, result.toStyledString()); }
     }
+    Json::Value sendmany(const Json::Value& amounts,
+                         const std::string& password) throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p["amounts"] = amounts;
+        p["password"] = password;
+        const Json::Value result = this->CallMethod("sendmany", p);
+        if (result.isArray() || result.isObject() || result.isString()) {
+            return result;
+        } else {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+                                            result.toStyledString());
+        }
+    }
     bool sendrawtransaction(const Json::Value tx) throw (jsonrpc::JsonRpcException) {
         Json::Value p;
         p["transaction"] = tx;
@@ -183,6 +196,60 @@ public:
                                             result.toStyledString());
         }
     }
+    Json::Value importprivkeys(const std::string& name,
+                               const Json::Value& keys,
+                               const std::string& password) throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p["name"] = name;
+        p["keys"] = keys;
+        p["password"] = password;
+        const Json::Value result = this->CallMethod("importprivkeys", p);
+        if (result.isObject()) {
+            return result;
+        } else {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+                                            result.toStyledString());
+        }
+    }
+    Json::Value watchaddresses(const std::string& name,
+                               const Json::Value& addresses) throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p["name"] = name;
+        p["addresses"] = addresses;
+        const Json::Value result = this->CallMethod("watchaddresses", p);
+        if (result.isObject()) {
+            return result;
+        } else {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+                                            result.toStyledString());
+        }
+    }
+    Json::Value newhdaccount(const std::string& name,
+                             const std::string& password) throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p["name"] = name;
+        p["password"] = password;
+        const Json::Value result = this->CallMethod("newhdaccount", p);
+        if (result.isObject() || result.isString()) {
+            return result;
+        } else {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+                                            result.toStyledString());
+        }
+    }
+    Json::Value getnewaddresses(const std::string& name,
+                                const uint64_t count) throw (jsonrpc::JsonRpcException) {
+        Json::Value p;
+        p["name"] = name;
+        p["count"] = Json::UInt64(count);
+        const Json::Value result = this->CallMethod("getnewaddresses", p);
+        if (result.isArray() || result.isString()) {
+            return result;
+        } else {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+                                            result.toStyledString());
+        }
+    }
     Json::Value getpeerinfo() throw (jsonrpc::JsonRpcException) {
        Json::Value p;
         p = Json::nullValue;
@@ -18,6 +18,8 @@
 #ifndef JSONRPC_CPP_STUB_CRYPTOSERVER_H_
 #define JSONRPC_CPP_STUB_CRYPTOSERVER_H_
 
+#include <mutex>
+
 #include <jsonrpccpp/server.h>
 
 #include "wallet.h"
@@ -36,6 +38,10 @@ public:
                                jsonrpc::JSON_STRING, "address",jsonrpc::JSON_STRING,"amount",
                                jsonrpc::JSON_REAL, "password", jsonrpc::JSON_STRING, NULL),
                                &CryptoRPCServer::sendtoaddressI);
+        this->bindAndAddMethod(jsonrpc::Procedure("sendmany", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_ARRAY, "amounts", jsonrpc::JSON_OBJECT, "password",
+                               jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::sendmanyI);
         this->bindAndAddMethod(jsonrpc::Procedure("sendrawtransaction", jsonrpc::PARAMS_BY_NAME,
                                jsonrpc::JSON_BOOLEAN, "transaction",jsonrpc::JSON_OBJECT, NULL),
                                &CryptoRPCServer::sendrawtransactionI);
@@ -73,6 +79,22 @@ public:
                                jsonrpc::JSON_OBJECT, "key", jsonrpc::JSON_STRING, "name", 
                                jsonrpc::JSON_STRING, "password", jsonrpc::JSON_STRING, NULL),
                                &CryptoRPCServer::importprivkeyI);
+        this->bindAndAddMethod(jsonrpc::Procedure("importprivkeys", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "keys", jsonrpc::JSON_ARRAY, "name",
+                               jsonrpc::JSON_STRING, "password", jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::importprivkeysI);
+        this->bindAndAddMethod(jsonrpc::Procedure("watchaddresses", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "addresses", jsonrpc::JSON_ARRAY, "name",
+                               jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::watchaddressesI);
+        this->bindAndAddMethod(jsonrpc::Procedure("newhdaccount", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "name", jsonrpc::JSON_STRING, "password",
+                               jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::newhdaccountI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getnewaddresses", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_ARRAY, "name", jsonrpc::JSON_STRING, "count",
+                               jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::getnewaddressesI);
         this->bindAndAddMethod(jsonrpc::Procedure("getpeerinfo", jsonrpc::PARAMS_BY_NAME,
                                jsonrpc::JSON_OBJECT, NULL),
                                &CryptoRPCServer::getpeerinfoI);
@@ -82,6 +104,43 @@ public:
         this->bindAndAddMethod(jsonrpc::Procedure("getoutputsetid", jsonrpc::PARAMS_BY_NAME,
                                jsonrpc::JSON_STRING, "outputs", jsonrpc::JSON_ARRAY,
                                NULL), &CryptoRPCServer::getoutputsetidI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getblocktemplate", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "publickey", jsonrpc::JSON_STRING,
+                               NULL), &CryptoRPCServer::getblocktemplateI);
+        this->bindAndAddMethod(jsonrpc::Procedure("submitblock", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_BOOLEAN, "id", jsonrpc::JSON_STRING,
+                               "nonce", jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::submitblockI);
+        this->bindAndAddMethod(jsonrpc::Procedure("generateblocks", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_ARRAY, "count", jsonrpc::JSON_INTEGER,
+                               "publickey", jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::generateblocksI);
+        this->bindAndAddMethod(jsonrpc::Procedure("generatetransactions", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_ARRAY, "count", jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::generatetransactionsI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getblockfilter", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "height", jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::getblockfilterI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getblockfilterheaders", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_ARRAY, "start", jsonrpc::JSON_INTEGER,
+                               "count", jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::getblockfilterheadersI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getaddresshistory", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "publickey", jsonrpc::JSON_STRING,
+                               "start", jsonrpc::JSON_INTEGER, "count", jsonrpc::JSON_INTEGER,
+                               NULL), &CryptoRPCServer::getaddresshistoryI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getaddressbalance", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "publickey", jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::getaddressbalanceI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getspendinginfo", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "id", jsonrpc::JSON_STRING, NULL),
+                               &CryptoRPCServer::getspendinginfoI);
+        this->bindAndAddMethod(jsonrpc::Procedure("getchainstats", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, "height", jsonrpc::JSON_INTEGER, NULL),
+                               &CryptoRPCServer::getchainstatsI);
+        this->bindAndAddMethod(jsonrpc::Procedure("gettxoutsetinfo", jsonrpc::PARAMS_BY_NAME,
+                               jsonrpc::JSON_OBJECT, NULL),
+                               &CryptoRPCServer::gettxoutsetinfoI);
     }
 
     inline virtual void getinfoI(const Json::Value &request, Json::Value &response) {
@@ -95,6 +154,9 @@ public:
                                        request["amount"].asDouble(),
                                        request["password"].asString());
     }
+    inline virtual void sendmanyI(const Json::Value &request, Json::Value &response) {
+        response = this->sendmany(request["amounts"], request["password"].asString());
+    }
     inline virtual void sendrawtransactionI(const Json::Value &request,
                                             Json::Value &response) {
         response = this->sendrawtransaction(request["transaction"]);
@@ -140,6 +202,19 @@ public:
         response = this->importprivkey(request["name"].asString(), request["key"].asString(),
                                        request["password"].asString());
     }
+    inline virtual void importprivkeysI(const Json::Value &request, Json::Value &response) {
+        response = this->importprivkeys(request["name"].asString(), request["keys"],
+                                        request["password"].asString());
+    }
+    inline virtual void watchaddressesI(const Json::Value &request, Json::Value &response) {
+        response = this->watchaddresses(request["name"].asString(), request["addresses"]);
+    }
+    inline virtual void newhdaccountI(const Json::Value &request, Json::Value &response) {
+        response = this->newhdaccount(request["name"].asString(), request["password"].asString());
+    }
+    inline virtual void getnewaddressesI(const Json::Value &request, Json::Value &response) {
+        response = this->getnewaddresses(request["name"].asString(), request["count"].asUInt64());
+    }
     inline virtual void getpeerinfoI(const Json::Value &request, Json::Value &response) {
         response = this->getpeerinfo();
     }
@@ -149,10 +224,48 @@ public:
     inline virtual void getoutputsetidI(const Json::Value &request, Json::Value &response) {
         response = this->getoutputsetid(request["outputs"]);
     }
+    inline virtual void getblocktemplateI(const Json::Value &request, Json::Value &response) {
+        response = this->getblocktemplate(request["publickey"].asString());
+    }
+    inline virtual void submitblockI(const Json::Value &request, Json::Value &response) {
+        response = this->submitblock(request["id"].asString(), request["nonce"].asUInt64());
+    }
+    inline virtual void generateblocksI(const Json::Value &request, Json::Value &response) {
+        response = this->generateblocks(request["count"].asUInt64(),
+                                        request["publickey"].asString());
+    }
+    inline virtual void generatetransactionsI(const Json::Value &request, Json::Value &response) {
+        response = this->generatetransactions(request["count"].asUInt64());
+    }
+    inline virtual void getblockfilterI(const Json::Value &request, Json::Value &response) {
+        response = this->getblockfilter(request["height"].asUInt64());
+    }
+    inline virtual void getblockfilterheadersI(const Json::Value &request, Json::Value &response) {
+        response = this->getblockfilterheaders(request["start"].asUInt64(),
+                                               request["count"].asUInt64());
+    }
+    inline virtual void getaddresshistoryI(const Json::Value &request, Json::Value &response) {
+        response = this->getaddresshistory(request["publickey"].asString(),
+                                           request["start"].asUInt64(),
+                                           request["count"].asUInt64());
+    }
+    inline virtual void getaddressbalanceI(const Json::Value &request, Json::Value &response) {
+        response = this->getaddressbalance(request["publickey"].asString());
+    }
+    inline virtual void getspendinginfoI(const Json::Value &request, Json::Value &response) {
+        response = this->getspendinginfo(request["id"].asString());
+    }
+    inline virtual void getchainstatsI(const Json::Value &request, Json::Value &response) {
+        response = this->getchainstats(request["height"].asUInt64());
+    }
+    inline virtual void gettxoutsetinfoI(const Json::Value &request, Json::Value &response) {
+        response = this->gettxoutsetinfo();
+    }
     virtual Json::Value getinfo() = 0;
     virtual Json::Value account(const std::string& account, const std::string& password) = 0;
     virtual std::string sendtoaddress(const std::string& address, double amount,
                                       const std::string& password) = 0;
+    virtual Json::Value sendmany(const Json::Value& amounts, const std::string& password) = 0;
     virtual bool sendrawtransaction(const Json::Value tx) = 0;
     virtual Json::Value listaccounts() = 0;
     virtual Json::Value listunspentoutputs(const std::string& account) = 0;
@@ -168,9 +281,26 @@ public:
     virtual Json::Value gettransaction(const std::string& id) = 0;
     virtual Json::Value importprivkey(const std::string& name, const std::string& key,
                                       const std::string& password) = 0;
+    virtual Json::Value importprivkeys(const std::string& name, const Json::Value& keys,
+                                       const std::string& password) = 0;
+    virtual Json::Value watchaddresses(const std::string& name, const Json::Value& addresses) = 0;
+    virtual Json::Value newhdaccount(const std::string& name, const std::string& password) = 0;
+    virtual Json::Value getnewaddresses(const std::string& name, const uint64_t count) = 0;
     virtual Json::Value getpeerinfo() = 0;
     virtual Json::Value dumpprivkeys(const std::string& account, const std::string& password) = 0;
     virtual std::string getoutputsetid(const Json::Value& outputs) = 0;
+    virtual Json::Value getblocktemplate(const std::string& publickey) = 0;
+    virtual bool submitblock(const std::string& id, const uint64_t nonce) = 0;
+    virtual Json::Value generateblocks(const uint64_t count, const std::string& publickey) = 0;
+    virtual Json::Value generatetransactions(const uint64_t count) = 0;
+    virtual Json::Value getblockfilter(const uint64_t height) = 0;
+    virtual Json::Value getblockfilterheaders(const uint64_t start, const uint64_t count) = 0;
+    virtual Json::Value getaddresshistory(const std::string& publickey, const uint64_t start,
+                                          const uint64_t count) = 0;
+    virtual Json::Value getaddressbalance(const std::string& publickey) = 0;
+    virtual Json::Value getspendinginfo(const std::string& id) = 0;
+    virtual Json::Value getchainstats(const uint64_t height) = 0;
+    virtual Json::Value gettxoutsetinfo() = 0;
 };
 
 class CryptoServer : public CryptoRPCServer {
@@ -181,9 +311,11 @@ public:
     virtual Json::Value account(const std::string& account, const std::string& password);
     virtual std::string sendtoaddress(const std::string& address, double amount,
                                       const std::string& password);
+    virtual Json::Value sendmany(const Json::Value& amounts, const std::string& password);
     virtual bool sendrawtransaction(const Json::Value tx);
     void setWallet(CryptoKernel::Wallet* Wallet, CryptoKernel::Blockchain* Blockchain,
-                   CryptoKernel::Network* Network, bool* running);
+                   CryptoKernel::Network* Network, CryptoKernel::Consensus* Consensus,
+                   bool* running);
     virtual Json::Value listaccounts();
     virtual Json::Value listunspentoutputs(const std::string& account);
     virtual Json::Value getpubkeyoutputs(const std::string& publickey);
@@ -198,14 +330,48 @@ public:
     virtual Json::Value gettransaction(const std::string& id);
     virtual Json::Value importprivkey(const std::string& name, const std::string& key,
                                       const std::string& password);
+    virtual Json::Value importprivkeys(const std::string& name, const Json::Value& keys,
+                                       const std::string& password);
+    virtual Json::Value watchaddresses(const std::string& name, const Json::Value& addresses);
+    virtual Json::Value newhdaccount(const std::string& name, const std::string& password);
+    virtual Json::Value getnewaddresses(const std::string& name, const uint64_t count);
     virtual Json::Value getpeerinfo();
     virtual Json::Value dumpprivkeys(const std::string& account, const std::string& password);
     virtual std::string getoutputsetid(const Json::Value& outputs);
+    virtual Json::Value getblocktemplate(const std::string& publickey);
+    virtual bool submitblock(const std::string& id, const uint64_t nonce);
+    virtual Json::Value generateblocks(const uint64_t count, const std::string& publickey);
+    virtual Json::Value generatetransactions(const uint64_t count);
+    virtual Json::Value getblockfilter(const uint64_t height);
+    virtual Json::Value getblockfilterheaders(const uint64_t start, const uint64_t count);
+    virtual Json::Value getaddresshistory(const std::string& publickey, const uint64_t start,
+                                          const uint64_t count);
+    virtual Json::Value getaddressbalance(const std::string& publickey);
+    virtual Json::Value getspendinginfo(const std::string& id);
+    virtual Json::Value getchainstats(const uint64_t height);
+    virtual Json::Value gettxoutsetinfo();
+
+    /**
+    * Answers every call but stop with a "warming up" error (code -28)
+    * until setWallet is called, so clients can connect while the coin is
+    * still starting
+    *
+    * @param status what the coin is doing, shown in the error message
+    * @param running set to false by stop
+    */
+    void setWarmup(const std::string& status, bool* running);
+
+    virtual void HandleMethodCall(jsonrpc::Procedure& proc, const Json::Value& input,
+                                  Json::Value& output);
 
 private:
+    std::mutex warmupMutex;
+    std::string warmupStatus;
+
     CryptoKernel::Wallet* wallet;
     CryptoKernel::Blockchain* blockchain;
     CryptoKernel::Network* network;
+    CryptoKernel::Consensus* consensus;
     bool* running;
 };
 
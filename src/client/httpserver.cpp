@@ -52,14 +52,26 @@ HttpServerLocal::HttpServerLocal(int port, const std::string& username, const st
 
 IClientConnectionHandler *HttpServerLocal::GetHandler(const std::string &url)
 {
-    if (AbstractServerConnector::GetHandler() != NULL)
-        return AbstractServerConnector::GetHandler();
-    map<string, IClientConnectionHandler*>::iterator it = this->urlhandler.find(url);
+    const string path = NormalizePath(url);
+    map<string, IClientConnectionHandler*>::iterator it = this->urlhandler.find(path);
     if (it != this->urlhandler.end())
         return it->second;
+    if (this->urlhandler.empty() || path == "/")
+        return AbstractServerConnector::GetHandler();
     return NULL;
 }
 
+string HttpServerLocal::NormalizePath(const std::string &url)
+{
+    // /wallet/name/ is the same route as /wallet/name
+    string path = url;
+    while (path.size() > 1 && path[path.size() - 1] == '/')
+        path.erase(path.size() - 1);
+    if (path.empty())
+        path = "/";
+    return path;
+}
+
 bool HttpServerLocal::StartListening()
 {
     if(!this->running)
@@ -137,8 +149,7 @@ bool HttpServerLocal::SendOptionsResponse(void* addInfo)
 
 void HttpServerLocal::SetUrlHandler(const string &url, IClientConnectionHandler *handler)
 {
-    this->urlhandler[url] = handler;
-    this->SetHandler(NULL);
+    this->urlhandler[NormalizePath(url)] = handler;
 }
 
 int HttpServerLocal::callback(void *cls, MHD_Connection *connection, const char *url, const char *method, const char *version, const char *upload_data, size_t *upload_data_size, void **con_cls)
@@ -175,7 +186,7 @@ int HttpServerLocal::callback(void *cls, MHD_Connection *connection, const char
               IClientConnectionHandler* handler = client_connection->server->GetHandler(string(url));
               if (handler == NULL)
               {
-                client_connection->code = MHD_HTTP_INTERNAL_SERVER_ERROR;
+                client_connection->code = MHD_HTTP_NOT_FOUND;
                 client_connection->server->SendResponse("No client connection handler found", client_connection);
               }
               else
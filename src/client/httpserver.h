@@ -62,6 +62,10 @@ namespace jsonrpc
                     void* addInfo = NULL);
             bool virtual SendOptionsResponse(void* addInfo);
 
+            /**
+             * @brief SetUrlHandler, serves requests to the given path with the given handler. Paths are matched
+             * without trailing slashes. Requests to / still go to this connector's own server.
+             */
             void SetUrlHandler(const std::string &url, IClientConnectionHandler *handler);
 
         private:
@@ -83,8 +87,26 @@ namespace jsonrpc
 
             IClientConnectionHandler* GetHandler(const std::string &url);
 
+            static std::string NormalizePath(const std::string &url);
+
             static int accessCallback(void *cls, const struct sockaddr* addr, socklen_t addrlen);
     };
 
+    /**
+     * Connector for a server that is served at a path of an HttpServerLocal instead of listening itself.
+     * Construct the server on it, then register it with HttpServerLocal::SetUrlHandler.
+     */
+    class UrlRoute : public AbstractServerConnector, public IClientConnectionHandler
+    {
+        public:
+            virtual bool StartListening() { return true; }
+            virtual bool StopListening() { return true; }
+
+            virtual void HandleRequest(const std::string& request, std::string& retValue)
+            {
+                GetHandler()->HandleRequest(request, retValue);
+            }
+    };
+
 } /* namespace jsonrpc */
 #endif /* JSONRPC_CPP_HTTPSERVERLOCALCONNECTOR_H_ */
@@ -86,15 +86,23 @@ int main(int argc, char* argv[]) {
         std::string command(argv[1]);
 
         std::string port = "8383";
+        std::string walletName;
 
         int offset = 0;
 
-        if(command == "-p" && argc >= 4) {
-            command = std::string(argv[3]);
-            port = std::string(argv[2]);
-            offset = 2;
-        } else if(command == "-p") {
-            throw std::runtime_error("Malformed commands");
+        while(command == "-p" || command == "-w") {
+            if(argc < 4 + offset) {
+                throw std::runtime_error("Malformed commands");
+            }
+
+            if(command == "-p") {
+                port = std::string(argv[2 + offset]);
+            } else {
+                walletName = std::string(argv[2 + offset]);
+            }
+
+            offset += 2;
+            command = std::string(argv[1 + offset]);
         }
 
 		const std::string userpass = config["rpcuser"].asString()
@@ -103,7 +111,10 @@ int main(int argc, char* argv[]) {
 		const std::string auth = base64_encode((unsigned char*)userpass.c_str(),
 		                                       userpass.size());
 
-        jsonrpc::HttpClient httpclient("http://127.0.0.1:" + port);
+        // Named wallets are served under their own path
+        const std::string path = walletName.empty() ? "" : "/wallet/" + walletName;
+
+        jsonrpc::HttpClient httpclient("http://127.0.0.1:" + port + path);
         httpclient.SetTimeout(30000);
 		httpclient.AddHeader("Authorization", "Basic " + auth);
         CryptoClient client(httpclient);
@@ -136,6 +147,17 @@ int main(int argc, char* argv[]) {
                 } else {
                     std::cout << "Usage: sendtoaddress [address] [amount]" << std::endl;
                 }
+            } else if(command == "sendmany") {
+                if(argc >= 4 + offset && (argc - offset) % 2 == 0) {
+                    Json::Value amounts;
+                    for(int i = 2 + offset; i < argc; i += 2) {
+                        amounts[std::string(argv[i])] = std::strtod(argv[i + 1], NULL);
+                    }
+                    const std::string password = getPass("Please enter your wallet passphrase: ");
+                    std::cout << client.sendmany(amounts, password).toStyledString() << std::endl;
+                } else {
+                    std::cout << "Usage: sendmany [address] [amount]..." << std::endl;
+                }
             } else if(command == "listaccounts") {
                 std::cout << client.listaccounts().toStyledString() << std::endl;
             } else if(command == "listunspentoutputs") {
@@ -177,6 +199,46 @@ int main(int argc, char* argv[]) {
                 } else {
                     std::cout << "Usage: importprivkey [accountname] [privkey]" << std::endl;
                 }
+            } else if(command == "importprivkeys") {
+                if(argc >= 4 + offset) {
+                    Json::Value keys;
+                    for(int i = 3 + offset; i < argc; i++) {
+                        keys.append(std::string(argv[i]));
+                    }
+                    const std::string password = getPass("Please enter your wallet passphrase: ");
+                    std::cout << client.importprivkeys(std::string(argv[2 + offset]), keys,
+                                                       password);
+                } else {
+                    std::cout << "Usage: importprivkeys [accountname] [privkey]..." << std::endl;
+                }
+            } else if(command == "watchaddresses") {
+                if(argc >= 4 + offset) {
+                    Json::Value addresses;
+                    for(int i = 3 + offset; i < argc; i++) {
+                        addresses.append(std::string(argv[i]));
+                    }
+                    std::cout << client.watchaddresses(std::string(argv[2 + offset]),
+                                                       addresses).toStyledString() << std::endl;
+                } else {
+                    std::cout << "Usage: watchaddresses [accountname] [address]..." << std::endl;
+                }
+            } else if(command == "newhdaccount") {
+                if(argc >= 3 + offset) {
+                    const std::string password = getPass("Please enter your wallet passphrase: ");
+                    std::cout << client.newhdaccount(std::string(argv[2 + offset]),
+                                                     password).toStyledString() << std::endl;
+                } else {
+                    std::cout << "Usage: newhdaccount [accountname]" << std::endl;
+                }
+            } else if(command == "getnewaddresses") {
+                if(argc >= 3 + offset) {
+                    const uint64_t count = argc >= 4 + offset ?
+                                           std::strtoull(argv[3 + offset], NULL, 10) : 1;
+                    std::cout << client.getnewaddresses(std::string(argv[2 + offset]),
+                                                        count).toStyledString() << std::endl;
+                } else {
+                    std::cout << "Usage: getnewaddresses [accountname] [count]" << std::endl;
+                }
             } else if(command == "getpeerinfo") {
                 std::cout << client.getpeerinfo() << std::endl;
             } else if(command == "gettransaction") {
@@ -202,14 +264,19 @@ int main(int argc, char* argv[]) {
                           << "getblock [id]\n"
                           << "getblockbyheight [height]\n"
                           << "getinfo\n"
+                          << "getnewaddresses [accountname] [count]\n"
                           << "getpeerinfo\n"
                           << "gettransaction [id]\n"
                           << "importprivkey [accountname] [privkey]\n"
+                          << "importprivkeys [accountname] [privkey]...\n"
                           << "listaccounts\n"
                           << "listtransactions\n"
                           << "listunspentoutputs [accountname]\n"
+                          << "newhdaccount [accountname]\n"
+                          << "sendmany [address] [amount]...\n"
                           << "sendtoaddress [address] [amount]\n"
-                          << "stop\n";
+                          << "stop\n"
+                          << "watchaddresses [accountname] [address]...\n";
             }
         } catch(jsonrpc::JsonRpcException e) {
             std::cout << e.what() << std::endl;
@@ -1,6 +1,13 @@
 #include "multicoin.h"
 
 #include "consensus/PoW.h"
+#include "consensus/raft.h"
+#include "consensus/AVRR.h"
+#include "consensus/regtest.h"
+#include "blockfilterindex.h"
+#include "addressindex.h"
+#include "spentindex.h"
+#include "chainstatsindex.h"
 
 CryptoKernel::MulticoinLoader::MulticoinLoader(const std::string& configFile,
                                                Log* log,
@@ -17,64 +24,161 @@ CryptoKernel::MulticoinLoader::MulticoinLoader(const std::string& configFile,
 
     t.close();
 
+    // Every coin shares these, so the threads and cache in use stay the
+    // same however many coins are loaded
+    const Json::Value& resources = config["resources"];
+    validationPool.reset(new ThreadPool(resources.get("validationthreads", 0).asUInt()));
+    ioPool.reset(new ThreadPool(resources.get("iothreads", 0).asUInt()));
+    Storage::setSharedCache(resources.get("dbcache", 0).asUInt());
+
+    // Each coin's RPC server answers straight away, with a "warming up"
+    // error until the coin has finished starting in the background
     for(const auto& coin : config["coins"]) {
         Coin* newCoin = new Coin;
         newCoin->name = coin["name"].asString();
 
-        auto subsidyFunc = getSubsidyFunc(coin["subsidy"].asString());
-        auto coinbaseOwnerFunc = [](const std::string& publicKey) {
-                                      return publicKey;
-                                  };
-
-        newCoin->blockchain.reset(new DynamicBlockchain(log,
-                                                        coin["blockdb"].asString(),
-                                                        coinbaseOwnerFunc,
-                                                        subsidyFunc));
-
-        newCoin->consensusAlgo = getConsensusAlgo(coin["consensus"]["type"].asString(),
-                                                  coin["consensus"]["params"],
-                                                  config,
-                                                  newCoin->blockchain.get());
-
-        newCoin->blockchain->loadChain(newCoin->consensusAlgo.get(),
-                                      coin["genesisblock"].asString());
-
-        newCoin->consensusAlgo->start();
-
-        newCoin->network.reset(new Network(log, newCoin->blockchain.get(),
-                                           coin["port"].asUInt(),
-                                           coin["peerdb"].asString()));
-
-        if(!coin["walletdb"].empty()) {
-            newCoin->wallet.reset(new Wallet(newCoin->blockchain.get(),
-                                            newCoin->network.get(),
-                                            log,
-                                            coin["walletdb"].asString()));
-        }
-
         newCoin->httpserver.reset(new jsonrpc::HttpServerLocal(coin["rpcport"].asUInt(),
                                   config["rpcuser"].asString(),
                                   config["rpcpassword"].asString(),
                                   config["sslcert"].asString(),
                                   config["sslkey"].asString()));
         newCoin->rpcserver.reset(new CryptoServer(*newCoin->httpserver));
-        newCoin->rpcserver->setWallet(newCoin->wallet.get(), newCoin->blockchain.get(),
-                                      newCoin->network.get(), running);
+        newCoin->rpcserver->setWarmup("Loading blockchain", running);
+
+        // Named wallets get their own server at /wallet/<name>, the coin's
+        // own server keeps /. The routes must all be in place before the
+        // server starts.
+        for(const std::string& name : coin["wallets"].getMemberNames()) {
+            std::unique_ptr<jsonrpc::UrlRoute> route(new jsonrpc::UrlRoute());
+            std::unique_ptr<CryptoServer> walletServer(new CryptoServer(*route));
+            walletServer->setWarmup("Loading blockchain", running);
+            newCoin->httpserver->SetUrlHandler("/wallet/" + name, route.get());
+            newCoin->walletRoutes[name] = std::move(route);
+            newCoin->walletServers[name] = std::move(walletServer);
+        }
+
         newCoin->rpcserver->StartListening();
 
         coins.push_back(std::unique_ptr<Coin>(newCoin));
+
+        newCoin->startThread.reset(new std::thread(&CryptoKernel::MulticoinLoader::startCoin,
+                                                   this, newCoin, coin, config, running));
     }
 }
 
 CryptoKernel::MulticoinLoader::~MulticoinLoader() {
     for(auto& coin : coins) {
         coin->rpcserver->StopListening();
-        coin->wallet.reset();
+        coin->startThread->join();
+    }
+
+    for(auto& coin : coins) {
+        coin->walletManager.reset();
+        if(coin->consensusAlgo) {
+            coin->consensusAlgo->setNetwork(nullptr);
+        }
         coin->network.reset();
         coin->consensusAlgo.reset();
     }
 }
 
+void CryptoKernel::MulticoinLoader::startCoin(Coin* coin, const Json::Value coinConfig,
+                                              const Json::Value config, bool* running) {
+    try {
+        auto subsidyFunc = getSubsidyFunc(coinConfig["subsidy"].asString());
+        auto coinbaseOwnerFunc = [](const std::string& publicKey) {
+                                      return publicKey;
+                                  };
+
+        coin->blockchain.reset(new DynamicBlockchain(log,
+                                                     coinConfig["blockdb"].asString(),
+                                                     coinbaseOwnerFunc,
+                                                     subsidyFunc));
+
+        // A coin's budget caps its share of the shared pools and memory
+        const Json::Value& budget = coinConfig["budget"];
+        const unsigned int maxThreads = budget.get("threads", 0).asUInt();
+        coin->blockchain->setValidationPool(validationPool.get(), maxThreads);
+        coin->blockchain->setMempoolLimit(budget.get("mempool", 0).asUInt64() * 1024 * 1024);
+
+        coin->consensusAlgo = getConsensusAlgo(coinConfig["consensus"]["type"].asString(),
+                                               coinConfig["consensus"]["params"],
+                                               config,
+                                               coin->blockchain.get());
+
+        for(const Json::Value& indexName : coinConfig["indexes"]) {
+            coin->indexes.push_back(getChainIndex(indexName.asString()));
+            coin->blockchain->addIndex(coin->indexes.back().get());
+        }
+
+        coin->blockchain->loadChain(coin->consensusAlgo.get(),
+                                    coinConfig["genesisblock"].asString());
+
+        setWarmup(coin, "Starting network", running);
+
+        Network::Options networkOptions;
+        networkOptions.port = coinConfig["port"].asUInt();
+        networkOptions.dbDir = coinConfig["peerdb"].asString();
+        networkOptions.ioPool = ioPool.get();
+        networkOptions.ioThreads = maxThreads;
+        coin->network.reset(new Network(log, coin->blockchain.get(), networkOptions));
+
+        coin->consensusAlgo->setNetwork(coin->network.get());
+        coin->consensusAlgo->start();
+
+        // Wallets catch up with the chain in the manager's thread once
+        // loaded, so the coin is usable before the rescan finishes
+        coin->walletManager.reset(new WalletManager(coin->blockchain.get(),
+                                                    coin->network.get(),
+                                                    log,
+                                                    getWalletSyncPolicy(
+                                                        coinConfig.get("walletsync", "keys").asString())));
+
+        Wallet* wallet = nullptr;
+        if(!coinConfig["walletdb"].empty() || !coinConfig["wallets"].empty()) {
+            setWarmup(coin, "Opening wallet", running);
+
+            std::lock_guard<std::mutex> lock(walletMutex);
+            // The walletdb wallet is the unnamed one served at /
+            if(!coinConfig["walletdb"].empty()) {
+                wallet = coin->walletManager->loadWallet("", coinConfig["walletdb"].asString());
+            }
+
+            for(auto& walletServer : coin->walletServers) {
+                const std::string& name = walletServer.first;
+                log->printf(LOG_LEVEL_INFO, "MulticoinLoader(): Opening wallet " + name + " for "
+                                            + coin->name);
+                coin->walletManager->loadWallet(name, coinConfig["wallets"][name].asString());
+            }
+        }
+
+        coin->rpcserver->setWallet(wallet, coin->blockchain.get(),
+                                   coin->network.get(),
+                                   coin->consensusAlgo.get(), running);
+
+        for(auto& walletServer : coin->walletServers) {
+            walletServer.second->setWallet(coin->walletManager->getWallet(walletServer.first),
+                                           coin->blockchain.get(),
+                                           coin->network.get(),
+                                           coin->consensusAlgo.get(), running);
+        }
+
+        log->printf(LOG_LEVEL_INFO, "MulticoinLoader(): Started " + coin->name);
+    } catch(const std::exception& e) {
+        log->printf(LOG_LEVEL_ERR, "MulticoinLoader(): Failed to start " + coin->name + ": " +
+                    e.what());
+        setWarmup(coin, "Failed to start: " + std::string(e.what()), running);
+    }
+}
+
+void CryptoKernel::MulticoinLoader::setWarmup(Coin* coin, const std::string& status,
+                                              bool* running) {
+    coin->rpcserver->setWarmup(status, running);
+    for(auto& walletServer : coin->walletServers) {
+        walletServer.second->setWarmup(status, running);
+    }
+}
+
 std::function<uint64_t(const uint64_t)> CryptoKernel::MulticoinLoader::getSubsidyFunc(
                                   const std::string& name) const {
     if(name == "k320") {
@@ -99,6 +203,34 @@ std::function<uint64_t(const uint64_t)> CryptoKernel::MulticoinLoader::getSubsid
     }
 }
 
+CryptoKernel::Wallet::SyncPolicy CryptoKernel::MulticoinLoader::getWalletSyncPolicy(
+                                  const std::string& name) const {
+    if(name == "always") {
+        return Wallet::SYNC_ALWAYS;
+    } else if(name == "keys") {
+        return Wallet::SYNC_KEYS;
+    } else if(name == "never") {
+        return Wallet::SYNC_NEVER;
+    } else {
+        throw std::runtime_error("Unknown wallet sync policy " + name);
+    }
+}
+
+std::unique_ptr<CryptoKernel::ChainIndex> CryptoKernel::MulticoinLoader::getChainIndex(
+                                          const std::string& name) const {
+    if(name == "blockfilter") {
+        return std::unique_ptr<CryptoKernel::ChainIndex>(new BlockFilterIndex());
+    } else if(name == "address") {
+        return std::unique_ptr<CryptoKernel::ChainIndex>(new AddressIndex());
+    } else if(name == "spent") {
+        return std::unique_ptr<CryptoKernel::ChainIndex>(new SpentIndex());
+    } else if(name == "chainstats") {
+        return std::unique_ptr<CryptoKernel::ChainIndex>(new ChainStatsIndex());
+    } else {
+        throw std::runtime_error("Unknown chain index " + name);
+    }
+}
+
 std::unique_ptr<CryptoKernel::Consensus> CryptoKernel::MulticoinLoader::getConsensusAlgo(
                                          const std::string& name,
                                          const Json::Value& params,
@@ -110,6 +242,37 @@ std::unique_ptr<CryptoKernel::Consensus> CryptoKernel::MulticoinLoader::getConse
                                                  blockchain,
                                                  config["miner"].asBool(),
                                                  config["pubKey"].asString()));
+    } else if(name == "raft") {
+        std::set<std::string> verifiers;
+        for(const auto& verifier : params["verifiers"]) {
+            verifiers.insert(verifier.asString());
+        }
+
+        return std::unique_ptr<CryptoKernel::Consensus>(
+               new Consensus::Raft(blockchain,
+                                   log,
+                                   verifiers,
+                                   config["pubKey"].asString(),
+                                   config["privKey"].asString(),
+                                   params.get("electiontimeout", 1000).asUInt64(),
+                                   params.get("heartbeattimeout", 250).asUInt64(),
+                                   params.get("blockinterval", 500).asUInt64(),
+                                   params.get("pipelinedepth", 4).asUInt(),
+                                   params["statedb"].asString()));
+    } else if(name == "avrr") {
+        std::set<std::string> verifiers;
+        for(const auto& verifier : params["verifiers"]) {
+            verifiers.insert(verifier.asString());
+        }
+
+        return std::unique_ptr<CryptoKernel::Consensus>(
+               new Consensus::AVRR(blockchain,
+                                   verifiers,
+                                   params["blocktarget"].asUInt64(),
+                                   config["pubKey"].asString(),
+                                   config["privKey"].asString()));
+    } else if(name == "regtest") {
+        return std::unique_ptr<CryptoKernel::Consensus>(new Consensus::Regtest(blockchain));
     } else {
         throw std::runtime_error("Unknown consensus algorithm " + name);
     }
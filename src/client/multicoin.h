@@ -2,10 +2,13 @@
 #define MULTICOIN_H_INCLUDED
 
 #include <functional>
+#include <mutex>
+#include <thread>
 
 #include "blockchain.h"
 #include "network.h"
-#include "wallet.h"
+#include "walletmanager.h"
+#include "threadpool.h"
 
 #include "httpserver.h"
 #include "cryptoserver.h"
@@ -22,19 +25,43 @@ namespace CryptoKernel {
             struct Coin {
                 std::string name;
                 std::unique_ptr<Consensus> consensusAlgo;
+                // Used by the blockchain, so declared before it to outlive it
+                std::vector<std::unique_ptr<ChainIndex>> indexes;
                 std::unique_ptr<Blockchain> blockchain;
                 std::unique_ptr<Network> network;
-                std::unique_ptr<Wallet> wallet;
+                std::unique_ptr<WalletManager> walletManager;
                 std::unique_ptr<jsonrpc::HttpServerLocal> httpserver;
                 std::unique_ptr<CryptoServer> rpcserver;
+                // One per named wallet, answering at /wallet/<name>. The
+                // routes are used by the servers, so declared first
+                std::map<std::string, std::unique_ptr<jsonrpc::UrlRoute>> walletRoutes;
+                std::map<std::string, std::unique_ptr<CryptoServer>> walletServers;
+                std::unique_ptr<std::thread> startThread;
             };
 
+            void startCoin(Coin* coin, const Json::Value coinConfig, const Json::Value config,
+                           bool* running);
+
+            void setWarmup(Coin* coin, const std::string& status, bool* running);
+
+            // Setting up a new wallet asks for a passphrase on the terminal,
+            // so only one coin may do it at a time
+            std::mutex walletMutex;
+
+            // Shared by every coin, so declared before them to outlive them
+            std::unique_ptr<ThreadPool> validationPool;
+            std::unique_ptr<ThreadPool> ioPool;
+
             std::vector<std::unique_ptr<Coin>> coins;
 
             Log* log;
 
             std::function<uint64_t(const uint64_t)> getSubsidyFunc(const std::string& name) const;
 
+            Wallet::SyncPolicy getWalletSyncPolicy(const std::string& name) const;
+
+            std::unique_ptr<ChainIndex> getChainIndex(const std::string& name) const;
+
             std::unique_ptr<Consensus> getConsensusAlgo(const std::string& name,
                                                         const Json::Value& params,
                                                         const Json::Value& config,
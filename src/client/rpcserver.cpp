@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 
@@ -22,20 +23,53 @@
 #include "version.h"
 #include "contract.h"
 #include "merkletree.h"
+#include "consensus/PoW.h"
+#include "consensus/regtest.h"
+#include "blockfilterindex.h"
+#include "addressindex.h"
+#include "spentindex.h"
+#include "chainstatsindex.h"
 
 CryptoServer::CryptoServer(jsonrpc::AbstractServerConnector &connector) : CryptoRPCServer(
         connector) {
-
+    wallet = nullptr;
+    blockchain = nullptr;
+    network = nullptr;
+    consensus = nullptr;
+    running = nullptr;
 }
 
 void CryptoServer::setWallet(CryptoKernel::Wallet* Wallet,
                              CryptoKernel::Blockchain* Blockchain,
                              CryptoKernel::Network* Network,
+                             CryptoKernel::Consensus* Consensus,
                              bool* running) {
+    std::lock_guard<std::mutex> lock(warmupMutex);
     wallet = Wallet;
     blockchain = Blockchain;
     network = Network;
+    consensus = Consensus;
     this->running = running;
+    warmupStatus.clear();
+}
+
+void CryptoServer::setWarmup(const std::string& status, bool* running) {
+    std::lock_guard<std::mutex> lock(warmupMutex);
+    warmupStatus = status;
+    this->running = running;
+}
+
+void CryptoServer::HandleMethodCall(jsonrpc::Procedure& proc, const Json::Value& input,
+                                    Json::Value& output) {
+    {
+        std::lock_guard<std::mutex> lock(warmupMutex);
+        if(!warmupStatus.empty() && proc.GetProcedureName() != "stop") {
+            // Same code as bitcoind uses while it loads
+            throw jsonrpc::JsonRpcException(-28, "Warming up: " + warmupStatus);
+        }
+    }
+
+    CryptoRPCServer::HandleMethodCall(proc, input, output);
 }
 
 Json::Value CryptoServer::getinfo() {
@@ -100,6 +134,35 @@ std::string CryptoServer::sendtoaddress(const std::string& address, double amoun
     return wallet->sendToAddress(address, Amount, password);
 }
 
+Json::Value CryptoServer::sendmany(const Json::Value& amounts, const std::string& password) {
+    std::map<std::string, uint64_t> payments;
+    for(const std::string& address : amounts.getMemberNames()) {
+        payments[address] = amounts[address].asDouble() * 100000000;
+    }
+
+    try {
+        Json::Value returning = Json::Value(Json::arrayValue);
+        for(const std::string& id : wallet->sendMany(payments, password)) {
+            returning.append(id);
+        }
+
+        return returning;
+    } catch(const CryptoKernel::Wallet::PartialSendException& e) {
+        // The transactions already sent can't be recalled, so the caller
+        // needs their ids as well as the failure
+        Json::Value returning;
+        returning["txids"] = Json::Value(Json::arrayValue);
+        for(const std::string& id : e.getSent()) {
+            returning["txids"].append(id);
+        }
+        returning["error"] = e.what();
+
+        return returning;
+    } catch(const CryptoKernel::Wallet::WalletException& e) {
+        return Json::Value(e.what());
+    }
+}
+
 bool CryptoServer::sendrawtransaction(const Json::Value tx) {
     try {
         const CryptoKernel::Blockchain::transaction transaction =
@@ -297,6 +360,54 @@ Json::Value CryptoServer::importprivkey(const std::string& name, const std::stri
     }
 }
 
+Json::Value CryptoServer::importprivkeys(const std::string& name, const Json::Value& keys,
+                                         const std::string& password) {
+    std::vector<std::string> privKeys;
+    for(const Json::Value& key : keys) {
+        privKeys.push_back(key.asString());
+    }
+
+    try {
+        return wallet->importPrivKeys(name, privKeys, password).toJson();
+    } catch(const CryptoKernel::Wallet::WalletException& e) {
+        return Json::Value(e.what());
+    }
+}
+
+Json::Value CryptoServer::watchaddresses(const std::string& name, const Json::Value& addresses) {
+    std::vector<std::string> pubKeys;
+    for(const Json::Value& address : addresses) {
+        pubKeys.push_back(address.asString());
+    }
+
+    try {
+        return wallet->watchAddresses(name, pubKeys).toJson();
+    } catch(const CryptoKernel::Wallet::WalletException& e) {
+        return Json::Value(e.what());
+    }
+}
+
+Json::Value CryptoServer::newhdaccount(const std::string& name, const std::string& password) {
+    try {
+        return wallet->newHDAccount(name, password).toJson();
+    } catch(const CryptoKernel::Wallet::WalletException& e) {
+        return Json::Value(e.what());
+    }
+}
+
+Json::Value CryptoServer::getnewaddresses(const std::string& name, const uint64_t count) {
+    try {
+        Json::Value returning = Json::Value(Json::arrayValue);
+        for(const std::string& address : wallet->newAddresses(name, count)) {
+            returning.append(address);
+        }
+
+        return returning;
+    } catch(const CryptoKernel::Wallet::WalletException& e) {
+        return Json::Value(e.what());
+    }
+}
+
 Json::Value CryptoServer::getpeerinfo() {
     Json::Value returning;
 
@@ -343,3 +454,203 @@ std::string CryptoServer::getoutputsetid(const Json::Value& outputs) {
     return CryptoKernel::MerkleNode::makeMerkleTree(outputIds)->getMerkleRoot()
            .toString();
 }
+
+Json::Value CryptoServer::getblocktemplate(const std::string& publickey) {
+    CryptoKernel::Consensus::PoW* pow = dynamic_cast<CryptoKernel::Consensus::PoW*>(consensus);
+    if(pow == nullptr) {
+        return Json::Value("Consensus algorithm does not support external mining");
+    }
+
+    if(!CryptoKernel::Crypto().setPublicKey(publickey)) {
+        return Json::Value("Invalid public key");
+    }
+
+    return pow->getWork(publickey);
+}
+
+bool CryptoServer::submitblock(const std::string& id, const uint64_t nonce) {
+    CryptoKernel::Consensus::PoW* pow = dynamic_cast<CryptoKernel::Consensus::PoW*>(consensus);
+    if(pow == nullptr) {
+        return false;
+    }
+
+    const CryptoKernel::BigNum blockId(id);
+    if(!pow->submitWork(blockId, nonce)) {
+        return false;
+    }
+
+    network->broadcastBlock(blockchain->getBlock(blockId.toString()));
+
+    return true;
+}
+
+Json::Value CryptoServer::generateblocks(const uint64_t count, const std::string& publickey) {
+    CryptoKernel::Consensus::Regtest* regtest =
+        dynamic_cast<CryptoKernel::Consensus::Regtest*>(consensus);
+    if(regtest == nullptr) {
+        return Json::Value("Block generation is only available with regtest consensus");
+    }
+
+    if(!publickey.empty() && !CryptoKernel::Crypto().setPublicKey(publickey)) {
+        return Json::Value("Invalid public key");
+    }
+
+    Json::Value returning = Json::arrayValue;
+    for(const CryptoKernel::BigNum& id : regtest->generateBlocks(count, publickey)) {
+        returning.append(id.toString());
+    }
+
+    return returning;
+}
+
+Json::Value CryptoServer::generatetransactions(const uint64_t count) {
+    CryptoKernel::Consensus::Regtest* regtest =
+        dynamic_cast<CryptoKernel::Consensus::Regtest*>(consensus);
+    if(regtest == nullptr) {
+        return Json::Value("Transaction generation is only available with regtest consensus");
+    }
+
+    Json::Value returning = Json::arrayValue;
+    for(const CryptoKernel::BigNum& id : regtest->generateTransactions(count)) {
+        returning.append(id.toString());
+    }
+
+    return returning;
+}
+
+Json::Value CryptoServer::getblockfilter(const uint64_t height) {
+    CryptoKernel::BlockFilterIndex* filterIndex =
+        dynamic_cast<CryptoKernel::BlockFilterIndex*>(blockchain->getIndex("blockfilter"));
+    if(filterIndex == nullptr) {
+        return Json::Value("Block filter index is not enabled");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    if(height == 0 || height > blockchain->getIndexHeight(dbTx.get(), "blockfilter")) {
+        return Json::Value();
+    }
+
+    Json::Value returning = filterIndex->getEntry(dbTx.get(), height);
+    returning["height"] = height;
+
+    return returning;
+}
+
+Json::Value CryptoServer::getblockfilterheaders(const uint64_t start, const uint64_t count) {
+    CryptoKernel::BlockFilterIndex* filterIndex =
+        dynamic_cast<CryptoKernel::BlockFilterIndex*>(blockchain->getIndex("blockfilter"));
+    if(filterIndex == nullptr) {
+        return Json::Value("Block filter index is not enabled");
+    }
+
+    if(count > 2000) {
+        return Json::Value("Cannot request more than 2000 headers at once");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    const uint64_t indexHeight = blockchain->getIndexHeight(dbTx.get(), "blockfilter");
+
+    Json::Value returning = Json::arrayValue;
+    for(uint64_t height = std::max<uint64_t>(start, 1);
+        height < start + count && height <= indexHeight; height++) {
+        returning.append(filterIndex->getFilterHeader(dbTx.get(), height));
+    }
+
+    return returning;
+}
+
+Json::Value CryptoServer::getaddresshistory(const std::string& publickey, const uint64_t start,
+                                            const uint64_t count) {
+    CryptoKernel::AddressIndex* addressIndex =
+        dynamic_cast<CryptoKernel::AddressIndex*>(blockchain->getIndex("address"));
+    if(addressIndex == nullptr) {
+        return Json::Value("Address index is not enabled");
+    }
+
+    if(count > 1000) {
+        return Json::Value("Cannot request more than 1000 transactions at once");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+
+    Json::Value returning;
+    returning["height"] = blockchain->getIndexHeight(dbTx.get(), "address");
+    returning["total"] = addressIndex->getSummary(dbTx.get(), publickey)["txcount"];
+    returning["transactions"] = addressIndex->getHistory(dbTx.get(), publickey, start, count);
+
+    return returning;
+}
+
+Json::Value CryptoServer::getaddressbalance(const std::string& publickey) {
+    CryptoKernel::AddressIndex* addressIndex =
+        dynamic_cast<CryptoKernel::AddressIndex*>(blockchain->getIndex("address"));
+    if(addressIndex == nullptr) {
+        return Json::Value("Address index is not enabled");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+
+    Json::Value returning = addressIndex->getSummary(dbTx.get(), publickey);
+    returning["height"] = blockchain->getIndexHeight(dbTx.get(), "address");
+
+    return returning;
+}
+
+Json::Value CryptoServer::getspendinginfo(const std::string& id) {
+    CryptoKernel::SpentIndex* spentIndex =
+        dynamic_cast<CryptoKernel::SpentIndex*>(blockchain->getIndex("spent"));
+    if(spentIndex == nullptr) {
+        return Json::Value("Spent index is not enabled");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+
+    return spentIndex->getSpendingInfo(dbTx.get(), id);
+}
+
+Json::Value CryptoServer::getchainstats(const uint64_t height) {
+    CryptoKernel::ChainStatsIndex* statsIndex =
+        dynamic_cast<CryptoKernel::ChainStatsIndex*>(blockchain->getIndex("chainstats"));
+    if(statsIndex == nullptr) {
+        return Json::Value("Chain stats index is not enabled");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    const uint64_t indexHeight = blockchain->getIndexHeight(dbTx.get(), "chainstats");
+
+    // Height 0 asks for the latest block indexed
+    const uint64_t statsHeight = height == 0 ? indexHeight : height;
+    if(statsHeight == 0 || statsHeight > indexHeight) {
+        return Json::Value();
+    }
+
+    Json::Value returning = statsIndex->getStats(dbTx.get(), statsHeight);
+    returning["height"] = statsHeight;
+
+    return returning;
+}
+
+Json::Value CryptoServer::gettxoutsetinfo() {
+    CryptoKernel::ChainStatsIndex* statsIndex =
+        dynamic_cast<CryptoKernel::ChainStatsIndex*>(blockchain->getIndex("chainstats"));
+    if(statsIndex == nullptr) {
+        return Json::Value("Chain stats index is not enabled");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    const uint64_t indexHeight = blockchain->getIndexHeight(dbTx.get(), "chainstats");
+    if(indexHeight == 0) {
+        return Json::Value();
+    }
+
+    const Json::Value stats = statsIndex->getStats(dbTx.get(), indexHeight);
+
+    Json::Value returning;
+    returning["height"] = indexHeight;
+    returning["blockId"] = stats["blockId"];
+    returning["utxos"] = stats["utxos"];
+    returning["bytes"] = stats["utxoBytes"];
+    returning["supply"] = stats["supply"];
+
+    return returning;
+}
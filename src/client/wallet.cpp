@@ -17,23 +17,31 @@
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+
+#include <openssl/rand.h>
 
 #include "wallet.h"
 #include "crypto.h"
+#include "base64.h"
 
 CryptoKernel::Wallet::Wallet(CryptoKernel::Blockchain* blockchain,
                              CryptoKernel::Network* network,
                              CryptoKernel::Log* log,
-                             const std::string& dbDir) {
+                             const std::string& dbDir,
+                             const bool watch,
+                             const SyncPolicy syncPolicy) {
     this->blockchain = blockchain;
     this->network = network;
     this->log = log;
+    this->syncPolicy = syncPolicy;
 
-    walletdb.reset(new CryptoKernel::Storage(dbDir, true, 8, false));
+    walletdb.reset(new CryptoKernel::Storage(dbDir, syncPolicy == SYNC_ALWAYS, 8, false));
     accounts.reset(new CryptoKernel::Storage::Table("accounts"));
     utxos.reset(new CryptoKernel::Storage::Table("utxos"));
     transactions.reset(new CryptoKernel::Storage::Table("transactions"));
     params.reset(new CryptoKernel::Storage::Table("params"));
+    hdKeys.reset(new CryptoKernel::Storage::Table("hdKeys"));
 
     std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
     const Json::Value height = params->get(dbTx.get(), "height");
@@ -51,18 +59,28 @@ CryptoKernel::Wallet::Wallet(CryptoKernel::Blockchain* blockchain,
         upgradeWallet();
     } else if(schemaVersion > LATEST_WALLET_SCHEMA) {
         throw std::runtime_error("Wallet schema version is newer than this software");
+    } else {
+        dbTx->abort();
+    }
+
+    if(!keyFilter) {
+        addToKeyFilter(std::vector<std::string>());
     }
 
     const time_t t = std::time(0);
     generator.seed(static_cast<uint64_t> (t));
 
     running = true;
-    watchThread.reset(new std::thread(&CryptoKernel::Wallet::watchFunc, this));
+    if(watch) {
+        watchThread.reset(new std::thread(&CryptoKernel::Wallet::watchFunc, this));
+    }
 }
 
 CryptoKernel::Wallet::~Wallet() {
     running = false;
-    watchThread->join();
+    if(watchThread) {
+        watchThread->join();
+    }
 }
 
 void CryptoKernel::Wallet::upgradeWallet() {
@@ -107,7 +125,7 @@ void CryptoKernel::Wallet::upgradeWallet() {
 
         params->put(dbTx.get(), "schemaVersion", Json::Value(1));
 
-        dbTx->commit();
+        commitKeys(dbTx.get());
 
         std::cout << "Wallet successfully encrypted" << std::endl;
 
@@ -151,6 +169,10 @@ void CryptoKernel::Wallet::upgradeWallet() {
     log->printf(LOG_LEVEL_INFO, "Wallet(): Wallet upgrade complete");
 }
 
+void CryptoKernel::Wallet::commitKeys(CryptoKernel::Storage::Transaction* dbTx) {
+    dbTx->commit(syncPolicy != SYNC_NEVER);
+}
+
 bool CryptoKernel::Wallet::checkPassword(const std::string& password) {
     std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
 
@@ -179,45 +201,7 @@ void CryptoKernel::Wallet::watchFunc() {
         std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
         std::unique_ptr<CryptoKernel::Storage::Transaction> bchainTx(blockchain->getTxHandle());
 
-        bool rewind = false;
-        do {
-            rewind = false;
-            const uint64_t height = params->get(dbTx.get(), "height").asUInt64();
-            const std::string tipId = params->get(dbTx.get(), "tipId").asString();
-            if(height > 0) {
-                try {
-                    const CryptoKernel::Blockchain::dbBlock syncBlock = blockchain->getBlockByHeightDB(
-                                bchainTx.get(), height);
-                    if(syncBlock.getId().toString() != tipId) {
-                        // There was a fork, rewind to fork block
-                        rewind = true;
-                    }
-                } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
-                    rewind = true;
-                }
-
-                if(rewind) {
-                    try {
-                        rewindBlock(dbTx.get(), bchainTx.get());
-                    } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
-                        dbTx->abort();
-                        clearDB();
-                        dbTx.reset(walletdb->begin());
-                    }
-                }
-            }
-        } while(rewind);
-
-        // Forks resolved, sync to current tip
-        const CryptoKernel::Blockchain::dbBlock tipBlock = blockchain->getBlockDB(bchainTx.get(),
-                "tip");
-        uint64_t height = params->get(dbTx.get(), "height").asUInt64();
-        while(height < tipBlock.getHeight()) {
-            const CryptoKernel::Blockchain::block currentBlock = blockchain->getBlockByHeight(
-                        bchainTx.get(), height + 1);
-            digestBlock(dbTx.get(), bchainTx.get(), currentBlock);
-            height = params->get(dbTx.get(), "height").asUInt64();
-        }
+        syncToTip(dbTx, bchainTx.get());
 
         // get the unconfirmed transactions
         const std::set<CryptoKernel::Blockchain::transaction> unconfirmedTxs = blockchain->getUnconfirmedTransactions();
@@ -232,6 +216,154 @@ void CryptoKernel::Wallet::watchFunc() {
     }
 }
 
+void CryptoKernel::Wallet::syncToTip(std::unique_ptr<CryptoKernel::Storage::Transaction>&
+                                     walletTx,
+                                     CryptoKernel::Storage::Transaction* bchainTx) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    rewindForks(walletTx, bchainTx);
+
+    // Forks resolved, sync to current tip
+    const CryptoKernel::Blockchain::dbBlock tipBlock = blockchain->getBlockDB(bchainTx, "tip");
+    uint64_t height = params->get(walletTx.get(), "height").asUInt64();
+    while(height < tipBlock.getHeight()) {
+        const CryptoKernel::Blockchain::block currentBlock = blockchain->getBlockByHeight(
+                    bchainTx, height + 1);
+        digestBlock(walletTx.get(), bchainTx, currentBlock);
+        height = params->get(walletTx.get(), "height").asUInt64();
+    }
+}
+
+void CryptoKernel::Wallet::rewindForks(std::unique_ptr<CryptoKernel::Storage::Transaction>&
+                                       walletTx,
+                                       CryptoKernel::Storage::Transaction* bchainTx) {
+    bool rewind = false;
+    do {
+        rewind = false;
+        const uint64_t height = params->get(walletTx.get(), "height").asUInt64();
+        const std::string tipId = params->get(walletTx.get(), "tipId").asString();
+        if(height > 0) {
+            try {
+                const CryptoKernel::Blockchain::dbBlock syncBlock = blockchain->getBlockByHeightDB(
+                            bchainTx, height);
+                if(syncBlock.getId().toString() != tipId) {
+                    // There was a fork, rewind to fork block
+                    rewind = true;
+                }
+            } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+                rewind = true;
+            }
+
+            if(rewind) {
+                try {
+                    rewindBlock(walletTx.get(), bchainTx);
+                } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+                    walletTx->abort();
+                    clearDB();
+                    walletTx.reset(walletdb->begin());
+                }
+            }
+        }
+    } while(rewind);
+}
+
+uint64_t CryptoKernel::Wallet::digestBlocks(CryptoKernel::Storage::Transaction* bchainTx,
+        const std::vector<CryptoKernel::Blockchain::block>& blocks,
+        const std::set<CryptoKernel::Blockchain::transaction>& unconfirmedTxs) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+
+    rewindForks(dbTx, bchainTx);
+
+    uint64_t height = params->get(dbTx.get(), "height").asUInt64();
+    for(const CryptoKernel::Blockchain::block& block : blocks) {
+        if(block.getHeight() == height + 1) {
+            // The blocks may have been read before a reorg
+            try {
+                blockchain->getBlockDB(bchainTx, block.getId().toString(), true);
+            } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+                break;
+            }
+
+            digestBlock(dbTx.get(), bchainTx, block);
+            height = params->get(dbTx.get(), "height").asUInt64();
+        }
+    }
+
+    for(const CryptoKernel::Blockchain::transaction& tx : unconfirmedTxs) {
+        digestTx(tx, dbTx.get(), bchainTx, true);
+    }
+
+    dbTx->commit();
+
+    return height;
+}
+
+void CryptoKernel::Wallet::rescanKeys(CryptoKernel::Storage::Transaction* walletTx,
+                                      CryptoKernel::Storage::Transaction* bchainTx,
+                                      const std::set<std::string>& pubKeys) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    std::set<CryptoKernel::Blockchain::dbOutput> unspent;
+    std::set<CryptoKernel::Blockchain::dbOutput> spent;
+    for(const std::string& pubKey : pubKeys) {
+        const auto keyUnspent = blockchain->getUnspentOutputs(bchainTx, pubKey);
+        unspent.insert(keyUnspent.begin(), keyUnspent.end());
+
+        const auto keySpent = blockchain->getSpentOutputs(bchainTx, pubKey);
+        spent.insert(keySpent.begin(), keySpent.end());
+    }
+
+    if(spent.empty()) {
+        // Nothing was spent, so the outputs and the transactions that
+        // created them are all there is to record
+        for(const CryptoKernel::Blockchain::dbOutput& out : unspent) {
+            Account acc = getAccountByKey(walletTx, out.getData()["publicKey"].asString());
+            acc.setBalance(acc.getBalance() + out.getValue());
+            accounts->put(walletTx, acc.getName(), acc.toJson());
+
+            const Txo newTxo = Txo(out.getId().toString(), out.getValue(), acc.isWatchOnly());
+            utxos->put(walletTx, out.getId().toString(), newTxo.toJson());
+
+            Json::Value txJson;
+            txJson["unconfirmed"] = false;
+            transactions->put(walletTx, out.getCreationTx().toString(), txJson);
+        }
+
+        return;
+    }
+
+    // The transactions that spent outputs aren't indexed, so digest every
+    // block from the first that paid one of the keys, looking only at them
+    uint64_t startHeight = params->get(walletTx, "height").asUInt64() + 1;
+    for(const auto* outputs : {&unspent, &spent}) {
+        for(const CryptoKernel::Blockchain::dbOutput& out : *outputs) {
+            const CryptoKernel::Blockchain::dbTransaction creationTx = blockchain->getTransactionDB(
+                        bchainTx, out.getCreationTx().toString());
+            const uint64_t height = blockchain->getBlockDB(bchainTx,
+                                    creationTx.getConfirmingBlock().toString()).getHeight();
+            startHeight = std::min(startHeight, height);
+        }
+    }
+
+    const uint64_t tipHeight = params->get(walletTx, "height").asUInt64();
+
+    log->printf(LOG_LEVEL_INFO, "Wallet::rescanKeys(): Rescanning " +
+                std::to_string(pubKeys.size()) + " keys from block " + std::to_string(startHeight));
+
+    for(uint64_t height = startHeight; height <= tipHeight; height++) {
+        const CryptoKernel::Blockchain::block block = blockchain->getBlockByHeight(bchainTx,
+                height);
+
+        std::set<CryptoKernel::Blockchain::transaction> txs = block.getTransactions();
+        txs.insert(block.getCoinbaseTx());
+
+        for(const CryptoKernel::Blockchain::transaction& tx : txs) {
+            digestTx(tx, walletTx, bchainTx, false, &pubKeys);
+        }
+    }
+}
+
 void CryptoKernel::Wallet::rewindTx(const CryptoKernel::Blockchain::transaction& tx,
                      CryptoKernel::Storage::Transaction* walletTx,
                      CryptoKernel::Storage::Transaction* bchainTx) {
@@ -253,16 +385,18 @@ void CryptoKernel::Wallet::rewindTx(const CryptoKernel::Blockchain::transaction&
         for(const CryptoKernel::Blockchain::input& inp : tx.getInputs()) {
             const CryptoKernel::Blockchain::output out = blockchain->getOutputDB(bchainTx,
                     inp.getOutputId().toString());
+            bool watchOnly = false;
             if(out.getData()["publicKey"].isString()) {
                 try {
                     Account acc = getAccountByKey(walletTx, out.getData()["publicKey"].asString());
                     acc.setBalance(acc.getBalance() + out.getValue());
                     accounts->put(walletTx, acc.getName(), acc.toJson());
+                    watchOnly = acc.isWatchOnly();
                 } catch(const WalletException& e) {
                     continue;
                 }
             }
-            const Txo newTxo = Txo(out.getId().toString(), out.getValue());
+            const Txo newTxo = Txo(out.getId().toString(), out.getValue(), watchOnly);
             utxos->put(walletTx, out.getId().toString(), newTxo.toJson());
         }
     }
@@ -279,7 +413,7 @@ void CryptoKernel::Wallet::rewindBlock(CryptoKernel::Storage::Transaction* walle
     */
     std::lock_guard<std::recursive_mutex> lock(walletLock);
     const std::string tipId = params->get(walletTx, "tipId").asString();
-    const CryptoKernel::Blockchain::block oldTip = blockchain->buildBlock(bchainTx, blockchain->getBlockDB(bchainTx, tipId));
+    const CryptoKernel::Blockchain::block oldTip = blockchain->getBlock(bchainTx, tipId);
 
     log->printf(LOG_LEVEL_INFO,
                 "Wallet::rewindBlock(): Rewinding block " + std::to_string(oldTip.getHeight()));
@@ -351,34 +485,48 @@ void CryptoKernel::Wallet::clearDB() {
 void CryptoKernel::Wallet::digestTx(const CryptoKernel::Blockchain::transaction& tx,
                  CryptoKernel::Storage::Transaction* walletTx,
                  CryptoKernel::Storage::Transaction* bchainTx,
-                 const bool unconfirmed) {
+                 const bool unconfirmed,
+                 const std::set<std::string>* onlyKeys) {
     bool trackTx = false;
 
     for(const CryptoKernel::Blockchain::input& inp : tx.getInputs()) {
         const Json::Value txo = utxos->get(walletTx, inp.getOutputId().toString());
         if(txo.isObject()) {
-            trackTx = true;
             if(!unconfirmed) {
-                utxos->erase(walletTx, inp.getOutputId().toString());
-
                 const CryptoKernel::Blockchain::output out = blockchain->getOutput(bchainTx,
                         inp.getOutputId().toString());
-                Account acc = getAccountByKey(walletTx, out.getData()["publicKey"].asString());
+                const std::string publicKey = out.getData()["publicKey"].asString();
+                if(onlyKeys != nullptr && onlyKeys->count(publicKey) == 0) {
+                    continue;
+                }
+
+                utxos->erase(walletTx, inp.getOutputId().toString());
+
+                Account acc = getAccountByKey(walletTx, publicKey);
                 acc.setBalance(acc.getBalance() - out.getValue());
                 accounts->put(walletTx, acc.getName(), acc.toJson());
             }
+            trackTx = true;
         }
     }
 
     for(const CryptoKernel::Blockchain::output& out : tx.getOutputs()) {
         // Check if there is a publicKey that belongs to you
         if(out.getData()["publicKey"].isString()) {
+            const std::string publicKey = out.getData()["publicKey"].asString();
+            if(!keyFilter->contains(publicKey) ||
+               (onlyKeys != nullptr && onlyKeys->count(publicKey) == 0)) {
+                continue;
+            }
+
+            bool watchOnly = false;
             try {
-                Account acc = getAccountByKey(walletTx, out.getData()["publicKey"].asString());
+                Account acc = getAccountByKey(walletTx, publicKey);
                 if(!unconfirmed) {
                     acc.setBalance(acc.getBalance() + out.getValue());
                     accounts->put(walletTx, acc.getName(), acc.toJson());
                 }
+                watchOnly = acc.isWatchOnly();
             } catch(const WalletException& e) {
                 continue;
             }
@@ -386,13 +534,16 @@ void CryptoKernel::Wallet::digestTx(const CryptoKernel::Blockchain::transaction&
             trackTx = true;
         
             if(!unconfirmed) {
-                const Txo newTxo = Txo(out.getId().toString(), out.getValue());
+                const Txo newTxo = Txo(out.getId().toString(), out.getValue(), watchOnly);
                 utxos->put(walletTx, out.getId().toString(), newTxo.toJson());
             }
         }
     }
 
-    if(trackTx) {
+    // The mempool is checked every sync, so only record an unconfirmed
+    // transaction the first time it's seen
+    if(trackTx && (!unconfirmed ||
+                   transactions->get(walletTx, tx.getId().toString()).isNull())) {
         Json::Value txJson;
         txJson["unconfirmed"] = unconfirmed;
         transactions->put(walletTx, tx.getId().toString(), txJson);
@@ -427,16 +578,38 @@ void CryptoKernel::Wallet::digestBlock(CryptoKernel::Storage::Transaction* walle
 CryptoKernel::Wallet::Account::Account(const std::string& name, const std::string& password) {
     this->name = name;
     balance = 0;
+    watchOnly = false;
+    hdIndex = 0;
+    nextChild = 0;
 
     const keyPair newKey = newAddress(password);
     keys.insert(newKey);
 }
 
+CryptoKernel::Wallet::Account::Account(const std::string& name, const HDKey& extendedKey,
+                                       const uint32_t index) {
+    this->name = name;
+    balance = 0;
+    watchOnly = false;
+    this->extendedKey.reset(new HDKey(extendedKey.toJson()));
+    hdIndex = index;
+    nextChild = 0;
+}
+
 Json::Value CryptoKernel::Wallet::Account::toJson() const {
     Json::Value returning;
 
     returning["name"] = name;
     returning["balance"] = balance;
+    if(watchOnly) {
+        returning["watchOnly"] = true;
+    }
+
+    if(extendedKey) {
+        returning["hd"]["key"] = extendedKey->toJson();
+        returning["hd"]["index"] = hdIndex;
+        returning["hd"]["next"] = nextChild;
+    }
 
     for(const keyPair& key : keys) {
         Json::Value jsonKeyPair;
@@ -451,6 +624,14 @@ Json::Value CryptoKernel::Wallet::Account::toJson() const {
 CryptoKernel::Wallet::Account::Account(const Json::Value& accountJson) {
     name = accountJson["name"].asString();
     balance = accountJson["balance"].asUInt64();
+    watchOnly = accountJson["watchOnly"].asBool();
+
+    const Json::Value& hd = accountJson["hd"];
+    if(hd.isObject()) {
+        extendedKey.reset(new HDKey(hd["key"]));
+    }
+    hdIndex = hd["index"].asUInt();
+    nextChild = hd["next"].asUInt();
 
     for(const Json::Value& key : accountJson["keys"]) {
         keyPair newKeys;
@@ -468,6 +649,34 @@ void CryptoKernel::Wallet::Account::setBalance(const uint64_t newBalance) {
     balance = newBalance;
 }
 
+bool CryptoKernel::Wallet::Account::isWatchOnly() const {
+    return watchOnly;
+}
+
+bool CryptoKernel::Wallet::Account::isHD() const {
+    return extendedKey != nullptr;
+}
+
+CryptoKernel::HDKey CryptoKernel::Wallet::Account::getExtendedKey() const {
+    if(!extendedKey) {
+        throw WalletException("Account is not HD");
+    }
+
+    return *extendedKey;
+}
+
+uint32_t CryptoKernel::Wallet::Account::getHDIndex() const {
+    return hdIndex;
+}
+
+uint32_t CryptoKernel::Wallet::Account::getNextChild() const {
+    return nextChild;
+}
+
+void CryptoKernel::Wallet::Account::setNextChild(const uint32_t nextChild) {
+    this->nextChild = nextChild;
+}
+
 void CryptoKernel::Wallet::Account::addKeyPair(const keyPair& kp) {
     keys.insert(kp);
 }
@@ -499,16 +708,19 @@ const {
     return getName() < rhs.getName();
 }
 
-CryptoKernel::Wallet::Txo::Txo(const std::string& id, const uint64_t value) {
+CryptoKernel::Wallet::Txo::Txo(const std::string& id, const uint64_t value,
+                               const bool watchOnly) {
     this->id = id;
     this->spent = false;
     this->value = value;
+    this->watchOnly = watchOnly;
 }
 
 CryptoKernel::Wallet::Txo::Txo(const Json::Value& txoJson) {
     id = txoJson["id"].asString();
     spent = txoJson["spent"].asBool();
     value = txoJson["value"].asUInt64();
+    watchOnly = txoJson["watchOnly"].asBool();
 }
 
 Json::Value CryptoKernel::Wallet::Txo::toJson() const {
@@ -517,6 +729,9 @@ Json::Value CryptoKernel::Wallet::Txo::toJson() const {
     returning["id"] = id;
     returning["spent"] = spent;
     returning["value"] = value;
+    if(watchOnly) {
+        returning["watchOnly"] = true;
+    }
 
     return returning;
 }
@@ -529,6 +744,10 @@ bool CryptoKernel::Wallet::Txo::isSpent() const {
     return spent;
 }
 
+bool CryptoKernel::Wallet::Txo::isWatchOnly() const {
+    return watchOnly;
+}
+
 uint64_t CryptoKernel::Wallet::Txo::getValue() const {
     return value;
 }
@@ -576,10 +795,12 @@ CryptoKernel::Wallet::Account CryptoKernel::Wallet::newAccount(const std::string
         }
 
         const Account acc = Account(name, password);
+        addToKeyFilter(std::vector<std::string>{(*acc.getKeys().begin()).pubKey});
+
         std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
         accounts->put(dbTx.get(), name, acc.toJson());
         accounts->put(dbTx.get(), (*acc.getKeys().begin()).pubKey, name, 0);
-        dbTx->commit();
+        commitKeys(dbTx.get());
         return acc;
     }
 
@@ -588,131 +809,252 @@ CryptoKernel::Wallet::Account CryptoKernel::Wallet::newAccount(const std::string
 
 std::string CryptoKernel::Wallet::sendToAddress(const std::string& pubKey,
         const uint64_t amount, const std::string& password) {
+    try {
+        return sendMany({{pubKey, amount}}, password).front();
+    } catch(const WalletException& e) {
+        return e.what();
+    }
+}
+
+std::vector<std::string> CryptoKernel::Wallet::sendMany(const std::map<std::string, uint64_t>&
+        payments, const std::string& password) {
     std::lock_guard<std::recursive_mutex> lock(walletLock);
     std::unique_ptr<CryptoKernel::Storage::Transaction> bchainTx(blockchain->getTxHandle());
 
     if(!checkPassword(password)) {
-        return "Incorrect wallet password";
+        throw WalletException("Incorrect wallet password");
     }
 
-    if(getTotalBalance() * 100000000 < amount) {
-        return "Insufficient funds";
+    if(payments.empty()) {
+        throw WalletException("No payments given");
     }
 
+    std::uniform_int_distribution<uint64_t> distribution(0,
+            std::numeric_limits<uint64_t>::max());
+
+    // Transaction::checkRep rejects anything larger than this, so the
+    // payments are split up front using upper bounds on the size each
+    // output and input adds once serialized
+    const size_t maxSize = 100 * 1024;
+    const size_t baseSize = 512;
+
+    Json::Value placeholder;
+    placeholder["signature"] = std::string(96, 'A');
+
+    std::vector<CryptoKernel::Blockchain::output> toThem;
+    std::vector<size_t> outputSizes;
+    std::vector<uint64_t> outputFees;
+    uint64_t total = 0;
+
     CryptoKernel::Crypto crypto;
-    if(!crypto.setPublicKey(pubKey)) {
-        return "Invalid address";
+    for(const auto& payment : payments) {
+        if(!crypto.setPublicKey(payment.first)) {
+            throw WalletException("Invalid address");
+        }
+
+        if(payment.second == 0 || total + payment.second < total) {
+            throw WalletException("Invalid amount");
+        }
+        total += payment.second;
+
+        Json::Value data;
+        data["publicKey"] = payment.first;
+
+        toThem.push_back(CryptoKernel::Blockchain::output(payment.second,
+                         distribution(generator), data));
+        outputSizes.push_back(CryptoKernel::Storage::toString(toThem.back().toJson()).size() + 1);
+        outputFees.push_back(CryptoKernel::Storage::toString(data).size() * 60);
     }
 
-    std::set<CryptoKernel::Blockchain::output> toSpend;
-    uint64_t accumulator = 0;
-    uint64_t fee = 15000;
+    if(getTotalBalance() < total) {
+        throw WalletException("Insufficient funds");
+    }
 
-    CryptoKernel::Storage::Table::Iterator* it = new CryptoKernel::Storage::Table::Iterator(
-        utxos.get(), walletdb.get());
-    for(it->SeekToFirst(); it->Valid(); it->Next()) {
+    // The base fee covers the first payment and the change, each further
+    // payment adds to it the same way inputs do
+    struct Batch {
+        size_t begin;
+        size_t end;
+        size_t size;
+        uint64_t amount;
+        uint64_t fee;
+        uint64_t accumulator;
+        std::set<CryptoKernel::Blockchain::output> toSpend;
+    };
+
+    const auto startBatch = [&](const size_t begin) {
+        Batch batch;
+        batch.begin = begin;
+        batch.end = begin;
+        batch.size = baseSize;
+        batch.amount = 0;
+        batch.fee = 15000;
+        batch.accumulator = 0;
+
+        while(batch.end < toThem.size() && batch.size + outputSizes[batch.end] <= maxSize) {
+            if(batch.end > batch.begin) {
+                batch.fee += outputFees[batch.end];
+            }
+            batch.size += outputSizes[batch.end];
+            batch.amount += toThem[batch.end].getValue();
+            batch.end++;
+        }
+
+        return batch;
+    };
+
+    std::vector<Batch> batches;
+    Batch batch = startBatch(0);
+    uint64_t feeTotal = 0;
+    bool funded = false;
+
+    std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+            CryptoKernel::Storage::Table::Iterator(utxos.get(), walletdb.get()));
+    for(it->SeekToFirst(); it->Valid() && !funded; it->Next()) {
         const Txo out = Txo(it->value());
-        if(accumulator < amount + fee) {
-            if(!out.isSpent()) {
-                try {
-                    const CryptoKernel::Blockchain::output fullOut = blockchain->getOutput(bchainTx.get(),
-                            it->key());
-                    if(fullOut.getData()["contract"].isNull()) {
-                        fee += CryptoKernel::Storage::toString(fullOut.getData()).size() * 60;
-                        toSpend.insert(fullOut);
-                        accumulator += fullOut.getValue();
-                    }
-                } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
-                    continue;
+        if(out.isSpent() || out.isWatchOnly()) {
+            continue;
+        }
+
+        try {
+            const CryptoKernel::Blockchain::output fullOut = blockchain->getOutput(bchainTx.get(),
+                    it->key());
+            if(!fullOut.getData()["contract"].isNull()) {
+                continue;
+            }
+
+            const size_t inputSize = CryptoKernel::Storage::toString(
+                                         CryptoKernel::Blockchain::input(fullOut.getId(),
+                                                 placeholder).toJson()).size() + 1;
+
+            // Make room for the input by leaving payments to the next
+            // transaction
+            while(batch.size + inputSize > maxSize && batch.end - batch.begin > 1) {
+                batch.end--;
+                batch.size -= outputSizes[batch.end];
+                batch.amount -= toThem[batch.end].getValue();
+                batch.fee -= outputFees[batch.end];
+            }
+
+            if(batch.size + inputSize > maxSize) {
+                throw WalletException("Payment needs too many inputs to fit in a transaction");
+            }
+
+            batch.fee += CryptoKernel::Storage::toString(fullOut.getData()).size() * 60;
+            batch.size += inputSize;
+            batch.accumulator += fullOut.getValue();
+            batch.toSpend.insert(fullOut);
+
+            if(batch.accumulator >= batch.amount + batch.fee) {
+                feeTotal += batch.fee;
+                batches.push_back(batch);
+
+                if(batch.end == toThem.size()) {
+                    funded = true;
+                } else {
+                    batch = startBatch(batch.end);
                 }
             }
-        } else {
-            break;
+        } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+            continue;
         }
     }
-    delete it;
+    it.reset();
 
-    if(accumulator < amount + fee) {
-        return "Insufficient funds when " + std::to_string(fee / 100000000.0) +
-               " fee is included";
+    if(!funded) {
+        throw WalletException("Insufficient funds when " +
+                              std::to_string((feeTotal + batch.fee) / 100000000.0) +
+                              " fee is included");
     }
 
-    std::uniform_int_distribution<uint64_t> distribution(0,
-            std::numeric_limits<uint64_t>::max());
-    Json::Value data;
-    data["publicKey"] = pubKey;
-
-    const CryptoKernel::Blockchain::output toThem = CryptoKernel::Blockchain::output(amount,
-            distribution(generator), data);
-
     std::stringstream buffer;
     buffer << distribution(generator) << "_change";
     const Account account = newAccount(buffer.str(), password);
 
-    data.clear();
-    data["publicKey"] = (*(account.getKeys().begin())).pubKey;
-
-    const CryptoKernel::Blockchain::output change = CryptoKernel::Blockchain::output(
-                accumulator - amount - fee, distribution(generator), data);
+    Json::Value changeData;
+    changeData["publicKey"] = (*(account.getKeys().begin())).pubKey;
 
-    std::set<CryptoKernel::Blockchain::output> outputs;
-    outputs.insert(change);
-    outputs.insert(toThem);
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
 
-    const std::string outputHash = CryptoKernel::Blockchain::transaction::getOutputSetId(
-                                       outputs).toString();
+    // Each key is decrypted once however many of its outputs are spent
+    std::map<std::string, std::string> privKeys;
+    std::unique_ptr<HDKey> seedKey;
 
-    std::set<CryptoKernel::Blockchain::input> spends;
+    const uint64_t now = static_cast<uint64_t>(std::time(0));
 
-    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    std::vector<CryptoKernel::Blockchain::transaction> txs;
+    for(const Batch& planned : batches) {
+        std::set<CryptoKernel::Blockchain::output> outputs(toThem.begin() + planned.begin,
+                toThem.begin() + planned.end);
+
+        const uint64_t change = planned.accumulator - planned.amount - planned.fee;
+        if(change > 0) {
+            outputs.insert(CryptoKernel::Blockchain::output(change, distribution(generator),
+                           changeData));
+        }
 
-    for(const CryptoKernel::Blockchain::output& out : toSpend) {
-        const std::string publicKey = out.getData()["publicKey"].asString();
-        Account acc = getAccountByKey(dbTx.get(), publicKey);
+        const std::string outputHash = CryptoKernel::Blockchain::transaction::getOutputSetId(
+                                           outputs).toString();
 
-        std::string privKey = "";
+        std::set<CryptoKernel::Blockchain::input> spends;
+        for(const CryptoKernel::Blockchain::output& out : planned.toSpend) {
+            const std::string publicKey = out.getData()["publicKey"].asString();
 
-        for(const auto& key : acc.getKeys()) {
-            if(key.pubKey == publicKey) {
-                privKey = key.privKey->decrypt(password);
-                break;
+            auto privKey = privKeys.find(publicKey);
+            if(privKey == privKeys.end()) {
+                const Account acc = getAccountByKey(dbTx.get(), publicKey);
+                privKey = privKeys.insert(std::make_pair(publicKey,
+                                          getPrivateKey(dbTx.get(), acc, publicKey, password,
+                                                  seedKey))).first;
             }
-        }
 
-        crypto.setPrivateKey(privKey);
+            crypto.setPrivateKey(privKey->second);
 
-        const std::string signature = crypto.sign(out.getId().toString() + outputHash);
-        Json::Value spendData;
-        spendData["signature"] = signature;
+            Json::Value spendData;
+            spendData["signature"] = crypto.sign(out.getId().toString() + outputHash);
 
-        const CryptoKernel::Blockchain::input inp = CryptoKernel::Blockchain::input(out.getId(),
-                spendData);
-        spends.insert(inp);
+            spends.insert(CryptoKernel::Blockchain::input(out.getId(), spendData));
+        }
 
-        Txo utxo = Txo(utxos->get(dbTx.get(), out.getId().toString()));
-        utxo.spend();
-        utxos->put(dbTx.get(), out.getId().toString(), utxo.toJson());
+        txs.push_back(CryptoKernel::Blockchain::transaction(spends, outputs, now));
     }
 
-    const time_t t = std::time(0);
-    const uint64_t now = static_cast<uint64_t> (t);
+    bchainTx->abort();
 
-    const CryptoKernel::Blockchain::transaction tx = CryptoKernel::Blockchain::transaction(
-                spends, outputs, now);
+    // Outputs are only marked spent once the transaction spending them is
+    // accepted, so a rejection part way leaves the rest spendable
+    std::vector<CryptoKernel::Blockchain::transaction> sent;
+    std::vector<std::string> ids;
+    for(const CryptoKernel::Blockchain::transaction& tx : txs) {
+        if(!std::get<0>(blockchain->submitTransaction(tx))) {
+            break;
+        }
 
-    bchainTx->abort();
+        for(const CryptoKernel::Blockchain::input& inp : tx.getInputs()) {
+            Txo utxo = Txo(utxos->get(dbTx.get(), inp.getOutputId().toString()));
+            utxo.spend();
+            utxos->put(dbTx.get(), inp.getOutputId().toString(), utxo.toJson());
+        }
 
-    if(!std::get<0>(blockchain->submitTransaction(tx))) {
-        return "Error submitting transaction";
+        sent.push_back(tx);
+        ids.push_back(tx.getId().toString());
+    }
+
+    if(sent.empty()) {
+        throw WalletException("Error submitting transaction");
     }
 
     dbTx->commit();
 
-    std::vector<CryptoKernel::Blockchain::transaction> txs;
-    txs.push_back(tx);
-    network->broadcastTransactions(txs);
+    network->broadcastTransactions(sent);
 
-    return tx.getId().toString();
+    if(sent.size() < txs.size()) {
+        throw PartialSendException("Error submitting transaction after sending " +
+                                   std::to_string(sent.size()) + " of " +
+                                   std::to_string(txs.size()), ids);
+    }
+
+    return ids;
 }
 
 uint64_t CryptoKernel::Wallet::getTotalBalance() {
@@ -724,7 +1066,7 @@ uint64_t CryptoKernel::Wallet::getTotalBalance() {
 
     for(it->SeekToFirst(); it->Valid(); it->Next()) {
         const Txo utxo = Txo(it->value());
-        if(!utxo.isSpent()) {
+        if(!utxo.isSpent() && !utxo.isWatchOnly()) {
             total += utxo.getValue();
         }
     }
@@ -790,6 +1132,9 @@ CryptoKernel::Wallet::signTransaction(const CryptoKernel::Blockchain::transactio
 
     std::set<CryptoKernel::Blockchain::input> newInputs;
 
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    std::unique_ptr<HDKey> seedKey;
+
     for(const CryptoKernel::Blockchain::input& input : tx.getInputs()) {
         // Look up UTXO to get publicKey
         Json::Value outputData;
@@ -800,18 +1145,13 @@ CryptoKernel::Wallet::signTransaction(const CryptoKernel::Blockchain::transactio
             return tx;
         }
 
-        const Account acc = getAccountByKey(outputData["publicKey"].asString());
-
-        std::string privKey = "";
-
-        for(const auto& key : acc.getKeys()) {
-            if(key.pubKey == outputData["publicKey"].asString()) {
-                privKey = key.privKey->decrypt(password);
-                break;
-            }
+        const Account acc = getAccountByKey(dbTx.get(), outputData["publicKey"].asString());
+        if(acc.isWatchOnly()) {
+            throw WalletException("Output belongs to a watch-only account");
         }
 
-        crypto.setPrivateKey(privKey);
+        crypto.setPrivateKey(getPrivateKey(dbTx.get(), acc, outputData["publicKey"].asString(),
+                                           password, seedKey));
         const std::string signature = crypto.sign(input.getOutputId().toString() + outputHash);
         Json::Value spendData = input.getData();
         spendData["signature"] = signature;
@@ -833,13 +1173,6 @@ CryptoKernel::Wallet::importPrivKey(const std::string& name, const std::string&
         throw WalletException("Incorrect wallet password");
     }
 
-    bool accountExists = false;
-
-    try {
-        const Account acc = getAccountByName(name);
-        accountExists = true;
-    } catch(const WalletException& e) {}
-
     CryptoKernel::Crypto crypto;
     if(!crypto.setPrivateKey(privKey)) {
         throw WalletException("Invalid private key");
@@ -848,29 +1181,290 @@ CryptoKernel::Wallet::importPrivKey(const std::string& name, const std::string&
     try {
         const Account acc = getAccountByKey(crypto.getPublicKey());
     } catch(const WalletException& e) {
+        return importPrivKeys(name, std::vector<std::string>{privKey}, password);
+    }
+
+    throw WalletException("Private key already in wallet");
+}
+
+CryptoKernel::Wallet::Account
+CryptoKernel::Wallet::importPrivKeys(const std::string& name,
+                                     const std::vector<std::string>& privKeys,
+                                     const std::string& password) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    if(!checkPassword(password)) {
+        throw WalletException("Incorrect wallet password");
+    }
+
+    std::vector<Account::keyPair> newKeys;
+    std::set<std::string> newPubKeys;
+    for(const std::string& privKey : privKeys) {
+        CryptoKernel::Crypto crypto;
+        try {
+            if(!crypto.setPrivateKey(privKey)) {
+                throw WalletException("Invalid private key");
+            }
+        } catch(const std::runtime_error& e) {
+            throw WalletException("Invalid private key");
+        }
+
+        const std::string pubKey = crypto.getPublicKey();
+        if(newPubKeys.count(pubKey) > 0) {
+            continue;
+        }
+
+        try {
+            getAccountByKey(pubKey);
+            continue;
+        } catch(const WalletException& e) {}
+
         Account::keyPair kp;
         kp.privKey.reset(new AES256(password, crypto.getPrivateKey()));
-        kp.pubKey = crypto.getPublicKey();
+        kp.pubKey = pubKey;
 
-        if(!accountExists) {
-            newAccount(name, password);
-        }
+        newKeys.push_back(kp);
+        newPubKeys.insert(pubKey);
+    }
+
+    bool watchOnly = false;
+    try {
+        watchOnly = getAccountByName(name).isWatchOnly();
+    } catch(const WalletException& e) {
+        newAccount(name, password);
+    }
+
+    if(watchOnly) {
+        throw WalletException("Account is watch-only");
+    }
+
+    addToKeyFilter(std::vector<std::string>(newPubKeys.begin(), newPubKeys.end()));
 
-        Account acc = getAccountByName(name);
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> bchainTx(blockchain->getTxHandle());
+
+    // Catch up with the chain first, so the key index and the wallet
+    // describe the same blocks
+    syncToTip(dbTx, bchainTx.get());
+
+    Account acc = Account(accounts->get(dbTx.get(), name));
+    for(const Account::keyPair& kp : newKeys) {
         acc.addKeyPair(kp);
+        accounts->put(dbTx.get(), kp.pubKey, name, 0);
+    }
+    accounts->put(dbTx.get(), name, acc.toJson());
+
+    if(!newPubKeys.empty()) {
+        rescanKeys(dbTx.get(), bchainTx.get(), newPubKeys);
+    }
+
+    const Account returning = Account(accounts->get(dbTx.get(), name));
+
+    bchainTx->abort();
+    commitKeys(dbTx.get());
 
+    return returning;
+}
+
+CryptoKernel::Wallet::Account
+CryptoKernel::Wallet::watchAddresses(const std::string& name,
+                                     const std::vector<std::string>& pubKeys) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    // Addresses that aren't valid keys can never be paid, so there is no
+    // need to decode millions of them up front
+    bool accountExists = false;
+    std::set<std::string> newPubKeys;
+    {
         std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
-        accounts->put(dbTx.get(), name, acc.toJson());
-        accounts->put(dbTx.get(), kp.pubKey, name, 0);
-        dbTx->commit();
+        const Json::Value accountJson = accounts->get(dbTx.get(), name);
+        if(accountJson.isObject()) {
+            if(!Account(accountJson).isWatchOnly()) {
+                throw WalletException("Account is not watch-only");
+            }
+            accountExists = true;
+        }
 
-        // Rescan
-        clearDB();
+        for(const std::string& pubKey : pubKeys) {
+            if(!pubKey.empty() && accounts->get(dbTx.get(), pubKey, 0).isNull()) {
+                newPubKeys.insert(pubKey);
+            }
+        }
+    }
 
-        return acc;
+    addToKeyFilter(std::vector<std::string>(newPubKeys.begin(), newPubKeys.end()));
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    std::unique_ptr<CryptoKernel::Storage::Transaction> bchainTx(blockchain->getTxHandle());
+
+    syncToTip(dbTx, bchainTx.get());
+
+    if(!accountExists) {
+        Json::Value accountJson;
+        accountJson["name"] = name;
+        accountJson["balance"] = 0;
+        accountJson["watchOnly"] = true;
+        accounts->put(dbTx.get(), name, accountJson);
     }
 
-    throw WalletException("Private key already in wallet");
+    for(const std::string& pubKey : newPubKeys) {
+        accounts->put(dbTx.get(), pubKey, name, 0);
+    }
+
+    if(!newPubKeys.empty()) {
+        rescanKeys(dbTx.get(), bchainTx.get(), newPubKeys);
+    }
+
+    const Account returning = Account(accounts->get(dbTx.get(), name));
+
+    bchainTx->abort();
+    commitKeys(dbTx.get());
+
+    return returning;
+}
+
+CryptoKernel::Wallet::Account
+CryptoKernel::Wallet::newHDAccount(const std::string& name, const std::string& password) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    if(!checkPassword(password)) {
+        throw WalletException("Incorrect wallet password");
+    }
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    if(!accounts->get(dbTx.get(), name).isNull()) {
+        throw WalletException("Account already exists");
+    }
+
+    std::string seed;
+    const Json::Value seedJson = params->get(dbTx.get(), "hdSeed");
+    if(seedJson.isNull()) {
+        unsigned char bytes[32];
+        if(!RAND_bytes(bytes, sizeof(bytes))) {
+            throw std::runtime_error("Could not generate random seed");
+        }
+        seed = std::string((char*)bytes, sizeof(bytes));
+
+        const std::string encoded = base64_encode(bytes, sizeof(bytes));
+        params->put(dbTx.get(), "hdSeed", AES256(password, encoded).toJson());
+    } else {
+        seed = base64_decode(AES256(seedJson).decrypt(password));
+    }
+
+    const HDKey master = HDKey::fromSeed(seed);
+
+    // Accounts take hardened children so one leaked address key can't
+    // expose the seed or the other accounts
+    uint32_t index = params->get(dbTx.get(), "hdAccounts").asUInt();
+    std::unique_ptr<HDKey> accountKey;
+    while(!accountKey) {
+        if(index >= HDKey::HARDENED) {
+            throw WalletException("No more HD accounts can be made");
+        }
+
+        // Only derivation may move on to the next index, BIP32 skips the
+        // rare index that gives an invalid key
+        try {
+            accountKey.reset(new HDKey(master.derive(HDKey::HARDENED + index)));
+        } catch(const std::runtime_error& e) {
+            index++;
+        }
+    }
+
+    const Account acc = Account(name, *accountKey, index);
+    params->put(dbTx.get(), "hdAccounts", Json::Value(index + 1));
+    accounts->put(dbTx.get(), name, acc.toJson());
+    commitKeys(dbTx.get());
+
+    return acc;
+}
+
+std::vector<std::string> CryptoKernel::Wallet::newAddresses(const std::string& name,
+        const uint64_t count) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    Account acc = getAccountByName(name);
+    const HDKey extendedKey = acc.getExtendedKey();
+
+    std::vector<std::string> pubKeys;
+    std::vector<uint32_t> children;
+    uint32_t child = acc.getNextChild();
+    while(pubKeys.size() < count) {
+        if(child >= HDKey::HARDENED) {
+            throw WalletException("Account has no more addresses");
+        }
+
+        // BIP32 skips the odd index that gives an invalid key
+        try {
+            pubKeys.push_back(extendedKey.derive(child).getPublicKey());
+            children.push_back(child);
+        } catch(const std::runtime_error& e) {}
+
+        child++;
+    }
+
+    addToKeyFilter(pubKeys);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(walletdb->begin());
+    for(size_t i = 0; i < pubKeys.size(); i++) {
+        accounts->put(dbTx.get(), pubKeys[i], name, 0);
+        hdKeys->put(dbTx.get(), pubKeys[i], Json::Value(children[i]));
+    }
+
+    acc.setNextChild(child);
+    accounts->put(dbTx.get(), name, acc.toJson());
+    commitKeys(dbTx.get());
+
+    return pubKeys;
+}
+
+std::string CryptoKernel::Wallet::getPrivateKey(CryptoKernel::Storage::Transaction* dbTx,
+        const Account& acc, const std::string& pubKey, const std::string& password,
+        std::unique_ptr<HDKey>& seedKey) {
+    const Json::Value child = hdKeys->get(dbTx, pubKey);
+    if(acc.isHD() && !child.isNull()) {
+        if(!seedKey) {
+            const AES256 seed(params->get(dbTx, "hdSeed"));
+            seedKey.reset(new HDKey(HDKey::fromSeed(base64_decode(seed.decrypt(password)))));
+        }
+
+        return seedKey->derive(HDKey::HARDENED + acc.getHDIndex()).derive(
+                   child.asUInt()).getPrivateKey();
+    }
+
+    for(const auto& key : acc.getKeys()) {
+        if(key.pubKey == pubKey) {
+            return key.privKey->decrypt(password);
+        }
+    }
+
+    throw WalletException("Could not find key for " + pubKey);
+}
+
+void CryptoKernel::Wallet::addToKeyFilter(const std::vector<std::string>& pubKeys) {
+    std::lock_guard<std::recursive_mutex> lock(walletLock);
+
+    if(!keyFilter || keyFilter->size() + pubKeys.size() > keyFilter->capacity()) {
+        // A Bloom filter can't grow, so build a bigger one from the public
+        // key index. Must not be called with a wallet transaction open.
+        size_t indexedKeys = 0;
+        std::unique_ptr<CryptoKernel::Storage::Table::Iterator> it(new
+                CryptoKernel::Storage::Table::Iterator(accounts.get(), walletdb.get(), 0));
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            indexedKeys++;
+        }
+
+        keyFilter.reset(new BloomFilter(std::max<size_t>((indexedKeys + pubKeys.size()) * 2,
+                                                         1024), 0.01));
+
+        for(it->SeekToFirst(); it->Valid(); it->Next()) {
+            keyFilter->insert(it->key());
+        }
+    }
+
+    for(const std::string& pubKey : pubKeys) {
+        keyFilter->insert(pubKey);
+    }
 }
 
 // This portion of code is from the following article: http://www.cplusplus.com/articles/E6vU7k9E/
@@ -32,16 +32,42 @@
 #include "blockchain.h"
 #include "network.h"
 #include "crypto.h"
+#include "bloomfilter.h"
 
 #define LATEST_WALLET_SCHEMA 2
 
 namespace CryptoKernel {
 class Wallet {
 public:
+    /**
+    * When the wallet waits for its writes to reach the disk. Outputs,
+    * balances and transactions can all be rebuilt from the chain, so losing
+    * the last few writes to them in a crash only means digesting a few
+    * blocks again. Keys, addresses handed out and the passphrase check
+    * can't be rebuilt.
+    */
+    enum SyncPolicy {
+        // fsync every write
+        SYNC_ALWAYS,
+        // fsync only writes of state that can't be rebuilt from the chain
+        SYNC_KEYS,
+        // leave flushing to the OS
+        SYNC_NEVER
+    };
+
+    /**
+    * Opens the wallet stored in dbDir, creating it if needed
+    *
+    * @param watch whether the wallet follows the chain from its own
+    *        thread. A WalletManager passes false and feeds it blocks instead.
+    * @param syncPolicy when the wallet's writes are fsynced
+    */
     Wallet(CryptoKernel::Blockchain* blockchain,
            CryptoKernel::Network* network,
            CryptoKernel::Log* log,
-           const std::string& dbDir);
+           const std::string& dbDir,
+           const bool watch = true,
+           const SyncPolicy syncPolicy = SYNC_KEYS);
 
     ~Wallet();
 
@@ -59,11 +85,40 @@ public:
         std::string message;
     };
 
+    /**
+    * Thrown by sendMany when a transaction is rejected after some of the
+    * others were already sent, carrying the ids of those that were
+    */
+    class PartialSendException : public WalletException {
+    public:
+        PartialSendException(const std::string& message, const std::vector<std::string>& sent) :
+            WalletException(message) {
+            this->sent = sent;
+        }
+
+        const std::vector<std::string>& getSent() const {
+            return sent;
+        }
+
+    private:
+        std::vector<std::string> sent;
+    };
+
     class Account {
     public:
         Account(const std::string& name, const std::string& password);
         Account(const Json::Value& accountJson);
 
+        /**
+        * Constructs an HD account from its extended key, of which only the
+        * public half is kept
+        *
+        * @param name the account's name
+        * @param extendedKey the key addresses are derived from
+        * @param index the account's index under the wallet seed
+        */
+        Account(const std::string& name, const HDKey& extendedKey, const uint32_t index);
+
         Json::Value toJson() const;
 
         struct keyPair {
@@ -88,15 +143,55 @@ public:
 
         uint64_t getBalance() const;
 
+        /**
+        * Returns whether this account only follows addresses it has no keys
+        * for. Such an account's addresses are kept in the wallet's public
+        * key index rather than in the account itself.
+        *
+        * @return true if the account is watch-only, false otherwise
+        */
+        bool isWatchOnly() const;
+
+        /**
+        * Returns whether the account derives its keys from the wallet seed.
+        * Like a watch-only account's, its addresses are kept in the
+        * wallet's public key index rather than in the account itself.
+        *
+        * @return true if the account is HD, false otherwise
+        */
+        bool isHD() const;
+
+        /**
+        * Returns the public extended key the account's addresses derive from
+        *
+        * @return the extended key
+        * @throw WalletException if the account is not HD
+        */
+        HDKey getExtendedKey() const;
+
+        uint32_t getHDIndex() const;
+
+        /**
+        * Returns the child index the account's next address derives from
+        *
+        * @return the next child index
+        */
+        uint32_t getNextChild() const;
+        void setNextChild(const uint32_t nextChild);
+
     private:
         std::set<keyPair> keys;
         std::string name;
         uint64_t balance;
+        bool watchOnly;
+        std::shared_ptr<HDKey> extendedKey;
+        uint32_t hdIndex;
+        uint32_t nextChild;
     };
 
     class Txo {
     public:
-        Txo(const std::string& id, const uint64_t value);
+        Txo(const std::string& id, const uint64_t value, const bool watchOnly = false);
         Txo(const Json::Value& txoJson);
 
         Json::Value toJson() const;
@@ -106,10 +201,19 @@ public:
 
         uint64_t getValue() const;
 
+        /**
+        * Returns whether the output belongs to a watch-only account, so
+        * can't be spent by this wallet
+        *
+        * @return true if the output is watch-only, false otherwise
+        */
+        bool isWatchOnly() const;
+
     private:
         std::string id;
         bool spent;
         uint64_t value;
+        bool watchOnly;
     };
 
     Account getAccountByName(const std::string& name);
@@ -119,10 +223,84 @@ public:
     Account importPrivKey(const std::string& name, const std::string& privKey,
                           const std::string& password);
 
+    /**
+    * Imports many private keys into an account at once. Rather than
+    * rescanning the whole chain, the wallet looks up the new keys in the
+    * chain's public key index and only digests blocks from the first one
+    * they appear in, leaving the rest of the wallet as it is.
+    *
+    * @param name the account to add the keys to, created if it does not exist
+    * @param privKeys the private keys to import. Keys already in the wallet
+    *        are skipped.
+    * @param password the wallet passphrase
+    * @return the account the keys were added to
+    * @throw WalletException if the password or any of the keys is invalid
+    */
+    Account importPrivKeys(const std::string& name, const std::vector<std::string>& privKeys,
+                           const std::string& password);
+
+    /**
+    * Follows addresses without their private keys. Payments to them count
+    * toward a watch-only account's balance and show up in its transactions,
+    * but are never spent or counted by getTotalBalance. Past payments are
+    * found the same way as for importPrivKeys.
+    *
+    * @param name the watch-only account to add the addresses to, created
+    *        if it does not exist
+    * @param pubKeys the addresses to follow. Addresses already in the
+    *        wallet are skipped.
+    * @return the account the addresses were added to
+    * @throw WalletException if the account exists and is not watch-only
+    */
+    Account watchAddresses(const std::string& name, const std::vector<std::string>& pubKeys);
+
+    /**
+    * Creates an account whose keys all derive from the wallet seed, which
+    * is generated the first time one is made. Backing up the seed backs up
+    * every address of every HD account.
+    *
+    * @param name the name of the new account
+    * @param password the wallet passphrase
+    * @return the new account
+    * @throw WalletException if the account exists or the password is wrong
+    */
+    Account newHDAccount(const std::string& name, const std::string& password);
+
+    /**
+    * Derives fresh addresses for an HD account from its public key. There
+    * is no private key to encrypt, so no passphrase is needed and
+    * thousands can be handed out a second.
+    *
+    * @param name the HD account
+    * @param count how many addresses to derive
+    * @return the new addresses, in derivation order
+    * @throw WalletException if the account does not exist or is not HD
+    */
+    std::vector<std::string> newAddresses(const std::string& name, const uint64_t count);
+
     std::string sendToAddress(const std::string& pubKey,
                               const uint64_t amount,
                               const std::string& password);
 
+    /**
+    * Pays many addresses at once. Coins are selected once for all of the
+    * payments, which go into as few transactions as fit within the
+    * transaction size limit, each with a single change output. The
+    * transactions are submitted together and broadcast in one go.
+    *
+    * @param payments map of address to amount to pay it, in the smallest
+    *        unit of the coin
+    * @param password the wallet password
+    * @return the ids of the transactions sent, in the order the payments
+    *         were split between them
+    * @throw PartialSendException if a transaction is rejected after others
+    *        were sent, holding the ids of those sent
+    * @throw WalletException if the password is wrong, an address or amount
+    *        is invalid, funds are short or the first transaction is rejected
+    */
+    std::vector<std::string> sendMany(const std::map<std::string, uint64_t>& payments,
+                                      const std::string& password);
+
     uint64_t getTotalBalance();
 
     std::set<Account> listAccounts();
@@ -133,11 +311,15 @@ public:
             CryptoKernel::Blockchain::transaction& tx, const std::string& password);
 
 private:
+    friend class WalletManager;
+
     std::unique_ptr<CryptoKernel::Storage> walletdb;
     std::unique_ptr<CryptoKernel::Storage::Table> accounts;
     std::unique_ptr<CryptoKernel::Storage::Table> utxos;
     std::unique_ptr<CryptoKernel::Storage::Table> transactions;
     std::unique_ptr<CryptoKernel::Storage::Table> params;
+    // Public key to child index for the keys of HD accounts
+    std::unique_ptr<CryptoKernel::Storage::Table> hdKeys;
 
     CryptoKernel::Blockchain* blockchain;
     CryptoKernel::Network* network;
@@ -150,6 +332,33 @@ private:
     void watchFunc();
     bool running;
 
+    void syncToTip(std::unique_ptr<CryptoKernel::Storage::Transaction>& walletTx,
+                   CryptoKernel::Storage::Transaction* bchainTx);
+
+    void rewindForks(std::unique_ptr<CryptoKernel::Storage::Transaction>& walletTx,
+                     CryptoKernel::Storage::Transaction* bchainTx);
+
+    /**
+    * Brings the wallet up to date from blocks the caller has already read,
+    * so several wallets can share one pass over the chain. Forks are
+    * rewound first and blocks that don't follow on from the wallet's
+    * height are skipped. Digesting stops at the first block that is no
+    * longer on the main chain, so the blocks may be read under an earlier
+    * chain handle.
+    *
+    * @param blocks consecutive main chain blocks, lowest first
+    * @param unconfirmedTxs mempool transactions to check once the blocks
+    *        are digested
+    * @return the height the wallet is synced to
+    */
+    uint64_t digestBlocks(CryptoKernel::Storage::Transaction* bchainTx,
+                          const std::vector<CryptoKernel::Blockchain::block>& blocks,
+                          const std::set<CryptoKernel::Blockchain::transaction>& unconfirmedTxs);
+
+    void rescanKeys(CryptoKernel::Storage::Transaction* walletTx,
+                    CryptoKernel::Storage::Transaction* bchainTx,
+                    const std::set<std::string>& pubKeys);
+
     void rewindBlock(CryptoKernel::Storage::Transaction* walletTx,
                      CryptoKernel::Storage::Transaction* bchainTx);
 
@@ -164,13 +373,23 @@ private:
     void digestTx(const CryptoKernel::Blockchain::transaction& tx,
                      CryptoKernel::Storage::Transaction* walletTx,
                      CryptoKernel::Storage::Transaction* bchainTx,
-                     const bool unconfirmed = false);
+                     const bool unconfirmed = false,
+                     const std::set<std::string>* onlyKeys = nullptr);
 
     std::recursive_mutex walletLock;
 
     Account getAccountByKey(CryptoKernel::Storage::Transaction* dbTx,
                             const std::string& pubKey);
 
+    /**
+    * Every public key in the wallet, so digesting a block can rule out
+    * almost all of its outputs without touching the database. Sized for
+    * twice the keys it was built with and rebuilt when that fills up.
+    */
+    std::unique_ptr<BloomFilter> keyFilter;
+
+    void addToKeyFilter(const std::vector<std::string>& pubKeys);
+
     void clearDB();
 
     uint64_t schemaVersion;
@@ -178,6 +397,25 @@ private:
     void upgradeWallet();
 
     bool checkPassword(const std::string& password);
+
+    SyncPolicy syncPolicy;
+
+    /**
+    * Commits a write of state that can't be rebuilt from the chain, such
+    * as new keys, fsyncing it unless the sync policy is SYNC_NEVER
+    */
+    void commitKeys(CryptoKernel::Storage::Transaction* dbTx);
+
+    /**
+    * Returns the private key for one of an account's public keys. HD keys
+    * are derived from the wallet seed, which is decrypted on first use and
+    * kept in seedKey for the rest of the caller's operation.
+    *
+    * @throw WalletException if the key is not the account's
+    */
+    std::string getPrivateKey(CryptoKernel::Storage::Transaction* dbTx, const Account& acc,
+                              const std::string& pubKey, const std::string& password,
+                              std::unique_ptr<HDKey>& seedKey);
 };
 }
 
@@ -0,0 +1,142 @@
+#include <algorithm>
+
+#include "walletmanager.h"
+
+CryptoKernel::WalletManager::WalletManager(Blockchain* blockchain, Network* network,
+                                           Log* log, const Wallet::SyncPolicy syncPolicy) {
+    this->blockchain = blockchain;
+    this->network = network;
+    this->log = log;
+    this->syncPolicy = syncPolicy;
+
+    running = true;
+    watchThread.reset(new std::thread(&CryptoKernel::WalletManager::watchFunc, this));
+}
+
+CryptoKernel::WalletManager::~WalletManager() {
+    running = false;
+    watchThread->join();
+}
+
+CryptoKernel::Wallet* CryptoKernel::WalletManager::loadWallet(const std::string& name,
+        const std::string& dbDir) {
+    {
+        std::lock_guard<std::mutex> lock(walletsMutex);
+        if(wallets.find(name) != wallets.end()) {
+            throw Wallet::WalletException("Wallet " + name + " is already loaded");
+        }
+    }
+
+    // Opening may ask for a passphrase, so is done without holding up the
+    // watch thread
+    std::unique_ptr<Wallet> wallet(new Wallet(blockchain, network, log, dbDir, false, syncPolicy));
+    Wallet* loaded = wallet.get();
+
+    std::lock_guard<std::mutex> lock(walletsMutex);
+    if(!wallets.insert(std::make_pair(name, std::move(wallet))).second) {
+        throw Wallet::WalletException("Wallet " + name + " is already loaded");
+    }
+
+    log->printf(LOG_LEVEL_INFO, "WalletManager::loadWallet(): Loaded wallet " + name);
+
+    return loaded;
+}
+
+CryptoKernel::Wallet* CryptoKernel::WalletManager::getWallet(const std::string& name) {
+    std::lock_guard<std::mutex> lock(walletsMutex);
+    const auto it = wallets.find(name);
+    if(it == wallets.end()) {
+        throw Wallet::WalletException("Wallet " + name + " is not loaded");
+    }
+
+    return it->second.get();
+}
+
+std::vector<std::string> CryptoKernel::WalletManager::listWallets() {
+    std::lock_guard<std::mutex> lock(walletsMutex);
+    std::vector<std::string> names;
+    for(const auto& wallet : wallets) {
+        names.push_back(wallet.first);
+    }
+
+    return names;
+}
+
+void CryptoKernel::WalletManager::watchFunc() {
+    // Blocks held in memory at once while catching wallets up
+    const uint64_t batchSize = 100;
+
+    // Wallet calls take their wallet's lock before the chain's, so the same
+    // order is kept here. Only one wallet is locked at a time, and the chain
+    // only while that wallet digests, so calls to every other wallet and to
+    // the chain get through while a wallet catches up.
+    const auto digest = [&](Wallet* wallet, const std::vector<Blockchain::block>& blocks,
+                            const std::set<Blockchain::transaction>& unconfirmedTxs) {
+        std::lock_guard<std::recursive_mutex> lock(wallet->walletLock);
+        std::unique_ptr<Storage::Transaction> bchainTx(blockchain->getTxHandle());
+        const uint64_t height = wallet->digestBlocks(bchainTx.get(), blocks, unconfirmedTxs);
+        bchainTx->abort();
+        return height;
+    };
+
+    while(running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
+        std::vector<Wallet*> toSync;
+        {
+            std::lock_guard<std::mutex> lock(walletsMutex);
+            for(const auto& wallet : wallets) {
+                toSync.push_back(wallet.second.get());
+            }
+        }
+
+        if(toSync.empty()) {
+            continue;
+        }
+
+        // Rewind any forks first so every height is on the main chain
+        std::map<Wallet*, uint64_t> heights;
+        for(Wallet* wallet : toSync) {
+            heights[wallet] = digest(wallet, std::vector<Blockchain::block>(),
+                                     std::set<Blockchain::transaction>());
+        }
+
+        while(running) {
+            uint64_t height = heights.begin()->second;
+            for(const auto& walletHeight : heights) {
+                height = std::min(height, walletHeight.second);
+            }
+
+            // Read each block once and hand it to every wallet that needs it
+            std::vector<Blockchain::block> blocks;
+            {
+                std::unique_ptr<Storage::Transaction> bchainTx(blockchain->getTxHandle());
+                const uint64_t tipHeight = blockchain->getBlockDB(bchainTx.get(), "tip").getHeight();
+                while(height < tipHeight && blocks.size() < batchSize) {
+                    height++;
+                    blocks.push_back(blockchain->getBlockByHeight(bchainTx.get(), height));
+                }
+                bchainTx->abort();
+            }
+
+            if(blocks.empty()) {
+                break;
+            }
+
+            for(Wallet* wallet : toSync) {
+                if(heights[wallet] < height) {
+                    heights[wallet] = digest(wallet, blocks, std::set<Blockchain::transaction>());
+                }
+            }
+        }
+
+        if(running) {
+            const std::set<Blockchain::transaction> unconfirmedTxs =
+                blockchain->getUnconfirmedTransactions();
+
+            for(Wallet* wallet : toSync) {
+                digest(wallet, std::vector<Blockchain::block>(), unconfirmedTxs);
+            }
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef WALLETMANAGER_H_INCLUDED
+#define WALLETMANAGER_H_INCLUDED
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "wallet.h"
+
+namespace CryptoKernel {
+/**
+* Holds several named wallets for one coin. Each wallet has its own
+* database and lock, so calls to one never wait on another, while a single
+* thread follows the chain for all of them and reads each block only once.
+*/
+class WalletManager {
+public:
+    /**
+    * @param syncPolicy when the loaded wallets' writes are fsynced
+    */
+    WalletManager(Blockchain* blockchain, Network* network, Log* log,
+                  const Wallet::SyncPolicy syncPolicy = Wallet::SYNC_KEYS);
+    ~WalletManager();
+
+    /**
+    * Opens the wallet stored in dbDir under the given name, creating it if
+    * needed. A new wallet asks for its passphrase on the terminal.
+    *
+    * @param name the name the wallet is known by
+    * @param dbDir the directory the wallet's database lives in
+    * @return the wallet, owned by the manager
+    * @throw WalletException if a wallet with that name is already loaded
+    */
+    Wallet* loadWallet(const std::string& name, const std::string& dbDir);
+
+    /**
+    * Returns the wallet loaded under the given name
+    *
+    * @param name the name of the wallet
+    * @return the wallet, owned by the manager
+    * @throw WalletException if no wallet with that name is loaded
+    */
+    Wallet* getWallet(const std::string& name);
+
+    /**
+    * Returns the names of the loaded wallets
+    *
+    * @return the wallet names, in order
+    */
+    std::vector<std::string> listWallets();
+
+private:
+    Blockchain* blockchain;
+    Network* network;
+    Log* log;
+    Wallet::SyncPolicy syncPolicy;
+
+    // Wallets are never unloaded, so pointers to them stay valid
+    std::map<std::string, std::unique_ptr<Wallet>> wallets;
+    std::mutex walletsMutex;
+
+    std::unique_ptr<std::thread> watchThread;
+    bool running;
+
+    void watchFunc();
+};
+}
+
+#endif // WALLETMANAGER_H_INCLUDED
@@ -0,0 +1,128 @@
+#include <map>
+
+#include "addressindex.h"
+
+CryptoKernel::AddressIndex::AddressIndex() : ChainIndex("address") {
+    summaries.reset(new Storage::Table("addressSummaries"));
+    history.reset(new Storage::Table("addressHistory"));
+    undo.reset(new Storage::Table("addressUndo"));
+}
+
+void CryptoKernel::AddressIndex::connectBlock(Storage::Transaction* transaction,
+                                              Blockchain* blockchain,
+                                              const Blockchain::block& block,
+                                              const uint64_t height) {
+    std::vector<Blockchain::transaction> txs;
+    txs.push_back(block.getCoinbaseTx());
+    for(const Blockchain::transaction& tx : block.getTransactions()) {
+        txs.push_back(tx);
+    }
+
+    Json::Value undoEntries = Json::arrayValue;
+    for(const Blockchain::transaction& tx : txs) {
+        std::map<std::string, int64_t> deltas;
+
+        for(const Blockchain::output& out : tx.getOutputs()) {
+            const Json::Value data = out.getData();
+            if(data["publicKey"].isString()) {
+                deltas[data["publicKey"].asString()] += out.getValue();
+            }
+        }
+
+        // The spent outputs were moved to stxos by confirmTransaction
+        for(const Blockchain::input& inp : tx.getInputs()) {
+            const Blockchain::output spent = blockchain->getOutput(transaction,
+                                                                   inp.getOutputId().toString());
+            const Json::Value data = spent.getData();
+            if(data["publicKey"].isString()) {
+                deltas[data["publicKey"].asString()] -= spent.getValue();
+            }
+        }
+
+        for(const auto& delta : deltas) {
+            Json::Value summary = getSummary(transaction, delta.first);
+            const uint64_t number = summary["txcount"].asUInt64();
+
+            Json::Value entry;
+            entry["height"] = height;
+            entry["txid"] = tx.getId().toString();
+            entry["delta"] = static_cast<Json::Int64>(delta.second);
+            history->put(transaction, historyKey(delta.first, number), entry);
+
+            summary["balance"] = summary["balance"].asUInt64() + delta.second;
+            if(delta.second > 0) {
+                summary["received"] = summary["received"].asUInt64() + delta.second;
+            }
+            summary["txcount"] = number + 1;
+            summaries->put(transaction, delta.first, summary);
+
+            Json::Value undoEntry;
+            undoEntry["publicKey"] = delta.first;
+            undoEntry["delta"] = static_cast<Json::Int64>(delta.second);
+            undoEntries.append(undoEntry);
+        }
+    }
+
+    undo->put(transaction, std::to_string(height), undoEntries);
+}
+
+void CryptoKernel::AddressIndex::disconnectBlock(Storage::Transaction* transaction,
+                                                 Blockchain* blockchain,
+                                                 const Blockchain::block& block,
+                                                 const uint64_t height) {
+    const Json::Value undoEntries = undo->get(transaction, std::to_string(height));
+
+    // Each entry was the last in its key's history when it was added
+    for(int i = static_cast<int>(undoEntries.size()) - 1; i >= 0; i--) {
+        const std::string publicKey = undoEntries[i]["publicKey"].asString();
+        const int64_t delta = undoEntries[i]["delta"].asInt64();
+
+        Json::Value summary = getSummary(transaction, publicKey);
+        const uint64_t number = summary["txcount"].asUInt64() - 1;
+        history->erase(transaction, historyKey(publicKey, number));
+
+        if(number == 0) {
+            summaries->erase(transaction, publicKey);
+            continue;
+        }
+
+        summary["balance"] = summary["balance"].asUInt64() - delta;
+        if(delta > 0) {
+            summary["received"] = summary["received"].asUInt64() - delta;
+        }
+        summary["txcount"] = number;
+        summaries->put(transaction, publicKey, summary);
+    }
+
+    undo->erase(transaction, std::to_string(height));
+}
+
+Json::Value CryptoKernel::AddressIndex::getSummary(Storage::Transaction* transaction,
+                                                   const std::string& publicKey) {
+    Json::Value summary = summaries->get(transaction, publicKey);
+    if(!summary.isObject()) {
+        summary["balance"] = static_cast<Json::UInt64>(0);
+        summary["received"] = static_cast<Json::UInt64>(0);
+        summary["txcount"] = static_cast<Json::UInt64>(0);
+    }
+
+    return summary;
+}
+
+Json::Value CryptoKernel::AddressIndex::getHistory(Storage::Transaction* transaction,
+                                                   const std::string& publicKey,
+                                                   const uint64_t start, const uint64_t count) {
+    const uint64_t total = getSummary(transaction, publicKey)["txcount"].asUInt64();
+
+    Json::Value returning = Json::arrayValue;
+    for(uint64_t number = start; number < total && number - start < count; number++) {
+        returning.append(history->get(transaction, historyKey(publicKey, number)));
+    }
+
+    return returning;
+}
+
+std::string CryptoKernel::AddressIndex::historyKey(const std::string& publicKey,
+                                                   const uint64_t number) {
+    return publicKey + "_" + std::to_string(number);
+}
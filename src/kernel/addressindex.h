@@ -0,0 +1,65 @@
+#ifndef ADDRESSINDEX_H_INCLUDED
+#define ADDRESSINDEX_H_INCLUDED
+
+#include "blockchain.h"
+
+namespace CryptoKernel {
+/**
+* Keeps the history and balance of every public key on the main chain, so
+* explorers can look up an address without scanning the chain.
+*
+* Each transaction that pays or spends from a key adds one entry to the
+* key's history holding the block height, the transaction id and the
+* change it made to the key's balance. Entries are numbered from 0 in the
+* order they joined the chain, so pages of the history stay put as new
+* entries are added.
+*/
+class AddressIndex : public ChainIndex {
+public:
+    AddressIndex();
+
+    void connectBlock(Storage::Transaction* transaction,
+                      Blockchain* blockchain,
+                      const Blockchain::block& block,
+                      const uint64_t height);
+
+    void disconnectBlock(Storage::Transaction* transaction,
+                         Blockchain* blockchain,
+                         const Blockchain::block& block,
+                         const uint64_t height);
+
+    /**
+    * Returns a key's balance and the size of its history
+    *
+    * @param publicKey the public key to look up
+    * @return JSON with the key's balance, the total it has received and
+    *         the number of entries in its history, all 0 for a key that
+    *         has never been used
+    */
+    Json::Value getSummary(Storage::Transaction* transaction, const std::string& publicKey);
+
+    /**
+    * Returns part of a key's history
+    *
+    * @param publicKey the public key to look up
+    * @param start the number of the first entry to return
+    * @param count the most entries to return
+    * @return an array of entries with the height, txid and delta of each,
+    *         oldest first
+    */
+    Json::Value getHistory(Storage::Transaction* transaction, const std::string& publicKey,
+                           const uint64_t start, const uint64_t count);
+
+private:
+    // Public key to its balance, total received and history size
+    std::unique_ptr<Storage::Table> summaries;
+    // Public key and entry number to a history entry
+    std::unique_ptr<Storage::Table> history;
+    // Height to the keys and deltas the block added, for undoing it
+    std::unique_ptr<Storage::Table> undo;
+
+    std::string historyKey(const std::string& publicKey, const uint64_t number);
+};
+}
+
+#endif // ADDRESSINDEX_H_INCLUDED
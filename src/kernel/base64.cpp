@@ -23,102 +23,131 @@
 
    René Nyffenegger rene.nyffenegger@adp-gmbh.ch
 
+   Altered for CryptoKernel: rewritten to be table-driven and to encode and
+   decode into caller-supplied buffers.
+
 */
 
 #include "base64.h"
-#include <iostream>
 
-static const std::string base64_chars =
+namespace {
+const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
 
+const unsigned char invalid = 0xff;
 
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
+struct DecodeTable {
+    unsigned char values[256];
 
-std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for(i = 0; (i <4) ; i++)
-            { ret += base64_chars[char_array_4[i]]; }
-            i = 0;
+    DecodeTable() {
+        for(unsigned int i = 0; i < 256; i++) {
+            values[i] = invalid;
+        }
+        for(unsigned char i = 0; i < 64; i++) {
+            values[static_cast<unsigned char>(base64_chars[i])] = i;
         }
     }
+};
 
-    if (i) {
-        for(j = i; j < 3; j++)
-        { char_array_3[j] = '\0'; }
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-        char_array_4[3] = char_array_3[2] & 0x3f;
+const DecodeTable decodeTable;
+}
 
-        for (j = 0; (j < i + 1); j++)
-        { ret += base64_chars[char_array_4[j]]; }
+size_t base64_encoded_size(const size_t len) {
+    return (len + 2) / 3 * 4;
+}
 
-        while((i++ < 3))
-        { ret += '='; }
+size_t base64_decoded_max_size(const size_t len) {
+    return len / 4 * 3 + (len % 4 > 1 ? len % 4 - 1 : 0);
+}
 
+size_t base64_encode(unsigned char const* bytes_to_encode, const size_t len, char* out) {
+    char* pos = out;
+
+    size_t i = 0;
+    for(; i + 3 <= len; i += 3) {
+        const uint32_t group = (bytes_to_encode[i] << 16) | (bytes_to_encode[i + 1] << 8) |
+                               bytes_to_encode[i + 2];
+        pos[0] = base64_chars[group >> 18];
+        pos[1] = base64_chars[(group >> 12) & 0x3f];
+        pos[2] = base64_chars[(group >> 6) & 0x3f];
+        pos[3] = base64_chars[group & 0x3f];
+        pos += 4;
     }
 
-    return ret;
+    if(i < len) {
+        const bool two = i + 1 < len;
+        const uint32_t group = (bytes_to_encode[i] << 16) | (two ? bytes_to_encode[i + 1] << 8 : 0);
+        pos[0] = base64_chars[group >> 18];
+        pos[1] = base64_chars[(group >> 12) & 0x3f];
+        pos[2] = two ? base64_chars[(group >> 6) & 0x3f] : '=';
+        pos[3] = '=';
+        pos += 4;
+    }
 
+    return pos - out;
 }
 
-std::string base64_decode(std::string const& encoded_string) {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
-
-    while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i ==4) {
-            for (i = 0; i <4; i++)
-            { char_array_4[i] = base64_chars.find(char_array_4[i]); }
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-            { ret += char_array_3[i]; }
-            i = 0;
+size_t base64_decode(const char* encoded, const size_t len, unsigned char* out) {
+    unsigned char* pos = out;
+
+    // Decode whole groups while every character is valid
+    size_t i = 0;
+    for(; i + 4 <= len; i += 4) {
+        const unsigned char a = decodeTable.values[static_cast<unsigned char>(encoded[i])];
+        const unsigned char b = decodeTable.values[static_cast<unsigned char>(encoded[i + 1])];
+        const unsigned char c = decodeTable.values[static_cast<unsigned char>(encoded[i + 2])];
+        const unsigned char d = decodeTable.values[static_cast<unsigned char>(encoded[i + 3])];
+        if((a | b | c | d) == invalid) {
+            break;
         }
+
+        const uint32_t group = (a << 18) | (b << 12) | (c << 6) | d;
+        pos[0] = group >> 16;
+        pos[1] = (group >> 8) & 0xff;
+        pos[2] = group & 0xff;
+        pos += 3;
     }
 
-    if (i) {
-        for (j = i; j <4; j++)
-        { char_array_4[j] = 0; }
+    // Padding, any other character or the end of the input finishes the
+    // data. A final group of n characters holds n - 1 bytes.
+    uint32_t group = 0;
+    unsigned int count = 0;
+    for(; i < len && count < 4; i++) {
+        const unsigned char value = decodeTable.values[static_cast<unsigned char>(encoded[i])];
+        if(value == invalid) {
+            break;
+        }
+        group = (group << 6) | value;
+        count++;
+    }
 
-        for (j = 0; j <4; j++)
-        { char_array_4[j] = base64_chars.find(char_array_4[j]); }
+    if(count > 1) {
+        group <<= 6 * (4 - count);
+        pos[0] = group >> 16;
+        if(count > 2) {
+            pos[1] = (group >> 8) & 0xff;
+        }
+        pos += count - 1;
+    }
 
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+    return pos - out;
+}
 
-        for (j = 0; (j < i - 1); j++) { ret += char_array_3[j]; }
+std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+    std::string ret(base64_encoded_size(in_len), '\0');
+    if(in_len > 0) {
+        base64_encode(bytes_to_encode, in_len, &ret[0]);
     }
-
     return ret;
 }
 
+std::string base64_decode(std::string const& encoded_string) {
+    std::string ret(base64_decoded_max_size(encoded_string.size()), '\0');
+    if(!ret.empty()) {
+        ret.resize(base64_decode(encoded_string.data(), encoded_string.size(),
+                                 reinterpret_cast<unsigned char*>(&ret[0])));
+    }
+    return ret;
+}
@@ -1,10 +1,45 @@
 #ifndef BASE64_H_INCLUDED
 #define BASE64_H_INCLUDED
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 std::string base64_encode(unsigned char const* btyes_to_encode, unsigned int len);
 std::string base64_decode(std::string const& s);
 
-#endif // BASE64_H_INCLUDED
+/**
+* Returns the number of characters base64_encode writes for the given
+* number of bytes, including padding
+*/
+size_t base64_encoded_size(const size_t len);
+
+/**
+* Returns the most bytes base64_decode can write for the given number of
+* characters
+*/
+size_t base64_decoded_max_size(const size_t len);
+
+/**
+* Base64 encodes bytes into a buffer without allocating
+*
+* @param bytes_to_encode the bytes to encode
+* @param len the number of bytes to encode
+* @param out where to write the encoding, room for base64_encoded_size(len)
+*        characters. No terminating null is written.
+* @return the number of characters written
+*/
+size_t base64_encode(unsigned char const* bytes_to_encode, const size_t len, char* out);
 
+/**
+* Base64 decodes characters into a buffer without allocating. Decoding
+* stops at the first padding or other non-base64 character.
+*
+* @param encoded the characters to decode
+* @param len the number of characters
+* @param out where to write the bytes, room for base64_decoded_max_size(len)
+* @return the number of bytes written
+*/
+size_t base64_decode(const char* encoded, const size_t len, unsigned char* out);
+
+#endif // BASE64_H_INCLUDED
@@ -24,6 +24,7 @@
 #include <math.h>
 #include <random>
 #include <thread>
+#include <atomic>
 
 #include "blockchain.h"
 #include "crypto.h"
@@ -41,7 +42,13 @@ CryptoKernel::Blockchain::Blockchain(CryptoKernel::Log* GlobalLog,
     stxos.reset(new CryptoKernel::Storage::Table("stxos"));
     inputs.reset(new CryptoKernel::Storage::Table("inputs"));
     candidates.reset(new CryptoKernel::Storage::Table("candidates"));
+    candidateBodies.reset(new CryptoKernel::Storage::Table("candidateBodies"));
+    indexes.reset(new CryptoKernel::Storage::Table("indexes"));
     log = GlobalLog;
+    validationPool = nullptr;
+    validationThreads = 0;
+    mempoolLimit = 0;
+    indexRunning = false;
 }
 
 bool CryptoKernel::Blockchain::loadChain(CryptoKernel::Consensus* consensus,
@@ -92,13 +99,23 @@ bool CryptoKernel::Blockchain::loadChain(CryptoKernel::Consensus* consensus,
     const block genesisBlock = getBlockByHeight(1);
     genesisBlockId = genesisBlock.getId();
 
+    loadCandidates();
+
     status = true;
 
+    if(!chainIndexes.empty()) {
+        indexRunning = true;
+        indexThread.reset(new std::thread(&CryptoKernel::Blockchain::indexFunc, this));
+    }
+
     return true;
 }
 
 CryptoKernel::Blockchain::~Blockchain() {
-
+    indexRunning = false;
+    if(indexThread) {
+        indexThread->join();
+    }
 }
 
 std::set<CryptoKernel::Blockchain::transaction>
@@ -114,12 +131,10 @@ CryptoKernel::Blockchain::dbBlock CryptoKernel::Blockchain::getBlockDB(
     Storage::Transaction* transaction, const std::string& id, const bool mainChain) {
     Json::Value jsonBlock = blocks->get(transaction, id);
     if(!jsonBlock.isObject()) {
-        // Check if it's an orphan
+        // Check if it's a fork candidate
         jsonBlock = candidates->get(transaction, id);
         if(!jsonBlock.isObject() || mainChain) {
             throw NotFoundException("Block " + id);
-        } else {
-            return dbBlock(block(jsonBlock));
         }
     }
 
@@ -138,6 +153,11 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::getBlock(
     Storage::Transaction* transaction, const std::string& id) {
     const dbBlock block = getBlockDB(transaction, id);
 
+    // Blocks off the main chain keep their bodies with the candidates
+    if(candidateIndex.contains(block.getId())) {
+        return getCandidate(transaction, block.getId());
+    }
+
     return buildBlock(transaction, block);
 }
 
@@ -145,22 +165,13 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::buildBlock(
     Storage::Transaction* dbTx, const dbBlock& dbblock) {
     std::set<transaction> transactions;
 
-    try {
-        for(const BigNum& txid : dbblock.getTransactions()) {
-            transactions.insert(getTransaction(dbTx, txid.toString()));
-        }
-
-        return block(transactions, getTransaction(dbTx, dbblock.getCoinbaseTx().toString()),
-                    dbblock.getPreviousBlockId(), dbblock.getTimestamp(), dbblock.getConsensusData(),
-                    dbblock.getHeight());
-    } catch(const NotFoundException& e) {
-        const Json::Value jsonBlock = candidates->get(dbTx, dbblock.getId().toString());
-        if(jsonBlock.isObject()) {
-            return block(jsonBlock);
-        } else {
-            throw;
-        }
+    for(const BigNum& txid : dbblock.getTransactions()) {
+        transactions.insert(getTransaction(dbTx, txid.toString()));
     }
+
+    return block(transactions, getTransaction(dbTx, dbblock.getCoinbaseTx().toString()),
+                 dbblock.getPreviousBlockId(), dbblock.getTimestamp(), dbblock.getConsensusData(),
+                 dbblock.getHeight());
 }
 
 CryptoKernel::Blockchain::block CryptoKernel::Blockchain::getBlockByHeight(
@@ -213,7 +224,7 @@ CryptoKernel::Blockchain::output CryptoKernel::Blockchain::getOutput(
         }
     }
 
-    return output(outputJson);
+    return output(outputJson, true);
 }
 
 CryptoKernel::Blockchain::dbOutput CryptoKernel::Blockchain::getOutputDB(
@@ -332,23 +343,87 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(const transac
     return result;
 }
 
-std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(const block& newBlock, bool genesisBlock) {
+std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(const block& newBlock, bool genesisBlock,
+                                                             const std::string& peer) {
     std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+
+    // Every block that arrives ages the pool, whether or not it is an orphan
+    orphanBlocks.expire();
+
+    const std::string previousBlockId = newBlock.getPreviousBlockId().toString();
+    if(!genesisBlock && !blocks->get(dbTx.get(), previousBlockId).isObject()
+       && !candidates->get(dbTx.get(), previousBlockId).isObject()) {
+        if(orphanBlocks.insert(newBlock, peer)) {
+            log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Previous block does not exist, "
+                                        "holding " + newBlock.getId().toString() + " as an orphan");
+        } else {
+            log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Previous block does not exist "
+                                        "and the orphan pool will not take the block");
+        }
+
+        return std::make_tuple(false, false);
+    }
+
     const auto result = submitBlock(dbTx.get(), newBlock, genesisBlock);
     if(std::get<0>(result)) {
         dbTx->commit();
+        candidateIndex.commit();
+
+        // Connect any orphans that were waiting on this block, and in turn
+        // any that were waiting on them
+        std::queue<BigNum> parents;
+        parents.push(newBlock.getId());
+        while(!parents.empty()) {
+            for(const block& orphan : orphanBlocks.popChildren(parents.front())) {
+                std::unique_ptr<Storage::Transaction> orphanTx(blockdb->begin());
+                if(std::get<0>(submitBlock(orphanTx.get(), orphan))) {
+                    orphanTx->commit();
+                    candidateIndex.commit();
+                    parents.push(orphan.getId());
+                } else {
+                    orphanTx.reset();
+                    candidateIndex.rollback();
+                    discardInvalidForks();
+                    log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Orphan block " +
+                                                orphan.getId().toString() + " failed to connect");
+                }
+            }
+            parents.pop();
+        }
+    } else {
+        dbTx.reset();
+        candidateIndex.rollback();
+        discardInvalidForks();
     }
     return result;
 }
 
+bool CryptoKernel::Blockchain::isOrphan(const BigNum& id) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    orphanBlocks.expire();
+    return orphanBlocks.contains(id);
+}
+
+unsigned int CryptoKernel::Blockchain::orphanCount() {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    orphanBlocks.expire();
+    return orphanBlocks.count();
+}
+
 std::tuple<bool, bool> CryptoKernel::Blockchain::submitTransaction(Storage::Transaction* dbTx,
         const transaction& tx) {
     std::lock_guard<std::recursive_mutex> lock(chainLock);
+    if(mempoolLimit > 0 && unconfirmedTransactions.size() + tx.size() > mempoolLimit) {
+        log->printf(LOG_LEVEL_INFO,
+                    "blockchain::submitTransaction(): Mempool is full, rejected " + tx.getId().toString());
+        return std::make_tuple(false, false);
+    }
+
 	const auto verifyResult = verifyTransaction(dbTx, tx);
     if(std::get<0>(verifyResult)) {
         if(consensus->submitTransaction(dbTx, tx)) {
-			if(unconfirmedTransactions.insert(tx)) {
+			if(unconfirmedTransactions.insert(tx, calculateTransactionFee(dbTx, tx))) {
 				log->printf(LOG_LEVEL_INFO,
 							"blockchain::submitTransaction(): Received transaction " + tx.getId().toString());
 				return std::make_tuple(true, false);
@@ -395,9 +470,6 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
                 log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Previous block does not exist");
                 return std::make_tuple(false, true);
             }
-
-            const block previousBlock = block(previousBlockJson);
-            previousBlockJson = dbBlock(previousBlock).toJson();
         }
 
         const dbBlock previousBlock = dbBlock(previousBlockJson);
@@ -417,21 +489,22 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
         const dbBlock tip = getBlockDB(dbTx, "tip");
         if(previousBlock.getId() != tip.getId()) {
             //This block does not directly lead on from last block
-            //Check if the verifier should've come before the current tip
-            //If so, reorg, otherwise ignore it
-            if(consensus->isBlockBetter(dbTx, newBlock, tip)) {
+            //Keep it as a candidate, then move to the strongest fork if it
+            //beats the current tip
+            blockHeight = previousBlock.getHeight() + 1;
+            onlySave = true;
+            putCandidate(dbTx, newBlock, blockHeight);
+
+            const BigNum newTipId = selectBestChain(dbTx, newBlock, tip);
+            if(newTipId != tip.getId()) {
                 log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Forking the chain");
-                if(!reorgChain(dbTx, previousBlock.getId())) {
+                if(!reorgChain(dbTx, newTipId)) {
                     log->printf(LOG_LEVEL_INFO, "blockchain::submitBlock(): Alternative chain is not valid");
                     return std::make_tuple(false, true);
                 }
-
-                blockHeight = getBlockDB(dbTx, "tip").getHeight() + 1;
             } else {
                 log->printf(LOG_LEVEL_WARN,
                             "blockchain::submitBlock(): Chain has less verifier backing than current chain");
-                blockHeight = getBlockDB(dbTx, newBlock.getPreviousBlockId().toString()).getHeight() + 1;
-                onlySave = true;
             }
         } else {
             blockHeight = tip.getHeight() + 1;
@@ -441,32 +514,28 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
     if(!onlySave) {
         uint64_t fees = 0;
 
-        const unsigned int threads = std::thread::hardware_concurrency();
-        const auto& txs = newBlock.getTransactions();
-        bool failure = false;
-        unsigned int nTx = 0;
-        std::vector<std::thread> threadsVec;
-
-        for(const auto& tx : txs) {
-            threadsVec.push_back(std::thread([&]{
-                if(!std::get<0>(verifyTransaction(dbTx, tx))) {
-                    failure = true;
-                }
-            }));
-            nTx++;
+        if(validationPool == nullptr) {
+            ownPool.reset(new ThreadPool(0));
+            validationPool = ownPool.get();
+        }
 
-            if(nTx % threads == 0 || nTx >= txs.size()) {
-                for(auto& thread : threadsVec) {
-                    thread.join();
-                }
-                threadsVec.clear();
+        const std::set<transaction> blockTxs = newBlock.getTransactions();
+        std::vector<const transaction*> txs;
+        for(const transaction& tx : blockTxs) {
+            txs.push_back(&tx);
+        }
 
-                if(failure) {
-                    log->printf(LOG_LEVEL_INFO,
-                            "blockchain::submitBlock(): Transaction could not be verified");
-                    return std::make_tuple(false, true);
-                }
+        std::atomic<bool> failure(false);
+        validationPool->forEach(txs.size(), [&](const size_t i) {
+            if(!failure && !std::get<0>(verifyTransaction(dbTx, *txs[i]))) {
+                failure = true;
             }
+        }, validationThreads);
+
+        if(failure) {
+            log->printf(LOG_LEVEL_INFO,
+                    "blockchain::submitBlock(): Transaction could not be verified");
+            return std::make_tuple(false, true);
         }
 
 
@@ -506,17 +575,14 @@ std::tuple<bool, bool> CryptoKernel::Blockchain::submitBlock(Storage::Transactio
         }
     }
 
-    if(onlySave) {
-        Json::Value jsonBlock = newBlock.toJson();
-        jsonBlock["height"] = blockHeight;
-        candidates->put(dbTx, newBlock.getId().toString(), jsonBlock);
-    } else {
+    if(!onlySave) {
         const dbBlock toSave = dbBlock(newBlock, blockHeight);
         const Json::Value blockAsJson = toSave.toJson();
-        candidates->erase(dbTx, idAsString);
+        eraseCandidate(dbTx, newBlock.getId());
         blocks->put(dbTx, "tip", blockAsJson);
         blocks->put(dbTx, std::to_string(blockHeight), Json::Value(idAsString), 0);
         blocks->put(dbTx, idAsString, blockAsJson);
+        connectIndexes(dbTx, newBlock, blockHeight);
 		unconfirmedTransactions.rescanMempool(dbTx, this);
     }
 
@@ -605,26 +671,26 @@ void CryptoKernel::Blockchain::confirmTransaction(Storage::Transaction* dbTransa
 
 bool CryptoKernel::Blockchain::reorgChain(Storage::Transaction* dbTransaction,
         const BigNum& newTipId) {
-    std::stack<block> blockList;
+    std::stack<BigNum> blockList;
 
     //Find common fork block
-    Json::Value blockJson = candidates->get(dbTransaction, newTipId.toString());
-    while(blockJson.isObject()) {
-        const block currentBlock = block(blockJson);
-        blockList.push(currentBlock);
-        blockJson = candidates->get(dbTransaction, currentBlock.getPreviousBlockId().toString());
+    BigNum forkBlockId = newTipId;
+    while(candidateIndex.contains(forkBlockId)) {
+        blockList.push(forkBlockId);
+        forkBlockId = candidateIndex.get(forkBlockId).previousBlockId;
     }
 
     //Reverse blocks to that point
-    const BigNum forkBlockId = blockList.top().getPreviousBlockId();
     while(getBlockDB(dbTransaction, "tip").getId() != forkBlockId) {
         reverseBlock(dbTransaction);
     }
 
     //Submit new blocks
     while(!blockList.empty()) {
-        if(!std::get<0>(submitBlock(dbTransaction, blockList.top()))) {
-            //TODO: should probably blacklist this fork if this happens
+        if(!std::get<0>(submitBlock(dbTransaction, getCandidate(dbTransaction, blockList.top())))) {
+            // Remembered so the fork can be dropped once this transaction is
+            // rolled back, rather than being picked as the best chain again
+            invalidCandidates.insert(blockList.top());
 
             log->printf(LOG_LEVEL_WARN, "blockchain::reorgChain(): New chain failed to verify");
 
@@ -672,7 +738,7 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock
     std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
 
-    const std::set<transaction> blockTransactions = getUnconfirmedTransactions();
+    const std::set<transaction> blockTransactions = unconfirmedTransactions.getTransactions();
 
     uint64_t height;
     BigNum previousBlockId;
@@ -688,16 +754,51 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock
     const time_t t = std::time(0);
     const uint64_t now = static_cast<uint64_t> (t);;
 
-    uint64_t value = getBlockReward(height);
+    const uint64_t value = getBlockReward(height) + unconfirmedTransactions.getTemplateFees();
 
-    for(const transaction& tx : blockTransactions) {
-        value += calculateTransactionFee(dbTx.get(), tx);
+    const transaction coinbaseTx = generateCoinbase(publicKey, value, now);
+
+    Json::Value consensusData;
+    if(!genesisBlock) {
+        consensusData = consensus->generateConsensusData(dbTx.get(), previousBlockId, publicKey);
     }
 
+    const block returning = block(blockTransactions, unconfirmedTransactions.getTemplateMerkleRoot(),
+                                  coinbaseTx, previousBlockId, now, consensusData, height);
+
+    return returning;
+}
+
+CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock(
+    const std::string& publicKey, const BigNum& previousBlockId, const uint64_t height,
+    const std::set<BigNum>& excludedTxs) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+
+    const auto blockTemplate = unconfirmedTransactions.getTemplate(excludedTxs);
+
+    const uint64_t now = static_cast<uint64_t>(std::time(0));
+
+    const uint64_t value = getBlockReward(height) + std::get<1>(blockTemplate);
+
+    const transaction coinbaseTx = generateCoinbase(publicKey, value, now);
+
+    const Json::Value consensusData = consensus->generateConsensusData(dbTx.get(),
+                                                                       previousBlockId,
+                                                                       publicKey);
+
+    return block(std::get<0>(blockTemplate), coinbaseTx, previousBlockId, now, consensusData,
+                 height);
+}
+
+CryptoKernel::Blockchain::transaction CryptoKernel::Blockchain::generateCoinbase(
+    const std::string& publicKey, const uint64_t value, const uint64_t timestamp) {
     const std::string pubKey = getCoinbaseOwner(publicKey);
 
-    std::default_random_engine generator(now);
-    std::uniform_int_distribution<unsigned int> distribution(0, UINT_MAX);
+    // Seeding from the time gave blocks built by the same key within the
+    // same second identical coinbase transactions
+    std::random_device generator;
+    std::uniform_int_distribution<uint64_t> distribution(0, UINT64_MAX);
     const uint64_t nonce = distribution(generator);
 
     Json::Value data;
@@ -706,17 +807,7 @@ CryptoKernel::Blockchain::block CryptoKernel::Blockchain::generateVerifyingBlock
     std::set<output> outputs;
     outputs.insert(output(value, nonce, data));
 
-    const transaction coinbaseTx = transaction(std::set<input>(), outputs, now, true);
-
-    Json::Value consensusData;
-    if(!genesisBlock) {
-        consensusData = consensus->generateConsensusData(dbTx.get(), previousBlockId, publicKey);
-    }
-
-    const block returning = block(blockTransactions, coinbaseTx, previousBlockId, now,
-                                  consensusData, height);
-
-    return returning;
+    return transaction(std::set<input>(), outputs, timestamp, true);
 }
 
 std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getUnspentOutputs(
@@ -724,12 +815,17 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getUnspen
     std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
 
+    return getUnspentOutputs(dbTx.get(), publicKey);
+}
+
+std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getUnspentOutputs(
+    Storage::Transaction* dbTx, const std::string& publicKey) {
     std::set<dbOutput> returning;
 
-    const auto unspent = utxos->get(dbTx.get(), publicKey, 0);
+    const auto unspent = utxos->get(dbTx, publicKey, 0);
 
     for(const auto& utxo : unspent) {
-        returning.insert(getOutputDB(dbTx.get(), utxo.asString()));
+        returning.insert(getOutputDB(dbTx, utxo.asString()));
     }
 
     return returning;
@@ -740,12 +836,17 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getSpentO
     std::lock_guard<std::recursive_mutex> lock(chainLock);
     std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
 
+    return getSpentOutputs(dbTx.get(), publicKey);
+}
+
+std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getSpentOutputs(
+    Storage::Transaction* dbTx, const std::string& publicKey) {
     std::set<dbOutput> returning;
 
-    const auto spent = stxos->get(dbTx.get(), publicKey, 0);
+    const auto spent = stxos->get(dbTx, publicKey, 0);
 
     for(const auto& stxo : spent) {
-        returning.insert(getOutputDB(dbTx.get(), stxo.asString()));
+        returning.insert(getOutputDB(dbTx, stxo.asString()));
     }
 
     return returning;
@@ -754,6 +855,8 @@ std::set<CryptoKernel::Blockchain::dbOutput> CryptoKernel::Blockchain::getSpentO
 void CryptoKernel::Blockchain::reverseBlock(Storage::Transaction* dbTransaction) {
     const block tip = getBlock(dbTransaction, "tip");
 
+    disconnectIndexes(dbTransaction, tip, getBlockDB(dbTransaction, "tip").getHeight());
+
     auto eraseUtxo = [&](const auto& out, auto& db) {
         db->erase(dbTransaction, out.getId().toString());
 
@@ -826,7 +929,7 @@ void CryptoKernel::Blockchain::reverseBlock(Storage::Transaction* dbTransaction)
     blocks->put(dbTransaction, "tip", getBlockDB(dbTransaction,
                 tip.getPreviousBlockId().toString()).toJson());
 
-    candidates->put(dbTransaction, tip.getId().toString(), tip.toJson());
+    putCandidate(dbTransaction, tip, tipDB.getHeight());
 
 	unconfirmedTransactions.rescanMempool(dbTransaction, this);
 
@@ -876,6 +979,128 @@ void CryptoKernel::Blockchain::emptyDB() {
     blockdb.reset();
     CryptoKernel::Storage::destroy(dbDir);
     blockdb.reset(new CryptoKernel::Storage(dbDir, false, 20, true));
+    candidateIndex.clear();
+}
+
+void CryptoKernel::Blockchain::loadCandidates() {
+    candidateIndex.clear();
+
+    std::map<std::string, Json::Value> stored;
+    {
+        Storage::Table::Iterator it(candidates.get(), blockdb.get());
+        for(it.SeekToFirst(); it.Valid(); it.Next()) {
+            stored.insert(std::make_pair(it.key(), it.value()));
+        }
+    }
+
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+    for(const auto& entry : stored) {
+        if(entry.second["coinbaseTx"].isObject()) {
+            // Older databases kept the whole block in the candidates table
+            const block candidateBlock = block(entry.second);
+            putCandidate(dbTx.get(), candidateBlock, entry.second["height"].asUInt64());
+        } else {
+            const dbBlock header = dbBlock(entry.second);
+            candidateIndex.insert({header.getId(), header.getPreviousBlockId(), header.getHeight(),
+                                   consensus->getChainWork(header)});
+        }
+    }
+    dbTx->commit();
+    candidateIndex.commit();
+}
+
+CryptoKernel::Blockchain::block CryptoKernel::Blockchain::getCandidate(Storage::Transaction* dbTx,
+                                                                       const BigNum& id) {
+    const Json::Value jsonBlock = candidateBodies->get(dbTx, id.toString());
+    if(!jsonBlock.isObject()) {
+        throw NotFoundException("Candidate block " + id.toString());
+    }
+
+    return block(jsonBlock);
+}
+
+void CryptoKernel::Blockchain::putCandidate(Storage::Transaction* dbTx, const block& candidateBlock,
+                                            const uint64_t height) {
+    const dbBlock header = dbBlock(candidateBlock, height);
+    const std::string id = header.getId().toString();
+
+    // The header is kept apart from the body so that lookups and fork walks
+    // never need to decode the full block
+    candidates->put(dbTx, id, header.toJson());
+
+    Json::Value jsonBlock = candidateBlock.toJson();
+    jsonBlock["height"] = height;
+    candidateBodies->put(dbTx, id, jsonBlock);
+
+    candidateIndex.insert({header.getId(), header.getPreviousBlockId(), height,
+                           consensus->getChainWork(header)});
+}
+
+void CryptoKernel::Blockchain::eraseCandidate(Storage::Transaction* dbTx, const BigNum& id) {
+    if(candidateIndex.contains(id)) {
+        candidates->erase(dbTx, id.toString());
+        candidateBodies->erase(dbTx, id.toString());
+        candidateIndex.erase(id);
+    }
+}
+
+CryptoKernel::BigNum CryptoKernel::Blockchain::selectBestChain(Storage::Transaction* dbTx,
+                                                               const block& newBlock,
+                                                               const dbBlock& tip) {
+    // The fork tips are ordered by work so the strongest one is found
+    // without walking any of the stored forks
+    if(!candidateIndex.empty()) {
+        const CandidateIndex::candidate best = candidateIndex.best();
+        if(consensus->getChainWork(tip) < best.work
+           && consensus->isBlockBetter(dbTx, getCandidate(dbTx, best.id), tip)) {
+            return best.id;
+        }
+    }
+
+    // Consensus algorithms that do not rank chains by work alone may still
+    // prefer the new block, e.g. a verifier that should have come first
+    if(consensus->isBlockBetter(dbTx, newBlock, tip)) {
+        return newBlock.getId();
+    }
+
+    return tip.getId();
+}
+
+void CryptoKernel::Blockchain::discardInvalidForks() {
+    if(invalidCandidates.empty()) {
+        return;
+    }
+
+    std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+
+    // Drop each block that failed to connect along with everything built on it
+    std::stack<BigNum> toErase;
+    for(const BigNum& id : invalidCandidates) {
+        toErase.push(id);
+    }
+    invalidCandidates.clear();
+
+    while(!toErase.empty()) {
+        const BigNum id = toErase.top();
+        toErase.pop();
+
+        for(const BigNum& child : candidateIndex.children(id)) {
+            toErase.push(child);
+        }
+
+        if(candidateIndex.contains(id)) {
+            log->printf(LOG_LEVEL_INFO, "blockchain::discardInvalidForks(): Dropping candidate " +
+                                        id.toString());
+            eraseCandidate(dbTx.get(), id);
+        }
+    }
+
+    dbTx->commit();
+    candidateIndex.commit();
+}
+
+std::string CryptoKernel::Blockchain::getDbDir() const {
+    return dbDir;
 }
 
 CryptoKernel::Storage::Transaction* CryptoKernel::Blockchain::getTxHandle() {
@@ -886,9 +1111,12 @@ CryptoKernel::Storage::Transaction* CryptoKernel::Blockchain::getTxHandle() {
 
 CryptoKernel::Blockchain::Mempool::Mempool() {
 	bytes = 0;
+    templateBytes = 0;
+    templateFees = 0;
+    templateStale = false;
 }
 
-bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx) {
+bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx, const uint64_t fee) {
 	// Check if any inputs or outputs conflict
 	if(txs.find(tx.getId()) != txs.end()) {
 		return false;
@@ -911,9 +1139,22 @@ bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx) {
 	}
 
 	txs.insert(std::pair<BigNum, transaction>(tx.getId(), tx));
+    fees.insert(std::pair<BigNum, uint64_t>(tx.getId(), fee));
 
     bytes += tx.size();
 
+    if(!templateStale) {
+        if(templateTxs.size() + 1 == txs.size()
+           && templateBytes + tx.size() < 3.9 * 1024 * 1024) {
+            templateTxs.insert(tx);
+            templateTree.insert(tx.getId());
+            templateBytes += tx.size();
+            templateFees += fee;
+        } else {
+            templateStale = true;
+        }
+    }
+
 	for(const input& inp : tx.getInputs()) {
 		inputs.insert(std::pair<BigNum, BigNum>(inp.getId(), tx.getId()));
         outputs.insert(std::pair<BigNum, BigNum>(inp.getOutputId(), tx.getId()));
@@ -928,7 +1169,19 @@ bool CryptoKernel::Blockchain::Mempool::insert(const transaction& tx) {
 
 void CryptoKernel::Blockchain::Mempool::remove(const transaction& tx) {
 	if(txs.find(tx.getId()) != txs.end()) {
+        if(!templateStale) {
+            if(templateTxs.size() == txs.size()) {
+                templateTxs.erase(tx);
+                templateTree.remove(tx.getId());
+                templateBytes -= tx.size();
+                templateFees -= fees[tx.getId()];
+            } else {
+                templateStale = true;
+            }
+        }
+
 		txs.erase(tx.getId());
+        fees.erase(tx.getId());
 
         bytes -= tx.size();
 
@@ -957,21 +1210,76 @@ void CryptoKernel::Blockchain::Mempool::rescanMempool(Storage::Transaction* dbTx
 	}
 }
 
-std::set<CryptoKernel::Blockchain::transaction> CryptoKernel::Blockchain::Mempool::getTransactions() const {
-	uint64_t totalSize = 0;
-	std::set<transaction> returning;
+std::set<CryptoKernel::Blockchain::transaction> CryptoKernel::Blockchain::Mempool::getTransactions() {
+    if(templateStale) {
+        rebuildTemplate();
+    }
+
+	return templateTxs;
+}
+
+uint64_t CryptoKernel::Blockchain::Mempool::getTemplateFees() {
+    if(templateStale) {
+        rebuildTemplate();
+    }
+
+    return templateFees;
+}
+
+CryptoKernel::BigNum CryptoKernel::Blockchain::Mempool::getTemplateMerkleRoot() {
+    if(templateStale) {
+        rebuildTemplate();
+    }
+
+    if(templateTxs.empty()) {
+        return BigNum();
+    }
+
+    return templateTree.getMerkleRoot();
+}
+
+std::tuple<std::set<CryptoKernel::Blockchain::transaction>, uint64_t>
+CryptoKernel::Blockchain::Mempool::getTemplate(const std::set<BigNum>& excluded) {
+    std::set<transaction> returning;
+    uint64_t returningBytes = 0;
+    uint64_t returningFees = 0;
+
+    for(const auto& it : txs) {
+        if(excluded.find(it.first) != excluded.end()) {
+            continue;
+        }
+
+        if(returningBytes + it.second.size() >= 3.9 * 1024 * 1024) {
+            break;
+        }
+
+        returning.insert(it.second);
+        returningBytes += it.second.size();
+        returningFees += fees[it.first];
+    }
+
+    return std::make_tuple(returning, returningFees);
+}
+
+void CryptoKernel::Blockchain::Mempool::rebuildTemplate() {
+    templateTxs.clear();
+    templateTree.clear();
+    templateBytes = 0;
+    templateFees = 0;
 
 	for(const auto& it : txs) {
-		if(totalSize + it.second.size() < 3.9 * 1024 * 1024) {
-			returning.insert(it.second);
-			totalSize += it.second.size();
+		if(templateBytes + it.second.size() < 3.9 * 1024 * 1024) {
+			templateTxs.insert(it.second);
+            templateTree.insert(it.first);
+			templateBytes += it.second.size();
+            templateFees += fees[it.first];
 			continue;
 		}
 
 		break;
 	}
 
-	return returning;
+    templateStale = false;
 }
 
 unsigned int CryptoKernel::Blockchain::Mempool::count() const {
@@ -989,3 +1297,391 @@ unsigned int CryptoKernel::Blockchain::mempoolCount() const {
 unsigned int CryptoKernel::Blockchain::mempoolSize() const {
     return unconfirmedTransactions.size();
 }
+
+void CryptoKernel::Blockchain::setValidationPool(ThreadPool* pool, const unsigned int maxThreads) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    validationPool = pool;
+    validationThreads = maxThreads;
+    if(pool != ownPool.get()) {
+        ownPool.reset();
+    }
+}
+
+void CryptoKernel::Blockchain::setMempoolLimit(const uint64_t bytes) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    mempoolLimit = bytes;
+}
+
+void CryptoKernel::Blockchain::addIndex(ChainIndex* index) {
+    std::lock_guard<std::recursive_mutex> lock(chainLock);
+    if(status) {
+        throw std::runtime_error("Indexes must be added before the chain is loaded");
+    }
+
+    if(getIndex(index->getName()) != nullptr) {
+        throw std::runtime_error("Index " + index->getName() + " has already been added");
+    }
+
+    chainIndexes.push_back(index);
+}
+
+CryptoKernel::ChainIndex* CryptoKernel::Blockchain::getIndex(const std::string& name) {
+    for(ChainIndex* index : chainIndexes) {
+        if(index->getName() == name) {
+            return index;
+        }
+    }
+
+    return nullptr;
+}
+
+uint64_t CryptoKernel::Blockchain::getIndexHeight(Storage::Transaction* dbTx,
+                                                  const std::string& name) {
+    const Json::Value state = indexes->get(dbTx, name);
+    const uint64_t height = state["height"].asUInt64();
+
+    // An index left on a fork while it was switched off is rebuilt from
+    // where it left the main chain, so doesn't count until then
+    if(height > 0 && blocks->get(dbTx, std::to_string(height), 0).asString()
+                     != state["tipId"].asString()) {
+        return 0;
+    }
+
+    return height;
+}
+
+void CryptoKernel::Blockchain::connectIndexes(Storage::Transaction* dbTx, const block& newBlock,
+                                              const uint64_t height) {
+    for(ChainIndex* index : chainIndexes) {
+        const Json::Value state = indexes->get(dbTx, index->getName());
+
+        // Indexes that are still catching up are left to the index thread
+        if(state["height"].asUInt64() + 1 != height || (height > 1 &&
+           state["tipId"].asString() != newBlock.getPreviousBlockId().toString())) {
+            continue;
+        }
+
+        index->connectBlock(dbTx, this, newBlock, height);
+
+        Json::Value newState;
+        newState["height"] = height;
+        newState["tipId"] = newBlock.getId().toString();
+        indexes->put(dbTx, index->getName(), newState);
+    }
+}
+
+void CryptoKernel::Blockchain::disconnectIndexes(Storage::Transaction* dbTx, const block& oldTip,
+                                                 const uint64_t height) {
+    for(ChainIndex* index : chainIndexes) {
+        const Json::Value state = indexes->get(dbTx, index->getName());
+        if(state["height"].asUInt64() != height ||
+           state["tipId"].asString() != oldTip.getId().toString()) {
+            continue;
+        }
+
+        index->disconnectBlock(dbTx, this, oldTip, height);
+
+        Json::Value newState;
+        newState["height"] = height - 1;
+        newState["tipId"] = oldTip.getPreviousBlockId().toString();
+        indexes->put(dbTx, index->getName(), newState);
+    }
+}
+
+bool CryptoKernel::Blockchain::syncIndex(Storage::Transaction* dbTx, ChainIndex* index,
+                                         const uint64_t maxBlocks) {
+    const Json::Value state = indexes->get(dbTx, index->getName());
+    uint64_t height = state["height"].asUInt64();
+    std::string tipId = state["tipId"].asString();
+
+    // Undo blocks that left the main chain while the index was switched off
+    while(height > 0 && blocks->get(dbTx, std::to_string(height), 0).asString() != tipId) {
+        const block oldBlock = getBlock(dbTx, tipId);
+        index->disconnectBlock(dbTx, this, oldBlock, height);
+        height--;
+        tipId = oldBlock.getPreviousBlockId().toString();
+    }
+
+    const uint64_t tipHeight = getBlockDB(dbTx, "tip").getHeight();
+    const uint64_t targetHeight = std::min(tipHeight, height + maxBlocks);
+    while(height < targetHeight) {
+        height++;
+        const block nextBlock = getBlockByHeight(dbTx, height);
+        index->connectBlock(dbTx, this, nextBlock, height);
+        tipId = nextBlock.getId().toString();
+    }
+
+    Json::Value newState;
+    newState["height"] = height;
+    newState["tipId"] = tipId;
+    indexes->put(dbTx, index->getName(), newState);
+
+    return height == tipHeight;
+}
+
+void CryptoKernel::Blockchain::indexFunc() {
+    const uint64_t batchSize = 100;
+
+    bool synced = false;
+    while(indexRunning && !synced) {
+        std::lock_guard<std::recursive_mutex> lock(chainLock);
+        std::unique_ptr<Storage::Transaction> dbTx(blockdb->begin());
+
+        synced = true;
+        for(ChainIndex* index : chainIndexes) {
+            try {
+                if(!syncIndex(dbTx.get(), index, batchSize)) {
+                    synced = false;
+                }
+            } catch(NotFoundException& e) {
+                log->printf(LOG_LEVEL_ERR, "Blockchain::indexFunc(): Index " + index->getName()
+                                           + " could not be built: " + e.what());
+                indexRunning = false;
+                return;
+            }
+        }
+
+        dbTx->commit();
+    }
+
+    log->printf(LOG_LEVEL_INFO, "Blockchain::indexFunc(): Indexes are up to date");
+}
+
+CryptoKernel::ChainIndex::ChainIndex(const std::string& name) {
+    this->name = name;
+}
+
+std::string CryptoKernel::ChainIndex::getName() const {
+    return name;
+}
+
+CryptoKernel::Blockchain::OrphanPool::OrphanPool() {
+    bytes = 0;
+}
+
+bool CryptoKernel::Blockchain::OrphanPool::insert(const block& orphan, const std::string& peer) {
+    // Bounds on the pool so that peers cannot exhaust our memory with
+    // blocks that may never connect
+    const unsigned int maxOrphans = 1000;
+    const unsigned int maxPeerOrphans = 500;
+    const uint64_t maxBytes = 64 * 1024 * 1024;
+
+    if(orphans.find(orphan.getId()) != orphans.end()) {
+        return false;
+    }
+
+    const auto peerIt = peerCounts.find(peer);
+    if(peerIt != peerCounts.end() && peerIt->second >= maxPeerOrphans) {
+        return false;
+    }
+
+    uint64_t orphanBytes = orphan.getCoinbaseTx().size();
+    for(const transaction& tx : orphan.getTransactions()) {
+        orphanBytes += tx.size();
+    }
+
+    // A block that could never fit must not flush the pool on its way out
+    if(orphanBytes > maxBytes) {
+        return false;
+    }
+
+    // Make room by dropping the oldest orphans
+    while(!byAge.empty() && (orphans.size() >= maxOrphans || bytes + orphanBytes > maxBytes)) {
+        remove(byAge.begin()->second);
+    }
+
+    const uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    orphans.insert(std::make_pair(orphan.getId(), orphanEntry{orphan, peer, now, orphanBytes}));
+    byParent.insert(std::make_pair(orphan.getPreviousBlockId(), orphan.getId()));
+    byAge.insert(std::make_pair(now, orphan.getId()));
+    peerCounts[peer]++;
+    bytes += orphanBytes;
+
+    return true;
+}
+
+std::vector<CryptoKernel::Blockchain::block> CryptoKernel::Blockchain::OrphanPool::popChildren(
+    const BigNum& parentId) {
+    std::vector<block> returning;
+
+    std::vector<BigNum> childIds;
+    const auto range = byParent.equal_range(parentId);
+    for(auto it = range.first; it != range.second; it++) {
+        childIds.push_back(it->second);
+    }
+
+    for(const BigNum& id : childIds) {
+        returning.push_back(orphans.find(id)->second.orphan);
+        remove(id);
+    }
+
+    return returning;
+}
+
+bool CryptoKernel::Blockchain::OrphanPool::contains(const BigNum& id) const {
+    return orphans.find(id) != orphans.end();
+}
+
+unsigned int CryptoKernel::Blockchain::OrphanPool::count() const {
+    return orphans.size();
+}
+
+void CryptoKernel::Blockchain::OrphanPool::remove(const BigNum& id) {
+    const auto it = orphans.find(id);
+    if(it == orphans.end()) {
+        return;
+    }
+
+    const auto range = byParent.equal_range(it->second.orphan.getPreviousBlockId());
+    for(auto parentIt = range.first; parentIt != range.second; parentIt++) {
+        if(parentIt->second == id) {
+            byParent.erase(parentIt);
+            break;
+        }
+    }
+
+    byAge.erase(std::make_pair(it->second.received, id));
+
+    const auto peerIt = peerCounts.find(it->second.peer);
+    if(--peerIt->second == 0) {
+        peerCounts.erase(peerIt);
+    }
+
+    bytes -= it->second.bytes;
+
+    orphans.erase(it);
+}
+
+void CryptoKernel::Blockchain::OrphanPool::expire() {
+    const uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+
+    // Orphans that have not connected after twenty minutes are unlikely to ever do so
+    const uint64_t expiry = 20 * 60;
+
+    while(!byAge.empty() && byAge.begin()->first + expiry < now) {
+        remove(byAge.begin()->second);
+    }
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::insert(const candidate& entry) {
+    if(candidates.find(entry.id) == candidates.end()) {
+        add(entry);
+        journal.push_back({true, entry});
+    }
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::erase(const BigNum& id) {
+    const auto it = candidates.find(id);
+    if(it != candidates.end()) {
+        journal.push_back({false, it->second});
+        remove(id);
+    }
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::add(const candidate& entry) {
+    candidates.insert(std::make_pair(entry.id, entry));
+    byParent.insert(std::make_pair(entry.previousBlockId, entry.id));
+
+    // The parent is no longer the end of its fork
+    const auto parent = candidates.find(entry.previousBlockId);
+    if(parent != candidates.end()) {
+        tips.erase(std::make_pair(parent->second.work, parent->first));
+    }
+
+    // A block reversed off the main chain may already have children here
+    if(byParent.find(entry.id) == byParent.end()) {
+        tips.insert(std::make_pair(entry.work, entry.id));
+    }
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::remove(const BigNum& id) {
+    const auto it = candidates.find(id);
+    const candidate entry = it->second;
+    candidates.erase(it);
+
+    tips.erase(std::make_pair(entry.work, entry.id));
+
+    const auto range = byParent.equal_range(entry.previousBlockId);
+    for(auto child = range.first; child != range.second; child++) {
+        if(child->second == id) {
+            byParent.erase(child);
+            break;
+        }
+    }
+
+    // The parent becomes a fork tip again once its last child is gone
+    const auto parent = candidates.find(entry.previousBlockId);
+    if(parent != candidates.end() && byParent.find(parent->first) == byParent.end()) {
+        tips.insert(std::make_pair(parent->second.work, parent->first));
+    }
+}
+
+bool CryptoKernel::Blockchain::CandidateIndex::contains(const BigNum& id) const {
+    return candidates.find(id) != candidates.end();
+}
+
+CryptoKernel::Blockchain::CandidateIndex::candidate CryptoKernel::Blockchain::CandidateIndex::get(
+    const BigNum& id) const {
+    const auto it = candidates.find(id);
+    if(it == candidates.end()) {
+        throw NotFoundException("Candidate block " + id.toString());
+    }
+
+    return it->second;
+}
+
+std::vector<CryptoKernel::BigNum> CryptoKernel::Blockchain::CandidateIndex::children(
+    const BigNum& id) const {
+    std::vector<BigNum> result;
+    const auto range = byParent.equal_range(id);
+    for(auto it = range.first; it != range.second; it++) {
+        result.push_back(it->second);
+    }
+
+    return result;
+}
+
+CryptoKernel::Blockchain::CandidateIndex::candidate CryptoKernel::Blockchain::CandidateIndex::best()
+const {
+    if(tips.empty()) {
+        throw NotFoundException("Candidate tip");
+    }
+
+    return candidates.at(tips.rbegin()->second);
+}
+
+bool CryptoKernel::Blockchain::CandidateIndex::empty() const {
+    return candidates.empty();
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::clear() {
+    candidates.clear();
+    byParent.clear();
+    tips.clear();
+    journal.clear();
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::commit() {
+    journal.clear();
+}
+
+void CryptoKernel::Blockchain::CandidateIndex::rollback() {
+    // Undo the changes made since the last commit, newest first, so the index
+    // matches the database again after an aborted transaction
+    for(auto it = journal.rbegin(); it != journal.rend(); it++) {
+        if(it->inserted) {
+            remove(it->entry.id);
+        } else {
+            add(it->entry);
+        }
+    }
+
+    journal.clear();
+}
+
+CryptoKernel::BigNum CryptoKernel::Consensus::getChainWork(
+    const CryptoKernel::Blockchain::dbBlock& block) {
+    std::stringstream buffer;
+    buffer << std::hex << block.getHeight();
+    return CryptoKernel::BigNum(buffer.str());
+}
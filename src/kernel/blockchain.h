@@ -22,13 +22,18 @@
 #include <set>
 #include <memory>
 #include <map>
+#include <thread>
 
 #include "storage.h"
 #include "log.h"
 #include "ckmath.h"
+#include "merkletree.h"
+#include "threadpool.h"
 
 namespace CryptoKernel {
 class Consensus;
+class ChainIndex;
+class Network;
 class Blockchain {
 public:
     Blockchain(CryptoKernel::Log* GlobalLog,
@@ -76,8 +81,18 @@ public:
 
         bool operator<(const output& rhs) const;
 
+    protected:
+        /**
+        * Constructs an output read back from the blockchain database. Its
+        * public key was checked when the output was first accepted, so it
+        * is not decoded again.
+        */
+        output(const Json::Value& jsonOutput, const bool trusted);
+
     private:
-        void checkRep();
+        friend class Blockchain;
+
+        void checkRep(const bool checkPublicKey = true);
 
         BigNum calculateId();
 
@@ -171,6 +186,17 @@ public:
         BigNum getId() const;
 
     private:
+        /**
+        * Constructs a block from a template whose transactions are already known
+        * to be conflict free, within the size limit and have the given Merkle
+        * root, so none of that is checked again
+        */
+        block(const std::set<transaction>& transactions, const BigNum& transactionMerkleRoot,
+              const transaction& coinbaseTx, const BigNum& previousBlockId, const uint64_t timestamp,
+              const Json::Value& consensusData, const uint64_t height);
+
+        friend class Blockchain;
+
         void checkRep();
 
         BigNum calculateId();
@@ -235,10 +261,18 @@ public:
     class dbOutput : public output {
     public:
         dbOutput(const output& compactOutput, const BigNum& creationTx);
+
+        /**
+        * Constructs an output from its database record. Records are only
+        * written for outputs that were already validated, so the public key
+        * is not checked again.
+        */
         dbOutput(const Json::Value& jsonOutput);
 
         Json::Value toJson() const;
 
+        BigNum getCreationTx() const;
+
     private:
         BigNum creationTx;
     };
@@ -252,6 +286,7 @@ public:
         Json::Value toJson() const;
 
         BigNum getId() const;
+        BigNum getConfirmingBlock() const;
         bool isCoinbaseTx() const;
         uint64_t getTimestamp() const;
         std::set<BigNum> getInputs() const;
@@ -272,10 +307,65 @@ public:
     };
 
     std::tuple<bool, bool> submitTransaction(const transaction& tx);
-    std::tuple<bool, bool> submitBlock(const block& newBlock, bool genesisBlock = false);
+
+    /**
+    * Submits a block to the blockchain. Blocks whose previous block is not yet
+    * known are held in a bounded orphan pool and connected automatically once
+    * their parent arrives. In that case the block is not accepted yet, but
+    * the submitter is not considered to have misbehaved.
+    *
+    * @param newBlock the block to submit
+    * @param genesisBlock true iff the block should be treated as the genesis block
+    * @param peer an identifier for the source of the block, used to enforce
+    *        the per-peer orphan limit. Empty if the block was produced locally.
+    * @return a tuple where the first element is true iff the block was accepted
+    *         and the second element is true iff the submitter misbehaved
+    */
+    std::tuple<bool, bool> submitBlock(const block& newBlock, bool genesisBlock = false,
+                                       const std::string& peer = "");
+
+    /**
+    * Returns true iff the block with the given id is waiting in the orphan
+    * pool for its previous block to arrive
+    *
+    * @param id the id of the block to look for
+    * @return true iff the block is a known orphan
+    */
+    bool isOrphan(const BigNum& id);
+
+    /**
+    * Returns the number of blocks currently held in the orphan pool
+    *
+    * @return the number of orphan blocks
+    */
+    unsigned int orphanCount();
+
+    /**
+    * Returns the directory the chain database is kept in, for components
+    * that need to keep their own files beside the chain
+    *
+    * @return the database directory given to the constructor
+    */
+    std::string getDbDir() const;
 
     block generateVerifyingBlock(const std::string& publicKey);
 
+    /**
+    * Builds a block on top of one that has been proposed but not yet added
+    * to the chain, for consensus algorithms that have several blocks in
+    * flight at once. Mempool transactions already in those blocks are left
+    * out.
+    *
+    * @param publicKey the public key the coinbase pays
+    * @param previousBlockId the id of the block to build on
+    * @param height the height of the new block
+    * @param excludedTxs the ids of the transactions in the blocks still in
+    *        flight
+    * @return the new block
+    */
+    block generateVerifyingBlock(const std::string& publicKey, const BigNum& previousBlockId,
+                                 const uint64_t height, const std::set<BigNum>& excludedTxs);
+
     block getBlock(Storage::Transaction* transaction, const std::string& id);
     block getBlockByHeight(Storage::Transaction* transaction, const uint64_t height);
 
@@ -338,8 +428,14 @@ public:
 
     std::set<dbOutput> getUnspentOutputs(const std::string& publicKey);
 
+    std::set<dbOutput> getUnspentOutputs(Storage::Transaction* dbTx,
+                                         const std::string& publicKey);
+
     std::set<dbOutput> getSpentOutputs(const std::string& publicKey);
 
+    std::set<dbOutput> getSpentOutputs(Storage::Transaction* dbTx,
+                                       const std::string& publicKey);
+
     std::set<transaction> getUnconfirmedTransactions();
 
     /**
@@ -356,13 +452,65 @@ public:
     unsigned int mempoolCount() const;
     unsigned int mempoolSize() const;
 
+    /**
+    * Sets the thread pool used to verify the transactions of new blocks.
+    * Without one the blockchain starts its own pool the first time it is
+    * needed, with a thread per hardware thread.
+    *
+    * @param pool the pool to use, which must outlive the blockchain
+    * @param maxThreads the most threads to verify one block with, 0 for
+    *        as many as the pool has
+    */
+    void setValidationPool(ThreadPool* pool, const unsigned int maxThreads = 0);
+
+    /**
+    * Limits the total size of the transactions held in the mempool.
+    * Transactions that would take the mempool over the limit are turned
+    * away until blocks make room.
+    *
+    * @param bytes the most bytes of transactions to hold, 0 for no limit
+    */
+    void setMempoolLimit(const uint64_t bytes);
+
+    /**
+    * Adds an optional index over the main chain. It is kept up to date in
+    * the same database transaction as each block that connects or
+    * disconnects. Blocks already in the chain when the index is first
+    * added are indexed in the background.
+    *
+    * @param index the index to add, which must outlive the blockchain
+    * @throw std::runtime_error if the chain is already loaded or an index
+    *        with the same name has been added
+    */
+    void addIndex(ChainIndex* index);
+
+    /**
+    * Returns the index added with the given name
+    *
+    * @param name the name of the index
+    * @return the index, or nullptr if none has that name
+    */
+    ChainIndex* getIndex(const std::string& name);
+
+    /**
+    * Returns the height of the main chain block an index has been built
+    * up to. Until it reaches the tip, the index is still catching up.
+    *
+    * @param name the name of the index
+    * @return the height of the last block indexed, 0 if none are
+    */
+    uint64_t getIndexHeight(Storage::Transaction* dbTx, const std::string& name);
+
 private:
     std::unique_ptr<Storage::Table> blocks;
     std::unique_ptr<Storage::Table> candidates;
+    std::unique_ptr<Storage::Table> candidateBodies;
     std::unique_ptr<Storage::Table> transactions;
     std::unique_ptr<Storage::Table> utxos;
     std::unique_ptr<Storage::Table> stxos;
     std::unique_ptr<Storage::Table> inputs;
+    // Index name to the height and id of the last block it covers
+    std::unique_ptr<Storage::Table> indexes;
 
     std::unique_ptr<Storage> blockdb;
     BigNum genesisBlockId;
@@ -372,11 +520,24 @@ private:
 		public:
 			Mempool();
 
-			bool insert(const transaction& tx);
+			bool insert(const transaction& tx, const uint64_t fee);
 			void remove(const transaction& tx);
-			std::set<transaction> getTransactions() const;
+			std::set<transaction> getTransactions();
 			void rescanMempool(Storage::Transaction* dbTx, Blockchain* blockchain);
 
+            uint64_t getTemplateFees();
+            BigNum getTemplateMerkleRoot();
+
+            /**
+            * Builds a block template as the longest run of transactions,
+            * in id order, that fits in a block, skipping the given ones
+            *
+            * @param excluded the ids of the transactions to leave out
+            * @return the transactions and their total fees
+            */
+            std::tuple<std::set<transaction>, uint64_t> getTemplate(
+                const std::set<BigNum>& excluded);
+
             unsigned int count() const;
             unsigned int size() const;
 
@@ -384,14 +545,132 @@ private:
 			std::map<BigNum, transaction> txs;
 			std::map<BigNum, BigNum> outputs;
 			std::map<BigNum, BigNum> inputs;
+            std::map<BigNum, uint64_t> fees;
 
             unsigned int bytes;
+
+            // The block template is the longest run of transactions, in id
+            // order, that fits in a block. It is kept up to date as
+            // transactions come and go, and only rebuilt from scratch when
+            // the mempool no longer fits in one block.
+            void rebuildTemplate();
+            std::set<transaction> templateTxs;
+            IncrementalMerkleTree templateTree;
+            uint64_t templateBytes;
+            uint64_t templateFees;
+            bool templateStale;
 	};
 
     Mempool unconfirmedTransactions;
 
+    class OrphanPool {
+        public:
+            OrphanPool();
+
+            bool insert(const block& orphan, const std::string& peer);
+            std::vector<block> popChildren(const BigNum& parentId);
+            bool contains(const BigNum& id) const;
+
+            unsigned int count() const;
+
+            // Drops orphans that have waited too long to connect
+            void expire();
+
+        private:
+            void remove(const BigNum& id);
+
+            struct orphanEntry {
+                block orphan;
+                std::string peer;
+                uint64_t received;
+                uint64_t bytes;
+            };
+
+            std::map<BigNum, orphanEntry> orphans;
+            std::multimap<BigNum, BigNum> byParent;
+            std::set<std::pair<uint64_t, BigNum>> byAge;
+            std::map<std::string, unsigned int> peerCounts;
+
+            uint64_t bytes;
+    };
+
+    OrphanPool orphanBlocks;
+
+    class CandidateIndex {
+        public:
+            struct candidate {
+                BigNum id;
+                BigNum previousBlockId;
+                uint64_t height;
+                BigNum work;
+            };
+
+            void insert(const candidate& entry);
+            void erase(const BigNum& id);
+            bool contains(const BigNum& id) const;
+            candidate get(const BigNum& id) const;
+            std::vector<BigNum> children(const BigNum& id) const;
+
+            // Returns the fork tip with the most cumulative work
+            candidate best() const;
+            bool empty() const;
+
+            void clear();
+
+            void commit();
+            void rollback();
+
+        private:
+            void add(const candidate& entry);
+            void remove(const BigNum& id);
+
+            std::map<BigNum, candidate> candidates;
+            std::multimap<BigNum, BigNum> byParent;
+            // Candidates that no other candidate builds on, keyed by work
+            std::set<std::pair<BigNum, BigNum>> tips;
+
+            struct change {
+                bool inserted;
+                candidate entry;
+            };
+            std::vector<change> journal;
+    };
+
+    CandidateIndex candidateIndex;
+
+    void loadCandidates();
+    block getCandidate(Storage::Transaction* dbTx, const BigNum& id);
+    void putCandidate(Storage::Transaction* dbTx, const block& candidateBlock, const uint64_t height);
+    void eraseCandidate(Storage::Transaction* dbTx, const BigNum& id);
+    BigNum selectBestChain(Storage::Transaction* dbTx, const block& newBlock, const dbBlock& tip);
+    void discardInvalidForks();
+
+    std::set<BigNum> invalidCandidates;
+
     std::string dbDir;
 
+    std::unique_ptr<ThreadPool> ownPool;
+    ThreadPool* validationPool;
+    unsigned int validationThreads;
+    uint64_t mempoolLimit;
+
+    std::vector<ChainIndex*> chainIndexes;
+    std::unique_ptr<std::thread> indexThread;
+    bool indexRunning;
+
+    /**
+    * Builds indexes that are behind the tip, a batch of blocks at a time
+    * so blocks can still be submitted meanwhile, until all have caught up
+    * and are kept up to date by submitBlock and reverseBlock instead
+    */
+    void indexFunc();
+    bool syncIndex(Storage::Transaction* dbTx, ChainIndex* index, const uint64_t maxBlocks);
+    void connectIndexes(Storage::Transaction* dbTx, const block& newBlock, const uint64_t height);
+    void disconnectIndexes(Storage::Transaction* dbTx, const block& oldTip, const uint64_t height);
+
+    transaction generateCoinbase(const std::string& publicKey, const uint64_t value,
+                                 const uint64_t timestamp);
+
     std::tuple<bool, bool> verifyTransaction(Storage::Transaction* dbTransaction, const transaction& tx,
                            const bool coinbaseTx = false);
     void confirmTransaction(Storage::Transaction* dbTransaction, const transaction& tx,
@@ -513,11 +792,83 @@ public:
      */
     virtual void start() = 0;
 
+    /**
+     * Gives the consensus algorithm the network it should use to exchange
+     * its own messages with other nodes, e.g. votes. Algorithms that only
+     * communicate through blocks can ignore this. Called with nullptr
+     * before the network is destroyed.
+     *
+     * @param network the network of this blockchain, or nullptr
+     */
+    virtual void setNetwork(CryptoKernel::Network* network) {};
+
+    /**
+     * Returns the cumulative work of the chain ending in the given block,
+     * used to order the stored fork tips so the strongest one can be found
+     * without walking them. Algorithms that do not measure work can keep
+     * the default, which is the block height.
+     *
+     * @param block the block at the end of the chain
+     * @return the work of the chain
+     */
+    virtual CryptoKernel::BigNum getChainWork(const CryptoKernel::Blockchain::dbBlock& block);
+
     class PoW;
     class AVRR;
     class Raft;
     class Regtest;
 };
+
+/**
+* Custom chain index interface.
+*
+* Extend this class to keep extra lookups over the main chain in the
+* blockchain database, e.g. for explorers or light clients. Add the index
+* with Blockchain::addIndex before the chain is loaded.
+*/
+class ChainIndex {
+public:
+    /**
+    * Constructs an index with the given name. The name identifies the
+    * index's progress in the database, so should not change, and makes a
+    * good prefix for the names of its tables.
+    *
+    * @param name the name of the index
+    */
+    ChainIndex(const std::string& name);
+
+    virtual ~ChainIndex() {};
+
+    std::string getName() const;
+
+    /**
+    * Called when a block joins the main chain, after its transactions
+    * have been confirmed, in the same database transaction
+    *
+    * @param block the block that joined the main chain
+    * @param height the block's height
+    */
+    virtual void connectBlock(Storage::Transaction* transaction,
+                              Blockchain* blockchain,
+                              const Blockchain::block& block,
+                              const uint64_t height) = 0;
+
+    /**
+    * Called when the last block the index connected leaves the main chain.
+    * The chain may no longer hold outputs the block spent or created, so
+    * an index should keep whatever it needs to undo a block itself.
+    *
+    * @param block the block that left the main chain
+    * @param height the block's height
+    */
+    virtual void disconnectBlock(Storage::Transaction* transaction,
+                                 Blockchain* blockchain,
+                                 const Blockchain::block& block,
+                                 const uint64_t height) = 0;
+
+private:
+    std::string name;
+};
 }
 
 #endif // BLOCKCHAIN_H_INCLUDED
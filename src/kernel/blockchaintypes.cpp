@@ -4,7 +4,13 @@
 #include "crypto.h"
 #include "merkletree.h"
 
-CryptoKernel::Blockchain::output::output(const Json::Value& jsonOutput) {
+CryptoKernel::Blockchain::output::output(const Json::Value& jsonOutput) : output(
+        jsonOutput, false) {
+
+}
+
+CryptoKernel::Blockchain::output::output(const Json::Value& jsonOutput,
+        const bool trusted) {
     try {
         value = jsonOutput["value"].asUInt64();
         nonce = jsonOutput["nonce"].asUInt64();
@@ -13,7 +19,7 @@ CryptoKernel::Blockchain::output::output(const Json::Value& jsonOutput) {
         throw InvalidElementException("Output JSON is malformed");
     }
 
-    checkRep();
+    checkRep(!trusted);
 
     id = calculateId();
 }
@@ -29,12 +35,12 @@ CryptoKernel::Blockchain::output::output(const uint64_t value, const uint64_t no
     id = calculateId();
 }
 
-void CryptoKernel::Blockchain::output::checkRep() {
+void CryptoKernel::Blockchain::output::checkRep(const bool checkPublicKey) {
     if(value < 1) {
         throw InvalidElementException("Output value cannot be less than 1");
     }
 
-    if(data["contract"].empty() && !data["publicKey"].empty()) {
+    if(checkPublicKey && data["contract"].empty() && !data["publicKey"].empty()) {
         CryptoKernel::Crypto crypto;
         try {
             if(!crypto.setPublicKey(data["publicKey"].asString())) {
@@ -62,8 +68,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::output::calculateId() {
     std::stringstream buffer;
     buffer << value << nonce << CryptoKernel::Storage::toString(data, false);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 CryptoKernel::BigNum CryptoKernel::Blockchain::output::getId() const {
@@ -85,7 +90,7 @@ bool CryptoKernel::Blockchain::output::operator<(const output& rhs) const {
 }
 
 CryptoKernel::Blockchain::dbOutput::dbOutput(const Json::Value& jsonOutput) : output(
-        jsonOutput) {
+        jsonOutput, true) {
     try {
         creationTx = CryptoKernel::BigNum(jsonOutput["creationTx"].asString());
     } catch(const Json::Exception& e) {
@@ -94,11 +99,14 @@ CryptoKernel::Blockchain::dbOutput::dbOutput(const Json::Value& jsonOutput) : ou
 }
 
 CryptoKernel::Blockchain::dbOutput::dbOutput(const output& compactOutput,
-        const BigNum& creationTx) : output(compactOutput.getValue(), compactOutput.getNonce(),
-                    compactOutput.getData()) {
+        const BigNum& creationTx) : output(compactOutput) {
     this->creationTx = creationTx;
 }
 
+CryptoKernel::BigNum CryptoKernel::Blockchain::dbOutput::getCreationTx() const {
+    return creationTx;
+}
+
 Json::Value CryptoKernel::Blockchain::dbOutput::toJson() const {
     Json::Value returning = this->output::toJson();
 
@@ -163,8 +171,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::input::calculateId() {
     std::stringstream buffer;
     buffer << outputId.toString() << CryptoKernel::Storage::toString(data, false);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 CryptoKernel::Blockchain::dbInput::dbInput(const Json::Value& inputJson) : input(
@@ -280,8 +287,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::transaction::calculateId() {
 
 	buffer << getOutputSetId().toString() << timestamp;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 bool CryptoKernel::Blockchain::transaction::operator<(const transaction& rhs) const {
@@ -393,8 +399,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::dbTransaction::calculateId() {
 
     buffer << timestamp;
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 void CryptoKernel::Blockchain::dbTransaction::checkRep () {
@@ -437,6 +442,10 @@ uint64_t CryptoKernel::Blockchain::dbTransaction::getTimestamp() const {
     return timestamp;
 }
 
+CryptoKernel::BigNum CryptoKernel::Blockchain::dbTransaction::getConfirmingBlock() const {
+    return confirmingBlock;
+}
+
 bool CryptoKernel::Blockchain::dbTransaction::isCoinbaseTx() const {
     return coinbaseTx;
 }
@@ -477,6 +486,20 @@ CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions
     id = calculateId();
 }
 
+CryptoKernel::Blockchain::block::block(const std::set<transaction>& transactions,
+                                       const BigNum& transactionMerkleRoot, const transaction& coinbaseTx,
+                                       const BigNum& previousBlockId, const uint64_t timestamp,
+                                       const Json::Value& consensusData, const uint64_t height)
+    : transactions(transactions), coinbaseTx(coinbaseTx) {
+    this->transactionMerkleRoot = transactionMerkleRoot;
+    this->previousBlockId = previousBlockId;
+    this->timestamp = timestamp;
+    this->consensusData = consensusData;
+    this->height = height;
+
+    id = calculateId();
+}
+
 CryptoKernel::Blockchain::block::block(const Json::Value& jsonBlock)
     : coinbaseTx(jsonBlock["coinbaseTx"], true) {
     try {
@@ -504,6 +527,17 @@ CryptoKernel::Blockchain::block::block(const Json::Value& jsonBlock)
 
     checkRep();
 
+	if(!transactions.empty()) {
+		std::set<BigNum> txIds;
+		for(const auto& tx : transactions) {
+			txIds.insert(tx.getId());
+		}
+
+		if(CryptoKernel::MerkleNode::makeMerkleTree(txIds)->getMerkleRoot() != transactionMerkleRoot) {
+			throw InvalidElementException("Transaction merkle root is incorrect");
+		}
+	}
+
     id = calculateId();
 }
 
@@ -521,8 +555,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::block::calculateId() {
     buffer << coinbaseTx.getId().toString() << previousBlockId.toString() << timestamp
 		   << CryptoKernel::Storage::toString(data);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 void CryptoKernel::Blockchain::block::checkRep() {
@@ -581,17 +614,6 @@ void CryptoKernel::Blockchain::block::checkRep() {
     if(totalInputs != inputIds.size()) {
         throw InvalidElementException("Block contains duplicate inputs");
     }
-
-	if(!transactions.empty()) {
-		std::set<BigNum> txIds;
-		for(const auto& tx : transactions) {
-			txIds.insert(tx.getId());
-		}
-
-		if(CryptoKernel::MerkleNode::makeMerkleTree(txIds)->getMerkleRoot() != transactionMerkleRoot) {
-			throw InvalidElementException("Transaction merkle root is incorrect");
-		}
-	}
 }
 
 Json::Value CryptoKernel::Blockchain::block::toJson() const {
@@ -746,8 +768,7 @@ CryptoKernel::BigNum CryptoKernel::Blockchain::dbBlock::calculateId() {
     buffer << coinbaseTx.toString() << previousBlockId.toString() << timestamp
 		   << CryptoKernel::Storage::toString(data);
 
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(buffer.str()));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(buffer.str()));
 }
 
 Json::Value CryptoKernel::Blockchain::dbBlock::toJson() const {
@@ -0,0 +1,90 @@
+#include <openssl/sha.h>
+
+#include "blockfilterindex.h"
+#include "base64.h"
+#include "crypto.h"
+
+CryptoKernel::BlockFilterIndex::BlockFilterIndex() : ChainIndex("blockfilter") {
+    filters.reset(new Storage::Table("blockfilterFilters"));
+}
+
+void CryptoKernel::BlockFilterIndex::connectBlock(Storage::Transaction* transaction,
+                                                  Blockchain* blockchain,
+                                                  const Blockchain::block& block,
+                                                  const uint64_t height) {
+    const GCSFilter filter(getKey(block.getId()), getElements(block));
+    const std::string encoded = filter.getEncoded();
+
+    std::string previousHeader;
+    if(height > 1) {
+        previousHeader = getFilterHeader(transaction, height - 1);
+    }
+
+    Json::Value entry;
+    entry["blockId"] = block.getId().toString();
+    entry["filter"] = base64_encode(reinterpret_cast<const unsigned char*>(encoded.c_str()),
+                                    encoded.size());
+    entry["header"] = Crypto::sha256(Crypto::sha256(encoded) + previousHeader);
+
+    filters->put(transaction, std::to_string(height), entry);
+}
+
+void CryptoKernel::BlockFilterIndex::disconnectBlock(Storage::Transaction* transaction,
+                                                     Blockchain* blockchain,
+                                                     const Blockchain::block& block,
+                                                     const uint64_t height) {
+    filters->erase(transaction, std::to_string(height));
+}
+
+Json::Value CryptoKernel::BlockFilterIndex::getEntry(Storage::Transaction* transaction,
+                                                     const uint64_t height) {
+    const Json::Value entry = filters->get(transaction, std::to_string(height));
+    if(!entry.isObject()) {
+        throw Blockchain::NotFoundException("Block filter at height " + std::to_string(height));
+    }
+
+    return entry;
+}
+
+CryptoKernel::GCSFilter CryptoKernel::BlockFilterIndex::getFilter(
+    Storage::Transaction* transaction, const uint64_t height) {
+    const Json::Value entry = getEntry(transaction, height);
+    const BigNum blockId = BigNum(entry["blockId"].asString());
+
+    return GCSFilter(getKey(blockId), base64_decode(entry["filter"].asString()));
+}
+
+std::string CryptoKernel::BlockFilterIndex::getFilterHeader(Storage::Transaction* transaction,
+                                                            const uint64_t height) {
+    return getEntry(transaction, height)["header"].asString();
+}
+
+std::string CryptoKernel::BlockFilterIndex::getKey(const BigNum& blockId) {
+    const std::string id = blockId.toString();
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(id.c_str()), id.size(), hash);
+
+    return std::string(reinterpret_cast<const char*>(hash), 16);
+}
+
+std::set<std::string> CryptoKernel::BlockFilterIndex::getElements(
+    const Blockchain::block& block) {
+    std::set<std::string> elements;
+
+    std::set<Blockchain::transaction> txs = block.getTransactions();
+    txs.insert(block.getCoinbaseTx());
+    for(const Blockchain::transaction& tx : txs) {
+        for(const Blockchain::output& out : tx.getOutputs()) {
+            const Json::Value data = out.getData();
+            if(data["publicKey"].isString()) {
+                elements.insert(data["publicKey"].asString());
+            }
+        }
+
+        for(const Blockchain::input& inp : tx.getInputs()) {
+            elements.insert(inp.getOutputId().toString());
+        }
+    }
+
+    return elements;
+}
@@ -0,0 +1,82 @@
+#ifndef BLOCKFILTERINDEX_H_INCLUDED
+#define BLOCKFILTERINDEX_H_INCLUDED
+
+#include "blockchain.h"
+#include "gcsfilter.h"
+
+namespace CryptoKernel {
+/**
+* Keeps a compact filter for every main chain block, in the style of
+* BIP157/158, so light clients can find the blocks that concern them
+* without revealing their addresses to the node.
+*
+* A block's filter holds the public keys of every output it creates and
+* the ids of every output it spends. Filters are keyed with the first 16
+* bytes of the SHA256 of the block id. Each filter also has a header,
+* sha256(sha256(filter) + previous header), so a client can check the
+* filters it is given against a header chain from several peers.
+*/
+class BlockFilterIndex : public ChainIndex {
+public:
+    BlockFilterIndex();
+
+    void connectBlock(Storage::Transaction* transaction,
+                      Blockchain* blockchain,
+                      const Blockchain::block& block,
+                      const uint64_t height);
+
+    void disconnectBlock(Storage::Transaction* transaction,
+                         Blockchain* blockchain,
+                         const Blockchain::block& block,
+                         const uint64_t height);
+
+    /**
+    * Returns the filter of the main chain block at the given height
+    *
+    * @param height the height of the block
+    * @return the block's filter
+    * @throw Blockchain::NotFoundException if the block has not been indexed
+    */
+    GCSFilter getFilter(Storage::Transaction* transaction, const uint64_t height);
+
+    /**
+    * Returns the filter header of the main chain block at the given height
+    *
+    * @param height the height of the block
+    * @return the filter header, hex encoded
+    * @throw Blockchain::NotFoundException if the block has not been indexed
+    */
+    std::string getFilterHeader(Storage::Transaction* transaction, const uint64_t height);
+
+    /**
+    * Returns the filter and header entry stored for the given height
+    *
+    * @param height the height of the block
+    * @return JSON with the blockId, the base64 encoded filter and its header
+    * @throw Blockchain::NotFoundException if the block has not been indexed
+    */
+    Json::Value getEntry(Storage::Transaction* transaction, const uint64_t height);
+
+    /**
+    * Returns the key a block's filter is built with
+    *
+    * @param blockId the id of the block
+    * @return the 16 byte SipHash key
+    */
+    static std::string getKey(const BigNum& blockId);
+
+    /**
+    * Returns the elements a block's filter is built from
+    *
+    * @param block the block
+    * @return the output public keys and spent output ids in the block
+    */
+    static std::set<std::string> getElements(const Blockchain::block& block);
+
+private:
+    // Height to the block id, filter and header
+    std::unique_ptr<Storage::Table> filters;
+};
+}
+
+#endif // BLOCKFILTERINDEX_H_INCLUDED
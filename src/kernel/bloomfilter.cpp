@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "bloomfilter.h"
+
+CryptoKernel::BloomFilter::BloomFilter(const size_t capacity,
+                                       const double falsePositiveRate) {
+    maxItems = capacity;
+    items = 0;
+
+    const double rate = std::min(std::max(falsePositiveRate, 1e-9), 0.5);
+    const double ln2 = std::log(2.0);
+    const double n = static_cast<double>(std::max<size_t>(capacity, 1));
+
+    nBits = std::max<uint64_t>(64, std::ceil(-n * std::log(rate) / (ln2 * ln2)));
+    nHashes = std::min(std::max(static_cast<int>(std::round(nBits / n * ln2)), 1), 30);
+
+    bits.resize((nBits + 63) / 64);
+}
+
+void CryptoKernel::BloomFilter::insert(const std::string& item) {
+    uint64_t h1, h2;
+    hash(item, h1, h2);
+
+    for(unsigned int i = 0; i < nHashes; i++) {
+        const uint64_t bit = (h1 + i * h2) % nBits;
+        bits[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    items++;
+}
+
+bool CryptoKernel::BloomFilter::contains(const std::string& item) const {
+    uint64_t h1, h2;
+    hash(item, h1, h2);
+
+    for(unsigned int i = 0; i < nHashes; i++) {
+        const uint64_t bit = (h1 + i * h2) % nBits;
+        if(!(bits[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t CryptoKernel::BloomFilter::size() const {
+    return items;
+}
+
+size_t CryptoKernel::BloomFilter::capacity() const {
+    return maxItems;
+}
+
+void CryptoKernel::BloomFilter::hash(const std::string& item, uint64_t& h1,
+                                     uint64_t& h2) const {
+    // Every probe is derived from two hashes (Kirsch and Mitzenmacher), the
+    // second being the first put through the splitmix64 finaliser
+    h1 = std::hash<std::string>()(item);
+
+    uint64_t z = h1 + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    h2 = (z ^ (z >> 31)) | 1;
+}
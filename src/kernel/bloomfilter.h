@@ -0,0 +1,66 @@
+#ifndef BLOOMFILTER_H_INCLUDED
+#define BLOOMFILTER_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CryptoKernel {
+/**
+* A compact, probabilistic set of strings. contains() is always true for
+* an inserted item, but may also be true for items that never were. While
+* the filter holds no more than its capacity, that happens at about the
+* rate it was sized for.
+*/
+class BloomFilter {
+public:
+    /**
+    * Constructs an empty filter
+    *
+    * @param capacity the number of items the filter is sized to hold
+    * @param falsePositiveRate the chance that contains() is wrongly true
+    *        once the filter holds capacity items, between 0 and 1
+    */
+    BloomFilter(const size_t capacity, const double falsePositiveRate);
+
+    /**
+    * Adds an item to the filter
+    *
+    * @param item the item to add
+    */
+    void insert(const std::string& item);
+
+    /**
+    * Checks whether an item may have been added to the filter
+    *
+    * @param item the item to look for
+    * @return false if the item was definitely never added, true otherwise
+    */
+    bool contains(const std::string& item) const;
+
+    /**
+    * Returns the number of items added to the filter
+    *
+    * @return the number of insert() calls
+    */
+    size_t size() const;
+
+    /**
+    * Returns the number of items the filter was sized to hold
+    *
+    * @return the capacity given to the constructor
+    */
+    size_t capacity() const;
+
+private:
+    void hash(const std::string& item, uint64_t& h1, uint64_t& h2) const;
+
+    std::vector<uint64_t> bits;
+    uint64_t nBits;
+    unsigned int nHashes;
+    size_t items;
+    size_t maxItems;
+};
+}
+
+#endif // BLOOMFILTER_H_INCLUDED
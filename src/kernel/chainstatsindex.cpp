@@ -0,0 +1,85 @@
+#include "chainstatsindex.h"
+
+CryptoKernel::ChainStatsIndex::ChainStatsIndex() : ChainIndex("chainstats") {
+    stats.reset(new Storage::Table("chainstatsStats"));
+}
+
+void CryptoKernel::ChainStatsIndex::connectBlock(Storage::Transaction* transaction,
+                                                 Blockchain* blockchain,
+                                                 const Blockchain::block& block,
+                                                 const uint64_t height) {
+    uint64_t supply = 0;
+    uint64_t utxos = 0;
+    uint64_t utxoBytes = 0;
+    uint64_t fees = 0;
+    uint64_t txs = 0;
+    if(height > 1) {
+        const Json::Value previous = getStats(transaction, height - 1);
+        supply = previous["supply"].asUInt64();
+        utxos = previous["utxos"].asUInt64();
+        utxoBytes = previous["utxoBytes"].asUInt64();
+        fees = previous["fees"].asUInt64();
+        txs = previous["transactions"].asUInt64();
+    }
+
+    const std::set<Blockchain::transaction> blockTxs = block.getTransactions();
+
+    uint64_t blockFees = 0;
+    for(const Blockchain::transaction& tx : blockTxs) {
+        uint64_t inputTotal = 0;
+        // The spent outputs were moved to stxos by confirmTransaction
+        for(const Blockchain::input& inp : tx.getInputs()) {
+            const Blockchain::output spent = blockchain->getOutput(transaction,
+                                                                   inp.getOutputId().toString());
+            inputTotal += spent.getValue();
+            utxos--;
+            utxoBytes -= Storage::toString(spent.toJson()).size();
+        }
+
+        uint64_t outputTotal = 0;
+        for(const Blockchain::output& out : tx.getOutputs()) {
+            outputTotal += out.getValue();
+            utxos++;
+            utxoBytes += Storage::toString(out.toJson()).size();
+        }
+
+        blockFees += inputTotal - outputTotal;
+        supply = supply + outputTotal - inputTotal;
+    }
+
+    // The coinbase pays out the subsidy and the fees just taken off supply
+    for(const Blockchain::output& out : block.getCoinbaseTx().getOutputs()) {
+        supply += out.getValue();
+        utxos++;
+        utxoBytes += Storage::toString(out.toJson()).size();
+    }
+
+    Json::Value entry;
+    entry["blockId"] = block.getId().toString();
+    entry["supply"] = supply;
+    entry["utxos"] = utxos;
+    entry["utxoBytes"] = utxoBytes;
+    entry["fees"] = fees + blockFees;
+    entry["transactions"] = txs + blockTxs.size() + 1;
+    entry["blockFees"] = blockFees;
+    entry["blockTransactions"] = blockTxs.size() + 1;
+
+    stats->put(transaction, std::to_string(height), entry);
+}
+
+void CryptoKernel::ChainStatsIndex::disconnectBlock(Storage::Transaction* transaction,
+                                                    Blockchain* blockchain,
+                                                    const Blockchain::block& block,
+                                                    const uint64_t height) {
+    stats->erase(transaction, std::to_string(height));
+}
+
+Json::Value CryptoKernel::ChainStatsIndex::getStats(Storage::Transaction* transaction,
+                                                    const uint64_t height) {
+    const Json::Value entry = stats->get(transaction, std::to_string(height));
+    if(!entry.isObject()) {
+        throw Blockchain::NotFoundException("Chain stats at height " + std::to_string(height));
+    }
+
+    return entry;
+}
@@ -0,0 +1,48 @@
+#ifndef CHAINSTATSINDEX_H_INCLUDED
+#define CHAINSTATSINDEX_H_INCLUDED
+
+#include "blockchain.h"
+
+namespace CryptoKernel {
+/**
+* Keeps running totals over the main chain as of every block, so chain
+* and UTXO set statistics can be read without walking either.
+*
+* Each block's entry holds the total supply (the value of all unspent
+* outputs), the number of unspent outputs, their size in bytes as serialised
+* JSON, the total fees paid and the number of transactions including
+* coinbases, each as of that block. Disconnecting a block just drops its
+* entry, as the one before it is unchanged.
+*/
+class ChainStatsIndex : public ChainIndex {
+public:
+    ChainStatsIndex();
+
+    void connectBlock(Storage::Transaction* transaction,
+                      Blockchain* blockchain,
+                      const Blockchain::block& block,
+                      const uint64_t height);
+
+    void disconnectBlock(Storage::Transaction* transaction,
+                         Blockchain* blockchain,
+                         const Blockchain::block& block,
+                         const uint64_t height);
+
+    /**
+    * Returns the statistics as of the main chain block at the given height
+    *
+    * @param height the height of the block
+    * @return JSON with the blockId, supply, utxos, utxoBytes, fees and
+    *         transactions as of the block, and the block's own blockFees
+    *         and blockTransactions
+    * @throw Blockchain::NotFoundException if the block has not been indexed
+    */
+    Json::Value getStats(Storage::Transaction* transaction, const uint64_t height);
+
+private:
+    // Height to the statistics as of that block
+    std::unique_ptr<Storage::Table> stats;
+};
+}
+
+#endif // CHAINSTATSINDEX_H_INCLUDED
@@ -1,79 +1,120 @@
-#include "../crypto.h"
-#include "AVRR.h"
+#include <chrono>
 
-CryptoKernel::Consensus::AVRR::AVRR(const std::set<std::string>& verifiers,
-                                    const uint64_t blockTarget) {
-    this->verifiers = verifiers;
-    this->blockTarget = blockTarget;
-}
+#include "AVRR.h"
 
-bool CryptoKernel::Consensus::AVRR::isBlockBetter(const CryptoKernel::Blockchain::dbBlock&
-        block, const CryptoKernel::Blockchain::dbBlock& tip) {
-    return (block.getConsensusData()["sequenceNumber"].asUInt64() <
-            tip.getConsensusData()["sequenceNumber"].asUInt64() &&
-            block.getHeight() >= tip.getHeight());
-}
+CryptoKernel::Consensus::AVRR::AVRR(CryptoKernel::Blockchain* blockchain,
+                                    const std::set<std::string>& verifiers,
+                                    const uint64_t blockTarget,
+                                    const std::string& pubKey,
+                                    const std::string& privKey) {
+    if(verifiers.empty() || blockTarget == 0) {
+        throw std::runtime_error("AVRR needs at least one verifier and a non-zero block target");
+    }
 
-std::string CryptoKernel::Consensus::AVRR::serializeConsensusData(
-    const CryptoKernel::Blockchain::block& block) {
-    return block.getConsensusData()["publicKey"].asString() +
-           block.getConsensusData()["sequenceNumber"].asString();
-}
+    this->blockchain = blockchain;
+    this->blockTarget = blockTarget;
+    this->pubKey = pubKey;
+    network = nullptr;
+    running = false;
+
+    // Same order as iterating the set, so the schedule of existing chains
+    // doesn't change
+    schedule.assign(verifiers.begin(), verifiers.end());
+
+    for(const std::string& verifier : verifiers) {
+        std::unique_ptr<CryptoKernel::Crypto> key(new CryptoKernel::Crypto());
+        if(!key->setPublicKey(verifier)) {
+            throw std::runtime_error("AVRR verifier public key " + verifier + " is invalid");
+        }
+        verifierKeys[verifier] = std::move(key);
+    }
 
-bool CryptoKernel::Consensus::AVRR::checkConsensusRules(const
-        CryptoKernel::Blockchain::block& block,
-        const CryptoKernel::Blockchain::block& previousBlock) {
-    const consensusData blockData = getConsensusData(block);
-    const consensusData previousBlockData = getConsensusData(previousBlock);
-    if(blockData.sequenceNumber <= previousBlockData.sequenceNumber ||
-            (block.getTimestamp() / blockTarget) != blockData.sequenceNumber) {
-        return false;
+    if(verifiers.find(pubKey) != verifiers.end()) {
+        signingKey.reset(new CryptoKernel::Crypto());
+        if(!signingKey->setPrivateKey(privKey) ||
+           !verifierKeys[pubKey]->verify(pubKey, signingKey->sign(pubKey))) {
+            throw std::runtime_error("AVRR private key does not match the verifier public key");
+        }
     }
+}
 
-    const time_t t = std::time(0);
-    const uint64_t now = static_cast<uint64_t> (t);
-    if(now < block.getTimestamp()) {
-        return false;
+CryptoKernel::Consensus::AVRR::~AVRR() {
+    setNetwork(nullptr);
+    running = false;
+    if(producerThread) {
+        producerThread->join();
     }
+}
 
-    if(getVerifier(block) != blockData.publicKey) {
+bool CryptoKernel::Consensus::AVRR::isBlockBetter(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::block& block,
+        const CryptoKernel::Blockchain::dbBlock& tip) {
+    try {
+        const consensusData blockData = getConsensusData(block.getConsensusData());
+        const consensusData tipData = getConsensusData(tip.getConsensusData());
+        return (blockData.sequenceNumber < tipData.sequenceNumber &&
+                block.getHeight() >= tip.getHeight());
+    } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
         return false;
     }
+}
 
-    CryptoKernel::Crypto crypto;
-    crypto.setPublicKey(blockData.publicKey);
-    if(!crypto.verify(block.getId().toString(), blockData.signature)) {
+bool CryptoKernel::Consensus::AVRR::checkConsensusRules(Storage::Transaction* transaction,
+        CryptoKernel::Blockchain::block& block,
+        const CryptoKernel::Blockchain::dbBlock& previousBlock) {
+    try {
+        const consensusData blockData = getConsensusData(block.getConsensusData());
+        const consensusData previousBlockData = getConsensusData(previousBlock.getConsensusData());
+        if(blockData.sequenceNumber <= previousBlockData.sequenceNumber ||
+                (block.getTimestamp() / blockTarget) != blockData.sequenceNumber) {
+            return false;
+        }
+
+        const time_t t = std::time(0);
+        const uint64_t now = static_cast<uint64_t> (t);
+        if(now < block.getTimestamp()) {
+            return false;
+        }
+
+        if(getVerifier(blockData.sequenceNumber) != blockData.publicKey) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(cryptoMutex);
+        return verifierKeys[blockData.publicKey]->verify(block.getId().toString(),
+                                                         blockData.signature);
+    } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
         return false;
     }
-
-    return true;
 }
 
 Json::Value CryptoKernel::Consensus::AVRR::generateConsensusData(
-    const CryptoKernel::Blockchain::block& block, const std::string& publicKey) {
+    Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId,
+    const std::string& publicKey) {
+    const time_t t = std::time(0);
+    const uint64_t now = static_cast<uint64_t> (t);
+
     consensusData data;
     data.publicKey = publicKey;
-    data.sequenceNumber = block.getTimestamp() / blockTarget;
+    data.sequenceNumber = now / blockTarget;
 
     return consensusDataToJson(data);
 }
 
-std::string CryptoKernel::Consensus::AVRR::getVerifier(const
-        CryptoKernel::Blockchain::block& block) {
-    const consensusData blockData = getConsensusData(block);
-    const uint64_t verifierId = blockData.sequenceNumber % verifiers.size();
-
-    return *std::next(verifiers.begin(), verifierId);
+std::string CryptoKernel::Consensus::AVRR::getVerifier(const uint64_t sequenceNumber) const {
+    return schedule[sequenceNumber % schedule.size()];
 }
 
 CryptoKernel::Consensus::AVRR::consensusData
-CryptoKernel::Consensus::AVRR::getConsensusData(const CryptoKernel::Blockchain::block&
-        block) {
+CryptoKernel::Consensus::AVRR::getConsensusData(const Json::Value& consensusJson) {
     consensusData returning;
-    const Json::Value data = block.getConsensusData();
-    returning.publicKey = data["publicKey"].asString();
-    returning.signature = data["signature"].asString();
-    returning.sequenceNumber = data["sequenceNumber"].asUInt64();
+    try {
+        returning.publicKey = consensusJson["publicKey"].asString();
+        returning.signature = consensusJson["signature"].asString();
+        returning.sequenceNumber = consensusJson["sequenceNumber"].asUInt64();
+    } catch(const Json::Exception& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException("Block consensusData JSON is malformed");
+    }
     return returning;
 }
 
@@ -86,22 +127,72 @@ Json::Value CryptoKernel::Consensus::AVRR::consensusDataToJson(
     return returning;
 }
 
-bool CryptoKernel::Consensus::AVRR::verifyTransaction(const
-        CryptoKernel::Blockchain::transaction& tx) {
+bool CryptoKernel::Consensus::AVRR::verifyTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
     return true;
 }
 
-bool CryptoKernel::Consensus::AVRR::confirmTransaction(const
-        CryptoKernel::Blockchain::transaction& tx) {
+bool CryptoKernel::Consensus::AVRR::confirmTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
     return true;
 }
 
-bool CryptoKernel::Consensus::AVRR::submitTransaction(const
-        CryptoKernel::Blockchain::transaction& tx) {
+bool CryptoKernel::Consensus::AVRR::submitTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
     return true;
 }
 
-bool CryptoKernel::Consensus::AVRR::submitBlock(const CryptoKernel::Blockchain::block&
-        block) {
+bool CryptoKernel::Consensus::AVRR::submitBlock(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::block& block) {
     return true;
 }
+
+void CryptoKernel::Consensus::AVRR::setNetwork(CryptoKernel::Network* network) {
+    std::lock_guard<std::mutex> lock(networkMutex);
+    this->network = network;
+}
+
+void CryptoKernel::Consensus::AVRR::start() {
+    if(!signingKey) {
+        return;
+    }
+
+    running = true;
+    producerThread.reset(new std::thread(&CryptoKernel::Consensus::AVRR::producer, this));
+}
+
+void CryptoKernel::Consensus::AVRR::producer() {
+    uint64_t lastProduced = 0;
+
+    while(running) {
+        const uint64_t now = static_cast<uint64_t>(std::time(0));
+        const uint64_t sequenceNumber = now / blockTarget;
+
+        if(sequenceNumber > lastProduced && getVerifier(sequenceNumber) == pubKey) {
+            CryptoKernel::Blockchain::block Block = blockchain->generateVerifyingBlock(pubKey);
+
+            // The block's timestamp must fall in our slot. If the slot ended
+            // while the block was built, wait for our next turn.
+            consensusData data = getConsensusData(Block.getConsensusData());
+            if(Block.getTimestamp() / blockTarget == sequenceNumber &&
+               data.sequenceNumber == sequenceNumber) {
+                {
+                    std::lock_guard<std::mutex> lock(cryptoMutex);
+                    data.signature = signingKey->sign(Block.getId().toString());
+                }
+                Block.setConsensusData(consensusDataToJson(data));
+
+                if(std::get<0>(blockchain->submitBlock(Block))) {
+                    std::lock_guard<std::mutex> lock(networkMutex);
+                    if(network != nullptr) {
+                        network->broadcastBlock(Block);
+                    }
+                }
+            }
+
+            lastProduced = sequenceNumber;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
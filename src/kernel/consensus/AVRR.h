@@ -1,7 +1,12 @@
 #ifndef AVRR_H_INCLUDED
 #define AVRR_H_INCLUDED
 
+#include <thread>
+#include <mutex>
+
 #include "../blockchain.h"
+#include "../network.h"
+#include "../crypto.h"
 
 namespace CryptoKernel {
 /**
@@ -17,10 +22,20 @@ public:
     * Constructs a AVRR consensus object with the given set
     * of authorised verifier public keys
     *
+    * @param blockchain the blockchain to produce blocks for
     * @param verifiers the set of verifier public keys
     * @param blockTarget the number of seconds between each block
+    * @param pubKey the public key of this node. If it is one of the verifiers
+    *        this node produces blocks in its slots.
+    * @param privKey the private key of this node, used to sign its blocks
     */
-    AVRR(const std::set<std::string>& verifiers, const uint64_t blockTarget);
+    AVRR(CryptoKernel::Blockchain* blockchain,
+         const std::set<std::string>& verifiers,
+         const uint64_t blockTarget,
+         const std::string& pubKey,
+         const std::string& privKey);
+
+    virtual ~AVRR();
 
     /**
     * In AVRR, a block displaces the current block tip if it is at least as high
@@ -28,11 +43,10 @@ public:
     * verifier's block in the round-robin always takes precedence but that verifiers
     * who miss their block submission slot cannot retroactively submit a block.
     */
-    bool isBlockBetter(const CryptoKernel::Blockchain::dbBlock& block,
+    bool isBlockBetter(Storage::Transaction* transaction,
+                       const CryptoKernel::Blockchain::block& block,
                        const CryptoKernel::Blockchain::dbBlock& tip);
 
-    std::string serializeConsensusData(const CryptoKernel::Blockchain::block& block);
-
     /**
     * Checks the following rules:
     *   - The block's sequence number is greater than the previous block
@@ -41,49 +55,89 @@ public:
     *   - Checks the block's timestamp with the system clock to make sure it is not
     *     from the future
     */
-    bool checkConsensusRules(const CryptoKernel::Blockchain::block& block,
-                             const CryptoKernel::Blockchain::block& previousBlockId);
+    bool checkConsensusRules(Storage::Transaction* transaction,
+                             CryptoKernel::Blockchain::block& block,
+                             const CryptoKernel::Blockchain::dbBlock& previousBlock);
 
-    Json::Value generateConsensusData(const CryptoKernel::Blockchain::block& block,
+    /**
+    * Sets the sequence number of the block to the current slot and the
+    * verifier to the given public key. The signature is added by the
+    * verifier once the block is complete.
+    */
+    Json::Value generateConsensusData(Storage::Transaction* transaction,
+                                      const CryptoKernel::BigNum& previousBlockId,
                                       const std::string& publicKey);
 
     /**
-    * Returns the public key of the verifier for the given block
+    * Returns the public key of the verifier scheduled for the given
+    * sequence number
     *
-    * @param block the block to get the verifier of
+    * @param sequenceNumber the slot to get the verifier of
     * @return the public key of the verifier
     */
-    std::string getVerifier(const CryptoKernel::Blockchain::block& block);
+    std::string getVerifier(const uint64_t sequenceNumber) const;
 
     /**
     * Has no effect, always returns true
     */
-    bool verifyTransaction(const CryptoKernel::Blockchain::transaction& tx);
+    bool verifyTransaction(Storage::Transaction* transaction,
+                           const CryptoKernel::Blockchain::transaction& tx);
 
     /**
     * Has no effect, always returns true
     */
-    bool confirmTransaction(const CryptoKernel::Blockchain::transaction& tx);
+    bool confirmTransaction(Storage::Transaction* transaction,
+                            const CryptoKernel::Blockchain::transaction& tx);
 
     /**
     * Has no effect, always returns true
     */
-    bool submitTransaction(const CryptoKernel::Blockchain::transaction& tx);
+    bool submitTransaction(Storage::Transaction* transaction,
+                           const CryptoKernel::Blockchain::transaction& tx);
 
     /**
     * Has no effect, always returns true
     */
-    bool submitBlock(const CryptoKernel::Blockchain::block& block);
+    bool submitBlock(Storage::Transaction* transaction,
+                     const CryptoKernel::Blockchain::block& block);
+
+    /**
+    * Uses the given network to broadcast the blocks this node produces
+    */
+    void setNetwork(CryptoKernel::Network* network);
+
+    /**
+    * Starts producing blocks in this node's slots if it is a verifier
+    */
+    void start();
+
 private:
-    std::set<std::string> verifiers;
+    CryptoKernel::Blockchain* blockchain;
     uint64_t blockTarget;
+    std::string pubKey;
+
+    // The round-robin order of the verifiers, indexed by sequence number
+    std::vector<std::string> schedule;
+
+    // Public keys of the verifiers decoded once, plus our own signing key
+    std::map<std::string, std::unique_ptr<CryptoKernel::Crypto>> verifierKeys;
+    std::unique_ptr<CryptoKernel::Crypto> signingKey;
+    std::mutex cryptoMutex;
+
     struct consensusData {
         uint64_t sequenceNumber;
         std::string signature;
         std::string publicKey;
     };
-    consensusData getConsensusData(const CryptoKernel::Blockchain::block& block);
+    consensusData getConsensusData(const Json::Value& consensusJson);
     Json::Value consensusDataToJson(const consensusData& data);
+
+    CryptoKernel::Network* network;
+    std::mutex networkMutex;
+
+    bool running;
+    std::unique_ptr<std::thread> producerThread;
+    void producer();
 };
 }
 
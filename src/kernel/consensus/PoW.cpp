@@ -5,10 +5,19 @@
 #include "Lyra2REv2/Lyra2RE.h"
 #include "../crypto.h"
 
+namespace {
+    // The largest possible 256-bit hash. A block's work is this less its target.
+    const CryptoKernel::BigNum maxTarget =
+        CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+
+    const CryptoKernel::BigNum minDifficulty =
+        CryptoKernel::BigNum("fffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+}
+
 CryptoKernel::Consensus::PoW::PoW(const uint64_t blockTarget,
                                   CryptoKernel::Blockchain* blockchain,
                                   const bool miner,
-                                  const std::string& pubKey) {
+                                  const std::string& pubKey) : dbBlockData(8192) {
     this->blockTarget = blockTarget;
     this->blockchain = blockchain;
     running = miner;
@@ -39,17 +48,10 @@ void CryptoKernel::Consensus::PoW::miner() {
         uint64_t count = 0;
         CryptoKernel::BigNum pow;
 
-        CryptoKernel::BigNum target = CryptoKernel::BigNum(
-                                          Block.getConsensusData()["target"].asString());
+        consensusData data = getConsensusData(Block);
         CryptoKernel::Blockchain::dbBlock previousBlock = blockchain->getBlockDB(
                     Block.getPreviousBlockId().toString());
-        const CryptoKernel::BigNum inverse =
-              CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-              target;
-        Json::Value consensusData = Block.getConsensusData();
-        consensusData["totalWork"] = (inverse + CryptoKernel::BigNum(
-                                          previousBlock.getConsensusData()["totalWork"].asString())).toString();
-        consensusData["nonce"] = nonce;
+        data.totalWork = (maxTarget - data.target) + getConsensusData(previousBlock).totalWork;
 
         do {
             t = std::time(0);
@@ -57,13 +59,8 @@ void CryptoKernel::Consensus::PoW::miner() {
             if((time2 - now) % 20 == 0 && (time2 - now) > 0) {
                 Block = blockchain->generateVerifyingBlock(pubKey);
                 previousBlock = blockchain->getBlockDB(Block.getPreviousBlockId().toString());
-                target = CryptoKernel::BigNum(Block.getConsensusData()["target"].asString());
-                const CryptoKernel::BigNum inverse =
-                    CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-                    target;
-                consensusData = Block.getConsensusData();
-                consensusData["totalWork"] = (inverse + CryptoKernel::BigNum(
-                                                  previousBlock.getConsensusData()["totalWork"].asString())).toString();
+                data = getConsensusData(Block);
+                data.totalWork = (maxTarget - data.target) + getConsensusData(previousBlock).totalWork;
                 now = time2;
                 count = 0;
             }
@@ -72,10 +69,10 @@ void CryptoKernel::Consensus::PoW::miner() {
             nonce += 1;
 
             pow = calculatePoW(Block, nonce);
-        } while(pow >= target && running);
+        } while(pow >= data.target && running);
 
-        consensusData["nonce"] = nonce;
-        Block.setConsensusData(consensusData);
+        data.nonce = nonce;
+        Block.setConsensusData(consensusDataToJson(data));
 
         if(running) {
             blockchain->submitBlock(Block);
@@ -83,6 +80,100 @@ void CryptoKernel::Consensus::PoW::miner() {
     }
 }
 
+Json::Value CryptoKernel::Consensus::PoW::getWork(const std::string& publicKey) {
+    std::lock_guard<std::mutex> lock(workMutex);
+
+    const uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    const BigNum tipId = blockchain->getBlockDB("tip").getId();
+
+    // Forget templates that no longer build on the tip, and those old enough
+    // that any range handed out for them has long been searched. Each key
+    // gets a fresh template every 20 seconds, so this keeps a handful per key
+    const uint64_t expiry = 120;
+    for(auto it = workTemplates.begin(); it != workTemplates.end();) {
+        if(it->second.block.getPreviousBlockId() != tipId || now - it->second.created >= expiry) {
+            it = workTemplates.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    for(auto it = currentWork.begin(); it != currentWork.end();) {
+        if(workTemplates.find(it->second) == workTemplates.end()) {
+            it = currentWork.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    auto it = workTemplates.end();
+    const auto current = currentWork.find(publicKey);
+    if(current != currentWork.end()) {
+        it = workTemplates.find(current->second);
+    }
+
+    if(it == workTemplates.end() || now - it->second.created >= 20) {
+        CryptoKernel::Blockchain::block Block = blockchain->generateVerifyingBlock(publicKey);
+        const CryptoKernel::Blockchain::dbBlock previousBlock = blockchain->getBlockDB(
+                    Block.getPreviousBlockId().toString());
+
+        consensusData data = getConsensusData(Block);
+        data.totalWork = (maxTarget - data.target) + getConsensusData(previousBlock).totalWork;
+        data.nonce = 0;
+        Block.setConsensusData(consensusDataToJson(data));
+
+        // Ranges start at 1 << 32 so they never overlap the nonces tried by
+        // the built-in miner
+        it = workTemplates.insert(std::make_pair(Block.getId(),
+                                  workTemplate{Block, data.target, now, 1})).first;
+        currentWork.erase(publicKey);
+        currentWork.insert(std::make_pair(publicKey, Block.getId()));
+    }
+
+    const uint64_t range = it->second.nextRange++;
+
+    Json::Value returning;
+    returning["id"] = it->first.toString();
+    returning["target"] = it->second.target.toString();
+    returning["height"] = it->second.block.getHeight();
+    returning["previousBlockId"] = it->second.block.getPreviousBlockId().toString();
+    returning["nonceStart"] = range << 32;
+    returning["nonceEnd"] = (range << 32) | 0xffffffff;
+
+    return returning;
+}
+
+bool CryptoKernel::Consensus::PoW::submitWork(const BigNum& id, const uint64_t nonce) {
+    std::unique_lock<std::mutex> lock(workMutex);
+
+    const auto it = workTemplates.find(id);
+    if(it == workTemplates.end()) {
+        return false;
+    }
+
+    CryptoKernel::Blockchain::block Block = it->second.block;
+    const BigNum target = it->second.target;
+    lock.unlock();
+
+    // Turn away bad solutions before taking the chain lock
+    if(calculatePoW(Block, nonce) >= target) {
+        return false;
+    }
+
+    Json::Value consensusData = Block.getConsensusData();
+    consensusData["nonce"] = nonce;
+    Block.setConsensusData(consensusData);
+
+    // checkConsensusRules is applied by the blockchain as part of submission
+    const bool accepted = std::get<0>(blockchain->submitBlock(Block));
+    if(accepted) {
+        lock.lock();
+        workTemplates.erase(id);
+    }
+
+    return accepted;
+}
+
 bool CryptoKernel::Consensus::PoW::isBlockBetter(Storage::Transaction* transaction,
         const CryptoKernel::Blockchain::block& block,
         const CryptoKernel::Blockchain::dbBlock& tip) {
@@ -91,26 +182,43 @@ bool CryptoKernel::Consensus::PoW::isBlockBetter(Storage::Transaction* transacti
     return blockData.totalWork > tipData.totalWork;
 }
 
+CryptoKernel::BigNum CryptoKernel::Consensus::PoW::getChainWork(
+    const CryptoKernel::Blockchain::dbBlock& block) {
+    return getConsensusData(block).totalWork;
+}
+
 CryptoKernel::Consensus::PoW::consensusData
 CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::block&
         block) {
-    consensusData data;
+    return jsonToConsensusData(block.getConsensusData());
+}
+
+CryptoKernel::Consensus::PoW::consensusData
+CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::dbBlock&
+        block) {
     const Json::Value consensusJson = block.getConsensusData();
+    const BigNum id = block.getId();
+
+    // A block id does not cover its nonce, so only trust the cached entry if
+    // it was taken from the same solution
+    consensusData data;
     try {
-        data.target = CryptoKernel::BigNum(consensusJson["target"].asString());
-        data.totalWork = CryptoKernel::BigNum(consensusJson["totalWork"].asString());
-        data.nonce = consensusJson["nonce"].asUInt64();
+        if(dbBlockData.get(id, data) && data.nonce == consensusJson["nonce"].asUInt64()) {
+            return data;
+        }
     } catch(const Json::Exception& e) {
         throw CryptoKernel::Blockchain::InvalidElementException("Block consensusData JSON is malformed");
     }
+
+    data = jsonToConsensusData(consensusJson);
+    dbBlockData.put(id, data);
+
     return data;
 }
 
 CryptoKernel::Consensus::PoW::consensusData
-CryptoKernel::Consensus::PoW::getConsensusData(const CryptoKernel::Blockchain::dbBlock&
-        block) {
+CryptoKernel::Consensus::PoW::jsonToConsensusData(const Json::Value& consensusJson) {
     consensusData data;
-    const Json::Value consensusJson = block.getConsensusData();
     try {
         data.target = CryptoKernel::BigNum(consensusJson["target"].asString());
         data.totalWork = CryptoKernel::BigNum(consensusJson["totalWork"].asString());
@@ -145,10 +253,7 @@ bool CryptoKernel::Consensus::PoW::checkConsensusRules(Storage::Transaction* tra
 
         //Check total work
         const consensusData tipData = getConsensusData(previousBlock);
-        const BigNum inverse =
-            CryptoKernel::BigNum("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff") -
-            blockData.target;
-        blockData.totalWork = inverse + tipData.totalWork;
+        blockData.totalWork = (maxTarget - blockData.target) + tipData.totalWork;
 
         block.setConsensusData(consensusDataToJson(blockData));
 
@@ -184,16 +289,13 @@ CryptoKernel::Consensus::PoW(blockTarget, blockchain, miner, pubKey) {
 
 CryptoKernel::BigNum CryptoKernel::Consensus::PoW::KGW_SHA256::powFunction(
     const std::string& inputString) {
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(inputString));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(inputString));
 }
 
 CryptoKernel::BigNum CryptoKernel::Consensus::PoW::KGW_SHA256::calculateTarget(
     Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId) {
     const uint64_t minBlocks = 144;
     const uint64_t maxBlocks = 4032;
-    const CryptoKernel::BigNum minDifficulty =
-        CryptoKernel::BigNum("fffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
 
     CryptoKernel::Blockchain::dbBlock currentBlock = blockchain->getBlockDB(transaction,
             previousBlockId.toString());
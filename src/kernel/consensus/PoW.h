@@ -2,8 +2,10 @@
 #define POW_H_INCLUDED
 
 #include <thread>
+#include <mutex>
 
 #include "../blockchain.h"
+#include "../lrucache.h"
 
 namespace CryptoKernel {
 /**
@@ -37,6 +39,12 @@ public:
                        const CryptoKernel::Blockchain::block& block,
                        const CryptoKernel::Blockchain::dbBlock& tip);
 
+    /**
+    * In Proof of Work the chain work is the total work recorded in the
+    * block's consensus data.
+    */
+    CryptoKernel::BigNum getChainWork(const CryptoKernel::Blockchain::dbBlock& block);
+
     std::string serializeConsensusData(const CryptoKernel::Blockchain::block& block);
 
     /**
@@ -95,6 +103,34 @@ public:
                                       const uint64_t nonce);
 
     virtual void start();
+
+    /**
+    * Hands out a unit of work to an external miner. The work is a block
+    * template paying to the given public key and a range of nonces that no
+    * other caller has been given for that template, so any number of miners
+    * can share one template without duplicating effort. Templates are
+    * replaced when the chain tip changes or after 20 seconds, and solutions
+    * are accepted for a template until the tip changes or for two minutes.
+    *
+    * A solution is a nonce in the range such that
+    * powFunction(id + decimal nonce) is below the target.
+    *
+    * @param publicKey the public key the coinbase output of the block pays to
+    * @return a JSON object with the block id, target, height and the first
+    *         and last nonce of the range to search
+    */
+    Json::Value getWork(const std::string& publicKey);
+
+    /**
+    * Submits a solved nonce for a unit of work previously handed out by
+    * getWork. The block is checked against the consensus rules and submitted
+    * to the blockchain.
+    *
+    * @param id the id of the block template that was solved
+    * @param nonce the nonce that solves it
+    * @return true iff the block was accepted by the blockchain
+    */
+    bool submitWork(const BigNum& id, const uint64_t nonce);
 protected:
     CryptoKernel::Blockchain* blockchain;
     uint64_t blockTarget;
@@ -108,10 +144,27 @@ protected:
     Json::Value consensusDataToJson(const consensusData& data);
 
 private:
+    consensusData jsonToConsensusData(const Json::Value& consensusJson);
+
+    /* Typed consensus data of stored blocks by block id. Stored blocks are
+       never modified so this saves re-parsing the hex fields each time a
+       block is revisited, e.g. by every calculateTarget window. */
+    CryptoKernel::LRUCache<BigNum, consensusData> dbBlockData;
+
     bool running;
     void miner();
     std::string pubKey;
     std::unique_ptr<std::thread> minerThread;
+
+    struct workTemplate {
+        CryptoKernel::Blockchain::block block;
+        BigNum target;
+        uint64_t created;
+        uint64_t nextRange;
+    };
+    std::map<BigNum, workTemplate> workTemplates;
+    std::map<std::string, BigNum> currentWork;
+    std::mutex workMutex;
 };
 
 class Consensus::PoW::KGW_SHA256 : public PoW {
@@ -1,90 +1,716 @@
+#include <algorithm>
+#include <chrono>
+
 #include "raft.h"
-#include "crypto.h"
 
-CryptoKernel::Consensus::Raft::Raft(const std::set<std::string> verifiers, const uint64_t electionTimeout, const uint64_t heartbeatTimeout) {
+CryptoKernel::Consensus::Raft::Raft(CryptoKernel::Blockchain* blockchain,
+                                    CryptoKernel::Log* log,
+                                    const std::set<std::string>& verifiers,
+                                    const std::string& pubKey,
+                                    const std::string& privKey,
+                                    const uint64_t electionTimeout,
+                                    const uint64_t heartbeatTimeout,
+                                    const uint64_t blockInterval,
+                                    const unsigned int pipelineDepth,
+                                    const std::string& dbDir) {
+    this->blockchain = blockchain;
+    this->log = log;
     this->verifiers = verifiers;
+    this->pubKey = pubKey;
     this->electionTimeout = electionTimeout;
     this->heartbeatTimeout = heartbeatTimeout;
+    this->blockInterval = blockInterval;
+    this->pipelineDepth = std::max(pipelineDepth, 1u);
+    network = nullptr;
+    running = false;
     currentState = nodeState::follower;
+    lastHeard = 0;
+    currentElectionTimeout = electionTimeout;
+    lastProposal = 0;
+    lastProgress = 0;
+    lastSent = 0;
+
+    for(const std::string& verifier : verifiers) {
+        std::unique_ptr<CryptoKernel::Crypto> key(new CryptoKernel::Crypto());
+        if(!key->setPublicKey(verifier)) {
+            throw std::runtime_error("Raft verifier public key " + verifier + " is invalid");
+        }
+        verifierKeys[verifier] = std::move(key);
+    }
+
+    if(verifiers.find(pubKey) != verifiers.end()) {
+        signingKey.reset(new CryptoKernel::Crypto());
+        if(!signingKey->setPrivateKey(privKey) ||
+           !verifierKeys[pubKey]->verify(pubKey, signingKey->sign(pubKey))) {
+            throw std::runtime_error("Raft private key does not match the verifier public key");
+        }
+    }
+
+    statedb.reset(new CryptoKernel::Storage(dbDir, true, 1, false));
+    state.reset(new CryptoKernel::Storage::Table("state"));
+
+    std::unique_ptr<Storage::Transaction> dbTx(statedb->begin());
+    currentTerm = state->get(dbTx.get(), "term").asUInt64();
+    votedFor = state->get(dbTx.get(), "votedFor").asString();
+    for(const Json::Value& acceptedJson : state->get(dbTx.get(), "accepted")) {
+        accepted.push_back(proposal{acceptedJson["block"],
+                                    acceptedJson["height"].asUInt64(),
+                                    acceptedJson["term"].asUInt64(),
+                                    BigNum(acceptedJson["id"].asString()),
+                                    BigNum(acceptedJson["previousId"].asString())});
+    }
+
+    generator.seed(std::random_device()());
+}
+
+CryptoKernel::Consensus::Raft::~Raft() {
+    setNetwork(nullptr);
+    running = false;
+    if(raftThread) {
+        raftThread->join();
+    }
 }
 
-bool CryptoKernel::Consensus::Raft::isBlockBetter(const CryptoKernel::Blockchain::block block, const CryptoKernel::Blockchain::block tip) {
+bool CryptoKernel::Consensus::Raft::isBlockBetter(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::block& block,
+        const CryptoKernel::Blockchain::dbBlock& tip) {
     return false;
 }
 
-std::string CryptoKernel::Consensus::Raft::serializeConsensusData(const CryptoKernel::Blockchain::block block) {
-    const consensusData blockData = getConsensusData(block);
-    return blockData.leader + blockData.leaderSignature + std::to_string(blockData.term);
+bool CryptoKernel::Consensus::Raft::checkConsensusRules(Storage::Transaction* transaction,
+        CryptoKernel::Blockchain::block& block,
+        const CryptoKernel::Blockchain::dbBlock& previousBlock) {
+    try {
+        const consensusData blockData = getConsensusData(block.getConsensusData());
+        const consensusData previousData = getConsensusData(previousBlock.getConsensusData());
+
+        if(blockData.term < previousData.term) {
+            return false;
+        }
+
+        const std::string id = block.getId().toString();
+        if(!verifySignature(blockData.leader, id, blockData.leaderSignature)) {
+            return false;
+        }
+
+        // The votes are keyed by public key so no verifier is counted twice
+        for(const auto& vote : blockData.votes) {
+            if(!verifySignature(vote.first, id, vote.second)) {
+                return false;
+            }
+        }
+
+        return blockData.votes.size() * 2 > verifiers.size();
+    } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+        return false;
+    }
+}
+
+Json::Value CryptoKernel::Consensus::Raft::generateConsensusData(
+    Storage::Transaction* transaction, const CryptoKernel::BigNum& previousBlockId,
+    const std::string& publicKey) {
+    consensusData data;
+    data.term = 0;
+    data.leader = publicKey;
+
+    return consensusDataToJson(data);
+}
+
+bool CryptoKernel::Consensus::Raft::verifyTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
+    return true;
+}
+
+bool CryptoKernel::Consensus::Raft::confirmTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
+    return true;
+}
+
+bool CryptoKernel::Consensus::Raft::submitTransaction(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::transaction& tx) {
+    return true;
+}
+
+bool CryptoKernel::Consensus::Raft::submitBlock(Storage::Transaction* transaction,
+        const CryptoKernel::Blockchain::block& block) {
+    return true;
+}
+
+void CryptoKernel::Consensus::Raft::setNetwork(CryptoKernel::Network* network) {
+    std::lock_guard<std::mutex> lock(networkMutex);
+    if(this->network != nullptr) {
+        this->network->setConsensusHandler(nullptr);
+    }
+
+    this->network = network;
+
+    if(network != nullptr) {
+        network->setConsensusHandler([this](const Json::Value& message) {
+            return receiveMessage(message);
+        });
+    }
+}
+
+void CryptoKernel::Consensus::Raft::start() {
+    if(!signingKey) {
+        log->printf(LOG_LEVEL_INFO, "Raft(): Not a verifier, following the chain only");
+        return;
+    }
+
+    running = true;
+    raftThread.reset(new std::thread(&CryptoKernel::Consensus::Raft::raftFunc, this));
+}
+
+CryptoKernel::Consensus::Raft::consensusData
+CryptoKernel::Consensus::Raft::getConsensusData(const Json::Value& consensusJson) {
+    consensusData data;
+    try {
+        data.term = consensusJson["term"].asUInt64();
+        data.leader = consensusJson["leader"].asString();
+        data.leaderSignature = consensusJson["leaderSignature"].asString();
+        for(const std::string& publicKey : consensusJson["votes"].getMemberNames()) {
+            data.votes[publicKey] = consensusJson["votes"][publicKey].asString();
+        }
+    } catch(const Json::Exception& e) {
+        throw CryptoKernel::Blockchain::InvalidElementException("Block consensusData JSON is malformed");
+    }
+    return data;
 }
 
-Json::Value CryptoKernel::Consensus::Raft::consensusDataToJson(const consensusData data) {
+Json::Value CryptoKernel::Consensus::Raft::consensusDataToJson(const consensusData& data) {
     Json::Value returning;
+    returning["term"] = data.term;
     returning["leader"] = data.leader;
     returning["leaderSignature"] = data.leaderSignature;
-    returning["term"] = static_cast<unsigned long long int>(data.term);
-    for(std::pair<std::string, std::string> vote : data.votes) {
-        Json::Value voteJson;
-        voteJson["publicKey"] = vote.first;
-        voteJson["signature"] = vote.second;
-        returning["votes"].append(voteJson);
+    for(const auto& vote : data.votes) {
+        returning["votes"][vote.first] = vote.second;
     }
     return returning;
 }
 
-CryptoKernel::Consensus::Raft::consensusData CryptoKernel::Consensus::Raft::getConsensusData(const CryptoKernel::Blockchain::block block) {
-    consensusData data;
-    data.leader = block.consensusData["leader"].asString();
-    data.leaderSignature = block.consensusData["leaderSignature"].asString();
-    data.term = block.consensusData["term"].asUInt64();
-    for(unsigned int i = 0; i < block.consensusData["votes"].size(); i++) {
-        data.votes.push_back(std::pair<std::string, std::string>(block.consensusData["votes"][i]["publicKey"].asString(), block.consensusData["votes"][i]["signature"].asString()));
+void CryptoKernel::Consensus::Raft::saveState() {
+    std::unique_ptr<Storage::Transaction> dbTx(statedb->begin());
+    state->put(dbTx.get(), "term", Json::Value(currentTerm));
+    state->put(dbTx.get(), "votedFor", Json::Value(votedFor));
+    Json::Value acceptedJson = Json::arrayValue;
+    for(const proposal& entry : accepted) {
+        Json::Value entryJson;
+        entryJson["block"] = entry.block;
+        entryJson["height"] = entry.height;
+        entryJson["term"] = entry.term;
+        entryJson["id"] = entry.id.toString();
+        entryJson["previousId"] = entry.previousId.toString();
+        acceptedJson.append(entryJson);
     }
-    return data;
+    state->put(dbTx.get(), "accepted", acceptedJson);
+    dbTx->commit();
 }
 
-bool CryptoKernel::Consensus::Raft::checkConsensusRules(const CryptoKernel::Blockchain::block block, const CryptoKernel::Blockchain::block previousBlock) {
-    const consensusData blockData = getConsensusData(block);
-    // Check if block is from current leader
-    if(blockData.leader == currentLeader && electionTerm == blockData.term) {
-        // If so, check if block has majority of votes
-        std::set<std::string> blockVoters;
-        for(const auto vote : blockData.votes) {
-            if(verifiers.find(vote.first) != verifiers.end()) {
-                if(blockVoters.find(vote.first) != blockVoters.end()) {
-                    return false;
-                } else {
-                    CryptoKernel::Crypto crypto;
-                    if(!crypto.setPublicKey(vote.first)) {
-                        return false;
-                    }
+bool CryptoKernel::Consensus::Raft::verifySignature(const std::string& publicKey,
+        const std::string& message, const std::string& signature) {
+    const auto it = verifierKeys.find(publicKey);
+    if(it == verifierKeys.end() || signature.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(cryptoMutex);
+    return it->second->verify(message, signature);
+}
+
+void CryptoKernel::Consensus::Raft::broadcast(Json::Value message) {
+    message["from"] = pubKey;
+    message["timestamp"] = now();
+    {
+        std::lock_guard<std::mutex> lock(cryptoMutex);
+        message["signature"] = signingKey->sign(CryptoKernel::Storage::toString(message, false));
+    }
+
+    lastSent = now();
+
+    std::lock_guard<std::mutex> lock(networkMutex);
+    if(network != nullptr) {
+        network->broadcastConsensusMessage(message);
+    }
+}
+
+bool CryptoKernel::Consensus::Raft::receiveMessage(const Json::Value& message) {
+    if(!message.isObject()) {
+        return false;
+    }
+
+    const std::string from = message["from"].asString();
+
+    Json::Value signedPart = message;
+    signedPart.removeMember("signature");
+    if(!verifySignature(from, CryptoKernel::Storage::toString(signedPart, false),
+                        message["signature"].asString())) {
+        return false;
+    }
+
+    // Valid messages are relayed even if this node does not take part
+    if(running && from != pubKey) {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        if(inbox.size() < 10000) {
+            inbox.push_back(message);
+        }
+    }
+
+    return true;
+}
+
+void CryptoKernel::Consensus::Raft::raftFunc() {
+    std::uniform_int_distribution<uint64_t> distribution(electionTimeout, 2 * electionTimeout);
+    currentElectionTimeout = distribution(generator);
+    lastHeard = now();
 
-                    if(!crypto.verify(block.id, vote.second)) {
-                        return false;
+    while(running) {
+        std::deque<Json::Value> messages;
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            messages.swap(inbox);
+        }
+
+        for(const Json::Value& message : messages) {
+            try {
+                handleMessage(message);
+            } catch(const Json::Exception& e) {
+                log->printf(LOG_LEVEL_WARN, "Raft(): Received a malformed message");
+            } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+                log->printf(LOG_LEVEL_WARN, "Raft(): Received a proposal with an invalid block");
+            }
+        }
+
+        try {
+            // Proposals that arrived before the block they build on
+            if(!pendingProposals.empty()) {
+                handlePending(blockchain->getBlockDB("tip").getId());
+            }
+
+            // Sign everything accepted this round in a single message
+            if(!pendingVotes.empty()) {
+                Json::Value message;
+                message["type"] = "votes";
+                message["term"] = currentTerm;
+                message["leader"] = currentLeader;
+                for(const Json::Value& vote : pendingVotes) {
+                    message["votes"].append(vote);
+                }
+                pendingVotes.clear();
+                broadcast(message);
+            }
+
+            const uint64_t time = now();
+            if(currentState == nodeState::leader) {
+                trimInFlight(blockchain->getBlockDB("tip"));
+
+                if(!inFlight.empty() && time - lastProgress >= electionTimeout) {
+                    // Followers may have missed some, propose them all again
+                    lastProgress = time;
+                    for(const inFlightEntry& pending : inFlight) {
+                        sendProposal(pending.entry);
                     }
-                    blockVoters.insert(vote.first);
+                } else if(inFlight.size() < pipelineDepth && time - lastProposal >= blockInterval) {
+                    propose();
                 }
-            } else {
-                return false;
+
+                if(now() - lastSent >= heartbeatTimeout) {
+                    Json::Value heartbeat;
+                    heartbeat["type"] = "heartbeat";
+                    heartbeat["term"] = currentTerm;
+                    broadcast(heartbeat);
+                }
+            } else if(time - lastHeard >= currentElectionTimeout) {
+                currentElectionTimeout = distribution(generator);
+                startElection();
             }
+        } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
+            log->printf(LOG_LEVEL_WARN, "Raft(): Failed to build or check a block");
+            inFlight.clear();
         }
 
-        if(blockVoters.size() > 0.5 * verifiers.size()) {
-            return true;
-        } else {
-            /* The block was otherwise valid but doesn't have enough votes yet
+        if(messages.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+}
+
+void CryptoKernel::Consensus::Raft::handleMessage(const Json::Value& message) {
+    const std::string type = message["type"].asString();
+    const std::string from = message["from"].asString();
+    const uint64_t term = message["term"].asUInt64();
 
-               If we haven't signed the block yet, sign it and broadcast a block
-               sign transaction. Also rebroadcast the block so other verifiers
-               can see it.
+    if(term > currentTerm) {
+        updateTerm(term);
+    } else if(term < currentTerm) {
+        return;
+    }
+
+    if(type == "requestvote") {
+        const std::tuple<uint64_t, uint64_t> theirs(message["lastTerm"].asUInt64(),
+                                                    message["lastHeight"].asUInt64());
+        if(currentState != nodeState::leader && (votedFor.empty() || votedFor == from)
+           && theirs >= lastEntry()) {
+            votedFor = from;
+            saveState();
+            lastHeard = now();
+
+            Json::Value vote;
+            vote["type"] = "vote";
+            vote["term"] = currentTerm;
+            vote["candidate"] = from;
+            broadcast(vote);
+        }
+    } else if(type == "vote") {
+        if(currentState == nodeState::candidate && message["candidate"].asString() == pubKey) {
+            votesReceived.insert(from);
+            if(votesReceived.size() * 2 > verifiers.size()) {
+                becomeLeader();
+            }
+        }
+    } else if(type == "heartbeat" || type == "propose") {
+        // There is only ever one leader per term
+        if(currentState == nodeState::leader ||
+           (!currentLeader.empty() && currentLeader != from)) {
+            return;
+        }
 
+        currentState = nodeState::follower;
+        currentLeader = from;
+        lastHeard = now();
 
-            */
+        if(type == "propose") {
+            handleProposal(message);
+        }
+    } else if(type == "votes") {
+        if(currentState == nodeState::leader && message["leader"].asString() == pubKey) {
+            handleVotes(message);
+        }
+    }
+}
+
+void CryptoKernel::Consensus::Raft::updateTerm(const uint64_t term) {
+    if(currentState != nodeState::follower) {
+        log->printf(LOG_LEVEL_INFO, "Raft(): Stepping down, term " + std::to_string(term) +
+                    " has started");
+    }
+
+    currentTerm = term;
+    votedFor = "";
+    currentLeader = "";
+    currentState = nodeState::follower;
+    inFlight.clear();
+    pendingVotes.clear();
+    saveState();
+}
+
+std::tuple<uint64_t, uint64_t> CryptoKernel::Consensus::Raft::lastEntry() {
+    const CryptoKernel::Blockchain::dbBlock tip = blockchain->getBlockDB("tip");
+    if(!accepted.empty() && accepted.back().height > tip.getHeight()) {
+        return std::make_tuple(accepted.back().term, accepted.back().height);
+    }
+
+    return std::make_tuple(getConsensusData(tip.getConsensusData()).term, tip.getHeight());
+}
+
+void CryptoKernel::Consensus::Raft::startElection() {
+    currentTerm++;
+    votedFor = pubKey;
+    currentLeader = "";
+    currentState = nodeState::candidate;
+    votesReceived.clear();
+    votesReceived.insert(pubKey);
+    saveState();
+    lastHeard = now();
+
+    log->printf(LOG_LEVEL_INFO, "Raft(): Starting election for term " +
+                std::to_string(currentTerm));
+
+    if(votesReceived.size() * 2 > verifiers.size()) {
+        becomeLeader();
+        return;
+    }
+
+    const auto last = lastEntry();
+
+    Json::Value request;
+    request["type"] = "requestvote";
+    request["term"] = currentTerm;
+    request["lastTerm"] = std::get<0>(last);
+    request["lastHeight"] = std::get<1>(last);
+    broadcast(request);
+}
+
+void CryptoKernel::Consensus::Raft::becomeLeader() {
+    log->printf(LOG_LEVEL_INFO, "Raft(): Elected leader for term " + std::to_string(currentTerm));
+
+    currentState = nodeState::leader;
+    currentLeader = pubKey;
+    inFlight.clear();
+    lastProposal = 0;
+
+    Json::Value heartbeat;
+    heartbeat["type"] = "heartbeat";
+    heartbeat["term"] = currentTerm;
+    broadcast(heartbeat);
+}
+
+void CryptoKernel::Consensus::Raft::propose() {
+    lastProposal = now();
+
+    const CryptoKernel::Blockchain::dbBlock tip = blockchain->getBlockDB("tip");
+    pruneAccepted(tip);
+
+    // Build on the last block in flight rather than waiting for it to commit
+    const uint64_t height = inFlight.empty() ? tip.getHeight() + 1
+                                             : inFlight.back().entry.height + 1;
+    const BigNum previousId = inFlight.empty() ? tip.getId() : inFlight.back().entry.id;
+
+    std::set<BigNum> excludedTxs;
+    for(const inFlightEntry& pending : inFlight) {
+        excludedTxs.insert(pending.txs.begin(), pending.txs.end());
+    }
+
+    const auto carried = std::find_if(accepted.begin(), accepted.end(),
+    [&](const proposal& entry) {
+        return entry.height == height && entry.previousId == previousId;
+    });
+
+    Json::Value blockJson;
+    if(carried != accepted.end()) {
+        // A block accepted in an earlier term may already have a majority of
+        // signatures somewhere, so it must be finished rather than replaced
+        blockJson = carried->block;
+    } else if(blockchain->mempoolCount() > excludedTxs.size()) {
+        if(inFlight.empty()) {
+            blockJson = blockchain->generateVerifyingBlock(pubKey).toJson();
+        } else {
+            blockJson = blockchain->generateVerifyingBlock(pubKey, previousId, height,
+                                                           excludedTxs).toJson();
         }
     } else {
-        return false;
+        return;
+    }
+
+    CryptoKernel::Blockchain::block Block(blockJson);
+    const std::string id = Block.getId().toString();
+
+    consensusData data;
+    data.term = currentTerm;
+    data.leader = pubKey;
+    {
+        std::lock_guard<std::mutex> lock(cryptoMutex);
+        data.leaderSignature = signingKey->sign(id);
+    }
+    Block.setConsensusData(consensusDataToJson(data));
+
+    inFlightEntry pending;
+    pending.entry = proposal{Block.toJson(), height, currentTerm, Block.getId(), previousId};
+    for(const CryptoKernel::Blockchain::transaction& tx : Block.getTransactions()) {
+        pending.txs.insert(tx.getId());
+    }
+    pending.votes[pubKey] = data.leaderSignature;
+
+    if(inFlight.empty()) {
+        lastProgress = lastProposal;
+    }
+    inFlight.push_back(pending);
+
+    accept(pending.entry);
+    saveState();
+
+    if(pending.votes.size() * 2 > verifiers.size()) {
+        commitReady();
+        return;
+    }
+
+    sendProposal(pending.entry);
+}
+
+void CryptoKernel::Consensus::Raft::sendProposal(const proposal& entry) {
+    Json::Value message;
+    message["type"] = "propose";
+    message["term"] = currentTerm;
+    message["block"] = entry.block;
+    broadcast(message);
+}
+
+void CryptoKernel::Consensus::Raft::handleProposal(const Json::Value& message) {
+    const CryptoKernel::Blockchain::block Block(message["block"]);
+    const consensusData data = getConsensusData(Block.getConsensusData());
+    const std::string id = Block.getId().toString();
+
+    if(data.leader != message["from"].asString() || data.term != currentTerm ||
+       !verifySignature(data.leader, id, data.leaderSignature)) {
+        return;
+    }
+
+    const CryptoKernel::Blockchain::dbBlock tip = blockchain->getBlockDB("tip");
+    pruneAccepted(tip);
+
+    // The leader doesn't wait for a block to commit before building on it,
+    // so a proposal may follow one that has only been accepted so far
+    const BigNum previousId = Block.getPreviousBlockId();
+    uint64_t height;
+    const auto parent = std::find_if(accepted.begin(), accepted.end(),
+    [&](const proposal& entry) {
+        return entry.id == previousId;
+    });
+    if(previousId == tip.getId()) {
+        height = tip.getHeight() + 1;
+    } else if(parent != accepted.end()) {
+        height = parent->height + 1;
+    } else {
+        // Proposals can overtake each other and the commits they build on
+        try {
+            blockchain->getBlockDB(previousId.toString());
+        } catch(const CryptoKernel::Blockchain::NotFoundException& e) {
+            if(pendingProposals.size() >= 64) {
+                pendingProposals.erase(pendingProposals.begin());
+            }
+            pendingProposals[previousId] = std::make_pair(currentTerm, message);
+        }
+        return;
+    }
+
+    if(Block.getHeight() != height) {
+        return;
+    }
+
+    const auto existing = std::find_if(accepted.begin(), accepted.end(),
+    [&](const proposal& entry) {
+        return entry.height == height;
+    });
+    if(existing != accepted.end() && existing->id != Block.getId() &&
+       existing->term == currentTerm) {
+        // Never sign two different blocks at the same height in one term
+        return;
+    }
+
+    accept(proposal{message["block"], height, currentTerm, Block.getId(), previousId});
+    saveState();
+
+    Json::Value vote;
+    vote["id"] = id;
+    {
+        std::lock_guard<std::mutex> lock(cryptoMutex);
+        vote["signature"] = signingKey->sign(id);
+    }
+    pendingVotes.push_back(vote);
+
+    handlePending(Block.getId());
+}
+
+void CryptoKernel::Consensus::Raft::handlePending(const BigNum& parentId) {
+    const auto it = pendingProposals.find(parentId);
+    if(it == pendingProposals.end()) {
+        return;
+    }
+
+    const Json::Value message = it->second.second;
+    pendingProposals.erase(it);
+    if(message["term"].asUInt64() == currentTerm) {
+        handleProposal(message);
+    }
+}
+
+void CryptoKernel::Consensus::Raft::pruneAccepted(const CryptoKernel::Blockchain::dbBlock& tip) {
+    while(!accepted.empty() && accepted.front().height <= tip.getHeight()) {
+        accepted.pop_front();
+    }
+
+    // Another block filled the slot these were built on
+    if(!accepted.empty() && accepted.front().previousId != tip.getId()) {
+        accepted.clear();
+    }
+}
+
+void CryptoKernel::Consensus::Raft::accept(const proposal& entry) {
+    const auto existing = std::find_if(accepted.begin(), accepted.end(),
+    [&](const proposal& other) {
+        return other.height == entry.height;
+    });
+    if(existing != accepted.end() && existing->id == entry.id) {
+        // Proposed again, or carried over by a new leader, so whatever was
+        // accepted on top of it still stands
+        *existing = entry;
+        return;
+    }
+
+    // As in Raft's log, a new entry replaces any at its height or above
+    while(!accepted.empty() && accepted.back().height >= entry.height) {
+        accepted.pop_back();
+    }
+
+    accepted.push_back(entry);
+}
+
+void CryptoKernel::Consensus::Raft::handleVotes(const Json::Value& message) {
+    if(inFlight.empty()) {
+        return;
+    }
+
+    // Votes for every height in flight arrive together
+    const std::string from = message["from"].asString();
+    for(const Json::Value& vote : message["votes"]) {
+        const std::string id = vote["id"].asString();
+        for(inFlightEntry& pending : inFlight) {
+            if(pending.entry.id.toString() == id) {
+                if(verifySignature(from, id, vote["signature"].asString())) {
+                    pending.votes[from] = vote["signature"].asString();
+                }
+                break;
+            }
+        }
+    }
+
+    commitReady();
+}
+
+void CryptoKernel::Consensus::Raft::commitReady() {
+    // Blocks commit in height order, however their votes arrive
+    while(!inFlight.empty() && inFlight.front().votes.size() * 2 > verifiers.size()) {
+        CryptoKernel::Blockchain::block Block(inFlight.front().entry.block);
+        consensusData data = getConsensusData(Block.getConsensusData());
+        data.votes = inFlight.front().votes;
+        Block.setConsensusData(consensusDataToJson(data));
+
+        inFlight.pop_front();
+        lastProgress = now();
+
+        if(std::get<0>(blockchain->submitBlock(Block))) {
+            std::lock_guard<std::mutex> lock(networkMutex);
+            if(network != nullptr) {
+                network->broadcastBlock(Block);
+            }
+        } else {
+            log->printf(LOG_LEVEL_WARN, "Raft(): Blockchain rejected block " +
+                        Block.getId().toString() + " despite a majority of votes");
+
+            // Don't carry a block the chain will never take, or anything
+            // built on it, into later terms
+            while(!accepted.empty() && accepted.back().height >= Block.getHeight()) {
+                accepted.pop_back();
+            }
+            saveState();
+            inFlight.clear();
+        }
     }
 }
 
-bool CryptoKernel::Consensus::Raft::submitBlock(const CryptoKernel::Blockchain::block block) {
+void CryptoKernel::Consensus::Raft::trimInFlight(const CryptoKernel::Blockchain::dbBlock& tip) {
+    while(!inFlight.empty() && tip.getHeight() >= inFlight.front().entry.height) {
+        // Raft chains do not fork, so a taller tip means the slot was filled
+        if(blockchain->getBlockByHeight(inFlight.front().entry.height).getId() ==
+           inFlight.front().entry.id) {
+            inFlight.pop_front();
+        } else {
+            inFlight.clear();
+        }
+        lastProgress = now();
+    }
+}
 
+uint64_t CryptoKernel::Consensus::Raft::now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>
+           (std::chrono::system_clock::now().time_since_epoch()).count();
 }
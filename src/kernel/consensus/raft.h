@@ -1,45 +1,234 @@
 #ifndef RAFT_H_INCLUDED
 #define RAFT_H_INCLUDED
 
-#include "blockchain.h"
+#include <thread>
+#include <mutex>
+#include <random>
+#include <deque>
+
+#include "../blockchain.h"
+#include "../network.h"
+#include "../crypto.h"
 
 namespace CryptoKernel {
-    class Consensus::Raft : public Consensus {
-        public:
-            Raft(const std::set<std::string> verifiers, const uint64_t electionTimeout, const uint64_t heartbeatTimeout);
-
-            /**
-            * In Raft, this should always return false. Blocks are only ever accepted if they are from
-            * the leader and have a majority of votes from other nodes, so there is no chance of forking.
-            */
-            bool isBlockBetter(const CryptoKernel::Blockchain::block block, const CryptoKernel::Blockchain::block tip);
-
-            std::string serializeConsensusData(const CryptoKernel::Blockchain::block block);
-
-            bool checkConsensusRules(const CryptoKernel::Blockchain::block block, const CryptoKernel::Blockchain::block previousBlock);
-
-            bool submitBlock(const CryptoKernel::Blockchain::block block);
-        private:
-            uint64_t electionTimeout;
-            uint64_t heartbeatTimeout;
-            std::set<std::string> verifiers;
-            enum nodeState {
-                follower,
-                candidate,
-                leader
-            };
-            uint64_t electionTerm;
-            std::string currentLeader;
-            struct consensusData {
-                std::string leader;
-                std::string leaderSignature;
-                std::vector<std::pair<std::string, std::string>> votes;
-                uint64_t term;
-            };
-            nodeState currentState;
-            Json::Value consensusDataToJson(const consensusData data);
-            consensusData getConsensusData(const CryptoKernel::Blockchain::block block);
+/**
+* Implements a Raft-style consensus algorithm for a permissioned set of
+* verifiers. The verifiers elect a leader for each term. The leader proposes
+* blocks to the other verifiers, who sign the id of each block they accept.
+* Once a majority of verifiers have signed a block it is final: the leader
+* adds the signatures to the block's consensusData and broadcasts it as a
+* normal block. Every node, verifier or not, checks the signatures in
+* checkConsensusRules.
+*
+* Proposals are pipelined: the leader builds each block on the one before
+* without waiting for it to commit, so several heights can be in flight at
+* once, and followers sign everything they accepted in a round in a single
+* message. Blocks still commit in height order.
+*
+* Verifiers exchange election and voting messages over Network's consensus
+* message channel. Like Raft, it tolerates crashed verifiers but not
+* malicious ones.
+*/
+class Consensus::Raft : public Consensus {
+public:
+    /**
+    * Constructs a Raft consensus object
+    *
+    * @param blockchain the blockchain the verifiers produce blocks for
+    * @param log the log to write election and proposal events to
+    * @param verifiers the public keys of the verifiers
+    * @param pubKey the public key of this node. If it is not one of the
+    *        verifiers this node only follows the chain.
+    * @param privKey the private key of this node
+    * @param electionTimeout the number of milliseconds without hearing from
+    *        a leader after which a verifier starts an election. The actual
+    *        timeout is randomised between this and twice this.
+    * @param heartbeatTimeout the maximum number of milliseconds between
+    *        messages from the leader
+    * @param blockInterval the number of milliseconds between the leader's
+    *        block proposals
+    * @param pipelineDepth the most blocks the leader may have proposed but
+    *        not yet committed
+    * @param dbDir the directory of the database the current term and vote
+    *        are kept in, so a restarted verifier cannot vote twice in a term
+    */
+    Raft(CryptoKernel::Blockchain* blockchain,
+         CryptoKernel::Log* log,
+         const std::set<std::string>& verifiers,
+         const std::string& pubKey,
+         const std::string& privKey,
+         const uint64_t electionTimeout,
+         const uint64_t heartbeatTimeout,
+         const uint64_t blockInterval,
+         const unsigned int pipelineDepth,
+         const std::string& dbDir);
+
+    virtual ~Raft();
+
+    /**
+    * In Raft, this always returns false. Blocks are only ever accepted if
+    * they have a majority of verifier signatures, and a verifier only signs
+    * one block at each height in a term, so there is no chance of forking.
+    */
+    bool isBlockBetter(Storage::Transaction* transaction,
+                       const CryptoKernel::Blockchain::block& block,
+                       const CryptoKernel::Blockchain::dbBlock& tip);
+
+    /**
+    * Checks the following rules:
+    *   - The block's leader is a verifier and has signed the block
+    *   - The block's term is not lower than the previous block's term
+    *   - The block carries valid signatures from a majority of verifiers
+    */
+    bool checkConsensusRules(Storage::Transaction* transaction,
+                             CryptoKernel::Blockchain::block& block,
+                             const CryptoKernel::Blockchain::dbBlock& previousBlock);
+
+    /**
+    * Sets the leader of the block to the given public key. The term and
+    * signatures are added by the leader when it proposes the block.
+    */
+    Json::Value generateConsensusData(Storage::Transaction* transaction,
+                                      const CryptoKernel::BigNum& previousBlockId,
+                                      const std::string& publicKey);
+
+    /**
+    * Has no effect, always returns true
+    */
+    bool verifyTransaction(Storage::Transaction* transaction,
+                           const CryptoKernel::Blockchain::transaction& tx);
+
+    /**
+    * Has no effect, always returns true
+    */
+    bool confirmTransaction(Storage::Transaction* transaction,
+                            const CryptoKernel::Blockchain::transaction& tx);
+
+    /**
+    * Has no effect, always returns true
+    */
+    bool submitTransaction(Storage::Transaction* transaction,
+                           const CryptoKernel::Blockchain::transaction& tx);
+
+    /**
+    * Has no effect, always returns true
+    */
+    bool submitBlock(Storage::Transaction* transaction,
+                     const CryptoKernel::Blockchain::block& block);
+
+    /**
+    * Registers for consensus messages on the given network
+    */
+    void setNetwork(CryptoKernel::Network* network);
+
+    /**
+    * Starts taking part in elections and block production if this node
+    * is a verifier
+    */
+    void start();
+
+private:
+    CryptoKernel::Blockchain* blockchain;
+    CryptoKernel::Log* log;
+
+    std::set<std::string> verifiers;
+    std::string pubKey;
+    uint64_t electionTimeout;
+    uint64_t heartbeatTimeout;
+    uint64_t blockInterval;
+    unsigned int pipelineDepth;
+
+    struct consensusData {
+        uint64_t term;
+        std::string leader;
+        std::string leaderSignature;
+        std::map<std::string, std::string> votes;
     };
+    consensusData getConsensusData(const Json::Value& consensusJson);
+    Json::Value consensusDataToJson(const consensusData& data);
+
+    enum nodeState {
+        follower,
+        candidate,
+        leader
+    };
+
+    // Persistent state
+    std::unique_ptr<CryptoKernel::Storage> statedb;
+    std::unique_ptr<CryptoKernel::Storage::Table> state;
+    uint64_t currentTerm;
+    std::string votedFor;
+    void saveState();
+
+    // The blocks this verifier has signed on top of the tip, lowest first.
+    // Any never committed are carried over to the next leader.
+    struct proposal {
+        Json::Value block;
+        uint64_t height;
+        uint64_t term;
+        BigNum id;
+        BigNum previousId;
+    };
+    std::deque<proposal> accepted;
+    void pruneAccepted(const CryptoKernel::Blockchain::dbBlock& tip);
+    void accept(const proposal& entry);
+
+    // Volatile state, only touched by raftFunc
+    nodeState currentState;
+    std::string currentLeader;
+    uint64_t lastHeard;
+    uint64_t currentElectionTimeout;
+    std::set<std::string> votesReceived;
+
+    // The leader's proposals that have not committed yet, lowest first
+    struct inFlightEntry {
+        proposal entry;
+        std::set<BigNum> txs;
+        std::map<std::string, std::string> votes;
+    };
+    std::deque<inFlightEntry> inFlight;
+    uint64_t lastProposal;
+    // When the lowest proposal in flight last committed or was sent again
+    uint64_t lastProgress;
+    uint64_t lastSent;
+    std::map<BigNum, std::pair<uint64_t, Json::Value>> pendingProposals;
+    std::vector<Json::Value> pendingVotes;
+
+    // Public keys of the verifiers decoded once, plus our own signing key
+    std::map<std::string, std::unique_ptr<CryptoKernel::Crypto>> verifierKeys;
+    std::unique_ptr<CryptoKernel::Crypto> signingKey;
+    std::mutex cryptoMutex;
+    bool verifySignature(const std::string& publicKey, const std::string& message,
+                         const std::string& signature);
+
+    CryptoKernel::Network* network;
+    std::mutex networkMutex;
+    void broadcast(Json::Value message);
+
+    std::deque<Json::Value> inbox;
+    std::mutex inboxMutex;
+    bool receiveMessage(const Json::Value& message);
+
+    bool running;
+    std::unique_ptr<std::thread> raftThread;
+    void raftFunc();
+
+    void handleMessage(const Json::Value& message);
+    void updateTerm(const uint64_t term);
+    void startElection();
+    void becomeLeader();
+    void propose();
+    void sendProposal(const proposal& entry);
+    void handleProposal(const Json::Value& message);
+    void handlePending(const BigNum& parentId);
+    void handleVotes(const Json::Value& message);
+    void commitReady();
+    void trimInFlight(const CryptoKernel::Blockchain::dbBlock& tip);
+    std::tuple<uint64_t, uint64_t> lastEntry();
+
+    std::default_random_engine generator;
+    static uint64_t now();
+};
 }
 
 #endif // RAFT_H_INCLUDED
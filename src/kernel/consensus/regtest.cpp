@@ -1,12 +1,37 @@
 #include <sstream>
+#include <fstream>
 #include <math.h>
 
 #include "regtest.h"
-#include "../crypto.h"
 
 CryptoKernel::Consensus::Regtest::Regtest(CryptoKernel::Blockchain* blockchain) 
 {
 	this->blockchain = blockchain;   
+	generator.seed(std::random_device()());
+
+	// The key is kept beside the chain so the outputs it was paid in earlier
+	// runs stay spendable after a restart
+	const std::string keyFile = blockchain->getDbDir() + "/regtestkey.json";
+	std::ifstream in(keyFile);
+	if(in.is_open()) {
+		const std::string buffer((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		const Json::Value keyJson = CryptoKernel::Storage::toJson(buffer);
+
+		key.reset(new CryptoKernel::Crypto());
+		if(!key->setPublicKey(keyJson["publicKey"].asString())
+		   || !key->setPrivateKey(keyJson["privateKey"].asString())) {
+			throw std::runtime_error("Regtest key file " + keyFile + " is invalid");
+		}
+	} else {
+		key.reset(new CryptoKernel::Crypto(true));
+
+		Json::Value keyJson;
+		keyJson["publicKey"] = key->getPublicKey();
+		keyJson["privateKey"] = key->getPrivateKey();
+
+		std::ofstream out(keyFile);
+		out << CryptoKernel::Storage::toString(keyJson, true);
+	}
 }
 
 CryptoKernel::Consensus::Regtest::~Regtest() {}
@@ -17,7 +42,7 @@ bool CryptoKernel::Consensus::Regtest::isBlockBetter(Storage::Transaction* trans
 	return blockData.isBetter;
 }
 
-bool CryptoKernel::Consensus::Regtest::checkConsensusRules(Storage::Transaction* transaction, const CryptoKernel::Blockchain::block& block, const CryptoKernel::Blockchain::dbBlock& previousBlock)
+bool CryptoKernel::Consensus::Regtest::checkConsensusRules(Storage::Transaction* transaction, CryptoKernel::Blockchain::block& block, const CryptoKernel::Blockchain::dbBlock& previousBlock)
 {
 	return true;
 }
@@ -61,6 +86,10 @@ bool CryptoKernel::Consensus::Regtest::submitBlock(Storage::Transaction* transac
 	return true;
 }
 
+void CryptoKernel::Consensus::Regtest::start()
+{
+}
+
 void CryptoKernel::Consensus::Regtest::mineBlock(const bool isBetter, const std::string &pubKey)
 {
 	CryptoKernel::Blockchain::block Block = blockchain->generateVerifyingBlock(pubKey);
@@ -70,6 +99,87 @@ void CryptoKernel::Consensus::Regtest::mineBlock(const bool isBetter, const std:
 	blockchain->submitBlock(Block);
 }
 
+std::vector<CryptoKernel::BigNum> CryptoKernel::Consensus::Regtest::generateBlocks(const uint64_t count, const std::string& pubKey)
+{
+	const std::string owner = pubKey.empty() ? key->getPublicKey() : pubKey;
+
+	std::vector<CryptoKernel::BigNum> returning;
+	for(uint64_t i = 0; i < count; i++) {
+		CryptoKernel::Blockchain::block Block = blockchain->generateVerifyingBlock(owner);
+		consensusData data;
+		data.isBetter = true;
+		Block.setConsensusData(consensusDataToJson(data));
+
+		if(!std::get<0>(blockchain->submitBlock(Block))) {
+			break;
+		}
+
+		returning.push_back(Block.getId());
+	}
+
+	return returning;
+}
+
+std::vector<CryptoKernel::BigNum> CryptoKernel::Consensus::Regtest::generateTransactions(const uint64_t count)
+{
+	std::lock_guard<std::mutex> lock(generateMutex);
+
+	const std::string publicKey = key->getPublicKey();
+	const std::set<CryptoKernel::Blockchain::dbOutput> unspent = blockchain->getUnspentOutputs(publicKey);
+
+	// Forget spends that have since confirmed or been dropped
+	std::set<CryptoKernel::BigNum> stillPending;
+	for(const auto& out : unspent) {
+		if(pendingSpends.find(out.getId()) != pendingSpends.end()) {
+			stillPending.insert(out.getId());
+		}
+	}
+	pendingSpends = stillPending;
+
+	Json::Value data;
+	data["publicKey"] = publicKey;
+
+	// Mirrors Blockchain::getTransactionFee, 200 bytes covers the signature
+	const uint64_t fee = (CryptoKernel::Storage::toString(data).size() * 2 + 200) * 100;
+	const uint64_t timestamp = static_cast<uint64_t>(std::time(0));
+
+	std::vector<CryptoKernel::BigNum> returning;
+	for(const auto& out : unspent) {
+		if(returning.size() >= count) {
+			break;
+		}
+
+		if(pendingSpends.find(out.getId()) != pendingSpends.end() || out.getValue() <= fee + 2) {
+			continue;
+		}
+
+		const uint64_t value = (out.getValue() - fee) / 2;
+		std::set<CryptoKernel::Blockchain::output> outputs;
+		outputs.insert(CryptoKernel::Blockchain::output(value, generator(), data));
+		outputs.insert(CryptoKernel::Blockchain::output(value, generator(), data));
+
+		Json::Value spendData;
+		spendData["signature"] = key->sign(out.getId().toString() +
+		                                   CryptoKernel::Blockchain::transaction::getOutputSetId(outputs).toString());
+
+		std::set<CryptoKernel::Blockchain::input> inputs;
+		inputs.insert(CryptoKernel::Blockchain::input(out.getId(), spendData));
+
+		const CryptoKernel::Blockchain::transaction tx(inputs, outputs, timestamp);
+		if(std::get<0>(blockchain->submitTransaction(tx))) {
+			pendingSpends.insert(out.getId());
+			returning.push_back(tx.getId());
+		}
+	}
+
+	return returning;
+}
+
+std::string CryptoKernel::Consensus::Regtest::getPublicKey() const
+{
+	return key->getPublicKey();
+}
+
 CryptoKernel::Consensus::Regtest::consensusData
 CryptoKernel::Consensus::Regtest::getConsensusData(const CryptoKernel::Blockchain::block& block) 
 {
@@ -2,8 +2,11 @@
 #define Regtest_H_INCLUDED
 
 #include <thread>
+#include <mutex>
+#include <random>
 
 #include "../blockchain.h"
+#include "../crypto.h"
 
 namespace CryptoKernel {
 
@@ -25,10 +28,8 @@ public:
 		const CryptoKernel::Blockchain::block& block,
 		const CryptoKernel::Blockchain::dbBlock& tip);
 
-	std::string serializeConsensusData(const CryptoKernel::Blockchain::block& block);
-	
 	bool checkConsensusRules(Storage::Transaction* transaction,
-                const CryptoKernel::Blockchain::block& block,
+                CryptoKernel::Blockchain::block& block,
                 const CryptoKernel::Blockchain::dbBlock& previousBlock);
 
 	Json::Value generateConsensusData(Storage::Transaction* transaction,
@@ -57,8 +58,42 @@ public:
 	*/
 	bool submitBlock(Storage::Transaction* transaction, const CryptoKernel::Blockchain::block& block);
 
+	/**
+	* Has no effect, blocks are only produced on request
+	*/
+	void start();
+
 	void mineBlock(const bool isBetter, const std::string &pubKey);
-	
+
+	/**
+	* Builds and connects the given number of blocks on top of the current
+	* tip, each taking as many mempool transactions as fit. Stops early if
+	* the blockchain rejects a block.
+	*
+	* @param count the number of blocks to generate
+	* @param pubKey the public key to pay the block rewards to. If empty the
+	*        rewards go to this object's own key so generateTransactions can
+	*        spend them.
+	* @return the ids of the connected blocks, in order
+	*/
+	std::vector<CryptoKernel::BigNum> generateBlocks(const uint64_t count, const std::string& pubKey);
+
+	/**
+	* Floods the mempool with synthetic transactions. Each one spends a
+	* confirmed output of this object's own key into two outputs back to the
+	* same key, so the number of spendable outputs doubles with every block.
+	*
+	* @param count the maximum number of transactions to generate
+	* @return the ids of the transactions the mempool accepted
+	*/
+	std::vector<CryptoKernel::BigNum> generateTransactions(const uint64_t count);
+
+	/**
+	* Returns the public key that receives the rewards of generateBlocks
+	* when no other key is given
+	*/
+	std::string getPublicKey() const;
+
 protected:
 	CryptoKernel::Blockchain* blockchain;
 	struct consensusData {
@@ -69,8 +104,14 @@ protected:
 	Json::Value consensusDataToJson(const consensusData& data);
 
 private:
-	
-	
+	// Key that funds the synthetic transactions, loaded from regtestkey.json
+	// in the chain's database directory and created there on first start
+	std::unique_ptr<CryptoKernel::Crypto> key;
+
+	// Outputs already spent by a synthetic transaction that hasn't confirmed
+	std::set<CryptoKernel::BigNum> pendingSpends;
+	std::mutex generateMutex;
+	std::mt19937_64 generator;
 };
 
 
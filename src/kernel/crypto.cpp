@@ -19,20 +19,74 @@
 #include <algorithm>
 #include <iomanip>
 #include <cstring>
+#include <vector>
 
 #include <openssl/sha.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <openssl/hmac.h>
 
 #include "crypto.h"
 #include "base64.h"
+#include "lrucache.h"
+
+namespace {
+// Base64 decodes keys and signatures on the stack, only unusually long
+// input goes to the heap
+class Decoded {
+public:
+    explicit Decoded(const std::string& encoded) {
+        buffer = stackBuffer;
+        const size_t maxSize = base64_decoded_max_size(encoded.size());
+        if(maxSize > sizeof(stackBuffer)) {
+            heapBuffer.resize(maxSize);
+            buffer = heapBuffer.data();
+        }
+        length = base64_decode(encoded.data(), encoded.size(), buffer);
+    }
+
+    unsigned char* data() {
+        return buffer;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    unsigned char stackBuffer[160];
+    std::vector<unsigned char> heapBuffer;
+    unsigned char* buffer;
+    size_t length;
+};
+
+// Decompressing a public key is much slower than copying the point, and
+// the same keys are set over and over while validating
+struct CachedPublicKey {
+    std::shared_ptr<EC_POINT> point;
+    point_conversion_form_t form;
+};
+
+CryptoKernel::LRUCache<std::string, CachedPublicKey>& publicKeyCache() {
+    static CryptoKernel::LRUCache<std::string, CachedPublicKey> cache(8192);
+    return cache;
+}
+
+// Building the curve from its name costs far more than copying it, so every
+// instance copies this one
+const EC_GROUP* secp256k1() {
+    static const std::unique_ptr<EC_GROUP, decltype(&EC_GROUP_free)> group(
+        EC_GROUP_new_by_curve_name(NID_secp256k1), EC_GROUP_free);
+    return group.get();
+}
+}
 
 CryptoKernel::Crypto::Crypto(const bool fGenerate) {
     eckey = EC_KEY_new();
     if(eckey == NULL) {
         throw std::runtime_error("Could not generate key pair");
     } else {
-        ecgroup = EC_GROUP_new_by_curve_name(NID_secp256k1);
+        ecgroup = secp256k1() != NULL ? EC_GROUP_dup(secp256k1()) : NULL;
         if(ecgroup == NULL) {
             throw std::runtime_error("Could not generate key pair");
         } else {
@@ -62,10 +116,10 @@ CryptoKernel::Crypto::~Crypto() {
 bool CryptoKernel::Crypto::verify(std::string message,
                                   std::string signature) {
     const std::string messageHash = sha256(message);
-    const std::string decodedSignature = base64_decode(signature);
+    Decoded decodedSignature(signature);
 
     if(!ECDSA_verify(0, (unsigned char*)messageHash.c_str(), (int)messageHash.size(),
-                     (unsigned char*)decodedSignature.c_str(), (int)decodedSignature.size(), eckey)) {
+                     decodedSignature.data(), (int)decodedSignature.size(), eckey)) {
         return false;
     }
 
@@ -129,20 +183,37 @@ std::string CryptoKernel::Crypto::getPrivateKey() {
 }
 
 bool CryptoKernel::Crypto::setPublicKey(std::string publicKey) {
-    const std::string decodedKey = base64_decode(publicKey);
+    CachedPublicKey cached;
+    if(publicKeyCache().get(publicKey, cached)) {
+        if(!EC_KEY_set_public_key(eckey, cached.point.get())) {
+            return false;
+        }
+        EC_KEY_set_conv_form(eckey, cached.form);
+        return true;
+    }
+
+    Decoded decodedKey(publicKey);
 
-    if(!EC_KEY_oct2key(eckey, (unsigned char*)decodedKey.c_str(),
+    if(!EC_KEY_oct2key(eckey, decodedKey.data(),
                        (unsigned int)decodedKey.size(), NULL)) {
         return false;
     } else {
+        // Only valid keys are cached, so junk keys can't push good ones out
+        EC_POINT* point = EC_POINT_dup(EC_KEY_get0_public_key(eckey), ecgroup);
+        if(point != NULL) {
+            cached.point.reset(point, EC_POINT_free);
+            cached.form = EC_KEY_get_conv_form(eckey);
+            publicKeyCache().put(publicKey, cached);
+        }
+
         return true;
     }
 }
 
 bool CryptoKernel::Crypto::setPrivateKey(std::string privateKey) {
-    const std::string decodedKey = base64_decode(privateKey);
+    Decoded decodedKey(privateKey);
 
-    if(!EC_KEY_oct2priv(eckey, (unsigned char*)decodedKey.c_str(),
+    if(!EC_KEY_oct2priv(eckey, decodedKey.data(),
                         (unsigned int)decodedKey.size())) {
         throw std::runtime_error("Could not copy private key");
     } else {
@@ -192,11 +263,19 @@ bool CryptoKernel::Crypto::getStatus() {
 }
 
 std::string base16_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-    std::stringstream ss;
-    for(unsigned int i = 0; i < in_len; i++) {
-        ss << std::setfill('0') << std::setw(2) << std::hex << (unsigned int)bytes_to_encode[i];
+    std::string returning(in_len * 2, '\0');
+    if(in_len > 0) {
+        base16_encode(bytes_to_encode, in_len, &returning[0]);
+    }
+    return returning;
+}
+
+void base16_encode(unsigned char const* bytes_to_encode, const size_t in_len, char* out) {
+    const char* digits = "0123456789abcdef";
+    for(size_t i = 0; i < in_len; i++) {
+        out[i * 2] = digits[bytes_to_encode[i] >> 4];
+        out[i * 2 + 1] = digits[bytes_to_encode[i] & 0x0f];
     }
-    return ss.str();
 }
 
 CryptoKernel::AES256::AES256(const Json::Value& objJson) {
@@ -314,4 +393,172 @@ std::shared_ptr<unsigned char> CryptoKernel::AES256::genKey(const std::string& p
     }
     
     return key;
-}
\ No newline at end of file
+}
+namespace {
+typedef std::unique_ptr<BIGNUM, decltype(&BN_free)> BigNumPtr;
+typedef std::unique_ptr<EC_POINT, decltype(&EC_POINT_free)> PointPtr;
+typedef std::unique_ptr<BN_CTX, decltype(&BN_CTX_free)> ContextPtr;
+
+std::string hmacSha512(const std::string& key, const std::string& data) {
+    unsigned char digest[64];
+    unsigned int digestLen = 0;
+    if(!HMAC(EVP_sha512(), key.data(), key.size(), (const unsigned char*)data.data(),
+             data.size(), digest, &digestLen)) {
+        throw std::runtime_error("Failed to calculate HMAC-SHA512");
+    }
+
+    return std::string((char*)digest, digestLen);
+}
+
+std::string pointToBytes(const EC_POINT* point, BN_CTX* ctx) {
+    unsigned char bytes[65];
+    const size_t len = EC_POINT_point2oct(secp256k1(), point, POINT_CONVERSION_UNCOMPRESSED,
+                                          bytes, sizeof(bytes), ctx);
+    if(len != sizeof(bytes)) {
+        throw std::runtime_error("Could not serialise public key");
+    }
+
+    return std::string((char*)bytes, len);
+}
+
+std::string secretToBytes(const BIGNUM* secret) {
+    unsigned char bytes[32];
+    if(BN_bn2binpad(secret, bytes, sizeof(bytes)) != sizeof(bytes)) {
+        throw std::runtime_error("Could not serialise private key");
+    }
+
+    return std::string((char*)bytes, sizeof(bytes));
+}
+
+// Sets a key's secret, public key and chain code from the 64 bytes of an
+// HMAC, adding the parent's secret or point as BIP32 describes
+void applyTweak(const std::string& digest, const BIGNUM* parentSecret,
+                const EC_POINT* parentPoint, std::string& privateKey,
+                std::string& publicKey, std::string& chainCode) {
+    ContextPtr ctx(BN_CTX_new(), BN_CTX_free);
+    const BIGNUM* order = EC_GROUP_get0_order(secp256k1());
+
+    BigNumPtr tweak(BN_bin2bn((const unsigned char*)digest.data(), 32, nullptr), BN_free);
+    if(!ctx || !tweak || BN_cmp(tweak.get(), order) >= 0) {
+        throw std::runtime_error("Derived key is invalid");
+    }
+
+    PointPtr point(EC_POINT_new(secp256k1()), EC_POINT_free);
+    if(parentPoint == nullptr) {
+        // Without a parent secret this is a master key, and the tweak is
+        // the secret itself
+        BigNumPtr secret(BN_dup(tweak.get()), BN_free);
+        if(!secret || (parentSecret != nullptr &&
+                       !BN_mod_add(secret.get(), tweak.get(), parentSecret, order, ctx.get()))) {
+            throw std::runtime_error("Could not derive private key");
+        }
+
+        if(BN_is_zero(secret.get()) ||
+           !EC_POINT_mul(secp256k1(), point.get(), secret.get(), nullptr, nullptr, ctx.get())) {
+            throw std::runtime_error("Derived key is invalid");
+        }
+
+        privateKey = secretToBytes(secret.get());
+    } else {
+        BigNumPtr one(BN_new(), BN_free);
+        if(!one || !BN_one(one.get()) ||
+           !EC_POINT_mul(secp256k1(), point.get(), tweak.get(), parentPoint, one.get(),
+                         ctx.get())) {
+            throw std::runtime_error("Could not derive public key");
+        }
+
+        privateKey.clear();
+    }
+
+    if(EC_POINT_is_at_infinity(secp256k1(), point.get())) {
+        throw std::runtime_error("Derived key is invalid");
+    }
+
+    publicKey = pointToBytes(point.get(), ctx.get());
+    chainCode = digest.substr(32, 32);
+}
+}
+
+CryptoKernel::HDKey::HDKey() {}
+
+CryptoKernel::HDKey CryptoKernel::HDKey::fromSeed(const std::string& seed) {
+    if(seed.size() < 16) {
+        throw std::runtime_error("Seed is too short");
+    }
+
+    HDKey master;
+    applyTweak(hmacSha512("Bitcoin seed", seed), nullptr, nullptr, master.privateKey,
+               master.publicKey, master.chainCode);
+
+    return master;
+}
+
+CryptoKernel::HDKey::HDKey(const Json::Value& json) {
+    publicKey = base64_decode(json["publicKey"].asString());
+    chainCode = base64_decode(json["chainCode"].asString());
+
+    if(publicKey.size() != 65 || chainCode.size() != 32) {
+        throw std::runtime_error("Extended key is malformed");
+    }
+}
+
+Json::Value CryptoKernel::HDKey::toJson() const {
+    Json::Value returning;
+
+    returning["publicKey"] = getPublicKey();
+    returning["chainCode"] = base64_encode((unsigned char*)chainCode.data(), chainCode.size());
+
+    return returning;
+}
+
+CryptoKernel::HDKey CryptoKernel::HDKey::derive(const uint32_t index) const {
+    std::string data;
+    if(index >= HARDENED) {
+        if(privateKey.empty()) {
+            throw std::runtime_error("Hardened derivation needs the private key");
+        }
+        data = std::string(1, '\0') + privateKey;
+    } else {
+        // The compressed form of the point, which only needs the parity of y
+        data = std::string(1, char(0x02 + (publicKey[64] & 1))) + publicKey.substr(1, 32);
+    }
+
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        data += char((index >> shift) & 0xff);
+    }
+
+    const std::string digest = hmacSha512(chainCode, data);
+
+    HDKey child;
+    if(privateKey.empty()) {
+        ContextPtr ctx(BN_CTX_new(), BN_CTX_free);
+        PointPtr parent(EC_POINT_new(secp256k1()), EC_POINT_free);
+        if(!ctx || !parent ||
+           !EC_POINT_oct2point(secp256k1(), parent.get(), (const unsigned char*)publicKey.data(),
+                               publicKey.size(), ctx.get())) {
+            throw std::runtime_error("Extended key is malformed");
+        }
+
+        applyTweak(digest, nullptr, parent.get(), child.privateKey, child.publicKey,
+                   child.chainCode);
+    } else {
+        BigNumPtr secret(BN_bin2bn((const unsigned char*)privateKey.data(), privateKey.size(),
+                                   nullptr), BN_free);
+        applyTweak(digest, secret.get(), nullptr, child.privateKey, child.publicKey,
+                   child.chainCode);
+    }
+
+    return child;
+}
+
+std::string CryptoKernel::HDKey::getPublicKey() const {
+    return base64_encode((unsigned char*)publicKey.data(), publicKey.size());
+}
+
+std::string CryptoKernel::HDKey::getPrivateKey() const {
+    if(privateKey.empty()) {
+        return "";
+    }
+
+    return base64_encode((unsigned char*)privateKey.data(), privateKey.size());
+}
@@ -86,7 +86,8 @@ public:
     std::string getPrivateKey();
 
     /**
-    * Sets the public key of the instance
+    * Sets the public key of the instance. Recently decoded keys are cached,
+    * so setting the same key again is cheap.
     *
     * @param publicKey valid public key from another instance of Crypto
     * @return true if setting the key was successful, false otherwise
@@ -132,8 +133,89 @@ class AES256 {
         std::shared_ptr<unsigned char> genKey(const std::string& password) const;
 };
 
+/**
+* A secp256k1 key with a chain code, deriving child keys as BIP32 does.
+* Non-hardened children can be derived from the public key alone, so new
+* public keys need neither the private key nor any password stretching.
+*/
+class HDKey {
+public:
+    /**
+    * Derives the master key from a seed
+    *
+    * @param seed the seed bytes, at least 16 of them
+    * @return the master key
+    * @throw std::runtime_error if the seed is too short or gives an invalid key
+    */
+    static HDKey fromSeed(const std::string& seed);
+
+    /**
+    * Loads a public key saved with toJson
+    *
+    * @param json the key's JSON
+    * @throw std::runtime_error if the JSON is not a valid key
+    */
+    HDKey(const Json::Value& json);
+
+    /**
+    * Returns the public key and chain code, base64 encoded. The private
+    * key is never included.
+    *
+    * @return the key's public JSON
+    */
+    Json::Value toJson() const;
+
+    /**
+    * Derives the child key at the given index. Indices from HARDENED up
+    * are hardened and need the private key.
+    *
+    * @param index the child's index
+    * @return the child, with a private key if this key has one
+    * @throw std::runtime_error if the index needs a private key this key
+    *        does not have or, very rarely, gives an invalid key. BIP32 has
+    *        the caller move on to the next index in that case.
+    */
+    HDKey derive(const uint32_t index) const;
+
+    /**
+    * Returns the public key, encoded the same as Crypto::getPublicKey
+    *
+    * @return the public key encoded base64
+    */
+    std::string getPublicKey() const;
+
+    /**
+    * Returns the private key, encoded as Crypto::setPrivateKey takes it
+    *
+    * @return the private key encoded base64, empty if this key only has
+    *         its public half
+    */
+    std::string getPrivateKey() const;
+
+    static const uint32_t HARDENED = 0x80000000;
+
+private:
+    HDKey();
+
+    // Raw bytes: the 65 byte uncompressed point, the 32 byte secret (empty
+    // if public only) and the 32 byte chain code
+    std::string publicKey;
+    std::string privateKey;
+    std::string chainCode;
+};
+
 }
 
 std::string base16_encode(unsigned char const* bytes_to_encode, unsigned int in_len);
 
+/**
+* Hex encodes bytes in lower case into a buffer without allocating
+*
+* @param bytes_to_encode the bytes to encode
+* @param in_len the number of bytes to encode
+* @param out where to write the encoding, room for 2 * in_len characters.
+*        No terminating null is written.
+*/
+void base16_encode(unsigned char const* bytes_to_encode, const size_t in_len, char* out);
+
 #endif // CRYPTO_H_INCLUDED
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "gcsfilter.h"
+
+namespace {
+uint64_t rotl(const uint64_t x, const int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+uint64_t readLE64(const unsigned char* bytes) {
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+// The high 64 bits of a * b
+uint64_t mulHigh(const uint64_t a, const uint64_t b) {
+    const uint64_t aLo = a & 0xffffffff;
+    const uint64_t aHi = a >> 32;
+    const uint64_t bLo = b & 0xffffffff;
+    const uint64_t bHi = b >> 32;
+
+    const uint64_t loLo = aLo * bLo;
+    const uint64_t hiLo = aHi * bLo;
+    const uint64_t loHi = aLo * bHi;
+    const uint64_t cross = (loLo >> 32) + (hiLo & 0xffffffff) + loHi;
+
+    return aHi * bHi + (hiLo >> 32) + (cross >> 32);
+}
+
+class BitWriter {
+public:
+    BitWriter(std::string& out) : out(out), bits(0), nBits(0) {}
+
+    void write(const uint64_t value, const unsigned int count) {
+        for(unsigned int i = count; i > 0; i--) {
+            bits = (bits << 1) | ((value >> (i - 1)) & 1);
+            if(++nBits == 8) {
+                out.push_back(static_cast<char>(bits));
+                bits = 0;
+                nBits = 0;
+            }
+        }
+    }
+
+    void flush() {
+        if(nBits > 0) {
+            out.push_back(static_cast<char>(bits << (8 - nBits)));
+            bits = 0;
+            nBits = 0;
+        }
+    }
+
+private:
+    std::string& out;
+    unsigned int bits;
+    unsigned int nBits;
+};
+
+class BitReader {
+public:
+    BitReader(const std::string& in, const size_t start) : in(in), pos(start), bit(0) {}
+
+    uint64_t read(const unsigned int count) {
+        uint64_t value = 0;
+        for(unsigned int i = 0; i < count; i++) {
+            value = (value << 1) | readBit();
+        }
+
+        return value;
+    }
+
+    unsigned int readBit() {
+        if(pos >= in.size()) {
+            throw std::runtime_error("GCS filter ends early");
+        }
+
+        const unsigned int value = (static_cast<unsigned char>(in[pos]) >> (7 - bit)) & 1;
+        if(++bit == 8) {
+            bit = 0;
+            pos++;
+        }
+
+        return value;
+    }
+
+    uint64_t readGolombRice() {
+        uint64_t quotient = 0;
+        while(readBit() == 1) {
+            quotient++;
+        }
+
+        return (quotient << CryptoKernel::GCSFilter::P) | read(CryptoKernel::GCSFilter::P);
+    }
+
+private:
+    const std::string& in;
+    size_t pos;
+    unsigned int bit;
+};
+}
+
+CryptoKernel::GCSFilter::GCSFilter(const std::string& key,
+                                   const std::set<std::string>& elements) {
+    setKey(key);
+    n = elements.size();
+
+    // CompactSize element count
+    if(n < 0xfd) {
+        encoded.push_back(static_cast<char>(n));
+    } else {
+        unsigned int width = 8;
+        if(n <= 0xffff) {
+            encoded.push_back(static_cast<char>(0xfd));
+            width = 2;
+        } else if(n <= 0xffffffff) {
+            encoded.push_back(static_cast<char>(0xfe));
+            width = 4;
+        } else {
+            encoded.push_back(static_cast<char>(0xff));
+        }
+
+        for(unsigned int i = 0; i < width; i++) {
+            encoded.push_back(static_cast<char>((n >> (8 * i)) & 0xff));
+        }
+    }
+    dataStart = encoded.size();
+
+    BitWriter writer(encoded);
+    uint64_t last = 0;
+    for(const uint64_t value : hashes(elements)) {
+        const uint64_t delta = value - last;
+        for(uint64_t quotient = delta >> P; quotient > 0; quotient--) {
+            writer.write(1, 1);
+        }
+        writer.write(0, 1);
+        writer.write(delta, P);
+        last = value;
+    }
+    writer.flush();
+}
+
+CryptoKernel::GCSFilter::GCSFilter(const std::string& key, const std::string& encoded) {
+    setKey(key);
+    this->encoded = encoded;
+
+    if(encoded.empty()) {
+        throw std::runtime_error("GCS filter is empty");
+    }
+
+    const unsigned char prefix = encoded[0];
+    unsigned int width = 0;
+    if(prefix == 0xfd) {
+        width = 2;
+    } else if(prefix == 0xfe) {
+        width = 4;
+    } else if(prefix == 0xff) {
+        width = 8;
+    }
+
+    if(encoded.size() < 1 + width) {
+        throw std::runtime_error("GCS filter ends early");
+    }
+
+    if(width == 0) {
+        n = prefix;
+    } else {
+        n = 0;
+        for(unsigned int i = width; i > 0; i--) {
+            n = (n << 8) | static_cast<unsigned char>(encoded[i]);
+        }
+    }
+    dataStart = 1 + width;
+
+    // Decode once up front so matching never reads past the end
+    BitReader reader(this->encoded, dataStart);
+    for(uint64_t i = 0; i < n; i++) {
+        reader.readGolombRice();
+    }
+}
+
+void CryptoKernel::GCSFilter::setKey(const std::string& key) {
+    if(key.size() != 16) {
+        throw std::runtime_error("GCS filter key must be 16 bytes");
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.data());
+    k0 = readLE64(bytes);
+    k1 = readLE64(bytes + 8);
+}
+
+std::string CryptoKernel::GCSFilter::getEncoded() const {
+    return encoded;
+}
+
+uint64_t CryptoKernel::GCSFilter::getN() const {
+    return n;
+}
+
+bool CryptoKernel::GCSFilter::match(const std::string& element) const {
+    return matchAny(std::set<std::string>{element});
+}
+
+bool CryptoKernel::GCSFilter::matchAny(const std::set<std::string>& elements) const {
+    if(n == 0 || elements.empty()) {
+        return false;
+    }
+
+    const std::vector<uint64_t> queries = hashes(elements);
+
+    // Walk the filter and the sorted queries together
+    BitReader reader(encoded, dataStart);
+    uint64_t value = 0;
+    auto query = queries.begin();
+    for(uint64_t i = 0; i < n; i++) {
+        value += reader.readGolombRice();
+        while(*query < value) {
+            if(++query == queries.end()) {
+                return false;
+            }
+        }
+
+        if(*query == value) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t CryptoKernel::GCSFilter::hashToRange(const std::string& element) const {
+    // Maps the hash onto [0, N * M) without a division
+    return mulHigh(sipHash(k0, k1, element), n * M);
+}
+
+std::vector<uint64_t> CryptoKernel::GCSFilter::hashes(
+    const std::set<std::string>& elements) const {
+    std::vector<uint64_t> returning;
+    returning.reserve(elements.size());
+    for(const std::string& element : elements) {
+        returning.push_back(hashToRange(element));
+    }
+
+    std::sort(returning.begin(), returning.end());
+
+    return returning;
+}
+
+uint64_t CryptoKernel::GCSFilter::sipHash(const uint64_t k0, const uint64_t k1,
+                                          const std::string& data) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    auto round = [&]() {
+        v0 += v1;
+        v1 = rotl(v1, 13);
+        v1 ^= v0;
+        v0 = rotl(v0, 32);
+        v2 += v3;
+        v3 = rotl(v3, 16);
+        v3 ^= v2;
+        v0 += v3;
+        v3 = rotl(v3, 21);
+        v3 ^= v0;
+        v2 += v1;
+        v1 = rotl(v1, 17);
+        v1 ^= v2;
+        v2 = rotl(v2, 32);
+    };
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    const size_t size = data.size();
+    const size_t end = size - (size % 8);
+    for(size_t i = 0; i < end; i += 8) {
+        const uint64_t m = readLE64(bytes + i);
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    }
+
+    // The last block holds the leftover bytes and the length
+    uint64_t last = static_cast<uint64_t>(size & 0xff) << 56;
+    for(size_t i = 0; i < size % 8; i++) {
+        last |= static_cast<uint64_t>(bytes[end + i]) << (8 * i);
+    }
+
+    v3 ^= last;
+    round();
+    round();
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    round();
+    round();
+    round();
+    round();
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
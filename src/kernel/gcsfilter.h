@@ -0,0 +1,99 @@
+#ifndef GCSFILTER_H_INCLUDED
+#define GCSFILTER_H_INCLUDED
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace CryptoKernel {
+/**
+* A Golomb-coded set, as used by BIP158 block filters. Like a Bloom filter
+* it may match strings that were never added, but it is close to the
+* smallest encoding possible for its false positive rate of 1 in M.
+* Elements are hashed with SipHash-2-4 into [0, N * M), sorted, and the
+* differences between them Golomb-Rice coded with P bit remainders.
+*/
+class GCSFilter {
+public:
+    /**
+    * Builds a filter over the given elements
+    *
+    * @param key the 16 byte SipHash key. Filters are only comparable when
+    *        built with the same key.
+    * @param elements the strings to add
+    */
+    GCSFilter(const std::string& key, const std::set<std::string>& elements);
+
+    /**
+    * Loads a filter from its encoding
+    *
+    * @param key the 16 byte SipHash key it was built with
+    * @param encoded the filter as returned by getEncoded
+    * @throw std::runtime_error if the encoding is malformed
+    */
+    GCSFilter(const std::string& key, const std::string& encoded);
+
+    /**
+    * Returns the filter's encoding: the number of elements as a
+    * CompactSize integer followed by the Golomb-Rice coded bit stream
+    *
+    * @return the encoded filter as raw bytes
+    */
+    std::string getEncoded() const;
+
+    /**
+    * Returns the number of distinct elements the filter was built with
+    *
+    * @return the filter's N
+    */
+    uint64_t getN() const;
+
+    /**
+    * Checks whether an element may be in the filter
+    *
+    * @param element the string to look for
+    * @return false if the element is definitely not in the filter, true otherwise
+    */
+    bool match(const std::string& element) const;
+
+    /**
+    * Checks whether any of the given elements may be in the filter. This
+    * is cheaper than calling match for each, as the filter is only decoded
+    * once.
+    *
+    * @param elements the strings to look for
+    * @return false if none of the elements are in the filter, true otherwise
+    */
+    bool matchAny(const std::set<std::string>& elements) const;
+
+    /**
+    * Computes SipHash-2-4 of the given data
+    *
+    * @param k0 the first 8 bytes of the key, read little endian
+    * @param k1 the last 8 bytes of the key, read little endian
+    * @param data the bytes to hash
+    * @return the 64 bit hash
+    */
+    static uint64_t sipHash(const uint64_t k0, const uint64_t k1, const std::string& data);
+
+    static const unsigned int P = 19;
+    static const uint64_t M = 784931;
+
+private:
+    void setKey(const std::string& key);
+
+    uint64_t hashToRange(const std::string& element) const;
+
+    std::vector<uint64_t> hashes(const std::set<std::string>& elements) const;
+
+    uint64_t k0;
+    uint64_t k1;
+    uint64_t n;
+    // Byte offset of the bit stream within encoded
+    size_t dataStart;
+    std::string encoded;
+};
+}
+
+#endif // GCSFILTER_H_INCLUDED
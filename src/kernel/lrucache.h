@@ -0,0 +1,116 @@
+#ifndef LRUCACHE_H_INCLUDED
+#define LRUCACHE_H_INCLUDED
+
+#include <list>
+#include <map>
+#include <mutex>
+
+namespace CryptoKernel {
+    /**
+    * A thread-safe cache holding at most a fixed number of entries. When
+    * full, inserting a new entry evicts the least recently used one.
+    */
+    template <class Key, class Value>
+    class LRUCache {
+        public:
+            /**
+            * Constructs an empty cache
+            *
+            * @param capacity the maximum number of entries to hold
+            */
+            LRUCache(const size_t capacity) {
+                this->capacity = capacity;
+            }
+
+            /**
+            * Looks up an entry and marks it as the most recently used
+            *
+            * @param key the key to look up
+            * @param value set to the cached value if the key was found
+            * @return true if the key was in the cache, false otherwise
+            */
+            bool get(const Key& key, Value& value) {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                const auto it = index.find(key);
+                if(it == index.end()) {
+                    return false;
+                }
+
+                entries.splice(entries.begin(), entries, it->second);
+                value = it->second->second;
+                return true;
+            }
+
+            /**
+            * Inserts or replaces an entry, evicting the least recently used
+            * entry if the cache is full
+            *
+            * @param key the key to store the value under
+            * @param value the value to store
+            */
+            void put(const Key& key, const Value& value) {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                if(capacity == 0) {
+                    return;
+                }
+
+                const auto it = index.find(key);
+                if(it != index.end()) {
+                    it->second->second = value;
+                    entries.splice(entries.begin(), entries, it->second);
+                    return;
+                }
+
+                if(entries.size() >= capacity) {
+                    index.erase(entries.back().first);
+                    entries.pop_back();
+                }
+
+                entries.emplace_front(key, value);
+                index.insert(std::make_pair(key, entries.begin()));
+            }
+
+            /**
+            * Removes an entry from the cache if it is present
+            *
+            * @param key the key to remove
+            */
+            void erase(const Key& key) {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                const auto it = index.find(key);
+                if(it != index.end()) {
+                    entries.erase(it->second);
+                    index.erase(it);
+                }
+            }
+
+            /**
+            * Removes every entry from the cache
+            */
+            void clear() {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                entries.clear();
+                index.clear();
+            }
+
+            /**
+            * Returns the number of entries in the cache
+            *
+            * @return the number of entries
+            */
+            size_t size() {
+                std::lock_guard<std::mutex> lock(cacheMutex);
+                return entries.size();
+            }
+
+        private:
+            typedef std::list<std::pair<Key, Value>> entryList;
+
+            entryList entries;
+            std::map<Key, typename entryList::iterator> index;
+            size_t capacity;
+            std::mutex cacheMutex;
+    };
+}
+
+#endif // LRUCACHE_H_INCLUDED
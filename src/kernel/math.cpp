@@ -17,8 +17,10 @@
 
 #include <sstream>
 #include <algorithm>
+#include <vector>
 
 #include "ckmath.h"
+#include "crypto.h"
 
 CryptoKernel::BigNum::BigNum(const std::string& hexString) {
     bn = BN_new();
@@ -39,18 +41,30 @@ CryptoKernel::BigNum::~BigNum() {
 }
 
 std::string CryptoKernel::BigNum::toString() const {
-    std::stringstream buffer;
-
-    char* hexStr = BN_bn2hex(bn);
-
-    buffer << hexStr;
-
-    free(hexStr);
-
-    std::string returning = buffer.str();
-    std::transform(returning.begin(), returning.end(), returning.begin(), ::tolower);
-
-    returning.erase(0, std::min(returning.find_first_not_of('0'), returning.size()-1));
+    const int nBytes = BN_num_bytes(bn);
+    if(nBytes == 0) {
+        return "0";
+    }
+
+    // Ids and hashes fit on the stack
+    unsigned char stackBuffer[64];
+    std::vector<unsigned char> heapBuffer;
+    unsigned char* bytes = stackBuffer;
+    if(nBytes > static_cast<int>(sizeof(stackBuffer))) {
+        heapBuffer.resize(nBytes);
+        bytes = heapBuffer.data();
+    }
+    BN_bn2bin(bn, bytes);
+
+    // Lower case hex without leading zeros. Negative numbers keep the
+    // whole first byte after the sign, as BN_bn2hex prints them.
+    const bool negative = BN_is_negative(bn);
+    const bool skipZero = !negative && bytes[0] < 0x10;
+    std::string returning(nBytes * 2 + negative, '-');
+    base16_encode(bytes, nBytes, &returning[negative]);
+    if(skipZero) {
+        returning.erase(0, 1);
+    }
 
     return returning;
 }
@@ -1,4 +1,6 @@
 #include <queue>
+#include <algorithm>
+#include <limits>
 
 #include "merkletree.h"
 #include "crypto.h"
@@ -53,8 +55,7 @@ CryptoKernel::BigNum CryptoKernel::MerkleNode::getRightVal() const {
 
 CryptoKernel::BigNum CryptoKernel::MerkleNode::calcRoot(const std::string& left,
                                                         const std::string& right) {
-    CryptoKernel::Crypto crypto;
-    return CryptoKernel::BigNum(crypto.sha256(left + right));
+    return CryptoKernel::BigNum(CryptoKernel::Crypto::sha256(left + right));
 }
 
 std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTree(
@@ -101,4 +102,77 @@ std::shared_ptr<CryptoKernel::MerkleNode> CryptoKernel::MerkleNode::makeMerkleTr
     }
     
     return nodes[0];
-}
\ No newline at end of file
+}
+
+CryptoKernel::IncrementalMerkleTree::IncrementalMerkleTree() {
+    levels.resize(1);
+    dirtyFrom = 0;
+}
+
+void CryptoKernel::IncrementalMerkleTree::insert(const BigNum& leaf) {
+    auto& leaves = levels[0];
+    const auto it = std::lower_bound(leaves.begin(), leaves.end(), leaf);
+    if(it != leaves.end() && !(leaf < *it)) {
+        return;
+    }
+
+    const size_t position = it - leaves.begin();
+    leaves.insert(it, leaf);
+    dirtyFrom = std::min(dirtyFrom, position);
+}
+
+void CryptoKernel::IncrementalMerkleTree::remove(const BigNum& leaf) {
+    auto& leaves = levels[0];
+    const auto it = std::lower_bound(leaves.begin(), leaves.end(), leaf);
+    if(it == leaves.end() || leaf < *it) {
+        return;
+    }
+
+    const size_t position = it - leaves.begin();
+    leaves.erase(it);
+    dirtyFrom = std::min(dirtyFrom, position);
+}
+
+void CryptoKernel::IncrementalMerkleTree::clear() {
+    levels.clear();
+    levels.resize(1);
+    dirtyFrom = 0;
+}
+
+CryptoKernel::BigNum CryptoKernel::IncrementalMerkleTree::getMerkleRoot() {
+    if(levels[0].empty()) {
+        return BigNum("0");
+    }
+
+    if(dirtyFrom != std::numeric_limits<size_t>::max()) {
+        // Pair up each level into the next, starting from the first pair that
+        // contains an invalidated node. An odd node out is paired with itself.
+        size_t start = dirtyFrom - dirtyFrom % 2;
+        size_t level = 0;
+        do {
+            if(levels.size() < level + 2) {
+                levels.resize(level + 2);
+            }
+            const auto& current = levels[level];
+            auto& next = levels[level + 1];
+            next.resize((current.size() + 1) / 2);
+
+            for(size_t i = start; i < current.size(); i += 2) {
+                const BigNum& right = i + 1 < current.size() ? current[i + 1] : current[i];
+                next[i / 2] = MerkleNode::calcRoot(current[i].toString(), right.toString());
+            }
+
+            start = (start / 2) - (start / 2) % 2;
+            level++;
+        } while(levels[level].size() > 1);
+
+        levels.resize(level + 1);
+        dirtyFrom = std::numeric_limits<size_t>::max();
+    }
+
+    return levels.back()[0];
+}
+
+unsigned int CryptoKernel::IncrementalMerkleTree::size() const {
+    return levels[0].size();
+}
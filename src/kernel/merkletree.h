@@ -3,6 +3,7 @@
 
 #include <set>
 #include <memory>
+#include <vector>
 
 #include "ckmath.h"
 
@@ -37,6 +38,57 @@ namespace CryptoKernel {
             BigNum root;
             
             static BigNum calcRoot(const std::string& left, const std::string& right);
+
+            friend class IncrementalMerkleTree;
+    };
+
+    /**
+    * A Merkle tree over a sorted set of leaves that keeps every level of the
+    * tree in memory. Inserting or removing a leaf only invalidates the nodes
+    * to the right of it, which are rehashed the next time the root is asked
+    * for. Produces the same root as MerkleNode::makeMerkleTree.
+    */
+    class IncrementalMerkleTree {
+        public:
+            IncrementalMerkleTree();
+
+            /**
+            * Adds a leaf to the tree. Has no effect if the leaf is already present.
+            *
+            * @param leaf the leaf to add
+            */
+            void insert(const BigNum& leaf);
+
+            /**
+            * Removes a leaf from the tree. Has no effect if the leaf is not present.
+            *
+            * @param leaf the leaf to remove
+            */
+            void remove(const BigNum& leaf);
+
+            /**
+            * Removes all of the leaves from the tree
+            */
+            void clear();
+
+            /**
+            * Returns the root of the tree, rehashing any nodes that have been
+            * invalidated since the last call
+            *
+            * @return the Merkle root of the current leaves, or zero if there are none
+            */
+            BigNum getMerkleRoot();
+
+            /**
+            * Returns the number of leaves in the tree
+            *
+            * @return the number of leaves
+            */
+            unsigned int size() const;
+
+        private:
+            std::vector<std::vector<BigNum>> levels;
+            size_t dirtyFrom;
     };
 }
 
@@ -1,26 +1,37 @@
 #include "network.h"
 #include "networkpeer.h"
 #include "version.h"
+#include "crypto.h"
 
 #include <list>
 
 CryptoKernel::Network::Network(CryptoKernel::Log* log,
                                CryptoKernel::Blockchain* blockchain,
                                const unsigned int port,
-                               const std::string& dbDir) {
+                               const std::string& dbDir) :
+Network(log, blockchain, defaultOptions(port, dbDir)) {}
+
+CryptoKernel::Network::Network(CryptoKernel::Log* log,
+                               CryptoKernel::Blockchain* blockchain,
+                               const Options& options) : seenConsensusMessages(8192) {
     this->log = log;
     this->blockchain = blockchain;
-    this->port = port;
+    this->options = options;
+    this->port = options.port;
     bestHeight = 0;
 
-    myAddress = sf::IpAddress::getPublicAddress();
+    if(options.publicAddress.empty()) {
+        myAddress = sf::IpAddress::getPublicAddress();
+    } else {
+        myAddress = sf::IpAddress(options.publicAddress);
+    }
 
-    networkdb.reset(new CryptoKernel::Storage(dbDir, false, 8, false));
+    networkdb.reset(new CryptoKernel::Storage(options.dbDir, false, 8, false));
     peers.reset(new Storage::Table("peers"));
 
     std::unique_ptr<Storage::Transaction> dbTx(networkdb->begin());
 
-    std::ifstream infile("peers.txt");
+    std::ifstream infile(options.peersFile);
     if(!infile.is_open()) {
         log->printf(LOG_LEVEL_ERR, "Network(): Could not open peers file");
     }
@@ -40,7 +51,9 @@ CryptoKernel::Network::Network(CryptoKernel::Log* log,
 
     dbTx->commit();
 
-    if(listener.listen(port) != sf::Socket::Done) {
+    const sf::IpAddress bindAddress = options.bindAddress.empty() ? sf::IpAddress::Any :
+                                      sf::IpAddress(options.bindAddress);
+    if(listener.listen(port, bindAddress) != sf::Socket::Done) {
         log->printf(LOG_LEVEL_ERR, "Network(): Could not bind to port " + std::to_string(port));
     }
 
@@ -58,6 +71,34 @@ CryptoKernel::Network::Network(CryptoKernel::Log* log,
     peerThread.reset(new std::thread(&CryptoKernel::Network::peerFunc, this));
 }
 
+CryptoKernel::Network::Options CryptoKernel::Network::defaultOptions(const unsigned int port,
+        const std::string& dbDir) {
+    Options options;
+    options.port = port;
+    options.dbDir = dbDir;
+    return options;
+}
+
+bool CryptoKernel::Network::parseAddress(const std::string& url, sf::IpAddress& address,
+        unsigned short& port) const {
+    const size_t colon = url.find(':');
+    port = this->port;
+    if(colon != std::string::npos) {
+        try {
+            const unsigned long parsedPort = std::stoul(url.substr(colon + 1));
+            if(parsedPort == 0 || parsedPort > 65535) {
+                return false;
+            }
+            port = parsedPort;
+        } catch(const std::exception& e) {
+            return false;
+        }
+    }
+
+    address = sf::IpAddress(url.substr(0, colon));
+    return address != sf::IpAddress::None;
+}
+
 CryptoKernel::Network::~Network() {
     running = false;
     connectionThread->join();
@@ -103,12 +144,16 @@ void CryptoKernel::Network::peerFunc() {
                     continue;
                 }
 
-                sf::IpAddress addr(it->key());
+                sf::IpAddress addr;
+                unsigned short peerPort;
+                if(!parseAddress(it->key(), addr, peerPort)) {
+                    continue;
+                }
 
-                if(addr == sf::IpAddress::getLocalAddress()
-                        || addr == myAddress
-                        || addr == sf::IpAddress::LocalHost
-                        || addr == sf::IpAddress::None) {
+                const bool local = addr == sf::IpAddress::getLocalAddress()
+                                   || addr == myAddress
+                                   || addr == sf::IpAddress::LocalHost;
+                if(local && (!options.allowLocal || peerPort == port)) {
                     continue;
                 }
 
@@ -118,7 +163,7 @@ void CryptoKernel::Network::peerFunc() {
 
                 // Attempt to connect to peer
                 sf::TcpSocket* socket = new sf::TcpSocket();
-                if(socket->connect(it->key(), port, sf::seconds(3)) != sf::Socket::Done) {
+                if(socket->connect(addr, peerPort, sf::seconds(3)) != sf::Socket::Done) {
                     log->printf(LOG_LEVEL_WARN, "Network(): Failed to connect to " + it->key());
                     delete socket;
                     peerInfos[it->key()] = peer;
@@ -126,7 +171,7 @@ void CryptoKernel::Network::peerFunc() {
                 }
 
                 PeerInfo* peerInfo = new PeerInfo;
-                peerInfo->peer.reset(new Peer(socket, blockchain, this, false));
+                peerInfo->peer.reset(new Peer(socket, blockchain, this, false, it->key()));
 
                 // Get height
                 Json::Value info;
@@ -158,7 +203,10 @@ void CryptoKernel::Network::peerFunc() {
 
                 peerInfo->info = peer;
 
-                connected[it->key()].reset(peerInfo);
+                {
+                    std::lock_guard<std::mutex> listLock(peerListMutex);
+                    connected[it->key()].reset(peerInfo);
+                }
                 peerInfos[it->key()] = peer;
                 break;
             }
@@ -200,15 +248,24 @@ void CryptoKernel::Network::peerFunc() {
                         it->second->info["height"] = info["tipHeight"].asUInt64();
 
                         for(const Json::Value& peer : info["peers"]) {
-                            sf::IpAddress addr(peer.asString());
-                            if(addr != sf::IpAddress::None) {
-                                if(!peers->get(dbTx.get(), addr.toString()).isObject()) {
-                                    log->printf(LOG_LEVEL_INFO, "Network(): Discovered new peer: " + addr.toString());
+                            sf::IpAddress addr;
+                            unsigned short peerPort;
+                            if(parseAddress(peer.asString(), addr, peerPort)) {
+                                if(!options.discovery) {
+                                    continue;
+                                }
+
+                                // Keep the port if the peer gave one
+                                const std::string url = peer.asString().find(':') == std::string::npos ?
+                                                        addr.toString() :
+                                                        addr.toString() + ":" + std::to_string(peerPort);
+                                if(!peers->get(dbTx.get(), url).isObject()) {
+                                    log->printf(LOG_LEVEL_INFO, "Network(): Discovered new peer: " + url);
                                     Json::Value newSeed;
                                     newSeed["lastseen"] = 0;
                                     newSeed["height"] = 1;
                                     newSeed["score"] = 0;
-                                    peers->put(dbTx.get(), addr.toString(), newSeed);
+                                    peers->put(dbTx.get(), url, newSeed);
                                 }
                             } else {
                                 changeScore(it->first, 10);
@@ -231,9 +288,17 @@ void CryptoKernel::Network::peerFunc() {
 
             for(const auto& peer : removals) {
                 const auto it = connected.find(peer);
-                peers->put(dbTx.get(), peer, it->second->info);
                 if(it != connected.end()) {
-                    connected.erase(it);
+                    peers->put(dbTx.get(), peer, it->second->info);
+
+                    // The peer is destroyed outside peerListMutex, its
+                    // thread may be waiting on it to broadcast
+                    std::unique_ptr<PeerInfo> removed;
+                    {
+                        std::lock_guard<std::mutex> listLock(peerListMutex);
+                        removed = std::move(it->second);
+                        connected.erase(it);
+                    }
                 }
             }
 
@@ -384,7 +449,7 @@ void CryptoKernel::Network::networkFunc() {
                         failure = false;
 
                         for(auto rit = blocks.rbegin(); rit != blocks.rend() && running; ++rit) {
-                            const auto blockResult = blockchain->submitBlock(*rit);
+                            const auto blockResult = blockchain->submitBlock(*rit, false, peer);
 
                             if(std::get<1>(blockResult)) {
                                 changeScore(peer, 50);
@@ -392,6 +457,11 @@ void CryptoKernel::Network::networkFunc() {
 
                             if(!std::get<0>(blockResult)) {
                                 failure = true;
+                                if(blockchain->isOrphan(rit->getId())) {
+                                    // The block is kept and will connect if its parent turns up
+                                    log->printf(LOG_LEVEL_INFO, "Network(): block from " + peer + " does not connect yet, resyncing");
+                                    break;
+                                }
                                 changeScore(peer, 25);
                                 log->printf(LOG_LEVEL_WARN, "Network(): offending block: " + rit->toJson().toStyledString());
                                 break;
@@ -407,7 +477,7 @@ void CryptoKernel::Network::networkFunc() {
         }
 
         if(bestHeight <= currentHeight || connected.size() == 0 || !madeProgress) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(20000));
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.syncInterval));
             currentHeight = blockchain->getBlockDB("tip").getHeight();
             startHeight = currentHeight;
             this->currentHeight = currentHeight;
@@ -424,32 +494,13 @@ void CryptoKernel::Network::connectionFunc() {
         sf::TcpSocket* client = new sf::TcpSocket();
         if(listener.accept(*client) == sf::Socket::Done) {
             std::lock_guard<std::recursive_mutex> lock(connectedMutex);
-            if(connected.find(client->getRemoteAddress().toString()) != connected.end()) {
-                log->printf(LOG_LEVEL_INFO,
-                            "Network(): Incoming connection duplicates existing connection for " +
-                            client->getRemoteAddress().toString());
-                client->disconnect();
-                delete client;
-                continue;
-            }
-
-            const auto it = banned.find(client->getRemoteAddress().toString());
-            if(it != banned.end()) {
-                if(it->second > static_cast<uint64_t>(std::time(nullptr))) {
-                    log->printf(LOG_LEVEL_INFO,
-                                "Network(): Incoming connection " + client->getRemoteAddress().toString() + " is banned");
-                    client->disconnect();
-                    delete client;
-                    continue;
-                }
-            }
 
             sf::IpAddress addr(client->getRemoteAddress());
 
-            if(addr == sf::IpAddress::getLocalAddress()
-                    || addr == myAddress
-                    || addr == sf::IpAddress::LocalHost
-                    || addr == sf::IpAddress::None) {
+            if(addr == sf::IpAddress::None || (!options.allowLocal &&
+                                               (addr == sf::IpAddress::getLocalAddress()
+                                                || addr == myAddress
+                                                || addr == sf::IpAddress::LocalHost))) {
                 log->printf(LOG_LEVEL_INFO,
                             "Network(): Incoming connection " + client->getRemoteAddress().toString() +
                             " is connecting to self");
@@ -458,12 +509,10 @@ void CryptoKernel::Network::connectionFunc() {
                 continue;
             }
 
-
-            log->printf(LOG_LEVEL_INFO,
-                        "Network(): Peer connected from " + client->getRemoteAddress().toString() + ":" +
-                        std::to_string(client->getRemotePort()));
+            const std::string source = addr.toString() + ":" + std::to_string(client->getRemotePort());
+            log->printf(LOG_LEVEL_INFO, "Network(): Peer connected from " + source);
             PeerInfo* peerInfo = new PeerInfo();
-            peerInfo->peer.reset(new Peer(client, blockchain, this, true));
+            peerInfo->peer.reset(new Peer(client, blockchain, this, true, source));
 
             Json::Value info;
 
@@ -475,24 +524,59 @@ void CryptoKernel::Network::connectionFunc() {
                 continue;
             }
 
+            unsigned int listenPort;
             try {
                 peerInfo->info["height"] = info["tipHeight"].asUInt64();
                 peerInfo->info["version"] = info["version"].asString();
+                listenPort = info["port"].asUInt();
             } catch(const Json::Exception& e) {
                 log->printf(LOG_LEVEL_WARN, "Network(): Incoming peer sent invalid info message");
                 delete peerInfo;
                 continue;
             }
 
+            if(listenPort > 65535) {
+                log->printf(LOG_LEVEL_WARN, "Network(): Incoming peer announced an invalid port");
+                delete peerInfo;
+                continue;
+            }
+
+            // Key the peer by the port it listens on, the same as if we had
+            // dialled it, never by the ephemeral port it connected from.
+            // Peers that announce no port are assumed to use ours.
+            const std::string url = listenPort == 0 || listenPort == port ?
+                                    addr.toString() :
+                                    addr.toString() + ":" + std::to_string(listenPort);
+
+            if(connected.find(url) != connected.end()) {
+                log->printf(LOG_LEVEL_INFO,
+                            "Network(): Incoming connection duplicates existing connection for " +
+                            url);
+                delete peerInfo;
+                continue;
+            }
+
+            if(isBanned(url)) {
+                log->printf(LOG_LEVEL_INFO,
+                            "Network(): Incoming connection " + url + " is banned");
+                delete peerInfo;
+                continue;
+            }
+
+            peerInfo->peer->setUrl(url);
+
             const std::time_t result = std::time(nullptr);
             peerInfo->info["lastseen"] = static_cast<uint64_t>(result);
 
             peerInfo->info["score"] = 0;
 
-            connected[client->getRemoteAddress().toString()].reset(peerInfo);
+            {
+                std::lock_guard<std::mutex> listLock(peerListMutex);
+                connected[url].reset(peerInfo);
+            }
 
             std::unique_ptr<Storage::Transaction> dbTx(networkdb->begin());
-            peers->put(dbTx.get(), client->getRemoteAddress().toString(), peerInfo->info);
+            peers->put(dbTx.get(), url, peerInfo->info);
             dbTx->commit();
         } else {
             delete client;
@@ -507,25 +591,84 @@ unsigned int CryptoKernel::Network::getConnections() {
 
 void CryptoKernel::Network::broadcastTransactions(const
         std::vector<CryptoKernel::Blockchain::transaction> transactions) {
+    sendToPeers([&](Peer* peer) {
+        peer->sendTransactions(transactions);
+    }, "broadcastTransactions");
+}
+
+void CryptoKernel::Network::broadcastBlock(const CryptoKernel::Blockchain::block block) {
+    sendToPeers([&](Peer* peer) {
+        peer->sendBlock(block);
+    }, "broadcastBlock");
+}
+
+void CryptoKernel::Network::broadcastConsensusMessage(const Json::Value& message) {
+    seenConsensusMessages.put(CryptoKernel::Crypto::sha256(
+                              CryptoKernel::Storage::toString(message, false)), true);
+
+    sendToPeers([&](Peer* peer) {
+        peer->sendConsensusMessage(message);
+    }, "broadcastConsensusMessage");
+}
+
+void CryptoKernel::Network::sendToPeers(const std::function<void(Peer*)>& send,
+                                        const std::string& caller) {
+    std::lock_guard<std::mutex> lock(peerListMutex);
+
+    std::vector<Peer*> peerList;
     for(std::map<std::string, std::unique_ptr<PeerInfo>>::iterator it = connected.begin();
             it != connected.end(); it++) {
+        peerList.push_back(it->second->peer.get());
+    }
+
+    const auto sendTo = [&](const size_t i) {
         try {
-            it->second->peer->sendTransactions(transactions);
+            send(peerList[i]);
         } catch(CryptoKernel::Network::Peer::NetworkError& err) {
-            log->printf(LOG_LEVEL_WARN, "Network::broadcastTransactions(): Failed to contact peer");
+            log->printf(LOG_LEVEL_WARN, "Network::" + caller + "(): Failed to contact peer");
+        }
+    };
+
+    if(options.ioPool != nullptr) {
+        options.ioPool->forEach(peerList.size(), sendTo, options.ioThreads);
+    } else {
+        for(size_t i = 0; i < peerList.size(); i++) {
+            sendTo(i);
         }
     }
 }
 
-void CryptoKernel::Network::broadcastBlock(const CryptoKernel::Blockchain::block block) {
-    for(std::map<std::string, std::unique_ptr<PeerInfo>>::iterator it = connected.begin();
-            it != connected.end(); it++) {
-        try {
-            it->second->peer->sendBlock(block);
-        } catch(CryptoKernel::Network::Peer::NetworkError& err) {
-            log->printf(LOG_LEVEL_WARN, "Network::broadcastBlock(): Failed to contact peer");
+void CryptoKernel::Network::setConsensusHandler(const std::function<bool(const Json::Value&)>&
+        handler) {
+    std::lock_guard<std::mutex> lock(consensusMutex);
+    consensusHandler = handler;
+}
+
+bool CryptoKernel::Network::handleConsensusMessage(const Json::Value& message) {
+    const std::string hash = CryptoKernel::Crypto::sha256(
+                                 CryptoKernel::Storage::toString(message, false));
+
+    // Each message arrives once per relaying peer, only handle the first
+    bool seen;
+    if(seenConsensusMessages.get(hash, seen)) {
+        return true;
+    }
+    seenConsensusMessages.put(hash, true);
+
+    {
+        std::lock_guard<std::mutex> lock(consensusMutex);
+        if(!consensusHandler) {
+            return true;
+        }
+
+        if(!consensusHandler(message)) {
+            return false;
         }
     }
+
+    broadcastConsensusMessage(message);
+
+    return true;
 }
 
 double CryptoKernel::Network::syncProgress() {
@@ -533,22 +676,45 @@ double CryptoKernel::Network::syncProgress() {
 }
 
 void CryptoKernel::Network::changeScore(const std::string& url, const uint64_t score) {
-    if(connected[url]) {
-        connected[url]->info["score"] = connected[url]->info["score"].asUInt64() + score;
+    const auto it = connected.find(url);
+    if(it != connected.end() && it->second) {
+        Json::Value& info = it->second->info;
+        info["score"] = info["score"].asUInt64() + score;
         log->printf(LOG_LEVEL_WARN,
                     "Network(): " + url + " misbehaving, increasing ban score by " + std::to_string(
-                        score) + " to " + connected[url]->info["score"].asString());
-        if(connected[url]->info["score"].asUInt64() > 200) {
+                        score) + " to " + info["score"].asString());
+        if(info["score"].asUInt64() > 200) {
             log->printf(LOG_LEVEL_WARN,
                         "Network(): Banning " + url + " for being above the ban score threshold");
             // Ban for 24 hours
             banned[url] = static_cast<uint64_t>(std::time(nullptr)) + 24 * 60 * 60;
         }
-        connected[url]->info["disconnect"] = true;
+        info["disconnect"] = true;
+    }
+}
+
+bool CryptoKernel::Network::isBanned(const std::string& url) {
+    const uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+    const std::string host = url.substr(0, url.find(':'));
+
+    // The port a peer announces is its own choice, so unless nodes share
+    // this machine a ban covers every port of the address
+    for(const auto& ban : banned) {
+        if(ban.second <= now) {
+            continue;
+        }
+
+        if(ban.first == url || (!options.allowLocal && ban.first.substr(0, ban.first.find(':')) == host)) {
+            return true;
+        }
     }
+
+    return false;
 }
 
 std::set<std::string> CryptoKernel::Network::getConnectedPeers() {
+    std::lock_guard<std::mutex> lock(peerListMutex);
+
     std::set<std::string> peerUrls;
     for(const auto& peer : connected) {
         peerUrls.insert(peer.first);
@@ -3,10 +3,13 @@
 
 #include <memory>
 #include <thread>
+#include <functional>
 
 #include <SFML/Network.hpp>
 
 #include "blockchain.h"
+#include "lrucache.h"
+#include "threadpool.h"
 
 namespace CryptoKernel {
 /**
@@ -27,6 +30,62 @@ public:
     Network(CryptoKernel::Log* log, CryptoKernel::Blockchain* blockchain,
             const unsigned int port, const std::string& dbDir);
 
+    /**
+    * Settings for running several networks on one machine, e.g. to simulate
+    * a network of nodes in one process
+    */
+    struct Options {
+        /** The port to listen on, and to connect to for peers without one */
+        unsigned int port = 49000;
+
+        /** The directory of the peers database */
+        std::string dbDir;
+
+        /** File of seed peers, one "address" or "address:port" per line */
+        std::string peersFile = "peers.txt";
+
+        /** Address to listen on, empty for all interfaces */
+        std::string bindAddress;
+
+        /** This node's public address, empty to look it up online */
+        std::string publicAddress;
+
+        /** Allow connections to and from this machine. Incoming peers are
+            then told apart by their port as well as their address. */
+        bool allowLocal = false;
+
+        /** Learn new peers from the peers of connected peers */
+        bool discovery = true;
+
+        /** Milliseconds to wait between sync attempts once caught up */
+        unsigned int syncInterval = 20000;
+
+        /** Simulated one-way latency in milliseconds added to every
+            message received */
+        unsigned int latency = 0;
+
+        /** Simulated bandwidth in bytes per second of every link, 0 for
+            unlimited */
+        uint64_t bandwidth = 0;
+
+        /** Pool to send broadcasts to several peers at once with, which
+            must outlive the network. Null to send to one peer at a time. */
+        ThreadPool* ioPool = nullptr;
+
+        /** The most pool threads one broadcast may use, 0 for all */
+        unsigned int ioThreads = 0;
+    };
+
+    /**
+    * Constructs a network object with the given options
+    *
+    * @param log a pointer to the CK log to use
+    * @param blockchain a pointer to the blockchain to sync
+    * @param options the network settings
+    */
+    Network(CryptoKernel::Log* log, CryptoKernel::Blockchain* blockchain,
+            const Options& options);
+
     /**
     * Default destructor
     */
@@ -54,6 +113,26 @@ public:
     */
     void broadcastBlock(const CryptoKernel::Blockchain::block block);
 
+    /**
+    * Broadcast a consensus algorithm message to connected peers. Peers
+    * relay messages their own handler accepts, so a message reaches every
+    * node participating in consensus, not only direct peers.
+    *
+    * @param message the message to broadcast
+    */
+    void broadcastConsensusMessage(const Json::Value& message);
+
+    /**
+    * Sets the function called with each new consensus message received
+    * from a peer. The handler should return false if the message is invalid,
+    * in which case it is not relayed and the sender is penalised. Pass an
+    * empty function to stop receiving messages; this waits for any running
+    * call to the handler to return.
+    *
+    * @param handler the function to pass consensus messages to
+    */
+    void setConsensusHandler(const std::function<bool(const Json::Value&)>& handler);
+
     /**
     * Returns an estimate of synchronisation progress
     *
@@ -97,6 +176,19 @@ private:
     class Peer;
 
     void changeScore(const std::string& url, const uint64_t score);
+    bool isBanned(const std::string& url);
+
+    void sendToPeers(const std::function<void(Peer*)>& send, const std::string& caller);
+
+    Options options;
+    static Options defaultOptions(const unsigned int port, const std::string& dbDir);
+    bool parseAddress(const std::string& url, sf::IpAddress& address,
+                      unsigned short& port) const;
+
+    bool handleConsensusMessage(const Json::Value& message);
+    std::function<bool(const Json::Value&)> consensusHandler;
+    std::mutex consensusMutex;
+    CryptoKernel::LRUCache<std::string, bool> seenConsensusMessages;
 
     struct PeerInfo {
         std::unique_ptr<Peer> peer;
@@ -105,6 +197,12 @@ private:
     std::map<std::string, std::unique_ptr<PeerInfo>> connected;
     std::recursive_mutex connectedMutex;
 
+    /* Held while peers are added to or removed from connected, and by
+       sendToPeers for the whole send so no peer is destroyed under it.
+       connectedMutex is held across slow requests to peers, so the
+       threads of the peers themselves can only wait on this one. */
+    std::mutex peerListMutex;
+
     CryptoKernel::Log* log;
     CryptoKernel::Blockchain* blockchain;
 
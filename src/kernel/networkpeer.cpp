@@ -1,11 +1,15 @@
+#include <algorithm>
 #include <chrono>
 
 #include "version.h"
 #include "networkpeer.h"
+#include "blockfilterindex.h"
 
 CryptoKernel::Network::Peer::Peer(sf::TcpSocket* client, CryptoKernel::Blockchain* blockchain,
-                                  CryptoKernel::Network* network, const bool incoming) {
+                                  CryptoKernel::Network* network, const bool incoming,
+                                  const std::string& url) {
     this->client = client;
+    this->url = url;
     this->blockchain = blockchain;
     this->network = network;
     running = true;
@@ -98,6 +102,25 @@ void CryptoKernel::Network::Peer::send(const Json::Value& response) {
     clientMutex.unlock();
 }
 
+void CryptoKernel::Network::Peer::shapeLink(const uint64_t bytes) {
+    const Network::Options& options = network->options;
+    if(options.latency == 0 && options.bandwidth == 0) {
+        return;
+    }
+
+    // Queue the message behind those still "on the wire", then hold it
+    // until it would have crossed the link
+    const auto now = std::chrono::steady_clock::now();
+    if(linkFree < now) {
+        linkFree = now;
+    }
+    if(options.bandwidth > 0) {
+        linkFree += std::chrono::microseconds(bytes * 1000000 / options.bandwidth);
+    }
+
+    std::this_thread::sleep_until(linkFree + std::chrono::milliseconds(options.latency));
+}
+
 void CryptoKernel::Network::Peer::requestFunc() {
     uint64_t nRequests = 0;
     uint64_t startTime = static_cast<uint64_t>(std::time(nullptr));
@@ -116,11 +139,13 @@ void CryptoKernel::Network::Peer::requestFunc() {
 
             // Don't allow packets bigger than 50MB
             if(packet.getDataSize() > 50 * 1024 * 1024) {
-                network->changeScore(client->getRemoteAddress().toString(), 250);
+                network->changeScore(getUrl(), 250);
                 running = false;
                 break;
             }
 
+            shapeLink(packet.getDataSize());
+
             std::string requestString;
             packet >> requestString;
 
@@ -133,6 +158,8 @@ void CryptoKernel::Network::Peer::requestFunc() {
                         Json::Value response;
                         response["data"]["version"] = version;
                         response["data"]["tipHeight"] = network->getCurrentHeight();
+                        // Lets peers we dialled key us the same way as peers that dial us
+                        response["data"]["port"] = network->port;
                         for(const auto& peer : network->getConnectedPeers()) {
                             response["data"]["peers"].append(peer);
                         }
@@ -149,7 +176,7 @@ void CryptoKernel::Network::Peer::requestFunc() {
 							if(std::get<0>(txResult)) {
 								txs.push_back(tx);
 							} else if(std::get<1>(txResult)) {
-								network->changeScore(client->getRemoteAddress().toString(), 50);
+								network->changeScore(getUrl(), 50);
 							}
 						}
 
@@ -163,19 +190,24 @@ void CryptoKernel::Network::Peer::requestFunc() {
 						// Don't accept blocks that are more than two hours away from the current time
 						const int64_t now = std::time(nullptr);
 						if(std::abs((int)(now - block.getTimestamp())) > 2 * 60 * 60) {
-							network->changeScore(client->getRemoteAddress().toString(), 50);
+							network->changeScore(getUrl(), 50);
 						} else {
 							try {
 								blockchain->getBlockDB(block.getId().toString());
 							} catch(const CryptoKernel::Blockchain::NotFoundException& e) {
-								const auto blockResult = blockchain->submitBlock(block, false);
+								const auto blockResult = blockchain->submitBlock(block, false,
+                                                                                 getUrl());
 								if(std::get<0>(blockResult)) {
 									network->broadcastBlock(block);
 								} else if(std::get<1>(blockResult)) {
-									network->changeScore(client->getRemoteAddress().toString(), 50);
+									network->changeScore(getUrl(), 50);
 								}
 							}
 						}
+                    } else if(request["command"] == "consensus") {
+                        if(!network->handleConsensusMessage(request["data"])) {
+                            network->changeScore(getUrl(), 50);
+                        }
                     } else if(request["command"] == "getunconfirmed") {
                         const std::set<CryptoKernel::Blockchain::transaction> unconfirmedTransactions =
                             blockchain->getUnconfirmedTransactions();
@@ -208,6 +240,36 @@ void CryptoKernel::Network::Peer::requestFunc() {
                             response["nonce"] = request["nonce"].asUInt64();
                             send(response);
                         }
+                    } else if(request["command"] == "getfilters" ||
+                              request["command"] == "getfilterheaders") {
+                        const bool headers = request["command"] == "getfilterheaders";
+                        const uint64_t start = request["data"]["start"].asUInt64();
+                        const uint64_t end = request["data"]["end"].asUInt64();
+                        CryptoKernel::BlockFilterIndex* filterIndex =
+                            dynamic_cast<CryptoKernel::BlockFilterIndex*>(
+                                blockchain->getIndex("blockfilter"));
+
+                        Json::Value returning;
+                        if(filterIndex != nullptr && end > start &&
+                           (end - start) <= (headers ? 2000 : 100)) {
+                            std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(
+                                blockchain->getTxHandle());
+                            const uint64_t indexHeight =
+                                blockchain->getIndexHeight(dbTx.get(), "blockfilter");
+                            for(uint64_t i = std::max<uint64_t>(start, 1);
+                                i < end && i <= indexHeight; i++) {
+                                if(headers) {
+                                    returning["data"].append(
+                                        filterIndex->getFilterHeader(dbTx.get(), i));
+                                } else {
+                                    returning["data"].append(filterIndex->getEntry(dbTx.get(), i));
+                                }
+                            }
+                        }
+
+                        returning["nonce"] = request["nonce"].asUInt64();
+
+                        send(returning);
                     } else if(request["command"] == "getblock") {
                         if(request["data"]["id"].empty()) {
                             Json::Value response;
@@ -232,7 +294,7 @@ void CryptoKernel::Network::Peer::requestFunc() {
                             send(response);
                         }
                     } else {
-                        network->changeScore(client->getRemoteAddress().toString(), 50);
+                        network->changeScore(getUrl(), 50);
                     }
                 } else if(!request["nonce"].empty()) {
                     std::lock_guard<std::mutex> lock(clientMutex);
@@ -241,15 +303,15 @@ void CryptoKernel::Network::Peer::requestFunc() {
                         responses[request["nonce"].asUInt64()] = request["data"];
                         requests.erase(it);
                     } else {
-                        network->changeScore(client->getRemoteAddress().toString(), 50);
+                        network->changeScore(getUrl(), 50);
                     }
                 }
             } catch(const NetworkError& e) {
                 running = false;
             } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
-                network->changeScore(client->getRemoteAddress().toString(), 50);
+                network->changeScore(getUrl(), 50);
             } catch(const Json::Exception& e) {
-                network->changeScore(client->getRemoteAddress().toString(), 250);
+                network->changeScore(getUrl(), 250);
             }
         } else {
             clientMutex.unlock();
@@ -258,7 +320,7 @@ void CryptoKernel::Network::Peer::requestFunc() {
 
         const uint64_t timeElapsed = static_cast<uint64_t>(std::time(nullptr)) - startTime;
         if(timeElapsed >= 30 && (double)nRequests/(double)timeElapsed > 50.0) {
-            network->changeScore(client->getRemoteAddress().toString(), 20);
+            network->changeScore(getUrl(), 20);
             nRequests = 0;
             startTime += timeElapsed;
         }
@@ -292,6 +354,14 @@ void CryptoKernel::Network::Peer::sendBlock(const CryptoKernel::Blockchain::bloc
     send(request);
 }
 
+void CryptoKernel::Network::Peer::sendConsensusMessage(const Json::Value& message) {
+    Json::Value request;
+    request["command"] = "consensus";
+    request["data"] = message;
+
+    send(request);
+}
+
 std::vector<CryptoKernel::Blockchain::transaction>
 CryptoKernel::Network::Peer::getUnconfirmedTransactions() {
     Json::Value request;
@@ -303,7 +373,7 @@ CryptoKernel::Network::Peer::getUnconfirmedTransactions() {
         try {
             returning.push_back(CryptoKernel::Blockchain::transaction(unconfirmed[i]));
         } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
-            network->changeScore(client->getRemoteAddress().toString(), 50);
+            network->changeScore(getUrl(), 50);
             throw NetworkError();
         }
     }
@@ -327,7 +397,7 @@ CryptoKernel::Blockchain::block CryptoKernel::Network::Peer::getBlock(
     try {
         return CryptoKernel::Blockchain::block(block);
     } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
-        network->changeScore(client->getRemoteAddress().toString(), 50);
+        network->changeScore(getUrl(), 50);
         throw NetworkError();
     }
 }
@@ -345,7 +415,7 @@ std::vector<CryptoKernel::Blockchain::block> CryptoKernel::Network::Peer::getBlo
         try {
             returning.push_back(CryptoKernel::Blockchain::block(blocks[i]));
         } catch(const CryptoKernel::Blockchain::InvalidElementException& e) {
-            network->changeScore(client->getRemoteAddress().toString(), 50);
+            network->changeScore(getUrl(), 50);
             throw NetworkError();
         }
     }
@@ -356,3 +426,13 @@ std::vector<CryptoKernel::Blockchain::block> CryptoKernel::Network::Peer::getBlo
 CryptoKernel::Network::peerStats CryptoKernel::Network::Peer::getPeerStats() const {
     return stats;
 }
+
+void CryptoKernel::Network::Peer::setUrl(const std::string& url) {
+    std::lock_guard<std::mutex> lock(urlMutex);
+    this->url = url;
+}
+
+std::string CryptoKernel::Network::Peer::getUrl() {
+    std::lock_guard<std::mutex> lock(urlMutex);
+    return url;
+}
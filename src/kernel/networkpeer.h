@@ -1,6 +1,7 @@
 #ifndef NETWORKPEER_H_INCLUDED
 #define NETWORKPEER_H_INCLUDED
 
+#include <chrono>
 #include <random>
 
 #include <SFML/Network.hpp>
@@ -10,13 +11,14 @@
 class CryptoKernel::Network::Peer {
 public:
     Peer(sf::TcpSocket* client, CryptoKernel::Blockchain* blockchain,
-         CryptoKernel::Network* network, const bool incoming);
+         CryptoKernel::Network* network, const bool incoming, const std::string& url);
     ~Peer();
 
     Json::Value getInfo();
     void sendTransactions(const std::vector<CryptoKernel::Blockchain::transaction>& 
                           transactions);
     void sendBlock(const CryptoKernel::Blockchain::block& block);
+    void sendConsensusMessage(const Json::Value& message);
     std::vector<CryptoKernel::Blockchain::transaction> getUnconfirmedTransactions();
     CryptoKernel::Blockchain::block getBlock(const uint64_t height, const std::string& id);
     std::vector<CryptoKernel::Blockchain::block> getBlocks(const uint64_t start,
@@ -24,6 +26,9 @@ public:
     
     Network::peerStats getPeerStats() const;
 
+    // Incoming peers are only known by their listening port after the handshake
+    void setUrl(const std::string& url);
+
     class NetworkError : std::exception {
     public:
         virtual const char* what() const throw() {
@@ -35,10 +40,15 @@ private:
     sf::TcpSocket* client;
     CryptoKernel::Blockchain* blockchain;
     CryptoKernel::Network* network;
+    std::string url;
+    std::mutex urlMutex;
+    std::string getUrl();
     std::mutex clientMutex;
     Json::Value sendRecv(const Json::Value& request);
     void send(const Json::Value& response);
     void requestFunc();
+    void shapeLink(const uint64_t bytes);
+    std::chrono::steady_clock::time_point linkFree;
     bool running;
     std::unique_ptr<std::thread> requestThread;
 
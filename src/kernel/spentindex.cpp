@@ -0,0 +1,37 @@
+#include "spentindex.h"
+
+CryptoKernel::SpentIndex::SpentIndex() : ChainIndex("spent") {
+    spends.reset(new Storage::Table("spentSpends"));
+}
+
+void CryptoKernel::SpentIndex::connectBlock(Storage::Transaction* transaction,
+                                            Blockchain* blockchain,
+                                            const Blockchain::block& block,
+                                            const uint64_t height) {
+    for(const Blockchain::transaction& tx : block.getTransactions()) {
+        for(const Blockchain::input& inp : tx.getInputs()) {
+            Json::Value entry;
+            entry["txid"] = tx.getId().toString();
+            entry["inputId"] = inp.getId().toString();
+            entry["height"] = height;
+            spends->put(transaction, inp.getOutputId().toString(), entry);
+        }
+    }
+}
+
+void CryptoKernel::SpentIndex::disconnectBlock(Storage::Transaction* transaction,
+                                               Blockchain* blockchain,
+                                               const Blockchain::block& block,
+                                               const uint64_t height) {
+    // Everything to undo is in the block itself
+    for(const Blockchain::transaction& tx : block.getTransactions()) {
+        for(const Blockchain::input& inp : tx.getInputs()) {
+            spends->erase(transaction, inp.getOutputId().toString());
+        }
+    }
+}
+
+Json::Value CryptoKernel::SpentIndex::getSpendingInfo(Storage::Transaction* transaction,
+                                                      const std::string& outputId) {
+    return spends->get(transaction, outputId);
+}
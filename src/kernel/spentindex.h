@@ -0,0 +1,41 @@
+#ifndef SPENTINDEX_H_INCLUDED
+#define SPENTINDEX_H_INCLUDED
+
+#include "blockchain.h"
+
+namespace CryptoKernel {
+/**
+* Records which main chain transaction spent each output, so a spent
+* output can be followed forward without scanning the chain.
+*/
+class SpentIndex : public ChainIndex {
+public:
+    SpentIndex();
+
+    void connectBlock(Storage::Transaction* transaction,
+                      Blockchain* blockchain,
+                      const Blockchain::block& block,
+                      const uint64_t height);
+
+    void disconnectBlock(Storage::Transaction* transaction,
+                         Blockchain* blockchain,
+                         const Blockchain::block& block,
+                         const uint64_t height);
+
+    /**
+    * Returns what spent the given output
+    *
+    * @param outputId the id of the output
+    * @return JSON with the txid and input id that spent the output and the
+    *         height of the block they are in, or null if no main chain
+    *         transaction has spent it
+    */
+    Json::Value getSpendingInfo(Storage::Transaction* transaction, const std::string& outputId);
+
+private:
+    // Output id to the spending txid, input id and height
+    std::unique_ptr<Storage::Table> spends;
+};
+}
+
+#endif // SPENTINDEX_H_INCLUDED
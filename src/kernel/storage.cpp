@@ -27,16 +27,33 @@
 
 #include "storage.h"
 
+std::shared_ptr<leveldb::Cache> CryptoKernel::Storage::globalCache;
+std::mutex CryptoKernel::Storage::globalCacheMutex;
+
 CryptoKernel::Storage::Storage(const std::string& filename, const bool sync, const unsigned int cache, const bool bloom) {
     leveldb::Options options;
     options.create_if_missing = true;
 
+    this->cache = nullptr;
+    filterPolicy = nullptr;
+
     if(cache > 0) {
-        options.block_cache = leveldb::NewLRUCache(cache * 1024 * 1024);
+        {
+            std::lock_guard<std::mutex> lock(globalCacheMutex);
+            sharedCache = globalCache;
+        }
+
+        if(sharedCache) {
+            options.block_cache = sharedCache.get();
+        } else {
+            this->cache = leveldb::NewLRUCache(cache * 1024 * 1024);
+            options.block_cache = this->cache;
+        }
     }
 
     if(bloom) {
-        options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+        filterPolicy = leveldb::NewBloomFilterPolicy(10);
+        options.filter_policy = filterPolicy;
     }
 
     this->sync = sync;
@@ -46,6 +63,8 @@ CryptoKernel::Storage::Storage(const std::string& filename, const bool sync, con
     dbMutex.unlock();
 
     if(!dbstatus.ok()) {
+        delete this->cache;
+        delete filterPolicy;
         throw std::runtime_error("Failed to open the database");
     }
 }
@@ -54,6 +73,19 @@ CryptoKernel::Storage::~Storage() {
     dbMutex.lock();
     delete db;
     dbMutex.unlock();
+
+    // LevelDB doesn't own these, and they must outlive the database
+    delete cache;
+    delete filterPolicy;
+}
+
+void CryptoKernel::Storage::setSharedCache(const unsigned int cache) {
+    std::lock_guard<std::mutex> lock(globalCacheMutex);
+    if(cache > 0) {
+        globalCache.reset(leveldb::NewLRUCache(static_cast<size_t>(cache) * 1024 * 1024));
+    } else {
+        globalCache.reset();
+    }
 }
 
 Json::Value CryptoKernel::Storage::toJson(const std::string& json) {
@@ -131,7 +163,16 @@ bool CryptoKernel::Storage::Transaction::ended() {
 }
 
 void CryptoKernel::Storage::Transaction::commit() {
+    commit(db->sync);
+}
+
+void CryptoKernel::Storage::Transaction::commit(const bool sync) {
     if(!finished) {
+        if(dbStateCache.empty()) {
+            abort();
+            return;
+        }
+
         leveldb::WriteBatch batch;
         for(auto& update : dbStateCache) {
             if(update.second.erased) {
@@ -142,7 +183,7 @@ void CryptoKernel::Storage::Transaction::commit() {
         }
 
         leveldb::WriteOptions options;
-        options.sync = db->sync;
+        options.sync = sync;
 
         leveldb::Status status = db->db->Write(options, &batch);
 
@@ -205,14 +246,15 @@ Json::Value CryptoKernel::Storage::Table::get(Transaction* transaction,
     return transaction->get(getKey(key, index));
 }
 
-CryptoKernel::Storage::Table::Iterator::Iterator(Table* table, Storage* db) {
+CryptoKernel::Storage::Table::Iterator::Iterator(Table* table, Storage* db,
+        const int index) {
     this->table = table;
     this->db = db;
     db->dbMutex.lock();
 
     it = db->db->NewIterator(leveldb::ReadOptions());
 
-    prefix = table->getKey("");
+    prefix = table->getKey("", index);
 }
 
 CryptoKernel::Storage::Table::Iterator::~Iterator() {
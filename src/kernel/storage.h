@@ -18,6 +18,7 @@
 #ifndef STORAGE_H_INCLUDED
 #define STORAGE_H_INCLUDED
 
+#include <memory>
 #include <mutex>
 
 #include <json/writer.h>
@@ -58,7 +59,24 @@ public:
 
         ~Transaction();
 
+        /**
+        * Writes the transaction's changes in one batch and ends it. A
+        * transaction that changed nothing ends without touching the disk.
+        *
+        * @throw std::runtime_error if the transaction has already ended or
+        *        the write fails
+        */
         void commit();
+
+        /**
+        * Commits as commit() does, overriding the database's sync setting
+        * for this write only
+        *
+        * @param sync set to true to fsync before returning, false to leave
+        *        flushing to the OS
+        */
+        void commit(const bool sync);
+
         void abort();
 
         void put(const std::string& key, const Json::Value& data);
@@ -93,7 +111,15 @@ public:
 
         class Iterator {
         public:
-            Iterator(Table* table, Storage* db);
+            /**
+            * Constructs an iterator over the keys of one index of a table
+            *
+            * @param table the table to iterate over
+            * @param db the database the table is in
+            * @param index the index to iterate over, -1 for the table's
+            *        primary keys
+            */
+            Iterator(Table* table, Storage* db, const int index = -1);
 
             ~Iterator();
 
@@ -148,6 +174,16 @@ public:
     */
     static bool destroy(const std::string& filename);
 
+    /**
+    * Makes every database opened from now on with a non-zero cache share a
+    * single block cache of the given size, rather than each having a cache
+    * of its own. Databases already open keep the cache they have.
+    *
+    * @param cache the size of the shared cache in MB, 0 to go back to a
+             cache per database
+    */
+    static void setSharedCache(const unsigned int cache);
+
     /**
     * Converts a string to a Json::Value
     *
@@ -170,6 +206,13 @@ private:
     leveldb::DB* db;
     std::mutex dbMutex;
     bool sync;
+
+    leveldb::Cache* cache;
+    std::shared_ptr<leveldb::Cache> sharedCache;
+    const leveldb::FilterPolicy* filterPolicy;
+
+    static std::shared_ptr<leveldb::Cache> globalCache;
+    static std::mutex globalCacheMutex;
 };
 }
 
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+
+#include "threadpool.h"
+
+namespace {
+// The pool the current thread works for, if any
+thread_local const CryptoKernel::ThreadPool* currentPool = nullptr;
+}
+
+CryptoKernel::ThreadPool::ThreadPool(const unsigned int threads) {
+    running = true;
+
+    const unsigned int nThreads = threads > 0 ? threads :
+                                  std::max(std::thread::hardware_concurrency(), 1u);
+    for(unsigned int i = 0; i < nThreads; i++) {
+        workers.push_back(std::thread(&CryptoKernel::ThreadPool::worker, this));
+    }
+}
+
+CryptoKernel::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        running = false;
+    }
+    tasksCv.notify_all();
+
+    for(std::thread& thread : workers) {
+        thread.join();
+    }
+}
+
+std::future<void> CryptoKernel::ThreadPool::run(const std::function<void()>& task) {
+    std::packaged_task<void()> packagedTask(task);
+    std::future<void> result = packagedTask.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        tasks.push(std::move(packagedTask));
+    }
+    tasksCv.notify_one();
+
+    return result;
+}
+
+void CryptoKernel::ThreadPool::forEach(const size_t count,
+                                       const std::function<void(const size_t)>& func,
+                                       const unsigned int maxParallel) {
+    // Helpers may only start once the caller has returned, so everything
+    // they touch outside of func lives here rather than on the stack
+    struct State {
+        std::atomic<size_t> next;
+        size_t finished;
+        std::exception_ptr error;
+        std::mutex mut;
+        std::condition_variable done;
+    };
+    std::shared_ptr<State> state(new State());
+    state->next = 0;
+    state->finished = 0;
+
+    const std::function<void()> work = [state, count, &func]() {
+        while(true) {
+            const size_t i = state->next++;
+            if(i >= count) {
+                return;
+            }
+
+            std::exception_ptr error;
+            try {
+                func(i);
+            } catch(...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(state->mut);
+            if(error && !state->error) {
+                state->error = error;
+            }
+            if(++state->finished == count) {
+                state->done.notify_all();
+            }
+        }
+    };
+
+    unsigned int helpers = 0;
+    if(currentPool != this && count > 1) {
+        const unsigned int parallel = maxParallel > 0 ? maxParallel : size() + 1;
+        helpers = std::min<size_t>(std::min(parallel - 1, size()), count - 1);
+    }
+
+    for(unsigned int i = 0; i < helpers; i++) {
+        // func is only called for indices claimed before finished reaches
+        // count, and we wait for that, so the reference stays valid
+        run(work);
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mut);
+    state->done.wait(lock, [&]() {
+        return state->finished == count;
+    });
+
+    if(state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+unsigned int CryptoKernel::ThreadPool::size() const {
+    return workers.size();
+}
+
+void CryptoKernel::ThreadPool::worker() {
+    currentPool = this;
+
+    while(true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasksMutex);
+            tasksCv.wait(lock, [&]() {
+                return !running || !tasks.empty();
+            });
+
+            if(tasks.empty()) {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
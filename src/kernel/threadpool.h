@@ -0,0 +1,75 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace CryptoKernel {
+/**
+* A fixed set of worker threads that run queued tasks. One pool can be
+* shared by several blockchains and networks in the same process so that
+* the number of busy threads stays bounded however many coins are loaded.
+*/
+class ThreadPool {
+public:
+    /**
+    * Starts a pool with the given number of workers
+    *
+    * @param threads the number of worker threads, 0 uses one per hardware
+    *        thread
+    */
+    ThreadPool(const unsigned int threads);
+
+    /**
+    * Finishes the queued tasks, then stops the workers
+    */
+    ~ThreadPool();
+
+    /**
+    * Queues a task to run on a worker
+    *
+    * @param task the function to run
+    * @return a future that becomes ready when the task has run. It holds
+    *         any exception the task threw.
+    */
+    std::future<void> run(const std::function<void()>& task);
+
+    /**
+    * Calls func(i) for every i in [0, count) and waits for all calls to
+    * return. The calling thread takes part, so this makes progress even
+    * when every worker is busy, and calls made from a worker of this pool
+    * simply run inline.
+    *
+    * @param count the number of calls to make
+    * @param func the function to call with each index
+    * @param maxParallel the most calls to run at once, including the
+    *        calling thread. 0 allows one per worker plus the caller.
+    * @throw the first exception thrown by func, once every call has
+    *        finished
+    */
+    void forEach(const size_t count, const std::function<void(const size_t)>& func,
+                 const unsigned int maxParallel = 0);
+
+    /**
+    * Returns the number of worker threads
+    */
+    unsigned int size() const;
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksCv;
+    bool running;
+
+    void worker();
+};
+}
+
+#endif // THREADPOOL_H_INCLUDED
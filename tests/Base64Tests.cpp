@@ -0,0 +1,88 @@
+#include "Base64Tests.h"
+
+#include "crypto.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Base64Test);
+
+Base64Test::Base64Test() {
+}
+
+Base64Test::~Base64Test() {
+}
+
+void Base64Test::setUp() {
+}
+
+void Base64Test::tearDown() {
+}
+
+namespace {
+std::string encode(const std::string& data) {
+    return base64_encode((const unsigned char*)data.c_str(), data.size());
+}
+}
+
+void Base64Test::testEncode() {
+    // RFC 4648 test vectors
+    CPPUNIT_ASSERT_EQUAL(std::string(""), encode(""));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zg=="), encode("f"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm8="), encode("fo"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm9v"), encode("foo"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm9vYg=="), encode("foob"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm9vYmE="), encode("fooba"));
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm9vYmFy"), encode("foobar"));
+
+    const std::string binary("\x00\xfb\xff\x3e\x3f", 5);
+    CPPUNIT_ASSERT_EQUAL(std::string("APv/Pj8="), encode(binary));
+}
+
+void Base64Test::testDecode() {
+    CPPUNIT_ASSERT_EQUAL(std::string(""), base64_decode(""));
+    CPPUNIT_ASSERT_EQUAL(std::string("f"), base64_decode("Zg=="));
+    CPPUNIT_ASSERT_EQUAL(std::string("fo"), base64_decode("Zm8="));
+    CPPUNIT_ASSERT_EQUAL(std::string("foo"), base64_decode("Zm9v"));
+    CPPUNIT_ASSERT_EQUAL(std::string("foobar"), base64_decode("Zm9vYmFy"));
+
+    // Padding is optional
+    CPPUNIT_ASSERT_EQUAL(std::string("fo"), base64_decode("Zm8"));
+
+    const std::string binary("\x00\xfb\xff\x3e\x3f", 5);
+    CPPUNIT_ASSERT_EQUAL(binary, base64_decode(encode(binary)));
+}
+
+void Base64Test::testDecodeStopsAtInvalid() {
+    CPPUNIT_ASSERT_EQUAL(std::string("foo"), base64_decode("Zm9v*mFy"));
+    CPPUNIT_ASSERT_EQUAL(std::string("f"), base64_decode("Zg==Zm9v"));
+    CPPUNIT_ASSERT_EQUAL(std::string(""), base64_decode("!Zm9v"));
+}
+
+void Base64Test::testBufferSizes() {
+    const std::string data = "foobar!";
+    char encoded[16];
+    const size_t encodedLen = base64_encode((const unsigned char*)data.c_str(), data.size(),
+                                            encoded);
+
+    CPPUNIT_ASSERT_EQUAL(base64_encoded_size(data.size()), encodedLen);
+    CPPUNIT_ASSERT_EQUAL(std::string("Zm9vYmFyIQ=="), std::string(encoded, encodedLen));
+
+    unsigned char decoded[16];
+    CPPUNIT_ASSERT(base64_decoded_max_size(encodedLen) >= data.size());
+    const size_t decodedLen = base64_decode(encoded, encodedLen, decoded);
+    CPPUNIT_ASSERT_EQUAL(data, std::string((const char*)decoded, decodedLen));
+
+    CPPUNIT_ASSERT_EQUAL(size_t(0), base64_encoded_size(0));
+    CPPUNIT_ASSERT_EQUAL(size_t(4), base64_encoded_size(1));
+    CPPUNIT_ASSERT_EQUAL(size_t(4), base64_encoded_size(3));
+    CPPUNIT_ASSERT_EQUAL(size_t(8), base64_encoded_size(4));
+    CPPUNIT_ASSERT_EQUAL(size_t(2), base64_decoded_max_size(3));
+    CPPUNIT_ASSERT_EQUAL(size_t(3), base64_decoded_max_size(4));
+}
+
+void Base64Test::testBase16() {
+    const unsigned char data[] = {0x00, 0x0f, 0xa5, 0xff};
+    CPPUNIT_ASSERT_EQUAL(std::string("000fa5ff"), base16_encode(data, 4));
+
+    char out[8];
+    base16_encode(data, 4, out);
+    CPPUNIT_ASSERT_EQUAL(std::string("000fa5ff"), std::string(out, 8));
+}
@@ -0,0 +1,33 @@
+#ifndef BASE64TEST_H
+#define BASE64TEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "base64.h"
+
+class Base64Test : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(Base64Test);
+
+    CPPUNIT_TEST(testEncode);
+    CPPUNIT_TEST(testDecode);
+    CPPUNIT_TEST(testDecodeStopsAtInvalid);
+    CPPUNIT_TEST(testBufferSizes);
+    CPPUNIT_TEST(testBase16);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    Base64Test();
+    virtual ~Base64Test();
+    void setUp();
+    void tearDown();
+
+private:
+    void testEncode();
+    void testDecode();
+    void testDecodeStopsAtInvalid();
+    void testBufferSizes();
+    void testBase16();
+};
+
+#endif
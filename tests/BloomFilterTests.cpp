@@ -0,0 +1,47 @@
+#include "BloomFilterTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(BloomFilterTest);
+
+BloomFilterTest::BloomFilterTest() {
+}
+
+BloomFilterTest::~BloomFilterTest() {
+}
+
+void BloomFilterTest::setUp() {
+}
+
+void BloomFilterTest::tearDown() {
+}
+
+void BloomFilterTest::testContains() {
+    CryptoKernel::BloomFilter filter(100, 0.01);
+    CPPUNIT_ASSERT_EQUAL(size_t(100), filter.capacity());
+    CPPUNIT_ASSERT(!filter.contains("a"));
+
+    // Going over capacity makes false positives likelier, never misses
+    for(unsigned int i = 0; i < 1000; i++) {
+        filter.insert("key" + std::to_string(i));
+    }
+
+    CPPUNIT_ASSERT_EQUAL(size_t(1000), filter.size());
+    for(unsigned int i = 0; i < 1000; i++) {
+        CPPUNIT_ASSERT(filter.contains("key" + std::to_string(i)));
+    }
+}
+
+void BloomFilterTest::testFalsePositiveRate() {
+    CryptoKernel::BloomFilter filter(10000, 0.01);
+    for(unsigned int i = 0; i < 10000; i++) {
+        filter.insert("in" + std::to_string(i));
+    }
+
+    unsigned int falsePositives = 0;
+    for(unsigned int i = 0; i < 100000; i++) {
+        if(filter.contains("out" + std::to_string(i))) {
+            falsePositives++;
+        }
+    }
+
+    CPPUNIT_ASSERT(falsePositives < 2000);
+}
@@ -0,0 +1,27 @@
+#ifndef BLOOMFILTERTEST_H
+#define BLOOMFILTERTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "bloomfilter.h"
+
+class BloomFilterTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(BloomFilterTest);
+
+    CPPUNIT_TEST(testContains);
+    CPPUNIT_TEST(testFalsePositiveRate);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    BloomFilterTest();
+    virtual ~BloomFilterTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testContains();
+    void testFalsePositiveRate();
+};
+
+#endif
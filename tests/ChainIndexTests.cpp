@@ -0,0 +1,233 @@
+#include "ChainIndexTests.h"
+
+#include <cstdio>
+
+#include "crypto.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ChainIndexTest);
+
+namespace {
+const uint64_t blockReward = 100000000;
+const std::string dbDir = "./testchaindb";
+const std::string genesisFile = "./testgenesis.json";
+}
+
+TestChain::TestChain(CryptoKernel::Log* log, const std::string& dbDir) :
+    CryptoKernel::Blockchain(log, dbDir) {}
+
+uint64_t TestChain::getBlockReward(const uint64_t height) {
+    return blockReward;
+}
+
+std::string TestChain::getCoinbaseOwner(const std::string& publicKey) {
+    return publicKey;
+}
+
+ChainIndexTest::ChainIndexTest() {}
+
+ChainIndexTest::~ChainIndexTest() {}
+
+void ChainIndexTest::setUp() {
+    CryptoKernel::Storage::destroy(dbDir);
+    std::remove(genesisFile.c_str());
+
+    log.reset(new CryptoKernel::Log("testChainIndex.log"));
+
+    addressIndex.reset(new CryptoKernel::AddressIndex());
+    spentIndex.reset(new CryptoKernel::SpentIndex());
+    chainStatsIndex.reset(new CryptoKernel::ChainStatsIndex());
+
+    blockchain.reset(new TestChain(log.get(), dbDir));
+    blockchain->addIndex(addressIndex.get());
+    blockchain->addIndex(spentIndex.get());
+    blockchain->addIndex(chainStatsIndex.get());
+
+    consensus.reset(new CryptoKernel::Consensus::Regtest(blockchain.get()));
+    CPPUNIT_ASSERT(blockchain->loadChain(consensus.get(), genesisFile));
+}
+
+void ChainIndexTest::tearDown() {
+    blockchain.reset();
+    consensus.reset();
+
+    addressIndex.reset();
+    spentIndex.reset();
+    chainStatsIndex.reset();
+
+    CryptoKernel::Storage::destroy(dbDir);
+    std::remove(genesisFile.c_str());
+}
+
+/**
+* Connects blocks paying the consensus key, each holding transactions that
+* spend the outputs of the ones before it
+*/
+void ChainIndexTest::connectBlocks(const unsigned int count) {
+    for(unsigned int i = 0; i < count; i++) {
+        consensus->generateTransactions(5);
+        CPPUNIT_ASSERT_EQUAL(size_t(1), consensus->generateBlocks(1, "").size());
+    }
+}
+
+/**
+* Forks the chain at the given height with one better block, so every
+* block above it leaves the main chain. The fork block holds no
+* transactions and pays a new key.
+*/
+void ChainIndexTest::reverseTo(const uint64_t height) {
+    std::set<CryptoKernel::BigNum> excludedTxs;
+    for(const CryptoKernel::Blockchain::transaction& tx : blockchain->getUnconfirmedTransactions()) {
+        excludedTxs.insert(tx.getId());
+    }
+
+    CryptoKernel::Crypto crypto(true);
+    const CryptoKernel::Blockchain::block forkPoint = blockchain->getBlockByHeight(height);
+    CryptoKernel::Blockchain::block forkBlock = blockchain->generateVerifyingBlock(
+                crypto.getPublicKey(), forkPoint.getId(), height + 1, excludedTxs);
+
+    Json::Value consensusData;
+    consensusData["isBetter"] = true;
+    forkBlock.setConsensusData(consensusData);
+
+    CPPUNIT_ASSERT(std::get<0>(blockchain->submitBlock(forkBlock)));
+    CPPUNIT_ASSERT_EQUAL(forkBlock.getId().toString(),
+                         blockchain->getBlockDB("tip").getId().toString());
+}
+
+/**
+* Returns the ids of every output created on the main chain
+*/
+std::set<std::string> ChainIndexTest::getOutputIds() {
+    std::set<std::string> returning;
+
+    const uint64_t tipHeight = blockchain->getBlockDB("tip").getHeight();
+    for(uint64_t height = 1; height <= tipHeight; height++) {
+        const CryptoKernel::Blockchain::block block = blockchain->getBlockByHeight(height);
+
+        std::vector<CryptoKernel::Blockchain::transaction> txs;
+        txs.push_back(block.getCoinbaseTx());
+        for(const CryptoKernel::Blockchain::transaction& tx : block.getTransactions()) {
+            txs.push_back(tx);
+        }
+
+        for(const CryptoKernel::Blockchain::transaction& tx : txs) {
+            for(const CryptoKernel::Blockchain::output& out : tx.getOutputs()) {
+                returning.insert(out.getId().toString());
+            }
+        }
+    }
+
+    return returning;
+}
+
+/**
+* Tests that reversing blocks returns an address's summary and history to
+* what they were before the blocks connected
+*/
+void ChainIndexTest::testAddressIndexUndo() {
+    const std::string publicKey = consensus->getPublicKey();
+
+    connectBlocks(4);
+    const uint64_t height = blockchain->getBlockDB("tip").getHeight();
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    const Json::Value summary = addressIndex->getSummary(dbTx.get(), publicKey);
+    const Json::Value history = addressIndex->getHistory(dbTx.get(), publicKey, 0, 1000);
+    const Json::Value page = addressIndex->getHistory(dbTx.get(), publicKey, 2, 3);
+    dbTx.reset();
+
+    CPPUNIT_ASSERT(summary["txcount"].asUInt64() > 0);
+    CPPUNIT_ASSERT_EQUAL(summary["txcount"].asUInt(), history.size());
+    CPPUNIT_ASSERT_EQUAL(3u, page.size());
+
+    connectBlocks(3);
+
+    dbTx.reset(blockchain->getTxHandle());
+    CPPUNIT_ASSERT(addressIndex->getSummary(dbTx.get(), publicKey)["txcount"].asUInt64()
+                   > summary["txcount"].asUInt64());
+    dbTx.reset();
+
+    reverseTo(height);
+
+    dbTx.reset(blockchain->getTxHandle());
+    CPPUNIT_ASSERT_EQUAL(summary, addressIndex->getSummary(dbTx.get(), publicKey));
+    CPPUNIT_ASSERT_EQUAL(history, addressIndex->getHistory(dbTx.get(), publicKey, 0, 1000));
+    CPPUNIT_ASSERT_EQUAL(page, addressIndex->getHistory(dbTx.get(), publicKey, 2, 3));
+}
+
+/**
+* Tests that reversing blocks forgets the spends they made and keeps the
+* spends made below them
+*/
+void ChainIndexTest::testSpentIndexUndo() {
+    connectBlocks(4);
+    const uint64_t height = blockchain->getBlockDB("tip").getHeight();
+    connectBlocks(3);
+
+    const std::set<std::string> outputIds = getOutputIds();
+
+    std::map<std::string, Json::Value> spends;
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    for(const std::string& outputId : outputIds) {
+        spends[outputId] = spentIndex->getSpendingInfo(dbTx.get(), outputId);
+    }
+    dbTx.reset();
+
+    reverseTo(height);
+
+    unsigned int kept = 0;
+    unsigned int undone = 0;
+    dbTx.reset(blockchain->getTxHandle());
+    for(const std::string& outputId : outputIds) {
+        const Json::Value spend = spends[outputId];
+        if(spend.isObject() && spend["height"].asUInt64() > height) {
+            CPPUNIT_ASSERT(spentIndex->getSpendingInfo(dbTx.get(), outputId).isNull());
+            undone++;
+        } else {
+            CPPUNIT_ASSERT_EQUAL(spend, spentIndex->getSpendingInfo(dbTx.get(), outputId));
+            if(spend.isObject()) {
+                kept++;
+            }
+        }
+    }
+
+    CPPUNIT_ASSERT(kept > 0);
+    CPPUNIT_ASSERT(undone > 0);
+}
+
+/**
+* Tests that reversing blocks drops their statistics and leaves those of
+* the blocks below them as they were
+*/
+void ChainIndexTest::testChainStatsIndexUndo() {
+    connectBlocks(4);
+    const uint64_t height = blockchain->getBlockDB("tip").getHeight();
+
+    std::vector<Json::Value> stats;
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(blockchain->getTxHandle());
+    for(uint64_t i = 1; i <= height; i++) {
+        stats.push_back(chainStatsIndex->getStats(dbTx.get(), i));
+    }
+    dbTx.reset();
+
+    connectBlocks(3);
+    reverseTo(height);
+    const std::string forkBlockId = blockchain->getBlockDB("tip").getId().toString();
+
+    dbTx.reset(blockchain->getTxHandle());
+    for(uint64_t i = 1; i <= height; i++) {
+        CPPUNIT_ASSERT_EQUAL(stats[i - 1], chainStatsIndex->getStats(dbTx.get(), i));
+    }
+
+    // The fork block only adds its reward to the totals as of the fork point
+    const Json::Value forkStats = chainStatsIndex->getStats(dbTx.get(), height + 1);
+    CPPUNIT_ASSERT_EQUAL(forkBlockId, forkStats["blockId"].asString());
+    CPPUNIT_ASSERT_EQUAL(stats.back()["supply"].asUInt64() + blockReward,
+                         forkStats["supply"].asUInt64());
+    CPPUNIT_ASSERT_EQUAL(stats.back()["utxos"].asUInt64() + 1, forkStats["utxos"].asUInt64());
+    CPPUNIT_ASSERT_EQUAL(stats.back()["transactions"].asUInt64() + 1,
+                         forkStats["transactions"].asUInt64());
+
+    CPPUNIT_ASSERT_THROW(chainStatsIndex->getStats(dbTx.get(), height + 2),
+                         CryptoKernel::Blockchain::NotFoundException);
+}
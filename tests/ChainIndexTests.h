@@ -0,0 +1,56 @@
+#ifndef CHAININDEXTEST_H
+#define CHAININDEXTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "blockchain.h"
+#include "addressindex.h"
+#include "spentindex.h"
+#include "chainstatsindex.h"
+#include "consensus/regtest.h"
+
+class TestChain : public CryptoKernel::Blockchain {
+public:
+    TestChain(CryptoKernel::Log* log, const std::string& dbDir);
+
+private:
+    uint64_t getBlockReward(const uint64_t height);
+    std::string getCoinbaseOwner(const std::string& publicKey);
+};
+
+class ChainIndexTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(ChainIndexTest);
+
+    CPPUNIT_TEST(testAddressIndexUndo);
+    CPPUNIT_TEST(testSpentIndexUndo);
+    CPPUNIT_TEST(testChainStatsIndexUndo);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    ChainIndexTest();
+    virtual ~ChainIndexTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testAddressIndexUndo();
+    void testSpentIndexUndo();
+    void testChainStatsIndexUndo();
+
+    void connectBlocks(const unsigned int count);
+    void reverseTo(const uint64_t height);
+    std::set<std::string> getOutputIds();
+
+    std::unique_ptr<CryptoKernel::Log> log;
+
+    // The indexes must outlive the blockchain they are added to
+    std::unique_ptr<CryptoKernel::AddressIndex> addressIndex;
+    std::unique_ptr<CryptoKernel::SpentIndex> spentIndex;
+    std::unique_ptr<CryptoKernel::ChainStatsIndex> chainStatsIndex;
+
+    std::unique_ptr<TestChain> blockchain;
+    std::unique_ptr<CryptoKernel::Consensus::Regtest> consensus;
+};
+
+#endif
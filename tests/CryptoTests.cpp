@@ -1,4 +1,5 @@
 #include "CryptoTests.h"
+#include "base64.h"
 
 CPPUNIT_TEST_SUITE_REGISTRATION(CryptoTest);
 
@@ -62,6 +63,70 @@ void CryptoTest::testPassingKeys() {
     delete tempCrypto;
 }
 
+/**
+* Tests setting the same public key repeatedly, as the cache does
+*/
+void CryptoTest::testPublicKeyCache() {
+    CryptoKernel::Crypto signer(true);
+    const std::string publicKey = signer.getPublicKey();
+    const std::string signature = signer.sign(plainText);
+
+    for(unsigned int i = 0; i < 2; i++) {
+        CryptoKernel::Crypto verifier;
+        CPPUNIT_ASSERT(verifier.setPublicKey(publicKey));
+        CPPUNIT_ASSERT_EQUAL(publicKey, verifier.getPublicKey());
+        CPPUNIT_ASSERT(verifier.verify(plainText, signature));
+    }
+
+    const std::string badKey = "AAAA" + publicKey.substr(4);
+    for(unsigned int i = 0; i < 2; i++) {
+        CryptoKernel::Crypto verifier;
+        CPPUNIT_ASSERT(!verifier.setPublicKey(badKey));
+    }
+}
+
+/**
+* Tests HD key derivation against BIP32 test vector 2
+*/
+void CryptoTest::testHDKeyDerivation() {
+    const std::string seedHex = "fffcf9f6f3f0edeae7e4e1dedbd8d5d2cfccc9c6c3c0bdbab7b4b1aeaba8"
+                                "a5a29f9c999693908d8a8784817e7b7875726f6c696663605d5a5754514e"
+                                "4b484542";
+    std::string seed;
+    for(size_t i = 0; i < seedHex.size(); i += 2) {
+        seed += char(std::stoi(seedHex.substr(i, 2), nullptr, 16));
+    }
+
+    const auto toHex = [](const std::string& encoded) {
+        const std::string decoded = base64_decode(encoded);
+        return base16_encode((unsigned char*)decoded.data(), decoded.size());
+    };
+
+    const CryptoKernel::HDKey master = CryptoKernel::HDKey::fromSeed(seed);
+    CPPUNIT_ASSERT_EQUAL(std::string("4b03d6fc340455b363f51020ad3ecca4f0850280cf436c70c727923f6db46c3e"),
+                         toHex(master.getPrivateKey()));
+
+    // m/0 from the private key and from the public key alone
+    const CryptoKernel::HDKey child = master.derive(0);
+    const CryptoKernel::HDKey publicChild = CryptoKernel::HDKey(master.toJson()).derive(0);
+    CPPUNIT_ASSERT_EQUAL(std::string("abe74a98f6c7eabee0428f53798f0ab8aa1bd37873999041703c742f15ac7e1e"),
+                         toHex(child.getPrivateKey()));
+    CPPUNIT_ASSERT_EQUAL(std::string("f0909affaa7ee7abe5dd4e100598d4dc53cd709d5a5c2cac40e7412f232f7c9c"),
+                         toHex(child.toJson()["chainCode"].asString()));
+    CPPUNIT_ASSERT_EQUAL(child.getPublicKey(), publicChild.getPublicKey());
+    CPPUNIT_ASSERT(publicChild.getPrivateKey().empty());
+
+    CryptoKernel::Crypto signer;
+    CPPUNIT_ASSERT(signer.setPrivateKey(child.getPrivateKey()));
+    CPPUNIT_ASSERT_EQUAL(child.getPublicKey(), signer.getPublicKey());
+
+    // m/0/2147483647H
+    const CryptoKernel::HDKey hardened = child.derive(CryptoKernel::HDKey::HARDENED + 2147483647);
+    CPPUNIT_ASSERT_EQUAL(std::string("877c779ad9687164e9c2f4f0f4ff0340814392330693ce95a58fe18fd52e6e93"),
+                         toHex(hardened.getPrivateKey()));
+    CPPUNIT_ASSERT_THROW(publicChild.derive(CryptoKernel::HDKey::HARDENED), std::runtime_error);
+}
+
 /**
 * Tests hashing with SHA256
 */
@@ -12,6 +12,8 @@ class CryptoTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testKeygen);
     CPPUNIT_TEST(testSignVerify);
     CPPUNIT_TEST(testPassingKeys);
+    CPPUNIT_TEST(testPublicKeyCache);
+    CPPUNIT_TEST(testHDKeyDerivation);
     CPPUNIT_TEST(testSHA256Hash);
 
     CPPUNIT_TEST_SUITE_END();
@@ -27,6 +29,8 @@ private:
     void testKeygen();
     void testSignVerify();
     void testPassingKeys();
+    void testPublicKeyCache();
+    void testHDKeyDerivation();
     void testSHA256Hash();
     CryptoKernel::Crypto *crypto;
     const std::string plainText = "This is a test.";
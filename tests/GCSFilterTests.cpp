@@ -0,0 +1,99 @@
+#include "GCSFilterTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(GCSFilterTest);
+
+GCSFilterTest::GCSFilterTest() {
+    for(char i = 0; i < 16; i++) {
+        key.push_back(i);
+    }
+}
+
+GCSFilterTest::~GCSFilterTest() {
+}
+
+void GCSFilterTest::setUp() {
+}
+
+void GCSFilterTest::tearDown() {
+}
+
+void GCSFilterTest::testSipHash() {
+    // Test vectors from the SipHash paper, with key 00 01 .. 0f
+    const uint64_t k0 = 0x0706050403020100ULL;
+    const uint64_t k1 = 0x0f0e0d0c0b0a0908ULL;
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0x726fdb47dd0e0e31ULL),
+                         CryptoKernel::GCSFilter::sipHash(k0, k1, ""));
+
+    std::string message;
+    for(char i = 0; i < 15; i++) {
+        message.push_back(i);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0xa129ca6149be45e5ULL),
+                         CryptoKernel::GCSFilter::sipHash(k0, k1, message));
+}
+
+void GCSFilterTest::testMatch() {
+    std::set<std::string> elements;
+    for(unsigned int i = 0; i < 1000; i++) {
+        elements.insert("in" + std::to_string(i));
+    }
+
+    const CryptoKernel::GCSFilter filter(key, elements);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1000), filter.getN());
+
+    for(const std::string& element : elements) {
+        CPPUNIT_ASSERT(filter.match(element));
+    }
+
+    CPPUNIT_ASSERT(filter.matchAny({"out1", "out2", "in500"}));
+    CPPUNIT_ASSERT(!filter.matchAny(std::set<std::string>()));
+
+    const CryptoKernel::GCSFilter empty(key, std::set<std::string>());
+    CPPUNIT_ASSERT_EQUAL(uint64_t(0), empty.getN());
+    CPPUNIT_ASSERT(!empty.match("in1"));
+}
+
+void GCSFilterTest::testEncoding() {
+    std::set<std::string> elements;
+    for(unsigned int i = 0; i < 1000; i++) {
+        elements.insert("in" + std::to_string(i));
+    }
+
+    const CryptoKernel::GCSFilter filter(key, elements);
+    const std::string encoded = filter.getEncoded();
+
+    // About P + 2.5 bits an element, plus the count
+    CPPUNIT_ASSERT(encoded.size() < 1000 * (CryptoKernel::GCSFilter::P + 3) / 8);
+
+    const CryptoKernel::GCSFilter decoded(key, encoded);
+    CPPUNIT_ASSERT_EQUAL(uint64_t(1000), decoded.getN());
+    for(const std::string& element : elements) {
+        CPPUNIT_ASSERT(decoded.match(element));
+    }
+
+    CPPUNIT_ASSERT_THROW(CryptoKernel::GCSFilter(key, encoded.substr(0, encoded.size() / 2)),
+                         std::runtime_error);
+    CPPUNIT_ASSERT_THROW(CryptoKernel::GCSFilter(key, std::string()), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(CryptoKernel::GCSFilter("short", elements), std::runtime_error);
+}
+
+void GCSFilterTest::testFalsePositiveRate() {
+    std::set<std::string> elements;
+    for(unsigned int i = 0; i < 1000; i++) {
+        elements.insert("in" + std::to_string(i));
+    }
+
+    const CryptoKernel::GCSFilter filter(key, elements);
+
+    // Each miss matches with a chance of about 1 in M
+    unsigned int falsePositives = 0;
+    for(unsigned int i = 0; i < 20000; i++) {
+        if(filter.match("out" + std::to_string(i))) {
+            falsePositives++;
+        }
+    }
+
+    CPPUNIT_ASSERT(falsePositives < 5);
+}
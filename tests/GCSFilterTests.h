@@ -0,0 +1,33 @@
+#ifndef GCSFILTERTEST_H
+#define GCSFILTERTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "gcsfilter.h"
+
+class GCSFilterTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(GCSFilterTest);
+
+    CPPUNIT_TEST(testSipHash);
+    CPPUNIT_TEST(testMatch);
+    CPPUNIT_TEST(testEncoding);
+    CPPUNIT_TEST(testFalsePositiveRate);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    GCSFilterTest();
+    virtual ~GCSFilterTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testSipHash();
+    void testMatch();
+    void testEncoding();
+    void testFalsePositiveRate();
+
+    std::string key;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "LRUCacheTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(LRUCacheTest);
+
+LRUCacheTest::LRUCacheTest() {
+}
+
+LRUCacheTest::~LRUCacheTest() {
+}
+
+void LRUCacheTest::setUp() {
+}
+
+void LRUCacheTest::tearDown() {
+}
+
+void LRUCacheTest::testGetPut() {
+    CryptoKernel::LRUCache<std::string, int> cache(4);
+    int value = 0;
+
+    CPPUNIT_ASSERT(!cache.get("a", value));
+
+    cache.put("a", 1);
+    CPPUNIT_ASSERT(cache.get("a", value));
+    CPPUNIT_ASSERT_EQUAL(1, value);
+
+    cache.put("a", 2);
+    CPPUNIT_ASSERT(cache.get("a", value));
+    CPPUNIT_ASSERT_EQUAL(2, value);
+    CPPUNIT_ASSERT_EQUAL(size_t(1), cache.size());
+}
+
+void LRUCacheTest::testEviction() {
+    CryptoKernel::LRUCache<int, int> cache(2);
+    int value = 0;
+
+    cache.put(1, 10);
+    cache.put(2, 20);
+
+    // Touch 1 so that 2 becomes the least recently used
+    CPPUNIT_ASSERT(cache.get(1, value));
+
+    cache.put(3, 30);
+    CPPUNIT_ASSERT_EQUAL(size_t(2), cache.size());
+    CPPUNIT_ASSERT(cache.get(1, value));
+    CPPUNIT_ASSERT_EQUAL(10, value);
+    CPPUNIT_ASSERT(!cache.get(2, value));
+    CPPUNIT_ASSERT(cache.get(3, value));
+    CPPUNIT_ASSERT_EQUAL(30, value);
+}
+
+void LRUCacheTest::testErase() {
+    CryptoKernel::LRUCache<int, int> cache(2);
+    int value = 0;
+
+    cache.put(1, 10);
+    cache.put(2, 20);
+    cache.erase(1);
+    CPPUNIT_ASSERT(!cache.get(1, value));
+    CPPUNIT_ASSERT_EQUAL(size_t(1), cache.size());
+
+    cache.clear();
+    CPPUNIT_ASSERT(!cache.get(2, value));
+    CPPUNIT_ASSERT_EQUAL(size_t(0), cache.size());
+}
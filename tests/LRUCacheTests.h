@@ -0,0 +1,29 @@
+#ifndef LRUCACHETEST_H
+#define LRUCACHETEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "lrucache.h"
+
+class LRUCacheTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(LRUCacheTest);
+
+    CPPUNIT_TEST(testGetPut);
+    CPPUNIT_TEST(testEviction);
+    CPPUNIT_TEST(testErase);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    LRUCacheTest();
+    virtual ~LRUCacheTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testGetPut();
+    void testEviction();
+    void testErase();
+};
+
+#endif
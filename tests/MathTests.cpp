@@ -76,3 +76,12 @@ void MathTest::testEmptyOperand() {
 
     CPPUNIT_ASSERT_EQUAL(expected, actual);
 }
+
+void MathTest::testToString() {
+    CPPUNIT_ASSERT_EQUAL(std::string("0"), CryptoKernel::BigNum("0").toString());
+    CPPUNIT_ASSERT_EQUAL(std::string("f"), CryptoKernel::BigNum("000f").toString());
+    CPPUNIT_ASSERT_EQUAL(std::string("10f"), CryptoKernel::BigNum("10f").toString());
+    CPPUNIT_ASSERT_EQUAL(std::string("ff00"), CryptoKernel::BigNum("FF00").toString());
+    CPPUNIT_ASSERT_EQUAL(std::string("-01"),
+                         (CryptoKernel::BigNum("1") - CryptoKernel::BigNum("2")).toString());
+}
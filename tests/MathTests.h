@@ -14,6 +14,7 @@ class MathTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testDivide);
     CPPUNIT_TEST(testHexGreater);
     CPPUNIT_TEST(testEmptyOperand);
+    CPPUNIT_TEST(testToString);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -30,6 +31,7 @@ private:
     void testDivide();
     void testHexGreater();
     void testEmptyOperand();
+    void testToString();
 };
 
 #endif
@@ -112,3 +112,29 @@ void MerkletreeTest::testMakeTreeFromLeaves() {
 
     CPPUNIT_ASSERT_EQUAL(expectedRight, actualRight);
 }
+
+
+void MerkletreeTest::testIncrementalTree() {
+    std::set<CryptoKernel::BigNum> leaves;
+    CryptoKernel::IncrementalMerkleTree tree;
+
+    for(unsigned int i = 1; i <= 9; i++) {
+        const CryptoKernel::BigNum leaf = CryptoKernel::BigNum(std::to_string(i * 7919));
+        leaves.insert(leaf);
+        tree.insert(leaf);
+
+        CPPUNIT_ASSERT_EQUAL(CryptoKernel::MerkleNode::makeMerkleTree(leaves)->getMerkleRoot().toString(),
+                             tree.getMerkleRoot().toString());
+    }
+
+    for(unsigned int i = 2; i <= 9; i += 3) {
+        const CryptoKernel::BigNum leaf = CryptoKernel::BigNum(std::to_string(i * 7919));
+        leaves.erase(leaf);
+        tree.remove(leaf);
+
+        CPPUNIT_ASSERT_EQUAL(CryptoKernel::MerkleNode::makeMerkleTree(leaves)->getMerkleRoot().toString(),
+                             tree.getMerkleRoot().toString());
+    }
+
+    CPPUNIT_ASSERT_EQUAL((unsigned int)leaves.size(), tree.size());
+}
\ No newline at end of file
@@ -14,6 +14,7 @@ class MerkletreeTest : public CPPUNIT_NS::TestFixture {
     CPPUNIT_TEST(testMakeTreeFromPtr01);
     CPPUNIT_TEST(testMakeTreeFromPtr02);
     CPPUNIT_TEST(testMakeTreeFromLeaves);
+    CPPUNIT_TEST(testIncrementalTree);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -33,6 +34,7 @@ private:
     void testMakeTreeFromPtr01();
     void testMakeTreeFromPtr02();
     void testMakeTreeFromLeaves();
+    void testIncrementalTree();
 };
 
 #endif
\ No newline at end of file
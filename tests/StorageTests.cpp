@@ -147,3 +147,32 @@ void StorageTest::testIterator() {
 
     CPPUNIT_ASSERT(!it->Valid());
 }
+
+void StorageTest::testCommit() {
+    Json::Value dataToStore;
+    dataToStore["myval"] = "synced";
+
+    {
+        CryptoKernel::Storage database("./testdb", false, 10, true);
+
+        std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+        dbTx->put("synceddata", dataToStore);
+        CPPUNIT_ASSERT_NO_THROW(dbTx->commit(true));
+        CPPUNIT_ASSERT(dbTx->ended());
+
+        // Nothing changed, so nothing is written, but the transaction
+        // still ends and frees the database
+        dbTx.reset(database.begin());
+        CPPUNIT_ASSERT_NO_THROW(dbTx->commit());
+        CPPUNIT_ASSERT(dbTx->ended());
+        CPPUNIT_ASSERT_THROW(dbTx->commit(), std::runtime_error);
+
+        dbTx.reset(database.begin());
+        CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("synceddata"));
+    }
+
+    CryptoKernel::Storage database("./testdb", false, 10, true);
+
+    std::unique_ptr<CryptoKernel::Storage::Transaction> dbTx(database.begin());
+    CPPUNIT_ASSERT_EQUAL(dataToStore, dbTx->get("synceddata"));
+}
@@ -0,0 +1,100 @@
+#include <atomic>
+#include <chrono>
+
+#include "ThreadPoolTests.h"
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ThreadPoolTest);
+
+ThreadPoolTest::ThreadPoolTest() {
+}
+
+ThreadPoolTest::~ThreadPoolTest() {
+}
+
+void ThreadPoolTest::setUp() {
+}
+
+void ThreadPoolTest::tearDown() {
+}
+
+void ThreadPoolTest::testRun() {
+    CryptoKernel::ThreadPool pool(2);
+    CPPUNIT_ASSERT_EQUAL(2u, pool.size());
+
+    std::atomic<int> count(0);
+    std::vector<std::future<void>> results;
+    for(int i = 0; i < 100; i++) {
+        results.push_back(pool.run([&]() {
+            count++;
+        }));
+    }
+
+    for(auto& result : results) {
+        result.get();
+    }
+    CPPUNIT_ASSERT_EQUAL(100, count.load());
+}
+
+void ThreadPoolTest::testForEach() {
+    CryptoKernel::ThreadPool pool(4);
+
+    std::vector<int> values(1000, 0);
+    pool.forEach(values.size(), [&](const size_t i) {
+        values[i] = i * 2;
+    });
+
+    for(size_t i = 0; i < values.size(); i++) {
+        CPPUNIT_ASSERT_EQUAL(static_cast<int>(i * 2), values[i]);
+    }
+
+    // Nothing to do returns straight away
+    pool.forEach(0, [&](const size_t i) {
+        CPPUNIT_FAIL("Called with no work");
+    });
+}
+
+void ThreadPoolTest::testForEachMaxParallel() {
+    CryptoKernel::ThreadPool pool(4);
+
+    std::atomic<int> running(0);
+    std::atomic<int> peak(0);
+    pool.forEach(40, [&](const size_t i) {
+        const int now = ++running;
+        int seen = peak;
+        while(now > seen && !peak.compare_exchange_weak(seen, now)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        running--;
+    }, 2);
+
+    CPPUNIT_ASSERT(peak.load() <= 2);
+}
+
+void ThreadPoolTest::testForEachNested() {
+    CryptoKernel::ThreadPool pool(2);
+
+    // Would deadlock if inner calls waited for workers that are all busy
+    // running outer calls
+    std::atomic<int> count(0);
+    pool.forEach(4, [&](const size_t i) {
+        pool.forEach(4, [&](const size_t j) {
+            count++;
+        });
+    });
+
+    CPPUNIT_ASSERT_EQUAL(16, count.load());
+}
+
+void ThreadPoolTest::testForEachException() {
+    CryptoKernel::ThreadPool pool(2);
+
+    std::atomic<int> count(0);
+    CPPUNIT_ASSERT_THROW(pool.forEach(10, [&](const size_t i) {
+        count++;
+        if(i == 5) {
+            throw std::runtime_error("Failed");
+        }
+    }), std::runtime_error);
+
+    // The other calls still ran
+    CPPUNIT_ASSERT_EQUAL(10, count.load());
+}
@@ -0,0 +1,33 @@
+#ifndef THREADPOOLTEST_H
+#define THREADPOOLTEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "threadpool.h"
+
+class ThreadPoolTest : public CPPUNIT_NS::TestFixture {
+    CPPUNIT_TEST_SUITE(ThreadPoolTest);
+
+    CPPUNIT_TEST(testRun);
+    CPPUNIT_TEST(testForEach);
+    CPPUNIT_TEST(testForEachMaxParallel);
+    CPPUNIT_TEST(testForEachNested);
+    CPPUNIT_TEST(testForEachException);
+
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    ThreadPoolTest();
+    virtual ~ThreadPoolTest();
+    void setUp();
+    void tearDown();
+
+private:
+    void testRun();
+    void testForEach();
+    void testForEachMaxParallel();
+    void testForEachNested();
+    void testForEachException();
+};
+
+#endif